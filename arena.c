@@ -0,0 +1,234 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "arena.h"
+#include "utilities.h"
+
+// Alignment of every allocation from the arena
+#define ARENA_ALIGNMENT (_Alignof(max_align_t))
+
+// Round n up to a multiple of a (a power of 2)
+#define ROUND_UP(n, a) (((n) + ((a) - 1)) & ~((size_t)(a) - 1))
+
+// A chunk of storage; its usable bytes start at the first cache line
+// boundary after this header
+typedef struct arena_chunk_s {
+    struct arena_chunk_s *next; // the chunk allocated before this one
+    size_t size; // total size, including this header
+} arena_chunk_t;
+
+// An arena: the chunks allocated so far (by all threads), most recent first,
+// and the statistics of the threads that have called arena_thread_done(),
+// all protected by lock
+struct arena_s {
+    arena_chunk_t *chunks;
+    unsigned long done_allocation_count;
+    size_t done_bytes_allocated;
+    pthread_mutex_t lock;
+};
+
+// the arena used by threads that have not chosen another
+static arena default_arena = { NULL, 0, 0, PTHREAD_MUTEX_INITIALIZER };
+
+// the arena this thread allocates from
+static _Thread_local arena *current = &default_arena;
+
+// The unused part of this thread's most recent (non-oversized) chunk
+static _Thread_local char *next_free = NULL;
+static _Thread_local char *limit = NULL;
+
+// this thread's statistics since the last arena_reset()
+// (or arena_thread_done())
+static _Thread_local unsigned long allocation_count = 0;
+static _Thread_local size_t bytes_allocated = 0;
+
+// Return the start of the usable storage in chunk c
+static char *chunk_data(arena_chunk_t *c)
+{
+    return (char *)c + ROUND_UP(sizeof(arena_chunk_t), ARENA_CACHE_LINE);
+}
+
+// Return the total size of a chunk with room for size bytes of data
+static size_t chunk_total_size(size_t size)
+{
+    return ROUND_UP(ROUND_UP(sizeof(arena_chunk_t), ARENA_CACHE_LINE) + size,
+		    ARENA_CACHE_LINE);
+}
+
+// Return a fresh chunk with room for at least size bytes of data,
+// linked onto the list of chunks
+static arena_chunk_t *arena_new_chunk(size_t size)
+{
+    size_t total = chunk_total_size(size);
+    arena_chunk_t *c = (arena_chunk_t *) aligned_alloc(ARENA_CACHE_LINE, total);
+    if (c == NULL) {
+	bail_with_error("No space to allocate %lu bytes for the arena!",
+			(unsigned long) total);
+    }
+    c->size = total;
+    pthread_mutex_lock(&current->lock);
+    c->next = current->chunks;
+    current->chunks = c;
+    pthread_mutex_unlock(&current->lock);
+    return c;
+}
+
+// Return (a pointer to) size bytes of fresh storage from the arena,
+// aligned suitably for any type.
+void *arena_alloc(size_t size)
+{
+    size = ROUND_UP(size == 0 ? 1 : size, ARENA_ALIGNMENT);
+    allocation_count++;
+    bytes_allocated += size;
+    if (size > (size_t)(limit - next_free)) {
+	if (size > ARENA_CHUNK_SIZE / 4) {
+	    // give big requests a chunk of their own,
+	    // so the rest of the current chunk is not wasted
+	    return chunk_data(arena_new_chunk(size));
+	}
+	arena_chunk_t *c = arena_new_chunk(ARENA_CHUNK_SIZE);
+	next_free = chunk_data(c);
+	limit = (char *)c + c->size;
+    }
+    void *ret = next_free;
+    next_free += size;
+    return ret;
+}
+
+// Requires: s != NULL
+// Return a copy of the string s allocated in the arena
+char *arena_strdup(const char *s)
+{
+    return arena_strndup(s, strlen(s));
+}
+
+// Requires: s != NULL
+// Return a copy of the first len characters of s (followed by a null char)
+// allocated in the arena
+char *arena_strndup(const char *s, size_t len)
+{
+    char *ret = (char *) arena_alloc(len + 1);
+    memcpy(ret, s, len);
+    ret[len] = '\0';
+    return ret;
+}
+
+// Requires: no other thread is using the arena
+// Release all the storage allocated from the arena,
+// keeping the first chunk (if it has the standard size) for reuse.
+void arena_reset()
+{
+    pthread_mutex_lock(&current->lock);
+    arena_chunk_t *c = current->chunks;
+    arena_chunk_t *first = NULL;
+    while (c != NULL) {
+	arena_chunk_t *next = c->next;
+	if (next == NULL && c->size == chunk_total_size(ARENA_CHUNK_SIZE)) {
+	    first = c;
+	} else {
+	    free(c);
+	}
+	c = next;
+    }
+    current->chunks = first;
+    if (first != NULL) {
+	next_free = chunk_data(first);
+	limit = (char *)first + first->size;
+    } else {
+	next_free = NULL;
+	limit = NULL;
+    }
+    allocation_count = 0;
+    bytes_allocated = 0;
+    current->done_allocation_count = 0;
+    current->done_bytes_allocated = 0;
+    pthread_mutex_unlock(&current->lock);
+}
+
+// Finish this thread's use of the arena (until it next allocates):
+// its statistics are added to the arena's totals,
+// and the rest of its chunk is abandoned.
+void arena_thread_done()
+{
+    pthread_mutex_lock(&current->lock);
+    current->done_allocation_count += allocation_count;
+    current->done_bytes_allocated += bytes_allocated;
+    pthread_mutex_unlock(&current->lock);
+    allocation_count = 0;
+    bytes_allocated = 0;
+    next_free = NULL;
+    limit = NULL;
+}
+
+// Return the number of allocations made from the arena
+// since the last arena_reset()
+unsigned long arena_allocation_count()
+{
+    pthread_mutex_lock(&current->lock);
+    unsigned long ret = current->done_allocation_count + allocation_count;
+    pthread_mutex_unlock(&current->lock);
+    return ret;
+}
+
+// Return the number of bytes allocated from the arena
+// since the last arena_reset()
+size_t arena_bytes_allocated()
+{
+    pthread_mutex_lock(&current->lock);
+    size_t ret = current->done_bytes_allocated + bytes_allocated;
+    pthread_mutex_unlock(&current->lock);
+    return ret;
+}
+
+// Return a new, empty arena
+arena *arena_create()
+{
+    arena *a = (arena *) malloc(sizeof(arena));
+    if (a == NULL) {
+	bail_with_error("No space for an arena!");
+    }
+    a->chunks = NULL;
+    a->done_allocation_count = 0;
+    a->done_bytes_allocated = 0;
+    pthread_mutex_init(&a->lock, NULL);
+    return a;
+}
+
+// Requires: no other thread is using a
+// Release all the storage of the arena a, and a itself
+// (if this thread is using a, it goes back to the default arena)
+void arena_destroy(arena *a)
+{
+    if (current == a) {
+	arena_use(NULL);
+    }
+    arena_chunk_t *c = a->chunks;
+    while (c != NULL) {
+	arena_chunk_t *next = c->next;
+	free(c);
+	c = next;
+    }
+    pthread_mutex_destroy(&a->lock);
+    free(a);
+}
+
+// Make this thread allocate from a (or from the default arena,
+// if a is NULL), first finishing its use of the arena it was using
+// (as arena_thread_done() does), if that is another arena
+void arena_use(arena *a)
+{
+    if (a == NULL) {
+	a = &default_arena;
+    }
+    if (a != current) {
+	arena_thread_done();
+	current = a;
+    }
+}
+
+// Return the arena this thread allocates from
+arena *arena_current()
+{
+    return current;
+}
@@ -0,0 +1,84 @@
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stddef.h>
+
+// The arena is a region of storage from which the compiler allocates
+// its ASTs, file locations, identifier attributes and the like.
+// Allocation just bumps a pointer in a large chunk of storage,
+// and nothing is freed individually:
+// all of the arena's storage is released at once by arena_reset(),
+// which is done once per compilation.
+// Several threads may allocate from the arena at once:
+// each thread bumps a pointer in a chunk of its own.
+// There may be several arenas (one for each compilation under way,
+// see compile_context.h): each thread allocates from the arena
+// it is using, which is the default arena unless it has chosen another
+// with arena_use(), and the functions below work on that arena.
+
+// An arena (its contents are private to arena.c)
+typedef struct arena_s arena;
+
+// Size (in bytes) of the chunks the arena gets from malloc
+// (allocations larger than a quarter of this get a chunk of their own)
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+// Chunks start on a cache line boundary of this many bytes
+#define ARENA_CACHE_LINE 64
+
+// Return (a pointer to) size bytes of fresh storage from the arena,
+// aligned suitably for any type.
+// If there is no space, bail with an error message,
+// so this never returns NULL.
+extern void *arena_alloc(size_t size);
+
+// Requires: s != NULL
+// Return a copy of the string s allocated in the arena
+extern char *arena_strdup(const char *s);
+
+// Requires: s != NULL
+// Return a copy of the first len characters of s (followed by a null char)
+// allocated in the arena
+extern char *arena_strndup(const char *s, size_t len);
+
+// Requires: no other thread is using the arena
+//           (each other thread that used it has called arena_thread_done())
+// Release all the storage allocated from the arena.
+// Every pointer previously returned by arena_alloc()
+// (or arena_strdup()) is invalid after this call.
+// (The first chunk is kept, so the next compilation can reuse it.)
+extern void arena_reset();
+
+// Finish this thread's use of the arena (until it next allocates):
+// its statistics are added to the arena's totals,
+// and the rest of its chunk is abandoned.
+// (Storage it allocated stays valid until arena_reset().)
+extern void arena_thread_done();
+
+// Return the number of allocations made from the arena
+// since the last arena_reset()
+// (by this thread and by the threads that have called arena_thread_done())
+extern unsigned long arena_allocation_count();
+
+// Return the number of bytes allocated from the arena
+// since the last arena_reset()
+// (by this thread and by the threads that have called arena_thread_done())
+extern size_t arena_bytes_allocated();
+
+// Return a new, empty arena
+extern arena *arena_create();
+
+// Requires: no other thread is using a
+// Release all the storage of the arena a, and a itself
+// (if this thread is using a, it goes back to the default arena)
+extern void arena_destroy(arena *a);
+
+// Make this thread allocate from a (or from the default arena,
+// if a is NULL), first finishing its use of the arena it was using
+// (as arena_thread_done() does), if that is another arena
+extern void arena_use(arena *a);
+
+// Return the arena this thread allocates from
+extern arena *arena_current();
+
+#endif
@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include "machine_types.h"
 #include "file_location.h"
+#include "id_use.h"
 
 // types of ASTs (type tags)
 typedef enum {
@@ -16,7 +17,7 @@ typedef enum {
     read_stmt_ast, print_stmt_ast, block_stmt_ast,
     condition_ast, db_condition_ast, rel_op_condition_ast,
     expr_ast, binary_op_expr_ast, negated_expr_ast, ident_ast, number_ast,
-    token_ast
+    token_ast, lazy_block_ast
 } AST_type;
 
 // The following types for structs named N_t
@@ -27,41 +28,51 @@ typedef enum {
 // The generic struct type (generic_t) has the fields that
 // should be in all alternatives for ASTs.
 typedef struct {
-    file_location *file_loc;
+    source_loc file_loc;
     AST_type type_tag; // says what field of the union is active
     void *next; // for lists
 } generic_t;
 
 // empty ::=
 typedef struct {
-    file_location *file_loc;
+    source_loc file_loc;
     AST_type type_tag;
 } empty_t;
 
 // identifiers
 typedef struct ident_s {
-    file_location *file_loc;
+    source_loc file_loc;
     AST_type type_tag;
     struct ident_s *next; // for lists this is a part of
     const char *name;
+    id_binding binding; // filled in by scope checking
 } ident_t;
 
 // (possibly signed) numbers
 typedef struct {
-    file_location *file_loc;
+    source_loc file_loc;
     AST_type type_tag;
-    const char *text;
     word_type value;
 } number_t;
 
 // tokens as ASTs
 typedef struct {
-    file_location *file_loc;
+    source_loc file_loc;
     AST_type type_tag;
     const char *text;
     int code;
 } token_t;
 
+// the text of a procedure's body that the parser skipped
+// (in lazy mode, see lexer_set_lazy), to be parsed when it is needed
+typedef struct lazy_block_s {
+    source_loc file_loc; // of the body's "begin"
+    AST_type type_tag;
+    const char *source; // the text of the file the body is in
+    size_t source_length; // the number of characters in that text
+    source_span text; // of the body in that file
+} lazy_block_t;
+
 // kinds of expressions
 typedef enum { expr_bin, expr_negated, 
                expr_ident, expr_number } expr_kind_e;
@@ -72,7 +83,7 @@ struct expr_s;
 // expr ::= expr arithOp expr
 // arithOp ::= + | - | * | /
 typedef struct {
-    file_location *file_loc;
+    source_loc file_loc;
     AST_type type_tag;
     struct expr_s *expr1;
     token_t arith_op;
@@ -81,14 +92,14 @@ typedef struct {
 
 // expr ::= - expr
 typedef struct {
-    file_location *file_loc;
+    source_loc file_loc;
     AST_type type_tag;
     struct expr_s *expr;
 } negated_expr_t;
     
 // expr ::= expr arithOp expr | ident | number
 typedef struct expr_s {
-    file_location *file_loc;
+    source_loc file_loc;
     AST_type type_tag;
     expr_kind_e expr_kind;
     union {
@@ -103,14 +114,14 @@ typedef struct expr_s {
 typedef enum { ck_db, ck_rel } condition_kind_e;
 
 typedef struct {
-    file_location *file_loc;
+    source_loc file_loc;
     AST_type type_tag;
     expr_t dividend;
     expr_t divisor;
 } db_condition_t;
 
 typedef struct {
-    file_location *file_loc;
+    source_loc file_loc;
     AST_type type_tag;
     expr_t expr1;
     token_t rel_op;
@@ -119,7 +130,7 @@ typedef struct {
 
 // condition ::= divisible expr expr | expr relOp expr
 typedef struct {
-    file_location *file_loc;
+    source_loc file_loc;
     AST_type type_tag;
     condition_kind_e cond_kind;
     union cond_u {
@@ -137,16 +148,17 @@ struct stmt_s;
 
 // stmt-list ::= stmt | stmt-list stmt
 typedef struct {
-    file_location *file_loc;
+    source_loc file_loc;
     AST_type type_tag;
     struct stmt_s *start;
+    struct stmt_s *last; // so appending takes constant time
 } stmt_list_t;
 
 typedef enum { empty_stmts_e, stmt_list_e } stmts_kind_e;
 
 // stmts ::= { stmts }
 typedef struct {
-    file_location *file_loc;
+    source_loc file_loc;
     AST_type type_tag;
     stmts_kind_e stmts_kind;
     stmt_list_t stmt_list; // when stmts_kind != empty_stmts_e
@@ -154,17 +166,19 @@ typedef struct {
 
 // stmt ::= ident := expr
 typedef struct {
-    file_location *file_loc;
+    source_loc file_loc;
     AST_type type_tag;
     const char *name;
+    id_binding binding; // of name, filled in by scope checking
     struct expr_s *expr;
 } assign_stmt_t;
 
 // stmt ::= call ident
 typedef struct {
-    file_location *file_loc;
+    source_loc file_loc;
     AST_type type_tag;
     const char *name;
+    id_binding binding; // of name, filled in by scope checking
 } call_stmt_t;
 
 // forward declaration for block type
@@ -172,14 +186,14 @@ struct block_s;
 
 // block-stmt ::= block
 typedef struct block_stmt_s {
-    file_location *file_loc;
+    source_loc file_loc;
     AST_type type_tag;
     struct block_s *block;
 } block_stmt_t;
 
 // if-stmt ::= if condition stmts stmts | if condition stmts
 typedef struct {
-    file_location *file_loc;
+    source_loc file_loc;
     AST_type type_tag;
     condition_t condition;
     stmts_t *then_stmts;
@@ -188,7 +202,7 @@ typedef struct {
 
 // stmt ::= while condition stmt
 typedef struct {
-    file_location *file_loc;
+    source_loc file_loc;
     AST_type type_tag;
     condition_t condition;
     stmts_t *body;
@@ -196,14 +210,15 @@ typedef struct {
 
 // stmt ::= read ident
 typedef struct {
-    file_location *file_loc;
+    source_loc file_loc;
     AST_type type_tag;
     const char *name;
+    id_binding binding; // of name, filled in by scope checking
 } read_stmt_t;
 
 // stmt ::= print expr
 typedef struct {
-    file_location *file_loc;
+    source_loc file_loc;
     AST_type type_tag;
     expr_t expr;
 } print_stmt_t;
@@ -211,7 +226,7 @@ typedef struct {
 // stmt ::= assign-stmt | call-stmt | if-stmt
 //        | while-stmt | read-stmt | print-stmt | block-stmt
 typedef struct stmt_s {
-    file_location *file_loc;
+    source_loc file_loc;
     AST_type type_tag;
     struct stmt_s *next; // for lists this is a part of
     stmt_kind_e stmt_kind;
@@ -228,30 +243,33 @@ typedef struct stmt_s {
 
 // procDecl ::= proc ident block
 typedef struct proc_decl_s {
-    file_location *file_loc;
+    source_loc file_loc;
     AST_type type_tag;
     struct proc_decl_s *next; // for lists
     const char *name;
-    struct block_s *block;
+    struct block_s *block; // NULL until a skipped body is parsed
+    lazy_block_t *body; // the skipped body (or NULL, if it was parsed)
 } proc_decl_t;
 
 // proc-decls ::= { proc-decl }
 typedef struct {
-    file_location *file_loc;
+    source_loc file_loc;
     AST_type type_tag;
     proc_decl_t *proc_decls;
+    proc_decl_t *last; // so appending takes constant time
 } proc_decls_t;
 
 // ident-list ::= ident | ident-list ident
 typedef struct {
-    file_location *file_loc;
+    source_loc file_loc;
     AST_type type_tag;
     ident_t *start;
+    ident_t *last; // so appending takes constant time
 } ident_list_t;
 
 // var-decl ::= var ident-list
 typedef struct var_decl_s {
-    file_location *file_loc;
+    source_loc file_loc;
     AST_type type_tag;
     struct var_decl_s *next; // for lists this is a part of
     ident_list_t ident_list;
@@ -259,14 +277,15 @@ typedef struct var_decl_s {
 
 // var-decls ::= { var-decl }
 typedef struct {
-    file_location *file_loc;
+    source_loc file_loc;
     AST_type type_tag;
     var_decl_t *var_decls;
+    var_decl_t *last; // so appending takes constant time
 } var_decls_t;
 
 // const-def ::= ident number
 typedef struct const_def_s {
-    file_location *file_loc;
+    source_loc file_loc;
     AST_type type_tag;
     struct const_def_s *next; // for lists this is a part of
     ident_t ident;
@@ -275,14 +294,15 @@ typedef struct const_def_s {
 
 // const-def-list ::= { const-def }
 typedef struct {
-    file_location *file_loc;
+    source_loc file_loc;
     AST_type type_tag;
     const_def_t *start;
+    const_def_t *last; // so appending takes constant time
 } const_def_list_t;
 
 // const-decl ::= const const-def-list
 typedef struct const_decl_s {
-    file_location *file_loc;
+    source_loc file_loc;
     AST_type type_tag;
     struct const_decl_s *next; // for lists this is a part of
     const_def_list_t const_def_list;
@@ -290,14 +310,15 @@ typedef struct const_decl_s {
 
 // const-decls ::= { const-decl }
 typedef struct {
-    file_location *file_loc;
+    source_loc file_loc;
     AST_type type_tag;
     const_decl_t *start;
+    const_decl_t *last; // so appending takes constant time
 } const_decls_t;
 
 // block ::= begin const-decls var-decls proc-decls stmts
 typedef struct block_s {
-    file_location *file_loc;
+    source_loc file_loc;
     AST_type type_tag;
     const_decls_t const_decls;
     var_decls_t var_decls;
@@ -336,13 +357,14 @@ typedef union AST_u {
     expr_t expr;
     binary_op_expr_t binary_op_expr;
     token_t token;
+    lazy_block_t lazy_block;
     number_t number;
     ident_t ident;
     empty_t empty;
 } AST;
 
 // Return the file location from an AST
-extern file_location *ast_file_loc(AST t);
+extern source_loc ast_file_loc(AST t);
 
 // Return the filename from the AST t
 extern const char *ast_filename(AST t);
@@ -354,7 +376,7 @@ extern unsigned int ast_line(AST t);
 extern AST_type ast_type_tag(AST t);
 
 // Return a pointer to a fresh copy of t
-// that has been allocated on the heap
+// that has been allocated in the arena
 extern AST *ast_heap_copy(AST t);
 
 // Return an AST for a block which contains the given ASTs.
@@ -405,12 +427,16 @@ extern proc_decls_t ast_proc_decls(proc_decls_t proc_decls,
 // Return an AST for a proc_decl
 extern proc_decl_t ast_proc_decl(ident_t ident, block_t block);
 
+// Return an AST for a proc_decl whose body was skipped by the parser
+// (see parseProcBody)
+extern proc_decl_t ast_proc_decl_lazy(ident_t ident, lazy_block_t body);
+
 
 // Return an AST for the list of statements 
 extern stmts_t ast_stmts_empty(empty_t empty);
 
 // Return an AST for empty found in the given file location
-extern empty_t ast_empty(file_location *file_loc);
+extern empty_t ast_empty(source_loc file_loc);
 
 // Return an AST for the list of statements 
 extern stmts_t ast_stmts(stmt_list_t stmt_list);
@@ -502,11 +528,11 @@ extern expr_t ast_expr_signed_expr(token_t sign, expr_t expr);
 // The following are made by the lexer...
 
 // Return an AST for the given token
-extern token_t ast_token(file_location *file_loc, const char *text, int code);
+extern token_t ast_token(source_loc file_loc, const char *text, int code);
 
 // Return an AST for an identifier
 // found in the file named fn, on line ln, with the given name.
-extern ident_t ast_ident(file_location *file_loc, const char *name);
+extern ident_t ast_ident(source_loc file_loc, const char *name);
 
 // Some operations on AST lists
 
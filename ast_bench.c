@@ -0,0 +1,139 @@
+// Benchmark comparing the two AST layouts (see ast.h and flat_ast.h):
+// parses a generated program with millions of nodes
+// (with about the number of statements given as the first argument),
+// and reports the memory used by each layout and the time
+// taken to scope check and to unparse each of them,
+// and to unparse each of them in parallel (with the number of threads
+// given as the second argument, by default one per processor).
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "lexer.h"
+#include "parser.h"
+#include "flat_ast.h"
+#include "symtab.h"
+#include "scope_check.h"
+#include "unparser.h"
+#include "thread_pool.h"
+#include "arena.h"
+#include "intern.h"
+#include "utilities.h"
+
+// name of the generated program file
+#define BENCH_FILE "ast_bench.tmp.spl"
+
+// default number of statements in the generated program
+#define DEFAULT_STMTS 1000000
+
+// Return the current time in nanoseconds
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Write a program with about n statements
+// (assignments, ifs, whiles and prints with nested expressions)
+// to BENCH_FILE
+static void write_program(unsigned int n)
+{
+    FILE *f = fopen(BENCH_FILE, "w");
+    if (f == NULL) {
+	bail_with_error("Cannot create %s", BENCH_FILE);
+    }
+    fprintf(f, "begin\n  const c = 7;\n  var x, y, z;\n");
+    for (unsigned int i = 0; i < n; i += 4) {
+	fprintf(f, "  x := ((x + %u) * (y - c)) / -z;\n", i);
+	fprintf(f, "  if x < y then y := y + 1 else z := (z - 1) * c end;\n");
+	fprintf(f, "  while divisible x by 3 do print x + y end;\n");
+    }
+    fprintf(f, "  x := 0\nend.\n");
+    fclose(f);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int n = DEFAULT_STMTS;
+    unsigned int threads = thread_pool_processors();
+    if (argc > 1) {
+	n = (unsigned int) atoi(argv[1]);
+	if (argc > 2) {
+	    threads = (unsigned int) atoi(argv[2]);
+	}
+	if (n == 0 || threads == 0) {
+	    bail_with_error("Usage: %s [statements [threads]]", argv[0]);
+	}
+    }
+    write_program(n);
+    FILE *devnull = fopen("/dev/null", "w");
+    if (devnull == NULL) {
+	bail_with_error("Cannot open /dev/null");
+    }
+
+    lexer_init(BENCH_FILE);
+    block_t prog;
+    if (tryParseProgram(&prog) != 0) {
+	bail_with_error("Cannot parse %s!", BENCH_FILE);
+    }
+    size_t tree_bytes = arena_bytes_allocated();
+
+    double start = now_ns();
+    flat_ast *fa = flat_ast_build(prog);
+    double build = now_ns() - start;
+    size_t flat_bytes = flat_ast_bytes(fa);
+    unsigned long nodes = fa->blocks.count + fa->const_decls.count
+	+ fa->const_defs.count + fa->var_decls.count + fa->idents.count
+	+ fa->proc_decls.count + fa->stmts.count + fa->conditions.count
+	+ fa->exprs.count;
+
+    symtab_initialize();
+    start = now_ns();
+    scope_check_program(&prog);
+    double tree_check = now_ns() - start;
+
+    symtab_initialize();
+    start = now_ns();
+    scope_check_flat_program(fa);
+    double flat_check = now_ns() - start;
+
+    start = now_ns();
+    unparseProgram(devnull, prog);
+    double tree_unparse = now_ns() - start;
+
+    start = now_ns();
+    unparseFlatProgram(devnull, fa);
+    double flat_unparse = now_ns() - start;
+
+    unparseSetThreads(threads);
+    start = now_ns();
+    unparseProgram(devnull, prog);
+    double tree_parallel = now_ns() - start;
+
+    start = now_ns();
+    unparseFlatProgram(devnull, fa);
+    double flat_parallel = now_ns() - start;
+    unparseSetThreads(1);
+
+    printf("%lu nodes (flattened in %.1f ms)\n", nodes, build / 1e6);
+    printf("%-8s %12s %12s %14s %14s\n",
+	   "layout", "MB", "bytes/node", "check ms", "unparse ms");
+    printf("%-8s %12.1f %12.1f %14.1f %14.1f\n", "tree",
+	   tree_bytes / 1e6, (double) tree_bytes / nodes,
+	   tree_check / 1e6, tree_unparse / 1e6);
+    printf("%-8s %12.1f %12.1f %14.1f %14.1f\n", "flat",
+	   flat_bytes / 1e6, (double) flat_bytes / nodes,
+	   flat_check / 1e6, flat_unparse / 1e6);
+    printf("unparse with %u threads: tree %.1f ms, flat %.1f ms\n", threads,
+	   tree_parallel / 1e6, flat_parallel / 1e6);
+
+    flat_ast_destroy(fa);
+    fclose(devnull);
+    lexer_close();
+    file_location_reset();
+    intern_reset();
+    arena_reset();
+    remove(BENCH_FILE);
+    return EXIT_SUCCESS;
+}
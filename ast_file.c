@@ -0,0 +1,619 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ast_file.h"
+#include "file_location.h"
+#include "intern.h"
+#include "utilities.h"
+
+// The magic number that starts each AST file
+// (changed whenever the layout of the files changes)
+#define AST_FILE_MAGIC "SPLAST01"
+
+// The byte order mark: this number, as the machine that wrote it
+// lays it out
+#define AST_FILE_BYTE_ORDER 0x01020304u
+
+// Each section of the file starts at a multiple of this many bytes
+#define AST_FILE_ALIGN 8
+
+// One of the arrays of a flat AST: where its number of elements,
+// its capacity and (a pointer to) its elements are in a flat_ast,
+// and the size of an element
+typedef struct {
+    size_t count;
+    size_t capacity;
+    size_t array;
+    size_t elem_size;
+} ast_array;
+
+#define AST_ARRAY(table, field) \
+    { offsetof(flat_ast, table.count), offsetof(flat_ast, table.capacity), \
+      offsetof(flat_ast, table.field), \
+      sizeof(*((flat_ast *) NULL)->table.field) }
+
+// The arrays of a flat AST (except for the names), in the file's order
+static const ast_array ast_arrays[] = {
+    AST_ARRAY(blocks, loc), AST_ARRAY(blocks, const_decls),
+    AST_ARRAY(blocks, var_decls), AST_ARRAY(blocks, proc_decls),
+    AST_ARRAY(blocks, stmts),
+    AST_ARRAY(const_decls, loc), AST_ARRAY(const_decls, defs),
+    AST_ARRAY(const_defs, loc), AST_ARRAY(const_defs, name),
+    AST_ARRAY(const_defs, value),
+    AST_ARRAY(var_decls, loc), AST_ARRAY(var_decls, idents),
+    AST_ARRAY(idents, loc), AST_ARRAY(idents, name),
+    AST_ARRAY(proc_decls, loc), AST_ARRAY(proc_decls, name),
+    AST_ARRAY(proc_decls, block),
+    AST_ARRAY(stmts, kind), AST_ARRAY(stmts, loc), AST_ARRAY(stmts, a),
+    AST_ARRAY(stmts, b), AST_ARRAY(stmts, c),
+    AST_ARRAY(stmt_lists, stmts),
+    AST_ARRAY(conditions, kind), AST_ARRAY(conditions, op),
+    AST_ARRAY(conditions, loc), AST_ARRAY(conditions, a),
+    AST_ARRAY(conditions, b),
+    AST_ARRAY(exprs, kind), AST_ARRAY(exprs, op), AST_ARRAY(exprs, loc),
+    AST_ARRAY(exprs, a), AST_ARRAY(exprs, b)
+};
+
+// number of ast_arrays
+#define AST_ARRAYS (sizeof(ast_arrays) / sizeof(ast_arrays[0]))
+
+// A part of the file: size bytes starting offset bytes into it
+typedef struct {
+    uint64_t offset;
+    uint64_t size;
+} ast_section;
+
+// A source file in the location table
+typedef struct {
+    uint64_t length;      // number of characters in the file
+    uint32_t base;        // location of its first character
+    uint32_t name;        // offset of its name in the strings
+    uint32_t first_line;  // index of its first line start
+    uint32_t line_count;  // number of its line starts
+} ast_source;
+
+// The header at the start of an AST file
+typedef struct {
+    char magic[8];
+    uint32_t byte_order;
+    uint32_t root;                    // the program's block
+    ast_section arrays[AST_ARRAYS];   // the flat AST's arrays
+    ast_section strings;              // null terminated names
+    ast_section names;                // a uint32_t offset in the strings
+                                      // for each identifier's name
+    ast_section sources;              // an ast_source for each file
+    ast_section line_starts;           // uint32_t line starts of all files
+} ast_file_header;
+
+// Return n rounded up to a multiple of AST_FILE_ALIGN
+static uint64_t ast_align(uint64_t n)
+{
+    return (n + AST_FILE_ALIGN - 1) / AST_FILE_ALIGN * AST_FILE_ALIGN;
+}
+
+// Return (a pointer to) the count of elements of array a in fa
+static uint32_t *array_count(const flat_ast *fa, const ast_array *a)
+{
+    return (uint32_t *) ((char *) fa + a->count);
+}
+
+// Return (a pointer to) the capacity of array a in fa
+static uint32_t *array_capacity(const flat_ast *fa, const ast_array *a)
+{
+    return (uint32_t *) ((char *) fa + a->capacity);
+}
+
+// Return (a pointer to) the pointer to the elements of array a in fa
+static void **array_elems(const flat_ast *fa, const ast_array *a)
+{
+    return (void **) ((char *) fa + a->array);
+}
+
+//--------------------------------------------------------------
+// Writing
+//--------------------------------------------------------------
+
+// Put section s next in the file, after *end, and advance *end past it
+static void place_section(ast_section *s, uint64_t size, uint64_t *end)
+{
+    s->offset = ast_align(*end);
+    s->size = size;
+    *end = s->offset + size;
+}
+
+// Write the size bytes at p to f at offset (after zero padding
+// from *written, which is then advanced), returning false if that fails
+static bool write_at(FILE *f, uint64_t offset, const void *p, size_t size,
+		     uint64_t *written)
+{
+    static const char zeros[AST_FILE_ALIGN] = { 0 };
+    // (p may be NULL if size is 0, as for an empty array)
+    if (fwrite(zeros, 1, offset - *written, f) != offset - *written
+	|| (size > 0 && fwrite(p, 1, size, f) != size)) {
+	return false;
+    }
+    *written = offset + size;
+    return true;
+}
+
+// Requires: fa's locations are in the files registered
+//           (in the registry this thread uses)
+// Write fa (and the location table of the registered files)
+// to the AST file named fname, bailing with an error message
+// if that cannot be done
+void ast_file_write(const char *fname, const flat_ast *fa)
+{
+    ast_file_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, AST_FILE_MAGIC, sizeof(h.magic));
+    h.byte_order = AST_FILE_BYTE_ORDER;
+    h.root = fa->root;
+
+    // the strings are the names, then the file names;
+    // and the tables of offsets are built first
+    unsigned int file_count = file_location_file_count();
+    uint32_t name_count = fa->names.count;
+    uint32_t *name_offsets
+	= (uint32_t *) malloc((name_count + 1) * sizeof(uint32_t));
+    ast_source *sources
+	= (ast_source *) malloc((file_count + 1) * sizeof(ast_source));
+    if (name_offsets == NULL || sources == NULL) {
+	free(name_offsets);
+	free(sources);
+	bail_with_error("No space to write the AST to %s!", fname);
+    }
+    uint64_t strings_size = 0;
+    for (uint32_t i = 0; i < name_count; i++) {
+	name_offsets[i] = (uint32_t) strings_size;
+	strings_size += strlen(fa->names.name[i]) + 1;
+    }
+    uint64_t line_count = 0;
+    for (unsigned int i = 0; i < file_count; i++) {
+	file_lines lines;
+	file_location_file(i, &lines);
+	sources[i].length = lines.length;
+	sources[i].base = lines.base;
+	sources[i].name = (uint32_t) strings_size;
+	sources[i].first_line = (uint32_t) line_count;
+	sources[i].line_count = lines.line_count;
+	strings_size += strlen(lines.filename) + 1;
+	line_count += lines.line_count;
+    }
+    if (strings_size > UINT32_MAX || line_count > UINT32_MAX) {
+	free(name_offsets);
+	free(sources);
+	bail_with_error("Too many names or lines to write the AST to %s!",
+			fname);
+    }
+
+    // lay out the file
+    uint64_t end = sizeof(h);
+    for (size_t a = 0; a < AST_ARRAYS; a++) {
+	place_section(&h.arrays[a], (uint64_t) *array_count(fa, &ast_arrays[a])
+		      * ast_arrays[a].elem_size, &end);
+    }
+    place_section(&h.strings, strings_size, &end);
+    place_section(&h.names, (uint64_t) name_count * sizeof(uint32_t), &end);
+    place_section(&h.sources, (uint64_t) file_count * sizeof(ast_source),
+		  &end);
+    place_section(&h.line_starts, line_count * sizeof(uint32_t), &end);
+
+    FILE *f = fopen(fname, "wb");
+    if (f == NULL) {
+	free(name_offsets);
+	free(sources);
+	bail_with_error("Cannot create the AST file %s", fname);
+    }
+    uint64_t written = 0;
+    bool ok = write_at(f, 0, &h, sizeof(h), &written);
+    for (size_t a = 0; ok && a < AST_ARRAYS; a++) {
+	ok = write_at(f, h.arrays[a].offset, *array_elems(fa, &ast_arrays[a]),
+		      h.arrays[a].size, &written);
+    }
+    ok = ok && write_at(f, h.strings.offset, "", 0, &written);
+    for (uint32_t i = 0; ok && i < name_count; i++) {
+	ok = write_at(f, written, fa->names.name[i],
+		      strlen(fa->names.name[i]) + 1, &written);
+    }
+    for (unsigned int i = 0; ok && i < file_count; i++) {
+	file_lines lines;
+	file_location_file(i, &lines);
+	ok = write_at(f, written, lines.filename, strlen(lines.filename) + 1,
+		      &written);
+    }
+    ok = ok && write_at(f, h.names.offset, name_offsets, h.names.size,
+			&written)
+	&& write_at(f, h.sources.offset, sources, h.sources.size, &written)
+	&& write_at(f, h.line_starts.offset, "", 0, &written);
+    for (unsigned int i = 0; ok && i < file_count; i++) {
+	file_lines lines;
+	file_location_file(i, &lines);
+	ok = write_at(f, written, lines.line_starts,
+		      lines.line_count * sizeof(uint32_t), &written);
+    }
+    free(name_offsets);
+    free(sources);
+    if (fclose(f) != 0 || !ok) {
+	// (so a partly written file is not loaded later)
+	int saved = errno;
+	remove(fname);
+	errno = saved;
+	bail_with_error("Cannot write the AST file %s", fname);
+    }
+}
+
+//--------------------------------------------------------------
+// Loading
+//--------------------------------------------------------------
+
+// Return true if the section s lies within a file of file_size bytes,
+// starts on an alignment boundary, and holds whole elements
+// of elem_size bytes
+static bool section_ok(const ast_section *s, uint64_t file_size,
+		       size_t elem_size)
+{
+    return s->offset % AST_FILE_ALIGN == 0
+	&& s->offset <= file_size && s->size <= file_size - s->offset
+	&& s->size % elem_size == 0;
+}
+
+// Requires: the file's size is at least sizeof(ast_file_header)
+// Return NULL if the AST file of file_size bytes mapped at base
+// is laid out correctly (putting the location after the end of its last
+// source file in *loc_end), and otherwise a description of what is wrong
+static const char *check_layout(const char *base, uint64_t file_size,
+				source_loc *loc_end)
+{
+    const ast_file_header *h = (const ast_file_header *) base;
+    if (memcmp(h->magic, AST_FILE_MAGIC, sizeof(h->magic)) != 0) {
+	return "is not an AST file (or is from another version)";
+    }
+    if (h->byte_order != AST_FILE_BYTE_ORDER) {
+	return "was written on a machine with another byte order";
+    }
+    for (size_t a = 0; a < AST_ARRAYS; a++) {
+	if (!section_ok(&h->arrays[a], file_size, ast_arrays[a].elem_size)
+	    || h->arrays[a].size / ast_arrays[a].elem_size >= FLAT_NONE) {
+	    return "has a malformed node array";
+	}
+	// (the arrays of a kind of node all have the same number of elements)
+	if (a > 0 && ast_arrays[a].count == ast_arrays[a-1].count
+	    && h->arrays[a].size / ast_arrays[a].elem_size
+	       != h->arrays[a-1].size / ast_arrays[a-1].elem_size) {
+	    return "has node arrays of different lengths";
+	}
+    }
+    if (h->root >= h->arrays[0].size / ast_arrays[0].elem_size) {
+	return "has no program block";
+    }
+    if (!section_ok(&h->strings, file_size, 1)
+	|| !section_ok(&h->names, file_size, sizeof(uint32_t))
+	|| !section_ok(&h->sources, file_size, sizeof(ast_source))
+	|| !section_ok(&h->line_starts, file_size, sizeof(uint32_t))) {
+	return "has a malformed name or location table";
+    }
+    const char *strings = base + h->strings.offset;
+    if (h->strings.size > UINT32_MAX
+	|| (h->strings.size > 0 && strings[h->strings.size - 1] != '\0')) {
+	return "has a malformed name table";
+    }
+    const uint32_t *names = (const uint32_t *) (base + h->names.offset);
+    for (uint64_t i = 0; i < h->names.size / sizeof(uint32_t); i++) {
+	if (names[i] >= h->strings.size) {
+	    return "has a malformed name table";
+	}
+    }
+    const ast_source *sources = (const ast_source *) (base + h->sources.offset);
+    const uint32_t *starts = (const uint32_t *) (base + h->line_starts.offset);
+    uint64_t line_count = h->line_starts.size / sizeof(uint32_t);
+    source_loc next_base = NO_SOURCE_LOC + 1;
+    for (uint64_t i = 0; i < h->sources.size / sizeof(ast_source); i++) {
+	const ast_source *s = &sources[i];
+	if (s->name >= h->strings.size || s->line_count == 0
+	    || s->first_line > line_count
+	    || s->line_count > line_count - s->first_line
+	    || s->base != next_base || s->length >= UINT32_MAX - s->base) {
+	    return "has a malformed location table";
+	}
+	const uint32_t *lines = &starts[s->first_line];
+	if (lines[0] != 0) {
+	    return "has a malformed location table";
+	}
+	for (uint32_t l = 1; l < s->line_count; l++) {
+	    if (lines[l] <= lines[l-1] || lines[l] > s->length) {
+		return "has a malformed location table";
+	    }
+	}
+	next_base = s->base + (source_loc) s->length + 1;
+    }
+    *loc_end = next_base;
+    return NULL;
+}
+
+// Return true if the range r lies within an array of count nodes
+static bool range_ok(flat_range r, uint32_t count)
+{
+    return r.first <= count && r.count <= count - r.first;
+}
+
+// Return NULL if each node of fa (whose names are not yet filled in)
+// refers only to nodes, names (of which there are name_count)
+// and locations (before loc_end) that exist, and has a kind
+// (and operator) that exists, and otherwise a description of
+// what is wrong; so the unparser and the checker stay within fa.
+// (This is one pass over the nodes, allocating nothing.)
+static const char *check_nodes(const flat_ast *fa, uint32_t name_count,
+			       source_loc loc_end)
+{
+    const char *bad_loc = "has a node with a malformed location";
+    const char *bad_node = "has a node that refers to a missing node";
+    const char *bad_name = "has a node that refers to a missing name";
+    const char *bad_kind = "has a node of an unknown kind";
+
+    const flat_blocks *bl = &fa->blocks;
+    for (uint32_t i = 0; i < bl->count; i++) {
+	if (bl->loc[i] >= loc_end) {
+	    return bad_loc;
+	}
+	if (!range_ok(bl->const_decls[i], fa->const_decls.count)
+	    || !range_ok(bl->var_decls[i], fa->var_decls.count)
+	    || !range_ok(bl->proc_decls[i], fa->proc_decls.count)
+	    || !range_ok(bl->stmts[i], fa->stmts.count)) {
+	    return bad_node;
+	}
+    }
+    for (uint32_t i = 0; i < fa->const_decls.count; i++) {
+	if (fa->const_decls.loc[i] >= loc_end) {
+	    return bad_loc;
+	}
+	if (!range_ok(fa->const_decls.defs[i], fa->const_defs.count)) {
+	    return bad_node;
+	}
+    }
+    for (uint32_t i = 0; i < fa->const_defs.count; i++) {
+	if (fa->const_defs.loc[i] >= loc_end) {
+	    return bad_loc;
+	}
+	if (fa->const_defs.name[i] >= name_count) {
+	    return bad_name;
+	}
+    }
+    for (uint32_t i = 0; i < fa->var_decls.count; i++) {
+	if (fa->var_decls.loc[i] >= loc_end) {
+	    return bad_loc;
+	}
+	if (!range_ok(fa->var_decls.idents[i], fa->idents.count)) {
+	    return bad_node;
+	}
+    }
+    for (uint32_t i = 0; i < fa->idents.count; i++) {
+	if (fa->idents.loc[i] >= loc_end) {
+	    return bad_loc;
+	}
+	if (fa->idents.name[i] >= name_count) {
+	    return bad_name;
+	}
+    }
+    for (uint32_t i = 0; i < fa->proc_decls.count; i++) {
+	if (fa->proc_decls.loc[i] >= loc_end) {
+	    return bad_loc;
+	}
+	if (fa->proc_decls.name[i] >= name_count) {
+	    return bad_name;
+	}
+	if (fa->proc_decls.block[i] >= bl->count) {
+	    return bad_node;
+	}
+    }
+
+    const flat_stmts *st = &fa->stmts;
+    uint32_t lists = fa->stmt_lists.count;
+    uint32_t conds = fa->conditions.count;
+    uint32_t exprs = fa->exprs.count;
+    for (uint32_t i = 0; i < st->count; i++) {
+	if (st->loc[i] >= loc_end) {
+	    return bad_loc;
+	}
+	bool ok;
+	switch (st->kind[i]) {
+	case assign_stmt:
+	    if (st->a[i] >= name_count) {
+		return bad_name;
+	    }
+	    ok = st->b[i] < exprs;
+	    break;
+	case call_stmt:
+	case read_stmt:
+	    if (st->a[i] >= name_count) {
+		return bad_name;
+	    }
+	    ok = true;
+	    break;
+	case if_stmt:
+	    ok = st->a[i] < conds && st->b[i] < lists
+		&& (st->c[i] == FLAT_NONE || st->c[i] < lists);
+	    break;
+	case while_stmt:
+	    ok = st->a[i] < conds && st->b[i] < lists;
+	    break;
+	case print_stmt:
+	    ok = st->a[i] < exprs;
+	    break;
+	case block_stmt:
+	    ok = st->a[i] < bl->count;
+	    break;
+	default:
+	    return bad_kind;
+	}
+	if (!ok) {
+	    return bad_node;
+	}
+    }
+    for (uint32_t i = 0; i < lists; i++) {
+	if (!range_ok(fa->stmt_lists.stmts[i], st->count)) {
+	    return bad_node;
+	}
+    }
+
+    const flat_conditions *co = &fa->conditions;
+    for (uint32_t i = 0; i < conds; i++) {
+	if (co->loc[i] >= loc_end) {
+	    return bad_loc;
+	}
+	if (co->kind[i] != ck_db
+	    && (co->kind[i] != ck_rel || co->op[i] < flat_op_eq
+		|| co->op[i] > flat_op_geq)) {
+	    return bad_kind;
+	}
+	if (co->a[i] >= exprs || co->b[i] >= exprs) {
+	    return bad_node;
+	}
+    }
+    const flat_exprs *ex = &fa->exprs;
+    for (uint32_t i = 0; i < exprs; i++) {
+	if (ex->loc[i] >= loc_end) {
+	    return bad_loc;
+	}
+	bool ok;
+	switch (ex->kind[i]) {
+	case expr_bin:
+	    if (ex->op[i] > flat_op_div) {
+		return bad_kind;
+	    }
+	    ok = ex->a[i] < exprs && ex->b[i] < exprs;
+	    break;
+	case expr_negated:
+	    ok = ex->a[i] < exprs;
+	    break;
+	case expr_ident:
+	    if (ex->a[i] >= name_count) {
+		return bad_name;
+	    }
+	    ok = true;
+	    break;
+	case expr_number:
+	    ok = true;
+	    break;
+	default:
+	    return bad_kind;
+	}
+	if (!ok) {
+	    return bad_node;
+	}
+    }
+    return NULL;
+}
+
+// Requires: no files are registered (in the registry this thread uses)
+// Load the AST file named fname, returning its flat AST
+// (which is freed with flat_ast_destroy), interning its names
+// and registering its location table.
+// If the file cannot be loaded, bail with an error message.
+flat_ast *ast_file_load(const char *fname)
+{
+    int fd = open(fname, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+	bail_with_error("Cannot open the AST file %s", fname);
+    }
+    if (!S_ISREG(st.st_mode) || (size_t) st.st_size < sizeof(ast_file_header)) {
+	close(fd);
+	bail_with_error("The file %s is not an AST file!", fname);
+    }
+    uint64_t file_size = (uint64_t) st.st_size;
+    char *base = (char *) mmap(NULL, (size_t) file_size, PROT_READ,
+			       MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+	bail_with_error("Cannot map the AST file %s", fname);
+    }
+    source_loc loc_end;
+    const char *problem = check_layout(base, file_size, &loc_end);
+    flat_ast *fa = NULL;
+    const ast_file_header *h = (const ast_file_header *) base;
+    uint32_t name_count = (uint32_t) (h->names.size / sizeof(uint32_t));
+    // the arrays are used where they are in the mapping
+    flat_ast nodes;
+    memset(&nodes, 0, sizeof(nodes));
+    if (problem == NULL) {
+	for (size_t a = 0; a < AST_ARRAYS; a++) {
+	    uint32_t count
+		= (uint32_t) (h->arrays[a].size / ast_arrays[a].elem_size);
+	    *array_count(&nodes, &ast_arrays[a]) = count;
+	    *array_capacity(&nodes, &ast_arrays[a]) = count;
+	    *array_elems(&nodes, &ast_arrays[a]) = base + h->arrays[a].offset;
+	}
+	problem = check_nodes(&nodes, name_count, loc_end);
+    }
+    if (problem == NULL) {
+	// only the names and the bindings (which scope checking fills in)
+	// are allocated, each with room for at least one element,
+	// so malloc's result is never NULL
+	fa = (flat_ast *) malloc(sizeof(flat_ast));
+	nodes.names.name
+	    = (const char **) malloc((name_count + 1) * sizeof(const char *));
+	nodes.stmts.binding = (id_binding *)
+	    malloc((nodes.stmts.count + 1) * sizeof(id_binding));
+	nodes.exprs.binding = (id_binding *)
+	    malloc((nodes.exprs.count + 1) * sizeof(id_binding));
+	if (fa == NULL || nodes.names.name == NULL
+	    || nodes.stmts.binding == NULL || nodes.exprs.binding == NULL) {
+	    free(fa);
+	    free(nodes.names.name);
+	    free(nodes.stmts.binding);
+	    free(nodes.exprs.binding);
+	    problem = "cannot be loaded, as there is no space"
+		" for its names and bindings";
+	}
+    }
+    if (problem != NULL) {
+	munmap(base, (size_t) file_size);
+	bail_with_error("The file %s %s!", fname, problem);
+    }
+
+    *fa = nodes;
+    for (uint32_t i = 0; i < fa->stmts.count; i++) {
+	fa->stmts.binding[i] = ID_BINDING_UNRESOLVED;
+    }
+    for (uint32_t i = 0; i < fa->exprs.count; i++) {
+	fa->exprs.binding[i] = ID_BINDING_UNRESOLVED;
+    }
+    fa->mapping = base;
+    fa->mapping_size = (size_t) file_size;
+    fa->root = h->root;
+
+    // the names are interned, so they can be compared as pointers
+    const char *strings = base + h->strings.offset;
+    const uint32_t *names = (const uint32_t *) (base + h->names.offset);
+    for (uint32_t i = 0; i < name_count; i++) {
+	const char *name = strings + names[i];
+	fa->names.name[i] = intern_string(name, strlen(name));
+    }
+    fa->names.count = fa->names.capacity = name_count;
+
+    // the line tables are used where they are in the mapping
+    const ast_source *sources = (const ast_source *) (base + h->sources.offset);
+    const uint32_t *starts = (const uint32_t *) (base + h->line_starts.offset);
+    for (uint64_t i = 0; i < h->sources.size / sizeof(ast_source); i++) {
+	file_lines lines;
+	lines.filename = strings + sources[i].name;
+	lines.base = sources[i].base;
+	lines.length = sources[i].length;
+	lines.line_starts = &starts[sources[i].first_line];
+	lines.line_count = sources[i].line_count;
+	if (file_location_register_lines(&lines) != lines.base) {
+	    flat_ast_destroy(fa);
+	    bail_with_error("The locations in %s cannot be registered,"
+			    " as other files are registered!", fname);
+	}
+    }
+    return fa;
+}
@@ -0,0 +1,45 @@
+#ifndef _AST_FILE_H
+#define _AST_FILE_H
+
+#include "flat_ast.h"
+
+// An AST file (conventionally named with the suffix .splast) holds
+// a program's flat AST (see flat_ast.h) in a compact binary form
+// that has no pointers in it, so it can be used without parsing
+// the program again: the file is mapped into memory (with one mmap)
+// and the flat AST's arrays point into that mapping,
+// so no storage is allocated for its nodes (only for the names,
+// and for the bindings that scope checking fills in).
+// The file holds, after a header:
+// - each of the flat AST's arrays, at an offset (from the start of
+//   the file) recorded in the header, aligned for its elements,
+// - the names of identifiers (null terminated),
+//   and the offset of each in those names,
+// - the location table: the name, length and line starts
+//   of each source file that the nodes' locations refer to,
+//   which is registered when the file is loaded (see file_location.h)
+//   so errors are reported at the same lines as in the source.
+// AST files are written and read on the same kind of machine
+// (the header records the byte order, and a file with another order
+// is not loaded).  The layout of a loaded file is checked, and so are
+// its nodes: each must have a kind that exists and refer only to
+// nodes, names and locations in the file.
+
+// The suffix conventionally used for AST files
+#define AST_FILE_SUFFIX ".splast"
+
+// Requires: fa's locations are in the files registered
+//           (in the registry this thread uses)
+// Write fa (and the location table of the registered files)
+// to the AST file named fname, bailing with an error message
+// if that cannot be done
+extern void ast_file_write(const char *fname, const flat_ast *fa);
+
+// Requires: no files are registered (in the registry this thread uses)
+// Load the AST file named fname, returning its flat AST
+// (which is freed with flat_ast_destroy), interning its names
+// and registering its location table.
+// If the file cannot be loaded, bail with an error message.
+extern flat_ast *ast_file_load(const char *fname);
+
+#endif
@@ -0,0 +1,216 @@
+// Benchmark for scope checking: reports the time and the stack space
+// used by scope_check_program on a deeply nested program,
+// on a wide (long) one, and on one with many procedures
+// (checked with one thread, and with the number of threads given
+// as the argument, by default one per processor).
+// The stack used is measured by running the check in a thread
+// whose stack is filled with a known pattern beforehand.
+// It also reports the size of the resolution table produced
+// and the time taken to count the uses of every declaration with it.
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "lexer.h"
+#include "parser.h"
+#include "symtab.h"
+#include "scope_check.h"
+#include "resolution.h"
+#include "thread_pool.h"
+#include "file_location.h"
+#include "arena.h"
+#include "intern.h"
+#include "utilities.h"
+
+// name of the generated program file
+#define BENCH_FILE "check_bench.tmp.spl"
+
+// nesting depth of the deep program
+#define DEEP_NESTING 1000
+
+// number of statements in the wide program
+#define WIDE_STMTS 1000000
+
+// number of procedures in the program with many procedures,
+// and the number of statements in each
+#define PROCS 5000
+#define PROC_STMTS 100
+
+// size of the stack of the thread that does the checking
+#define STACK_SIZE (64 * 1024 * 1024)
+
+// alignment of the thread's stack (a page)
+#define STACK_ALIGNMENT 4096
+
+// byte used to fill the stack before checking
+#define STACK_FILL 0xA5
+
+// Return the current time in nanoseconds
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Write a program with if statements nested DEEP_NESTING deep,
+// the innermost of which prints a deeply nested expression
+static void write_deep_program()
+{
+    FILE *f = fopen(BENCH_FILE, "w");
+    if (f == NULL) {
+	bail_with_error("Cannot create %s", BENCH_FILE);
+    }
+    fprintf(f, "begin\n  var x, y;\n");
+    for (int i = 0; i < DEEP_NESTING; i++) {
+	fprintf(f, "  if x < %d then\n", i);
+    }
+    fprintf(f, "  print ");
+    for (int i = 0; i < DEEP_NESTING; i++) {
+	fprintf(f, "(x + ");
+    }
+    fprintf(f, "y");
+    for (int i = 0; i < DEEP_NESTING; i++) {
+	fprintf(f, ")");
+    }
+    fprintf(f, "\n");
+    for (int i = 0; i < DEEP_NESTING; i++) {
+	fprintf(f, "  end\n");
+    }
+    fprintf(f, "end.\n");
+    fclose(f);
+}
+
+// Write a program with a block of WIDE_STMTS statements
+static void write_wide_program()
+{
+    FILE *f = fopen(BENCH_FILE, "w");
+    if (f == NULL) {
+	bail_with_error("Cannot create %s", BENCH_FILE);
+    }
+    fprintf(f, "begin\n  var x, y;\n");
+    for (int i = 0; i < WIDE_STMTS; i++) {
+	fprintf(f, "  if x < %d then y := (x + y) * %d else read x end;\n",
+		i, i);
+    }
+    fprintf(f, "  x := 0\nend.\n");
+    fclose(f);
+}
+
+// Write a program with PROCS procedures, each with PROC_STMTS statements
+// that use its own variables, the program's, and earlier procedures
+static void write_procs_program()
+{
+    FILE *f = fopen(BENCH_FILE, "w");
+    if (f == NULL) {
+	bail_with_error("Cannot create %s", BENCH_FILE);
+    }
+    fprintf(f, "begin\n  const c = 3;\n  var x, y;\n");
+    for (int p = 0; p < PROCS; p++) {
+	fprintf(f, "  proc p%d\n  begin\n    var a, b;\n", p);
+	for (int i = 0; i < PROC_STMTS; i++) {
+	    fprintf(f, "    if a < %d then b := (x + a) * c else read y end;\n",
+		    i);
+	}
+	fprintf(f, "    call p%d\n  end;\n", p / 2);
+    }
+    fprintf(f, "  call p0\nend.\n");
+    fclose(f);
+}
+
+// the program checked by check_thread, the number of threads to use,
+// and the time it took
+static block_t bench_prog;
+static unsigned int bench_threads;
+static double check_time;
+
+// Scope check bench_prog, recording the time taken in check_time
+static void *check_thread(void *arg)
+{
+    symtab_initialize();
+    scope_check_set_threads(bench_threads);
+    double start = now_ns();
+    scope_check_program(&bench_prog);
+    check_time = now_ns() - start;
+    return NULL;
+}
+
+// Parse BENCH_FILE, then scope check it in a thread (using threads threads),
+// and print the time taken and the stack space used, labeled by name
+static void bench(const char *name, unsigned int threads)
+{
+    bench_threads = threads;
+    lexer_init(BENCH_FILE);
+    if (tryParseProgram(&bench_prog) != 0) {
+	bail_with_error("Cannot parse %s!", BENCH_FILE);
+    }
+
+    char *stack = (char *) aligned_alloc(STACK_ALIGNMENT, STACK_SIZE);
+    if (stack == NULL) {
+	bail_with_error("No space for the checking thread's stack!");
+    }
+    memset(stack, STACK_FILL, STACK_SIZE);
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, stack, STACK_SIZE);
+    pthread_t thread;
+    if (pthread_create(&thread, &attr, check_thread, NULL) != 0) {
+	bail_with_error("Cannot create the checking thread!");
+    }
+    pthread_join(thread, NULL);
+    pthread_attr_destroy(&attr);
+
+    // the stack grows down, so the lowest byte changed marks its depth
+    size_t untouched = 0;
+    while (untouched < STACK_SIZE
+	   && (unsigned char) stack[untouched] == STACK_FILL) {
+	untouched++;
+    }
+    free(stack);
+
+    unsigned int decls = resolution_decl_count();
+    unsigned int *counts
+	= (unsigned int *) malloc((decls + 1) * sizeof(unsigned int));
+    if (counts == NULL) {
+	bail_with_error("No space for the use counts!");
+    }
+    double start = now_ns();
+    resolution_count_uses(counts);
+    double count_time = now_ns() - start;
+    free(counts);
+
+    char label[32];
+    snprintf(label, sizeof(label), "%s/%u", name, threads);
+    printf("%-10s %12.1f %12.1f %8u %10u %10.2f\n", label, check_time / 1e6,
+	   (STACK_SIZE - untouched) / 1024.0, decls,
+	   resolution_use_count(), count_time / 1e6);
+
+    lexer_close();
+    file_location_reset();
+    intern_reset();
+    arena_reset();
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int threads = thread_pool_processors();
+    if (argc > 1) {
+	threads = (unsigned int) atoi(argv[1]);
+	if (threads == 0) {
+	    bail_with_error("Usage: %s [threads]", argv[0]);
+	}
+    }
+    printf("%-10s %12s %12s %8s %10s %10s\n", "input/thrds", "check ms",
+	   "stack KB", "decls", "uses", "count ms");
+    write_deep_program();
+    bench("deep", 1);
+    write_wide_program();
+    bench("wide", 1);
+    write_procs_program();
+    bench("procs", 1);
+    bench("procs", threads);
+    remove(BENCH_FILE);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,509 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <errno.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "compile.h"
+#include "compile_context.h"
+#include "parser.h"
+#include "lexer.h"
+#include "ast.h"
+#include "flat_ast.h"
+#include "ast_file.h"
+#include "symtab.h"
+#include "scope_check.h"
+#include "unparser.h"
+#include "phase_stats.h"
+#include "thread_pool.h"
+#include "utilities.h"
+
+// A program to compile: the file named name, or,
+// if text is not NULL, the len chars at text (named name),
+// or, if ast_file is true, the AST in the AST file named name
+typedef struct {
+    char *name;
+    const char *text;
+    size_t len;
+    bool ast_file;
+} compile_input;
+
+// Start the lexer reading the program in
+static void start_lexer(const compile_input *in)
+{
+    if (in->text != NULL) {
+	lexer_init_text(in->name, in->text, in->len);
+    } else {
+	lexer_init(in->name);
+    }
+}
+
+// Read all the tokens of the program in (in a pass of its own)
+static void lex_pass(const compile_input *in)
+{
+    start_lexer(in);
+    AST lval;
+    while (lexer_next(&lval) != 0) {
+	// (the tokens are just read)
+    }
+}
+
+// Release the storage for the ASTs, names and symbol table entries,
+// and the source text and its line table (of this thread's context)
+void compile_release()
+{
+    intern_reset();
+    arena_reset();
+    lexer_close();
+    file_location_reset();
+}
+
+// Run the phases opts asks for (after the lex phase) on the program in,
+// printing the unparsed program on out, and putting the flat AST built
+// or loaded (if any) in *fa, and the program's AST (allocated in
+// the arena) in *ast, unless ast is NULL. Return 0, or the parser's code
+// if it found errors.
+static int compile_phases(const compile_input *in, const compile_options *opts,
+			  FILE *out, flat_ast *volatile *fa, block_t **ast)
+{
+    // parsing (or loading the flat AST, which stands in for parsing)
+    phase_stats_start(phase_parse);
+    block_t prog;
+    block_t *progast = NULL;
+    if (in->ast_file) {
+	*fa = ast_file_load(in->name);
+    } else {
+	start_lexer(in);
+	lexer_set_lazy(opts->lazy);
+	progast
+	    = (ast != NULL) ? (block_t *) arena_alloc(sizeof(block_t)) : &prog;
+	// (in lazy mode, the bodies are parsed when they are needed instead)
+	int rc = (opts->parallel_parse && !opts->lazy)
+	             ? tryParseProgramParallel(progast)
+	             : tryParseProgram(progast);
+	if (rc != 0) {
+	    return rc;
+	}
+	if (ast != NULL) {
+	    *ast = progast;
+	}
+	if (opts->flat || opts->emit_ast != NULL) {
+	    // (the flat AST has all the bodies, so any skipped are parsed)
+	    parseProcBodies(&progast->proc_decls);
+	    *fa = flat_ast_build(*progast);
+	}
+    }
+    phase_stats_finish(phase_parse);
+    if (opts->emit_ast != NULL) {
+	ast_file_write(opts->emit_ast, *fa);
+    }
+    // a loaded AST is only flat
+    bool flat = opts->flat || in->ast_file;
+
+    // unparse to check on the AST
+    if (opts->phases & (1u << phase_unparse)) {
+	phase_stats_start(phase_unparse);
+	if (flat) {
+	    unparseFlatProgram(out, *fa);
+	} else {
+	    unparseProgram(out, *progast);
+	}
+	fflush(out);
+	phase_stats_finish(phase_unparse);
+    }
+
+    // check for duplicate declarations and undeclared identifiers
+    if (opts->phases & (1u << phase_check)) {
+	phase_stats_start(phase_check);
+	// building symbol table
+	symtab_initialize();
+	if (flat) {
+	    scope_check_flat_program(*fa);
+	} else {
+	    scope_check_program(progast);
+	}
+	phase_stats_finish(phase_check);
+    }
+    return 0;
+}
+
+// Compile the program in, as compile_file does (without a cache),
+// but without printing statistics, and
+// if ast is not NULL, put the program's AST (or NULL, if it was
+// not parsed) in *ast, and do not release the storage
+static int compile_uncached(const compile_input *in,
+			    const compile_options *opts,
+			    FILE *out, FILE *err, block_t **ast)
+{
+    if (ast != NULL) {
+	*ast = NULL;
+    }
+    lexer_set_errors(err);
+    // (so an OS error reported with bail_with_error is one that happened
+    // in this compilation, not, e.g., a cache miss's failed open)
+    errno = 0;
+    // (these are volatile, as they are used after a longjmp to trap)
+    volatile int status = 0;
+    flat_ast *volatile fa = NULL;
+    error_trap trap;
+    if (setjmp(trap.env) == 0) {
+	error_trap_push(&trap);
+	if ((opts->phases & (1u << phase_lex)) && !in->ast_file) {
+	    phase_stats_start(phase_lex);
+	    lex_pass(in);
+	    phase_stats_finish(phase_lex);
+	    compile_release();
+	}
+	if (opts->phases & (1u << phase_parse)) {
+	    status = compile_phases(in, opts, out, &fa, ast);
+	}
+	error_trap_pop(&trap);
+    } else {
+	// as bail_with_message would report it
+	fflush(out);
+	fprintf(err, "%s\n", trap.message);
+	status = EXIT_FAILURE;
+    }
+    // (the phase an error stopped is measured up to the error)
+    phase_stats_finish_started();
+    if (fa != NULL) {
+	flat_ast_destroy(fa);
+    }
+    if (ast == NULL) {
+	compile_release();
+    }
+    lexer_set_errors(NULL);
+    return status;
+}
+
+// Put the key for the cached result of compiling the program in
+// (whose text is not NULL) as opts says into *key
+// (which starts with the compiler's version, see compile_cache_open)
+static void compile_cache_key(const compile_input *in,
+			      const compile_options *opts, cache_key *key)
+{
+    compile_cache_key_init(opts->cache, key);
+    uint32_t phases = opts->phases;
+    cache_key_add(key, &phases, sizeof(phases));
+    uint8_t flat = opts->flat;
+    cache_key_add(key, &flat, sizeof(flat));
+    // (errors in procedure bodies are found later in lazy mode)
+    uint8_t lazy = opts->lazy;
+    cache_key_add(key, &lazy, sizeof(lazy));
+    // (the name appears in the errors, and the null char ends it)
+    cache_key_add(key, in->name, strlen(in->name) + 1);
+    uint64_t len = in->len;
+    cache_key_add(key, &len, sizeof(len));
+    cache_key_add(key, in->text, in->len);
+}
+
+// Map the regular file named fname into memory, putting its address
+// (or NULL, if it is empty) in *text and its size in *len,
+// and return true, or return false if that cannot be done
+static bool map_source(const char *fname, void **text, size_t *len)
+{
+    *text = NULL;
+    *len = 0;
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0) {
+	return false;
+    }
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    if (ok && st.st_size > 0) {
+	void *p = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	ok = (p != MAP_FAILED);
+	if (ok) {
+	    *text = p;
+	    *len = (size_t) st.st_size;
+	}
+    }
+    close(fd);
+    return ok;
+}
+
+// Compile the program in as compile_uncached does (without keeping
+// its AST), but if opts->cache has the result of compiling it,
+// just print that, and otherwise add the result to the cache
+static int compile_cached(const compile_input *in,
+			  const compile_options *opts, FILE *out, FILE *err)
+{
+    // the program's text is needed for its key
+    compile_input text = *in;
+    void *mapped = NULL;
+    size_t mapped_size = 0;
+    if (in->text == NULL) {
+	if (!map_source(in->name, &mapped, &mapped_size)) {
+	    // (so the error is reported as it would be without a cache)
+	    return compile_uncached(in, opts, out, err, NULL);
+	}
+	text.text = (mapped != NULL) ? (const char *) mapped : "";
+	text.len = mapped_size;
+    }
+    cache_key key;
+    compile_cache_key(&text, opts, &key);
+
+    cache_entry e;
+    int status;
+    bool hit = compile_cache_lookup(opts->cache, &key, &e);
+    phase_stats_count_cache(hit);
+    if (hit) {
+	status = e.status;
+	fwrite(e.output, 1, e.output_size, out);
+	fflush(out);
+	fwrite(e.errors, 1, e.errors_size, err);
+	compile_cache_entry_free(&e);
+    } else {
+	e.output = e.errors = NULL;
+	e.output_size = e.errors_size = 0;
+	FILE *cout = open_memstream(&e.output, &e.output_size);
+	FILE *cerr = open_memstream(&e.errors, &e.errors_size);
+	if (cout == NULL || cerr == NULL) {
+	    if (cout != NULL) {
+		fclose(cout);
+	    }
+	    if (cerr != NULL) {
+		fclose(cerr);
+	    }
+	    status = compile_uncached(&text, opts, out, err, NULL);
+	} else {
+	    status = compile_uncached(&text, opts, cout, cerr, NULL);
+	    fclose(cout);
+	    fclose(cerr);
+	    e.status = status;
+	    compile_cache_store(opts->cache, &key, &e);
+	    fwrite(e.output, 1, e.output_size, out);
+	    fflush(out);
+	    fwrite(e.errors, 1, e.errors_size, err);
+	}
+	free(e.output);
+	free(e.errors);
+    }
+    if (mapped != NULL) {
+	munmap(mapped, mapped_size);
+    }
+    return status;
+}
+
+// Compile the program in, as compile_file does,
+// but if ast is not NULL, put the program's AST (or NULL, if it was
+// not parsed) in *ast, and do not release the storage
+static int compile_input_program(const compile_input *in,
+				 const compile_options *opts,
+				 FILE *out, FILE *err, block_t **ast)
+{
+    phase_stats_reset();
+    // (the cache is not used when the AST is kept, loaded or written,
+    // as the result is then more than the output and errors)
+    bool cached = opts->cache != NULL && ast == NULL && !in->ast_file
+	&& opts->emit_ast == NULL;
+    int status = cached
+	? compile_cached(in, opts, out, err)
+	: compile_uncached(in, opts, out, err, ast);
+    // (after any errors, which are also printed on err)
+    if (opts->stats) {
+	phase_stats_print(err, opts->stats_json, in->name);
+    }
+    fflush(err);
+    return status;
+}
+
+// Requires: fname != NULL
+// Compile the file named fname, as opts says, in the context this thread
+// is working in, printing the unparsed program on out and the errors
+// (and statistics) on err.
+// Return 0 if there were no errors, and otherwise the process's
+// exit code for them (1, or the code the parser returned).
+int compile_file(char *fname, const compile_options *opts,
+		 FILE *out, FILE *err)
+{
+    compile_input in = { fname, NULL, 0, false };
+    return compile_input_program(&in, opts, out, err, NULL);
+}
+
+// Requires: name != NULL and text points to len chars
+// Compile the program that is the len chars at text, as compile_file
+// would if they were the contents of the file named name
+int compile_text(char *name, const char *text, size_t len,
+		 const compile_options *opts, FILE *out, FILE *err)
+{
+    compile_input in = { name, text, len, false };
+    return compile_input_program(&in, opts, out, err, NULL);
+}
+
+// Requires: fname != NULL
+// Compile the program whose AST is in the AST file named fname
+// (see ast_file.h), as compile_file does, but loading its flat AST
+// instead of lexing and parsing it (so it is unparsed and checked
+// with the flat AST layout)
+int compile_ast_file(char *fname, const compile_options *opts,
+		     FILE *out, FILE *err)
+{
+    compile_input in = { fname, NULL, 0, true };
+    return compile_input_program(&in, opts, out, err, NULL);
+}
+
+// Requires: name != NULL and text points to len chars, and ast != NULL
+// Compile the program that is the len chars at text, as compile_text does,
+// putting the program's AST in *ast (or NULL, if it could not be parsed),
+// but without releasing the storage for the compilation, so the AST
+// (and its names and locations) stay valid until compile_release()
+int compile_text_keeping_ast(char *name, const char *text, size_t len,
+			     const compile_options *opts,
+			     FILE *out, FILE *err, block_t **ast)
+{
+    compile_input in = { name, text, len, false };
+    return compile_input_program(&in, opts, out, err, ast);
+}
+
+//--------------------------------------------------------------
+// Compiling several files at once
+//--------------------------------------------------------------
+
+// Each worker thread compiles files in a context of its own
+// (which it keeps for all its files, so its storage is reused),
+// collecting the output and errors for each file in memory.
+// As each file is finished, the output of the files finished so far
+// that have no unfinished file before them is written,
+// so the output is the same as compiling the files one at a time.
+
+// The result of compiling one of the files
+typedef struct {
+    char *output; // what the compilation printed on out
+    size_t output_size;
+    char *errors; // what it printed on err
+    size_t errors_size;
+    int status; // what compile_file returned
+    bool finished;
+} file_result;
+
+// The files being compiled
+typedef struct {
+    char **fnames;
+    const compile_options *opts;
+    file_result *results;
+    compile_context **contexts; // each worker's context (or NULL)
+    pthread_mutex_t lock; // protects the fields below and the writing
+    unsigned int written; // the number of files written so far
+    unsigned int count; // the number of files
+    int status; // the first nonzero status written (or 0)
+} file_batch;
+
+// Write the results of the files that are finished and not yet written,
+// up to the first file that is not finished
+// (the caller must hold batch->lock)
+static void write_finished(file_batch *batch)
+{
+    while (batch->written < batch->count
+	   && batch->results[batch->written].finished) {
+	file_result *r = &batch->results[batch->written++];
+	fwrite(r->output, 1, r->output_size, stdout);
+	fflush(stdout);
+	fwrite(r->errors, 1, r->errors_size, stderr);
+	fflush(stderr);
+	free(r->output);
+	free(r->errors);
+	r->output = r->errors = NULL;
+	if (batch->status == 0) {
+	    batch->status = r->status;
+	}
+    }
+}
+
+// Compile the file numbered task of ctx (a file_batch)
+// in the context of the worker thread numbered worker
+static void compile_file_task(void *ctx, unsigned int task,
+			      unsigned int worker)
+{
+    file_batch *batch = (file_batch *) ctx;
+    if (batch->contexts[worker] == NULL) {
+	batch->contexts[worker] = compile_context_create();
+    }
+    compile_context_enter(batch->contexts[worker]);
+
+    file_result *r = &batch->results[task];
+    FILE *out = open_memstream(&r->output, &r->output_size);
+    FILE *err = open_memstream(&r->errors, &r->errors_size);
+    if (out == NULL || err == NULL) {
+	bail_with_error("No space for the output of %s!", batch->fnames[task]);
+    }
+    r->status = compile_file(batch->fnames[task], batch->opts, out, err);
+    fclose(out);
+    fclose(err);
+
+    pthread_mutex_lock(&batch->lock);
+    r->finished = true;
+    write_finished(batch);
+    pthread_mutex_unlock(&batch->lock);
+}
+
+// Finish a worker thread's compiling (its storage for unparsing
+// and scope checking is kept for the next batch)
+static void compile_file_done(void *ctx, unsigned int worker)
+{
+    compile_context_enter(NULL);
+}
+
+// Release the storage a worker thread kept for compiling
+static void compile_worker_release(void *ctx, unsigned int worker)
+{
+    compile_thread_release();
+}
+
+// Free the storage this thread keeps from one compilation to the next
+// (for unparsing and scope checking) and stop its worker threads
+// (see thread_pool_release), freeing theirs (e.g., before it exits)
+void compile_thread_release()
+{
+    thread_pool_release(compile_worker_release, NULL);
+    unparseRelease();
+    scope_check_release();
+    symtab_release();
+}
+
+// Requires: threads > 0
+// Compile the count files named in fnames, as opts says,
+// with threads of them being compiled at once (each in its own context),
+// printing the output and then the errors for each file, in order,
+// on stdout and stderr (the output for a file is written as soon as
+// that file and the ones before it are compiled).
+// Return 0 if there were no errors, and otherwise the exit code for the
+// first file that had errors.
+int compile_files(char **fnames, unsigned int count,
+		  const compile_options *opts, unsigned int threads)
+{
+    file_batch batch;
+    batch.fnames = fnames;
+    batch.opts = opts;
+    batch.count = count;
+    batch.written = 0;
+    batch.status = 0;
+    // (with room for at least one, so calloc's result is never NULL)
+    batch.results = (file_result *) calloc(count + 1, sizeof(file_result));
+    batch.contexts
+	= (compile_context **) calloc(threads + 1, sizeof(compile_context *));
+    if (batch.results == NULL || batch.contexts == NULL) {
+	bail_with_error("No space to compile %u files!", count);
+    }
+    pthread_mutex_init(&batch.lock, NULL);
+    fflush(stdout);
+
+    thread_pool_run(count, threads, compile_file_task, compile_file_done,
+		    &batch);
+
+    for (unsigned int w = 0; w < threads; w++) {
+	if (batch.contexts[w] != NULL) {
+	    compile_context_destroy(batch.contexts[w]);
+	}
+    }
+    pthread_mutex_destroy(&batch.lock);
+    free(batch.contexts);
+    free(batch.results);
+    return batch.status;
+}
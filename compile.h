@@ -0,0 +1,88 @@
+#ifndef _COMPILE_H
+#define _COMPILE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "ast.h"
+#include "compile_cache.h"
+
+// The compiler's driver: running the phases (see phase_stats.h)
+// on one file (or program text), or on several files at once
+// (each in a context of its own, see compile_context.h).
+// Errors in a file are reported and the compilation of that file stops,
+// but the process does not exit.
+// With a compile cache (see compile_cache.h), the result of compiling
+// a program is looked up by a hash of the compiler's version, the phases
+// run, the program's name and its text; when it is found, the program
+// is not lexed or parsed, and otherwise its result is added to the cache.
+
+// How to compile a file
+typedef struct {
+    bool flat;           // use the flat AST layout (see flat_ast.h)
+    bool lazy;           // parse procedure bodies when they are needed
+			 // (see lexer_set_lazy)
+    bool parallel_parse; // unless lazy, parse them in parallel
+			 // (see tryParseProgramParallel)
+    unsigned int phases; // the phases to run, a bit for each compiler_phase
+    bool stats;          // print statistics on the phases (after errors)
+    bool stats_json;     // print those statistics as JSON
+    compile_cache *cache; // the cache of compilation results (or NULL)
+    const char *emit_ast; // write the flat AST to this AST file
+			  // (see ast_file.h) after parsing (or NULL)
+} compile_options;
+
+// Requires: fname != NULL
+// Compile the file named fname, as opts says, in the context this thread
+// is working in, printing the unparsed program on out and the errors
+// (and statistics) on err.
+// Return 0 if there were no errors, and otherwise the process's
+// exit code for them (1, or the code the parser returned).
+// The storage for the compilation is released (for reuse) before returning.
+extern int compile_file(char *fname, const compile_options *opts,
+			FILE *out, FILE *err);
+
+// Requires: name != NULL and text points to len chars
+// Compile the program that is the len chars at text, as compile_file
+// would if they were the contents of the file named name
+extern int compile_text(char *name, const char *text, size_t len,
+			const compile_options *opts, FILE *out, FILE *err);
+
+// Requires: fname != NULL
+// Compile the program whose AST is in the AST file named fname
+// (see ast_file.h), as compile_file does, but loading its flat AST
+// instead of lexing and parsing it (so it is unparsed and checked
+// with the flat AST layout)
+extern int compile_ast_file(char *fname, const compile_options *opts,
+			    FILE *out, FILE *err);
+
+// Requires: name != NULL and text points to len chars, and ast != NULL
+// Compile the program that is the len chars at text, as compile_text does
+// (but without using a cache),
+// putting the program's AST in *ast (or NULL, if it could not be parsed),
+// but without releasing the storage for the compilation, so the AST
+// (and its names and locations) stay valid until compile_release()
+extern int compile_text_keeping_ast(char *name, const char *text, size_t len,
+				    const compile_options *opts,
+				    FILE *out, FILE *err, block_t **ast);
+
+// Release the storage for the ASTs, names and symbol table entries,
+// and the source text and its line table (of this thread's context)
+extern void compile_release();
+
+// Free the storage this thread keeps from one compilation to the next
+// (for unparsing and scope checking) and stop its worker threads
+// (see thread_pool_release), freeing theirs (e.g., before it exits)
+extern void compile_thread_release();
+
+// Requires: threads > 0
+// Compile the count files named in fnames, as opts says,
+// with threads of them being compiled at once (each in its own context),
+// printing the output and then the errors for each file, in order,
+// on stdout and stderr (the output for a file is written as soon as
+// that file and the ones before it are compiled).
+// Return 0 if there were no errors, and otherwise the exit code for the
+// first file that had errors.
+extern int compile_files(char **fnames, unsigned int count,
+			 const compile_options *opts, unsigned int threads);
+
+#endif
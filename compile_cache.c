@@ -0,0 +1,474 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <link.h>
+#include <sys/stat.h>
+#include "compile_cache.h"
+#include "utilities.h"
+
+// An entry file is a header followed by the output and then the errors.
+// (Entries are only read by the machine that wrote them,
+// so the header is written as it is laid out in memory.)
+
+// The magic number that starts each entry file
+// (changed whenever the layout of the entries changes)
+#define CACHE_MAGIC "SPLC0001"
+
+// The header of an entry file
+typedef struct {
+    char magic[8];
+    uint64_t key_hi, key_lo; // the entry's key
+    int64_t status;
+    uint64_t output_size, errors_size;
+} entry_header;
+
+// When evicting entries, remove them until the entries take at most
+// this fraction of the limit, so eviction is not done on every store
+#define CACHE_LOW_WATER(limit) ((limit) / 4 * 3)
+
+// Temporary files older than this many seconds are left from a process
+// that died while writing them, and are removed when evicting
+#define CACHE_STALE_TEMP_SECONDS 3600
+
+// The prefix of the names of temporary files
+#define CACHE_TEMP_PREFIX ".tmp."
+
+struct compile_cache_s {
+    char *dir;
+    size_t limit;
+    pthread_mutex_t lock; // protects the fields below
+    bool scanned; // has the size of the entries been found?
+    size_t size;  // the size of the entries (as far as this process knows)
+    unsigned long temps; // the number of temporary files made
+    cache_key version; // the key with just the compiler's version added
+};
+
+// FNV-1a's 128 bit offset basis
+#define FNV128_BASIS_HI 0x6c62272e07bb0142ULL
+#define FNV128_BASIS_LO 0x62b821756295c58dULL
+
+// Start key, with nothing added to it
+void cache_key_init(cache_key *key)
+{
+    key->hi = FNV128_BASIS_HI;
+    key->lo = FNV128_BASIS_LO;
+}
+
+// Add the n bytes at p to key
+void cache_key_add(cache_key *key, const void *p, size_t n)
+{
+    // FNV-1a's 128 bit prime is 2^88 + 0x13b,
+    // so multiplying by it (mod 2^128) is a shift and a small multiply
+    const unsigned char *bytes = (const unsigned char *) p;
+    uint64_t hi = key->hi;
+    uint64_t lo = key->lo;
+    for (size_t i = 0; i < n; i++) {
+	lo ^= bytes[i];
+	uint64_t carry = ((lo >> 32) * 0x13b
+			  + (((lo & 0xffffffffULL) * 0x13b) >> 32)) >> 32;
+	hi = hi * 0x13b + carry + (lo << 24);
+	lo = lo * 0x13b;
+    }
+    key->hi = hi;
+    key->lo = lo;
+}
+
+// Return the name (from malloc) of the file in c's directory
+// with the given name, or NULL if there is no space for it
+static char *cache_path(const compile_cache *c, const char *name)
+{
+    size_t len = strlen(c->dir) + 1 + strlen(name) + 1;
+    char *path = (char *) malloc(len);
+    if (path != NULL) {
+	snprintf(path, len, "%s/%s", c->dir, name);
+    }
+    return path;
+}
+
+// Return the name (from malloc) of the entry file for key in c,
+// or NULL if there is no space for it
+static char *entry_path(const compile_cache *c, const cache_key *key)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "%016llx%016llx" COMPILE_CACHE_SUFFIX,
+	     (unsigned long long) key->hi, (unsigned long long) key->lo);
+    return cache_path(c, name);
+}
+
+// Read n bytes from the file fd into p, returning false if that fails
+static bool read_all(int fd, char *p, size_t n)
+{
+    while (n > 0) {
+	ssize_t got = read(fd, p, n);
+	if (got < 0 && errno == EINTR) {
+	    continue;
+	} else if (got <= 0) {
+	    return false;
+	}
+	p += got;
+	n -= (size_t) got;
+    }
+    return true;
+}
+
+// Write the n bytes at p on the file fd, returning false if that fails
+static bool write_all(int fd, const char *p, size_t n)
+{
+    while (n > 0) {
+	ssize_t put = write(fd, p, n);
+	if (put < 0 && errno == EINTR) {
+	    continue;
+	} else if (put <= 0) {
+	    return false;
+	}
+	p += put;
+	n -= (size_t) put;
+    }
+    return true;
+}
+
+// The compiler's version, as far as cached results are concerned,
+// is this name, followed by the build ID of the program (a hash of
+// the whole program made by the linker) or, if it has none,
+// the contents of the program's file, so a compiler relinked after any
+// change never uses the results of another. (If neither can be found,
+// the time this file was compiled is used instead.)
+#define COMPILER_NAME "spl compiler 1"
+
+// the type of the ELF note holding a build ID
+#ifndef NT_GNU_BUILD_ID
+#define NT_GNU_BUILD_ID 3
+#endif
+
+// What add_build_id works on
+typedef struct {
+    cache_key *key;
+    bool found; // was a build ID added to key?
+} build_id_search;
+
+// Add the build ID of the object info describes (if it has one)
+// to the key in ctx (a build_id_search), and return 1,
+// so only the first object (the program) is looked at
+static int add_build_id(struct dl_phdr_info *info, size_t size, void *ctx)
+{
+    build_id_search *search = (build_id_search *) ctx;
+    for (int i = 0; i < info->dlpi_phnum && !search->found; i++) {
+	const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+	if (ph->p_type != PT_NOTE) {
+	    continue;
+	}
+	const char *p = (const char *) (info->dlpi_addr + ph->p_vaddr);
+	const char *end = p + ph->p_memsz;
+	// (each note's name and description are padded to 4 bytes)
+	while (p + sizeof(ElfW(Nhdr)) <= end) {
+	    const ElfW(Nhdr) *note = (const ElfW(Nhdr) *) p;
+	    const char *name = p + sizeof(ElfW(Nhdr));
+	    const char *desc = name + ((note->n_namesz + 3) & ~3u);
+	    if (desc + note->n_descsz > end) {
+		break;
+	    }
+	    if (note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4
+		&& memcmp(name, "GNU", 4) == 0) {
+		cache_key_add(search->key, desc, note->n_descsz);
+		search->found = true;
+		break;
+	    }
+	    p = desc + ((note->n_descsz + 3) & ~3u);
+	}
+    }
+    return 1;
+}
+
+// Add the contents of the file named fname to key,
+// returning false if it cannot be read
+static bool add_file(cache_key *key, const char *fname)
+{
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0) {
+	return false;
+    }
+    char buf[65536];
+    ssize_t got;
+    while ((got = read(fd, buf, sizeof(buf))) != 0) {
+	if (got < 0 && errno == EINTR) {
+	    continue;
+	} else if (got < 0) {
+	    close(fd);
+	    return false;
+	}
+	cache_key_add(key, buf, (size_t) got);
+    }
+    close(fd);
+    return true;
+}
+
+// Put the key with just the compiler's version added in *key
+static void version_key(cache_key *key)
+{
+    cache_key_init(key);
+    cache_key_add(key, COMPILER_NAME, sizeof(COMPILER_NAME));
+    build_id_search search = { key, false };
+    dl_iterate_phdr(add_build_id, &search);
+    if (!search.found && !add_file(key, "/proc/self/exe")) {
+	const char built[] = __DATE__ " " __TIME__;
+	cache_key_add(key, built, sizeof(built));
+    }
+}
+
+// Start key for an entry of c: with the compiler's version
+// (see compile_cache_open) added to it
+void compile_cache_key_init(const compile_cache *c, cache_key *key)
+{
+    *key = c->version;
+}
+
+// Requires: dir != NULL
+// Return the cache kept in the directory named dir (creating it if need be)
+// whose entries may take at most limit bytes.
+// If the directory cannot be made, bail with an error message.
+compile_cache *compile_cache_open(const char *dir, size_t limit)
+{
+    struct stat st;
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+	bail_with_error("Cannot make the cache directory %s", dir);
+    }
+    if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+	bail_with_error("The cache directory %s is not a directory", dir);
+    }
+    compile_cache *c = (compile_cache *) calloc(1, sizeof(compile_cache));
+    if (c == NULL || (c->dir = strdup(dir)) == NULL) {
+	bail_with_error("No space for the cache in %s!", dir);
+    }
+    c->limit = limit;
+    pthread_mutex_init(&c->lock, NULL);
+    version_key(&c->version);
+    return c;
+}
+
+// Release c (its entries stay in its directory)
+void compile_cache_close(compile_cache *c)
+{
+    pthread_mutex_destroy(&c->lock);
+    free(c->dir);
+    free(c);
+}
+
+// If c has an entry for key, put it in *e (whose output and errors
+// are from malloc, see compile_cache_entry_free) and return true,
+// otherwise return false
+bool compile_cache_lookup(compile_cache *c, const cache_key *key,
+			  cache_entry *e)
+{
+    char *path = entry_path(c, key);
+    if (path == NULL) {
+	return false;
+    }
+    int fd = open(path, O_RDONLY);
+    free(path);
+    if (fd < 0) {
+	return false;
+    }
+    // the output and errors are read into one buffer,
+    // each followed by a null char
+    char *buf = NULL;
+    entry_header h;
+    struct stat st;
+    bool found = fstat(fd, &st) == 0
+	&& read_all(fd, (char *) &h, sizeof(h))
+	&& memcmp(h.magic, CACHE_MAGIC, sizeof(h.magic)) == 0
+	&& h.key_hi == key->hi && h.key_lo == key->lo
+	// (an entry whose sizes do not add up is not used)
+	&& h.output_size <= (uint64_t) st.st_size
+	&& h.errors_size <= (uint64_t) st.st_size
+	&& sizeof(h) + h.output_size + h.errors_size == (uint64_t) st.st_size
+	&& (buf = (char *) malloc(h.output_size + h.errors_size + 2)) != NULL
+	&& read_all(fd, buf, h.output_size)
+	&& read_all(fd, buf + h.output_size + 1, h.errors_size);
+    if (found) {
+	// the entry has just been used (see compile_cache_store)
+	futimens(fd, NULL);
+	buf[h.output_size] = '\0';
+	buf[h.output_size + 1 + h.errors_size] = '\0';
+	e->status = (int) h.status;
+	e->output = buf;
+	e->output_size = h.output_size;
+	e->errors = buf + h.output_size + 1;
+	e->errors_size = h.errors_size;
+    } else {
+	free(buf);
+    }
+    close(fd);
+    return found;
+}
+
+// Free the storage of the entry *e (returned by compile_cache_lookup)
+void compile_cache_entry_free(cache_entry *e)
+{
+    // (the errors are in the same buffer as the output)
+    free(e->output);
+    e->output = e->errors = NULL;
+}
+
+// An entry file found when evicting
+typedef struct {
+    char *name;
+    struct timespec used; // when it was last used
+    size_t size;
+} entry_file;
+
+// Compare the entry files at a and b by when they were last used
+static int compare_used(const void *a, const void *b)
+{
+    const struct timespec *ta = &((const entry_file *) a)->used;
+    const struct timespec *tb = &((const entry_file *) b)->used;
+    if (ta->tv_sec != tb->tv_sec) {
+	return (ta->tv_sec < tb->tv_sec) ? -1 : 1;
+    }
+    return (ta->tv_nsec < tb->tv_nsec) ? -1 : (ta->tv_nsec > tb->tv_nsec);
+}
+
+// Return true if name ends with suffix
+static bool has_suffix(const char *name, const char *suffix)
+{
+    size_t n = strlen(name);
+    size_t s = strlen(suffix);
+    return n >= s && strcmp(name + n - s, suffix) == 0;
+}
+
+// Find the size of the entries in c's directory and,
+// if evict is true and they take more than c's limit,
+// remove the least recently used ones until they take at most
+// CACHE_LOW_WATER(c->limit) (and remove stale temporary files).
+// Record the size the entries then take in c->size.
+// (The caller must hold c->lock.)
+static void cache_scan(compile_cache *c, bool evict)
+{
+    DIR *d = opendir(c->dir);
+    if (d == NULL) {
+	return;
+    }
+    entry_file *files = NULL;
+    size_t count = 0, capacity = 0;
+    size_t size = 0;
+    time_t now = time(NULL);
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+	bool entry = has_suffix(de->d_name, COMPILE_CACHE_SUFFIX);
+	bool temp = strncmp(de->d_name, CACHE_TEMP_PREFIX,
+			    strlen(CACHE_TEMP_PREFIX)) == 0;
+	if (!entry && !temp) {
+	    continue;
+	}
+	char *path = cache_path(c, de->d_name);
+	struct stat st;
+	if (path == NULL || stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+	    free(path);
+	    continue;
+	}
+	if (temp) {
+	    if (evict && now - st.st_mtime > CACHE_STALE_TEMP_SECONDS) {
+		unlink(path);
+	    }
+	    free(path);
+	    continue;
+	}
+	size += (size_t) st.st_size;
+	if (evict) {
+	    if (count == capacity) {
+		capacity = (capacity == 0) ? 256 : 2 * capacity;
+		entry_file *more = (entry_file *)
+		    realloc(files, capacity * sizeof(entry_file));
+		if (more == NULL) {
+		    free(path);
+		    break;
+		}
+		files = more;
+	    }
+	    files[count].name = path;
+	    files[count].used = st.st_mtim;
+	    files[count].size = (size_t) st.st_size;
+	    count++;
+	} else {
+	    free(path);
+	}
+    }
+    closedir(d);
+
+    if (size > c->limit) {
+	qsort(files, count, sizeof(entry_file), compare_used);
+	for (size_t i = 0; i < count && size > CACHE_LOW_WATER(c->limit);
+	     i++) {
+	    // (another process may have removed it already)
+	    if (unlink(files[i].name) == 0 || errno == ENOENT) {
+		size -= files[i].size;
+	    }
+	}
+    }
+    for (size_t i = 0; i < count; i++) {
+	free(files[i].name);
+    }
+    free(files);
+    c->size = size;
+    c->scanned = true;
+}
+
+// Record *e as the entry for key in c (replacing any entry for key),
+// removing the least recently used entries if c is then over its limit.
+// (If the entry cannot be written, c is left as it was.)
+void compile_cache_store(compile_cache *c, const cache_key *key,
+			 const cache_entry *e)
+{
+    entry_header h;
+    memcpy(h.magic, CACHE_MAGIC, sizeof(h.magic));
+    h.key_hi = key->hi;
+    h.key_lo = key->lo;
+    h.status = e->status;
+    h.output_size = e->output_size;
+    h.errors_size = e->errors_size;
+
+    pthread_mutex_lock(&c->lock);
+    unsigned long temp_number = c->temps++;
+    pthread_mutex_unlock(&c->lock);
+    char temp_name[64];
+    snprintf(temp_name, sizeof(temp_name), CACHE_TEMP_PREFIX "%ld.%lu",
+	     (long) getpid(), temp_number);
+    char *temp = cache_path(c, temp_name);
+    char *path = entry_path(c, key);
+    int fd = (temp == NULL || path == NULL) ? -1
+	: open(temp, O_WRONLY | O_CREAT | O_EXCL, 0666);
+    bool written = fd >= 0
+	&& write_all(fd, (const char *) &h, sizeof(h))
+	&& write_all(fd, e->output, e->output_size)
+	&& write_all(fd, e->errors, e->errors_size);
+    if (fd >= 0) {
+	written = (close(fd) == 0) && written;
+	if (!written || rename(temp, path) != 0) {
+	    unlink(temp);
+	    written = false;
+	}
+    }
+    free(temp);
+    free(path);
+    if (!written) {
+	return;
+    }
+
+    pthread_mutex_lock(&c->lock);
+    if (c->scanned) {
+	c->size += sizeof(h) + e->output_size + e->errors_size;
+    } else {
+	// (this counts the new entry)
+	cache_scan(c, false);
+    }
+    if (c->size > c->limit) {
+	cache_scan(c, true);
+    }
+    pthread_mutex_unlock(&c->lock);
+}
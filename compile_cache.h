@@ -0,0 +1,78 @@
+#ifndef _COMPILE_CACHE_H
+#define _COMPILE_CACHE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// The compile cache keeps the results of compilations (the output,
+// the errors and the status) in files in a directory, keyed by a hash
+// of everything the result depends on (see compile.c), so compiling
+// an unchanged file again just copies its result from the cache.
+// Each entry is written to a temporary file that is then renamed,
+// so readers (in any process) never see a partly written entry.
+// The cache's size is bounded: when the entries would take more than
+// its limit, the least recently used ones are removed (an entry's
+// modification time is set whenever it is used).
+// Several threads (and processes) may use the same cache at once.
+
+// The suffix of the names of the cache's entry files
+#define COMPILE_CACHE_SUFFIX ".splc"
+
+// The default limit on the size of a cache (in bytes)
+#define COMPILE_CACHE_DEFAULT_LIMIT ((size_t) 256 * 1024 * 1024)
+
+// A cache key: a 128 bit hash (FNV-1a) of the bytes added to it
+typedef struct {
+    uint64_t hi, lo;
+} cache_key;
+
+// The result of a compilation, as kept in the cache
+typedef struct {
+    int status;
+    char *output;
+    size_t output_size;
+    char *errors;
+    size_t errors_size;
+} cache_entry;
+
+// A cache (its contents are private to compile_cache.c)
+typedef struct compile_cache_s compile_cache;
+
+// Start key, with nothing added to it
+extern void cache_key_init(cache_key *key);
+
+// Add the n bytes at p to key
+extern void cache_key_add(cache_key *key, const void *p, size_t n);
+
+// Requires: dir != NULL
+// Return the cache kept in the directory named dir (creating it if need be)
+// whose entries may take at most limit bytes.
+// The compiler's version is found, as a hash of the program's build ID
+// (or of its file), so entries made by another build are never used.
+// If the directory cannot be made, bail with an error message.
+extern compile_cache *compile_cache_open(const char *dir, size_t limit);
+
+// Start key for an entry of c: with the compiler's version
+// (see compile_cache_open) added to it
+extern void compile_cache_key_init(const compile_cache *c, cache_key *key);
+
+// Release c (its entries stay in its directory)
+extern void compile_cache_close(compile_cache *c);
+
+// If c has an entry for key, put it in *e (whose output and errors
+// are from malloc, see compile_cache_entry_free) and return true,
+// otherwise return false
+extern bool compile_cache_lookup(compile_cache *c, const cache_key *key,
+				 cache_entry *e);
+
+// Free the storage of the entry *e (returned by compile_cache_lookup)
+extern void compile_cache_entry_free(cache_entry *e);
+
+// Record *e as the entry for key in c (replacing any entry for key),
+// removing the least recently used entries if c is then over its limit.
+// (If the entry cannot be written, c is left as it was.)
+extern void compile_cache_store(compile_cache *c, const cache_key *key,
+				const cache_entry *e);
+
+#endif
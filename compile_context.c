@@ -0,0 +1,74 @@
+#include <stdlib.h>
+#include "compile_context.h"
+#include "utilities.h"
+
+struct compile_context_s {
+    arena *arena;
+    intern_table *names;
+    file_registry *files;
+    resolution_table *resolutions;
+    lexer *lexer;
+};
+
+// the context this thread works in (NULL for the default context)
+static _Thread_local compile_context *current = NULL;
+
+// Return a new compilation context, with nothing in it
+compile_context *compile_context_create()
+{
+    compile_context *ctx = (compile_context *) malloc(sizeof(compile_context));
+    if (ctx == NULL) {
+	bail_with_error("No space for a compilation context!");
+    }
+    ctx->arena = arena_create();
+    ctx->names = intern_table_create();
+    ctx->files = file_registry_create();
+    ctx->resolutions = resolution_table_create();
+    ctx->lexer = lexer_create();
+    return ctx;
+}
+
+// Requires: no other thread is in ctx
+// Release ctx and all that is in it
+// (if this thread is in ctx, it goes back to the default context)
+void compile_context_destroy(compile_context *ctx)
+{
+    if (current == ctx) {
+	compile_context_enter(NULL);
+    }
+    lexer_destroy(ctx->lexer);
+    resolution_table_destroy(ctx->resolutions);
+    file_registry_destroy(ctx->files);
+    intern_table_destroy(ctx->names);
+    arena_destroy(ctx->arena);
+    free(ctx);
+}
+
+// Make this thread work in the context ctx
+// (or in the default context, if ctx is NULL)
+void compile_context_enter(compile_context *ctx)
+{
+    if (ctx == current) {
+	return;
+    }
+    if (ctx == NULL) {
+	arena_use(NULL);
+	intern_table_use(NULL);
+	file_registry_use(NULL);
+	resolution_table_use(NULL);
+	lexer_use(NULL);
+    } else {
+	arena_use(ctx->arena);
+	intern_table_use(ctx->names);
+	file_registry_use(ctx->files);
+	resolution_table_use(ctx->resolutions);
+	lexer_use(ctx->lexer);
+    }
+    current = ctx;
+}
+
+// Return the context this thread works in (NULL for the default context)
+compile_context *compile_context_current()
+{
+    return current;
+}
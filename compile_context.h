@@ -0,0 +1,40 @@
+#ifndef _COMPILE_CONTEXT_H
+#define _COMPILE_CONTEXT_H
+
+#include "arena.h"
+#include "intern.h"
+#include "file_location.h"
+#include "resolution.h"
+#include "lexer.h"
+
+// A compilation context holds all the state of one compilation
+// that is not local to a function: the arena its ASTs are allocated in,
+// the table of interned names, the registry of source files,
+// the resolution table, and the lexer (with the flex scanner
+// and the bison parser being reentrant).
+// A thread works in a context after entering it,
+// and the modules' functions then use that context's instances,
+// so several threads can each compile a different program at once.
+// (Each thread's symbol table is already its own, see symtab.h.)
+// A thread that has not entered a context works in the default one,
+// which is all the modules' default instances.
+
+// A compilation context (its contents are private to compile_context.c)
+typedef struct compile_context_s compile_context;
+
+// Return a new compilation context, with nothing in it
+extern compile_context *compile_context_create();
+
+// Requires: no other thread is in ctx
+// Release ctx and all that is in it
+// (if this thread is in ctx, it goes back to the default context)
+extern void compile_context_destroy(compile_context *ctx);
+
+// Make this thread work in the context ctx
+// (or in the default context, if ctx is NULL)
+extern void compile_context_enter(compile_context *ctx);
+
+// Return the context this thread works in (NULL for the default context)
+extern compile_context *compile_context_current();
+
+#endif
@@ -1,47 +1,197 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "compile.h"
+#include "serve.h"
 #include "parser.h"
-#include "lexer.h"
-#include "ast.h"
-#include "symtab.h"
 #include "scope_check.h"
-#include "utilities.h"
 #include "unparser.h"
+#include "phase_stats.h"
 
 /* Print a usage message on stderr 
    and exit with failure. */
 static void usage(const char *cmdname)
 {
     fprintf(stderr,
-	    "Usage: %s file.spl\n",
-	    cmdname);
+	    "Usage: %s [--flat] [--lazy] [--threads N [--parallel-parse]]\n"
+	    "       [--phases=P,...] [--no-unparse]\n"
+	    "       [--stats[=json]] [--cache-dir dir [--cache-size MB]]\n"
+	    "       [--emit-ast=file.splast] file.spl ...\n"
+	    "   or: %s [options] --load-ast=file.splast\n"
+	    "   or: %s [options] --serve socket\n"
+	    "where the phases P are lex, parse, unparse and check\n"
+	    "(by default parse,unparse,check; unparse and check imply parse)\n"
+	    "With several files, they are compiled N at once (with --threads N),\n"
+	    "and their outputs are printed in order (--stats is not allowed);\n"
+	    "with --serve, compile requests are served on the Unix domain\n"
+	    "socket (N at once, see serve.h);\n"
+	    "with --cache-dir, results are kept in (and reused from)\n"
+	    "a cache in dir, of at most MB megabytes (see compile_cache.h);\n"
+	    "with --emit-ast, the (one) file's AST is also written\n"
+	    "to file.splast, and with --load-ast, the AST in file.splast\n"
+	    "is unparsed and checked, instead of parsing a file (see ast_file.h);\n"
+	    "with --lazy, procedure bodies are only parsed when a phase needs them\n"
+	    "(so syntax errors in them are reported then, see lexer_set_lazy),\n"
+	    "and with --parallel-parse, the (one) file's procedure bodies\n"
+	    "are parsed by N threads (see tryParseProgramParallel)\n",
+	    cmdname, cmdname, cmdname);
     exit(EXIT_FAILURE);
 }
 
+// Return the set of phases (a bit for each compiler_phase) named
+// in the comma-separated list, or call usage if one is not a phase
+static unsigned int parse_phases(const char *cmdname, const char *list)
+{
+    unsigned int phases = 0;
+    const char *name = list;
+    while (true) {
+	size_t len = strcspn(name, ",");
+	compiler_phase p;
+	if (!phase_lookup(name, len, &p)) {
+	    usage(cmdname);
+	}
+	phases |= 1u << p;
+	if (name[len] == '\0') {
+	    return phases;
+	}
+	name += len + 1;
+    }
+}
+
 int main(int argc, char *argv[])
 {
     const char *cmdname = argv[0];
     --argc;
-    /* 1 non-option argument */
-    if (argc != 1 || argv[1][0] == '-') {
+    argv++;
+    // with --flat, use the flat AST layout (see flat_ast.h)
+    bool flat = false;
+    // with --lazy, skip the procedures' bodies when parsing,
+    // parsing each when it is needed
+    bool lazy = false;
+    // with --threads N, unparse and scope check using N threads
+    // (or compile N files at once, if there are several)
+    unsigned int threads = 1;
+    // with --parallel-parse, also parse using those threads
+    bool parallel_parse = false;
+    // the phases to run, a bit for each compiler_phase
+    unsigned int phases
+	= (1u << phase_parse) | (1u << phase_unparse) | (1u << phase_check);
+    // with --stats, print statistics on the phases on stderr
+    // (as JSON with --stats=json)
+    bool stats = false;
+    bool stats_json = false;
+    // with --serve socket, serve compile requests on that socket
+    const char *socket_path = NULL;
+    // with --cache-dir dir, keep the results in a cache in dir
+    // (of at most --cache-size megabytes)
+    const char *cache_dir = NULL;
+    size_t cache_limit = COMPILE_CACHE_DEFAULT_LIMIT;
+    // with --emit-ast=file, write the AST to that file, and
+    // with --load-ast=file, compile the AST in that file
+    const char *emit_ast = NULL;
+    char *load_ast = NULL;
+    while (argc > 0 && argv[0][0] == '-') {
+	if (strcmp(argv[0], "--flat") == 0) {
+	    flat = true;
+	} else if (strcmp(argv[0], "--lazy") == 0) {
+	    lazy = true;
+	} else if (strcmp(argv[0], "--parallel-parse") == 0) {
+	    parallel_parse = true;
+	} else if (strcmp(argv[0], "--threads") == 0 && argc > 1) {
+	    int n = atoi(argv[1]);
+	    if (n <= 0) {
+		usage(cmdname);
+	    }
+	    threads = (unsigned int) n;
+	    --argc;
+	    argv++;
+	} else if (strncmp(argv[0], "--phases=", 9) == 0) {
+	    phases = parse_phases(cmdname, argv[0] + 9);
+	} else if (strcmp(argv[0], "--no-unparse") == 0) {
+	    phases &= ~(1u << phase_unparse);
+	} else if (strcmp(argv[0], "--serve") == 0 && argc > 1) {
+	    socket_path = argv[1];
+	    --argc;
+	    argv++;
+	} else if (strcmp(argv[0], "--cache-dir") == 0 && argc > 1) {
+	    cache_dir = argv[1];
+	    --argc;
+	    argv++;
+	} else if (strcmp(argv[0], "--cache-size") == 0 && argc > 1) {
+	    int mb = atoi(argv[1]);
+	    if (mb <= 0) {
+		usage(cmdname);
+	    }
+	    cache_limit = (size_t) mb * 1024 * 1024;
+	    --argc;
+	    argv++;
+	} else if (strncmp(argv[0], "--emit-ast=", 11) == 0
+		   && argv[0][11] != '\0') {
+	    emit_ast = argv[0] + 11;
+	} else if (strncmp(argv[0], "--load-ast=", 11) == 0
+		   && argv[0][11] != '\0') {
+	    load_ast = argv[0] + 11;
+	} else if (strcmp(argv[0], "--stats") == 0) {
+	    stats = true;
+	} else if (strcmp(argv[0], "--stats=json") == 0) {
+	    stats = true;
+	    stats_json = true;
+	} else {
 	    usage(cmdname);
+	}
+	--argc;
+	argv++;
     }
+    /* 1 or more non-option arguments (or none, with --serve or --load-ast) */
+    if ((socket_path == NULL && load_ast == NULL) ? argc < 1 : argc > 0) {
+	usage(cmdname);
+    }
+    // (the server and --load-ast compile no files of their own,
+    // and only one file's AST can be written)
+    if ((socket_path != NULL && (load_ast != NULL || emit_ast != NULL))
+	|| (argc > 1 && emit_ast != NULL)) {
+	usage(cmdname);
+    }
+    for (int i = 0; i < argc; i++) {
+	if (argv[i][0] == '-') {
+	    usage(cmdname);
+	}
+    }
+    // (the statistics of files compiled at once would be mixed up)
+    if (argc > 1 && stats) {
+	usage(cmdname);
+    }
+    // the AST is needed to unparse or check it
+    if (phases & ((1u << phase_unparse) | (1u << phase_check))) {
+	phases |= 1u << phase_parse;
+    }
+    compile_cache *cache
+	= (cache_dir != NULL) ? compile_cache_open(cache_dir, cache_limit) : NULL;
+    compile_options opts
+	= { flat, lazy, parallel_parse, phases, stats, stats_json, cache,
+	    emit_ast };
 
-    lexer_init(argv[1]);
-
-    // parsing
-    block_t progast = parseProgram(argv[1]);
-
-    // unparse to check on the AST
-    unparseProgram(stdout, progast);
-
-    // comment out the next two commands to disable declaration checking
-
-    // building symbol table
-    symtab_initialize();
-
-    // check for duplicate declarations
-    scope_check_program(progast);
-
-    return EXIT_SUCCESS;
+    int status;
+    if (socket_path != NULL) {
+	status = serve_run(socket_path, &opts, threads);
+    } else if (load_ast != NULL) {
+	unparseSetThreads(threads);
+	scope_check_set_threads(threads);
+	status = compile_ast_file(load_ast, &opts, stdout, stderr);
+    } else if (argc == 1) {
+	parseSetThreads(threads);
+	unparseSetThreads(threads);
+	scope_check_set_threads(threads);
+	status = compile_file(argv[0], &opts, stdout, stderr);
+    } else {
+	// each file is unparsed and checked by one thread,
+	// and threads files are compiled at once
+	status = compile_files(argv, (unsigned int) argc, &opts, threads);
+    }
+    if (cache != NULL) {
+	compile_cache_close(cache);
+    }
+    compile_thread_release();
+    return status;
 }
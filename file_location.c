@@ -1,34 +1,243 @@
 /* $Id: file_location.c,v 1.3 2023/10/19 06:14:57 leavens Exp $ */
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <stddef.h>
+#include <limits.h>
+#include <stdbool.h>
 #include "file_location.h"
 #include "utilities.h"
 
-// Requires: filename != NULL
-// Return a (pointer to a) fresh file_location with the given
-// information
-file_location *file_location_make(const char *filename,
-					 unsigned int line)
+// a registered source file and its line table
+typedef struct {
+    const char *filename;
+    source_loc base; // location of the file's first character
+    size_t length; // number of characters in the file
+    // line_starts[i] is the offset of the first character of line i+1
+    const unsigned int *line_starts;
+    unsigned int line_count;
+    bool owns_lines; // was line_starts allocated by file_location_register?
+} source_file;
+
+// A registry: the registered files, in order of registration
+// (so of their bases), and the location that will be given
+// to the next file's first character
+struct file_registry_s {
+    source_file *files;
+    unsigned int file_count;
+    unsigned int file_capacity;
+    source_loc next_base;
+};
+
+// the registry used by threads that have not chosen another
+static file_registry default_registry = { NULL, 0, 0, NO_SOURCE_LOC + 1 };
+
+// the registry this thread registers and locates files in
+static _Thread_local file_registry *current = &default_registry;
+
+// Requires: text points to len characters
+// Return a freshly allocated table of the offsets at which
+// the lines of text start, setting *count to the number of lines
+static unsigned int *line_table(const char *text, size_t len,
+				unsigned int *count)
 {
-    file_location *ret = (file_location *) malloc(sizeof(file_location));
-    if (ret == NULL) {
-	bail_with_error("Could not allocate space for a file_location!");
+    unsigned int capacity = 1024;
+    unsigned int n = 0;
+    unsigned int *starts = (unsigned int *) malloc(capacity * sizeof(unsigned int));
+    const char *p = text;
+    const char *end = text + len;
+    for (;;) {
+	if (starts == NULL) {
+	    bail_with_error("No space for a line table!");
+	}
+	if (n == capacity) {
+	    capacity *= 2;
+	    starts = (unsigned int *) realloc(starts, capacity * sizeof(unsigned int));
+	    continue;
+	}
+	starts[n++] = (unsigned int) (p - text);
+	const char *nl = (const char *) memchr(p, '\n', end - p);
+	if (nl == NULL) {
+	    break;
+	}
+	p = nl + 1;
     }
-    ret->filename = filename;
-    ret->line = line;
-    return ret;
+    *count = n;
+    return starts;
+}
+
+// Add the file described by lines (except for its base)
+// to this thread's registry, giving it the next base,
+// and return it (with owns_lines false),
+// or return NULL if there are too many source_locs for it
+static source_file *register_file(const file_lines *lines)
+{
+    file_registry *r = current;
+    if (lines->length >= (size_t) (UINT_MAX - r->next_base)) {
+	return NULL;
+    }
+    if (r->file_count == r->file_capacity) {
+	r->file_capacity = (r->file_capacity == 0) ? 8 : 2 * r->file_capacity;
+	r->files = (source_file *) realloc(r->files, r->file_capacity * sizeof(source_file));
+	if (r->files == NULL) {
+	    bail_with_error("No space to register %s!", lines->filename);
+	}
+    }
+    source_file *f = &r->files[r->file_count++];
+    f->filename = lines->filename;
+    f->base = r->next_base;
+    f->length = lines->length;
+    f->line_starts = lines->line_starts;
+    f->line_count = lines->line_count;
+    f->owns_lines = false;
+    // the end of the file also has a location
+    r->next_base += (source_loc) lines->length + 1;
+    return f;
+}
+
+// Requires: filename != NULL and text points to len characters
+// Register a source file with the given name and text,
+// recording where each of its lines starts, and
+// return the source_loc of the file's first character.
+// The locations of the file's characters (and of its end) are
+// consecutive from there, so the location of text[i] is the result + i.
+// If the file's locations would not fit in a source_loc,
+// bail with "Too much source text to locate" the file.
+source_loc file_location_register(const char *filename,
+				  const char *text, size_t len)
+{
+    assert(filename != NULL);
+    file_lines lines;
+    lines.filename = filename;
+    lines.length = len;
+    unsigned int *starts = line_table(text, len, &lines.line_count);
+    lines.line_starts = starts;
+    source_file *f = register_file(&lines);
+    if (f == NULL) {
+	free(starts);
+	bail_with_error("Too much source text to locate %s!", filename);
+    }
+    f->owns_lines = true;
+    return f->base;
+}
+
+// Requires: lines->filename != NULL, lines->line_count > 0,
+//           lines->line_starts[0] == 0, and the line starts are
+//           increasing and at most lines->length
+// Register a source file with the given name, length and line table
+// (without its text), as file_location_register would,
+// and return the source_loc of the file's first character.
+// The name and line table are not copied, so they must stay valid
+// until the registered files are forgotten.
+source_loc file_location_register_lines(const file_lines *lines)
+{
+    assert(lines->filename != NULL && lines->line_count > 0);
+    source_file *f = register_file(lines);
+    if (f == NULL) {
+	bail_with_error("Too much source text to locate %s!", lines->filename);
+    }
+    return f->base;
+}
+
+// Return the number of registered files
+unsigned int file_location_file_count()
+{
+    return current->file_count;
 }
 
-// Requires: fl != NULL
-// Return a (pointer to a) fresh copy of fl
-file_location *file_location_copy(file_location *fl)
+// Requires: i < file_location_file_count()
+// Put the line table of the i-th registered file into *lines
+void file_location_file(unsigned int i, file_lines *lines)
 {
-    file_location *ret = (file_location *) malloc(sizeof(file_location));
-    if (ret == NULL) {
-	bail_with_error("Could not allocate space for a file_location!");
+    assert(i < current->file_count);
+    const source_file *f = &current->files[i];
+    lines->filename = f->filename;
+    lines->base = f->base;
+    lines->length = f->length;
+    lines->line_starts = f->line_starts;
+    lines->line_count = f->line_count;
+}
+
+// Requires: loc is a location in a registered file
+// Return the file name and line number of the location loc
+file_location file_location_of(source_loc loc)
+{
+    file_location ret = { NULL, 0 };
+    const source_file *files = current->files;
+    // find the last file whose base is not after loc
+    unsigned int lo = 0, hi = current->file_count;
+    while (lo < hi) {
+	unsigned int mid = lo + (hi - lo) / 2;
+	if (files[mid].base <= loc) {
+	    lo = mid + 1;
+	} else {
+	    hi = mid;
+	}
+    }
+    if (lo == 0) {
+	return ret;
     }
-    ret->filename = fl->filename;
-    ret->line = fl->line;
+    const source_file *f = &files[lo - 1];
+    unsigned int offset = loc - f->base;
+    assert(offset <= f->length);
+    // find the last line that starts at or before offset
+    lo = 0;
+    hi = f->line_count;
+    while (lo < hi) {
+	unsigned int mid = lo + (hi - lo) / 2;
+	if (f->line_starts[mid] <= offset) {
+	    lo = mid + 1;
+	} else {
+	    hi = mid;
+	}
+    }
+    ret.filename = f->filename;
+    ret.line = lo;
     return ret;
 }
+
+// Forget all the registered files
+// (so every source_loc made so far is invalid)
+void file_location_reset()
+{
+    for (unsigned int i = 0; i < current->file_count; i++) {
+	if (current->files[i].owns_lines) {
+	    free((unsigned int *) current->files[i].line_starts);
+	}
+    }
+    current->file_count = 0;
+    current->next_base = NO_SOURCE_LOC + 1;
+}
+
+// Return a new registry, with no files registered
+file_registry *file_registry_create()
+{
+    file_registry *r = (file_registry *) malloc(sizeof(file_registry));
+    if (r == NULL) {
+	bail_with_error("No space for a file registry!");
+    }
+    r->files = NULL;
+    r->file_count = 0;
+    r->file_capacity = 0;
+    r->next_base = NO_SOURCE_LOC + 1;
+    return r;
+}
+
+// Release the registry r
+// (if this thread is using r, it goes back to the default registry)
+void file_registry_destroy(file_registry *r)
+{
+    file_registry *saved = current;
+    current = r;
+    file_location_reset();
+    current = (saved == r) ? &default_registry : saved;
+    free(r->files);
+    free(r);
+}
+
+// Make this thread register and locate files in the registry r
+// (or in the default registry, if r is NULL)
+void file_registry_use(file_registry *r)
+{
+    current = (r != NULL) ? r : &default_registry;
+}
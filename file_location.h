@@ -1,6 +1,7 @@
 /* $Id: file_location.h,v 1.2 2023/10/13 12:15:32 leavens Exp $ */
 #ifndef _FILE_LOCATION_H
 #define _FILE_LOCATION_H
+#include <stddef.h>
 
 // location in a source file (useful for error messages)
 typedef struct {
@@ -8,14 +9,89 @@ typedef struct {
     unsigned int line; // of first token
 } file_location;
 
-// Requires: filename != NULL
-// Return a (pointer to a) fresh file_location with the given
-// information
-extern file_location *file_location_make(const char *filename,
-					 unsigned int line);
+// a compact location in a source file, which fits in 32 bits
+// so it can be stored in each AST node:
+// the offset of a character in the text of all the registered
+// source files (laid end to end), plus 1.
+// Use file_location_of to find the file name and line number.
+// So all the source text registered at once (which is that of one
+// compilation, as the files are forgotten after each) must be
+// under 4 GiB: registering more is reported as an error.
+typedef unsigned int source_loc;
 
-// Requires: fl != NULL
-// Return a (pointer to a) fresh copy of fl
-extern file_location *file_location_copy(file_location *fl);
+// the source_loc used when there is no location
+#define NO_SOURCE_LOC 0
+
+// a span of text in a source file:
+// the length characters starting offset characters into the file
+typedef struct {
+    unsigned int offset;
+    unsigned int length;
+} source_span;
+
+// Requires: filename != NULL and text points to len characters
+// Register a source file with the given name and text,
+// recording where each of its lines starts, and
+// return the source_loc of the file's first character.
+// The locations of the file's characters (and of its end) are
+// consecutive from there, so the location of text[i] is the result + i.
+// If the file's locations would not fit in a source_loc,
+// bail with "Too much source text to locate" the file.
+extern source_loc file_location_register(const char *filename,
+					 const char *text, size_t len);
+
+// a registered source file's line table
+typedef struct {
+    const char *filename;
+    source_loc base; // location of the file's first character
+    size_t length; // number of characters in the file
+    // line_starts[i] is the offset of the first character of line i+1
+    const unsigned int *line_starts;
+    unsigned int line_count;
+} file_lines;
+
+// Requires: lines->filename != NULL, lines->line_count > 0,
+//           lines->line_starts[0] == 0, and the line starts are
+//           increasing and at most lines->length
+// Register a source file with the given name, length and line table
+// (without its text), as file_location_register would,
+// and return the source_loc of the file's first character.
+// The name and line table are not copied, so they must stay valid
+// until the registered files are forgotten.
+extern source_loc file_location_register_lines(const file_lines *lines);
+
+// Return the number of registered files
+extern unsigned int file_location_file_count();
+
+// Requires: i < file_location_file_count()
+// Put the line table of the i-th registered file into *lines
+extern void file_location_file(unsigned int i, file_lines *lines);
+
+// Requires: loc is a location in a registered file
+// Return the file name and line number of the location loc
+extern file_location file_location_of(source_loc loc);
+
+// Forget all the registered files
+// (so every source_loc made so far is invalid)
+extern void file_location_reset();
+
+// Files are registered in a registry: each thread uses the default
+// registry, unless it has chosen another with file_registry_use
+// (as each compilation under way does, see compile_context.h),
+// and the functions above work on the registry the thread is using.
+
+// A registry of source files (its contents are private to file_location.c)
+typedef struct file_registry_s file_registry;
+
+// Return a new registry, with no files registered
+extern file_registry *file_registry_create();
+
+// Release the registry r
+// (if this thread is using r, it goes back to the default registry)
+extern void file_registry_destroy(file_registry *r);
+
+// Make this thread register and locate files in the registry r
+// (or in the default registry, if r is NULL)
+extern void file_registry_use(file_registry *r);
 
 #endif
@@ -0,0 +1,89 @@
+// Test of the limit on the source text that can be located:
+// registers files (by their line tables, so without any text)
+// whose locations reach the last source_loc, and checks that
+// they are located and that registering any more text is reported
+// as an error (leaving the registered files as they were).
+// Prints one line per check and exits with a failure code
+// if anything is wrong.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <setjmp.h>
+#include <stdbool.h>
+#include "file_location.h"
+#include "utilities.h"
+
+// the one line start of each (one line) file
+static const unsigned int first_line[1] = { 0 };
+
+// has a check failed?
+static bool failed = false;
+
+// Print what was checked, and whether ok says it passed
+static void report(const char *what, bool ok)
+{
+    printf("%s: %s\n", what, ok ? "ok" : "FAILED");
+    if (!ok) {
+	failed = true;
+    }
+}
+
+// Register a one line file named filename with length characters,
+// returning true and setting *base to its first location,
+// or returning false if that is reported as an error,
+// with the message in msg (which has room for ERROR_MESSAGE_SIZE chars)
+static bool try_register(const char *filename, size_t length,
+			 source_loc *base, char *msg)
+{
+    file_lines lines;
+    lines.filename = filename;
+    lines.length = length;
+    lines.line_starts = first_line;
+    lines.line_count = 1;
+    error_trap trap;
+    if (setjmp(trap.env) != 0) {
+	strcpy(msg, trap.message);
+	return false;
+    }
+    error_trap_push(&trap);
+    *base = file_location_register_lines(&lines);
+    error_trap_pop(&trap);
+    return true;
+}
+
+int main()
+{
+    char msg[ERROR_MESSAGE_SIZE];
+    source_loc base;
+
+    // the largest file there is room for ends at the last location
+    // (the one before UINT_MAX, which would make the next base wrap)
+    bool ok = try_register("big.spl", UINT_MAX - 2, &base, msg);
+    report("largest file registered", ok && base == NO_SOURCE_LOC + 1);
+    file_location end = file_location_of(UINT_MAX - 1);
+    report("end of largest file located",
+	   end.filename != NULL && strcmp(end.filename, "big.spl") == 0
+	   && end.line == 1);
+
+    // not even an empty file fits after it
+    ok = try_register("empty.spl", 0, &base, msg);
+    report("no room after largest file",
+	   !ok && strcmp(msg, "Too much source text to locate empty.spl!") == 0);
+    report("registered files unchanged", file_location_file_count() == 1);
+
+    // a file one character too long does not fit on its own
+    file_location_reset();
+    ok = try_register("too_big.spl", UINT_MAX - 1, &base, msg);
+    report("file one character too long",
+	   !ok
+	   && strcmp(msg, "Too much source text to locate too_big.spl!") == 0);
+
+    // and files still fit after that
+    ok = try_register("small.spl", 10, &base, msg);
+    report("small file registered after error",
+	   ok && base == NO_SOURCE_LOC + 1 && file_location_file_count() == 1);
+    file_location_reset();
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
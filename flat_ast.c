@@ -0,0 +1,763 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include "flat_ast.h"
+#include "scope.h"
+#include "utilities.h"
+#include "spl.tab.h"
+
+// initial number of nodes of each kind there is room for
+#define INITIAL_FLAT_CAPACITY 16
+
+// Requires: p is NULL or was returned by malloc or realloc
+// Return p resized to hold capacity elements of elem_size bytes each,
+// bailing if there is no space
+static void *flat_resize(void *p, uint32_t capacity, size_t elem_size)
+{
+    void *ret = realloc(p, (size_t) capacity * elem_size);
+    if (ret == NULL) {
+	bail_with_error("No space for %u AST nodes!", capacity);
+    }
+    return ret;
+}
+
+// Resize the array field to hold capacity elements
+#define FLAT_RESIZE(field, capacity) \
+    ((field) = flat_resize((field), (capacity), sizeof(*(field))))
+
+// Return the new capacity of an array that has capacity elements
+// and needs room for at least needed elements
+static uint32_t flat_new_capacity(uint32_t capacity, uint32_t needed)
+{
+    if (needed >= FLAT_NONE) {
+	bail_with_error("Too many AST nodes of one kind!");
+    }
+    if (capacity == 0) {
+	capacity = INITIAL_FLAT_CAPACITY;
+    }
+    while (capacity < needed) {
+	capacity = (capacity > FLAT_NONE / 2) ? FLAT_NONE : 2 * capacity;
+    }
+    return capacity;
+}
+
+// The following functions each add n nodes of one kind to fa
+// (with their fields uninitialized)
+// and return the index of the first of them.
+
+static flat_index blocks_add(flat_ast *fa, uint32_t n)
+{
+    flat_blocks *t = &fa->blocks;
+    if (t->count + n > t->capacity) {
+	t->capacity = flat_new_capacity(t->capacity, t->count + n);
+	FLAT_RESIZE(t->loc, t->capacity);
+	FLAT_RESIZE(t->const_decls, t->capacity);
+	FLAT_RESIZE(t->var_decls, t->capacity);
+	FLAT_RESIZE(t->proc_decls, t->capacity);
+	FLAT_RESIZE(t->stmts, t->capacity);
+    }
+    flat_index ret = t->count;
+    t->count += n;
+    return ret;
+}
+
+static flat_index const_decls_add(flat_ast *fa, uint32_t n)
+{
+    flat_const_decls *t = &fa->const_decls;
+    if (t->count + n > t->capacity) {
+	t->capacity = flat_new_capacity(t->capacity, t->count + n);
+	FLAT_RESIZE(t->loc, t->capacity);
+	FLAT_RESIZE(t->defs, t->capacity);
+    }
+    flat_index ret = t->count;
+    t->count += n;
+    return ret;
+}
+
+static flat_index const_defs_add(flat_ast *fa, uint32_t n)
+{
+    flat_const_defs *t = &fa->const_defs;
+    if (t->count + n > t->capacity) {
+	t->capacity = flat_new_capacity(t->capacity, t->count + n);
+	FLAT_RESIZE(t->loc, t->capacity);
+	FLAT_RESIZE(t->name, t->capacity);
+	FLAT_RESIZE(t->value, t->capacity);
+    }
+    flat_index ret = t->count;
+    t->count += n;
+    return ret;
+}
+
+static flat_index var_decls_add(flat_ast *fa, uint32_t n)
+{
+    flat_var_decls *t = &fa->var_decls;
+    if (t->count + n > t->capacity) {
+	t->capacity = flat_new_capacity(t->capacity, t->count + n);
+	FLAT_RESIZE(t->loc, t->capacity);
+	FLAT_RESIZE(t->idents, t->capacity);
+    }
+    flat_index ret = t->count;
+    t->count += n;
+    return ret;
+}
+
+static flat_index idents_add(flat_ast *fa, uint32_t n)
+{
+    flat_idents *t = &fa->idents;
+    if (t->count + n > t->capacity) {
+	t->capacity = flat_new_capacity(t->capacity, t->count + n);
+	FLAT_RESIZE(t->loc, t->capacity);
+	FLAT_RESIZE(t->name, t->capacity);
+    }
+    flat_index ret = t->count;
+    t->count += n;
+    return ret;
+}
+
+static flat_index proc_decls_add(flat_ast *fa, uint32_t n)
+{
+    flat_proc_decls *t = &fa->proc_decls;
+    if (t->count + n > t->capacity) {
+	t->capacity = flat_new_capacity(t->capacity, t->count + n);
+	FLAT_RESIZE(t->loc, t->capacity);
+	FLAT_RESIZE(t->name, t->capacity);
+	FLAT_RESIZE(t->block, t->capacity);
+    }
+    flat_index ret = t->count;
+    t->count += n;
+    return ret;
+}
+
+static flat_index stmts_add(flat_ast *fa, uint32_t n)
+{
+    flat_stmts *t = &fa->stmts;
+    if (t->count + n > t->capacity) {
+	t->capacity = flat_new_capacity(t->capacity, t->count + n);
+	FLAT_RESIZE(t->kind, t->capacity);
+	FLAT_RESIZE(t->loc, t->capacity);
+	FLAT_RESIZE(t->a, t->capacity);
+	FLAT_RESIZE(t->b, t->capacity);
+	FLAT_RESIZE(t->c, t->capacity);
+	FLAT_RESIZE(t->binding, t->capacity);
+    }
+    flat_index ret = t->count;
+    t->count += n;
+    return ret;
+}
+
+static flat_index stmt_lists_add(flat_ast *fa, uint32_t n)
+{
+    flat_stmt_lists *t = &fa->stmt_lists;
+    if (t->count + n > t->capacity) {
+	t->capacity = flat_new_capacity(t->capacity, t->count + n);
+	FLAT_RESIZE(t->stmts, t->capacity);
+    }
+    flat_index ret = t->count;
+    t->count += n;
+    return ret;
+}
+
+static flat_index conditions_add(flat_ast *fa, uint32_t n)
+{
+    flat_conditions *t = &fa->conditions;
+    if (t->count + n > t->capacity) {
+	t->capacity = flat_new_capacity(t->capacity, t->count + n);
+	FLAT_RESIZE(t->kind, t->capacity);
+	FLAT_RESIZE(t->op, t->capacity);
+	FLAT_RESIZE(t->loc, t->capacity);
+	FLAT_RESIZE(t->a, t->capacity);
+	FLAT_RESIZE(t->b, t->capacity);
+    }
+    flat_index ret = t->count;
+    t->count += n;
+    return ret;
+}
+
+static flat_index exprs_add(flat_ast *fa, uint32_t n)
+{
+    flat_exprs *t = &fa->exprs;
+    if (t->count + n > t->capacity) {
+	t->capacity = flat_new_capacity(t->capacity, t->count + n);
+	FLAT_RESIZE(t->kind, t->capacity);
+	FLAT_RESIZE(t->op, t->capacity);
+	FLAT_RESIZE(t->loc, t->capacity);
+	FLAT_RESIZE(t->a, t->capacity);
+	FLAT_RESIZE(t->b, t->capacity);
+	FLAT_RESIZE(t->binding, t->capacity);
+    }
+    flat_index ret = t->count;
+    t->count += n;
+    return ret;
+}
+
+// Requires: name is interned
+// Return the index of name in the names of fa, adding it if needed
+static flat_index flat_name(flat_ast *fa, const char *name)
+{
+    flat_names *t = &fa->names;
+    if (2 * (t->count + 1) > t->index_capacity) {
+	// grow the hash index, keeping it at most half full
+	uint32_t capacity = flat_new_capacity(t->index_capacity,
+					      2 * (t->count + 1));
+	uint32_t *index = (uint32_t *) calloc(capacity, sizeof(uint32_t));
+	if (index == NULL) {
+	    bail_with_error("No space for a name index!");
+	}
+	for (uint32_t i = 0; i < t->count; i++) {
+	    uint32_t h = scope_hash(t->name[i]) & (capacity - 1);
+	    while (index[h] != 0) {
+		h = (h + 1) & (capacity - 1);
+	    }
+	    index[h] = i + 1;
+	}
+	free(t->index);
+	t->index = index;
+	t->index_capacity = capacity;
+    }
+    uint32_t mask = t->index_capacity - 1;
+    uint32_t h = scope_hash(name) & mask;
+    while (t->index[h] != 0) {
+	if (t->name[t->index[h] - 1] == name) {
+	    return t->index[h] - 1;
+	}
+	h = (h + 1) & mask;
+    }
+    if (t->count == t->capacity) {
+	t->capacity = flat_new_capacity(t->capacity, t->count + 1);
+	FLAT_RESIZE(t->name, t->capacity);
+    }
+    t->name[t->count] = name;
+    t->index[h] = t->count + 1;
+    return t->count++;
+}
+
+// Return the flat_op for the token code of an operator
+static flat_op flat_op_of(int code)
+{
+    switch (code) {
+    case plussym: return flat_op_plus;
+    case minussym: return flat_op_minus;
+    case multsym: return flat_op_mult;
+    case divsym: return flat_op_div;
+    case eqeqsym: return flat_op_eq;
+    case neqsym: return flat_op_neq;
+    case ltsym: return flat_op_lt;
+    case leqsym: return flat_op_leq;
+    case gtsym: return flat_op_gt;
+    case geqsym: return flat_op_geq;
+    default:
+	bail_with_error("Unknown operator token code (%d) in flat_op_of!",
+			code);
+	return flat_op_plus;
+    }
+}
+
+// Return the spelling of the operator op
+const char *flat_op_spelling(flat_op op)
+{
+    static const char *spellings[] = {
+	"+", "-", "*", "/", "==", "!=", "<", "<=", ">", ">="
+    };
+    assert(op <= flat_op_geq);
+    return spellings[op];
+}
+
+// The AST is flattened with an explicit stack of work instead of
+// by recursion, so the depth of nesting in programs is only limited
+// by the memory available.
+// Each node is added to fa when its work is done, and its index
+// is then stored into the field of its parent that refers to it.
+// Since the arrays of fa move when they grow, that field is named
+// by which array it is in (a flat_dest) and the index in that array.
+
+// fields of fa that refer to a node (or, for ranges, to a run of them)
+typedef enum {
+    flat_dest_root, flat_dest_expr_a, flat_dest_expr_b,
+    flat_dest_condition_a, flat_dest_condition_b,
+    flat_dest_stmt_a, flat_dest_stmt_b,
+    flat_dest_proc_block,
+    flat_dest_stmt_list, flat_dest_block_stmts
+} flat_dest;
+
+// kinds of work items
+typedef enum {
+    flat_work_block,       // node is a block_t
+    flat_work_proc_decls,  // node is a proc_decl_t (at index at),
+                           // then those after it
+    flat_work_stmts,       // node is a stmts_t
+    flat_work_stmt_list,   // node is a stmt_t (at index at),
+                           // then those after it
+    flat_work_condition,   // node is a condition_t
+    flat_work_expr         // node is an expr_t
+} flat_work_kind;
+
+// a node to add to fa; its index (or range) is stored into
+// the field dest of the node at index dest_at
+typedef struct {
+    flat_work_kind kind;
+    const void *node;
+    flat_index at;
+    flat_dest dest;
+    flat_index dest_at;
+} flat_work;
+
+// this thread's stack of work
+static _Thread_local flat_work *work = NULL;
+static _Thread_local uint32_t work_size = 0;
+static _Thread_local uint32_t work_capacity = 0;
+
+// Push work to add node (of the given kind) to fa,
+// storing its index into the field dest of the node at dest_at
+static void flat_push(flat_work_kind kind, const void *node, flat_index at,
+		      flat_dest dest, flat_index dest_at)
+{
+    if (work_size == work_capacity) {
+	work_capacity = flat_new_capacity(work_capacity, work_size + 1);
+	FLAT_RESIZE(work, work_capacity);
+    }
+    flat_work *w = &work[work_size++];
+    w->kind = kind;
+    w->node = node;
+    w->at = at;
+    w->dest = dest;
+    w->dest_at = dest_at;
+}
+
+// Store the index i into the field dest of the node at dest_at in fa
+static void flat_store(flat_ast *fa, flat_dest dest, flat_index dest_at,
+		       flat_index i)
+{
+    switch (dest) {
+    case flat_dest_root:
+	fa->root = i;
+	break;
+    case flat_dest_expr_a:
+	fa->exprs.a[dest_at] = i;
+	break;
+    case flat_dest_expr_b:
+	fa->exprs.b[dest_at] = i;
+	break;
+    case flat_dest_condition_a:
+	fa->conditions.a[dest_at] = i;
+	break;
+    case flat_dest_condition_b:
+	fa->conditions.b[dest_at] = i;
+	break;
+    case flat_dest_stmt_a:
+	fa->stmts.a[dest_at] = i;
+	break;
+    case flat_dest_stmt_b:
+	fa->stmts.b[dest_at] = i;
+	break;
+    case flat_dest_proc_block:
+	fa->proc_decls.block[dest_at] = i;
+	break;
+    default:
+	bail_with_error("Unexpected flat_dest (%d) in flat_store!", dest);
+	break;
+    }
+}
+
+// Store the range r into the field dest of the node at dest_at in fa
+static void flat_store_range(flat_ast *fa, flat_dest dest,
+			     flat_index dest_at, flat_range r)
+{
+    if (dest == flat_dest_stmt_list) {
+	fa->stmt_lists.stmts[dest_at] = r;
+    } else {
+	assert(dest == flat_dest_block_stmts);
+	fa->blocks.stmts[dest_at] = r;
+    }
+}
+
+// Add the expression exp to fa, returning its index,
+// and push work for its subexpressions
+static flat_index flatten_expr(flat_ast *fa, const expr_t *exp)
+{
+    flat_index e = exprs_add(fa, 1);
+    flat_index a = FLAT_NONE, b = FLAT_NONE;
+    uint8_t op = 0;
+    switch (exp->expr_kind) {
+    case expr_bin:
+	op = flat_op_of(exp->data.binary.arith_op.code);
+	flat_push(flat_work_expr, exp->data.binary.expr2, 0,
+		  flat_dest_expr_b, e);
+	flat_push(flat_work_expr, exp->data.binary.expr1, 0,
+		  flat_dest_expr_a, e);
+	break;
+    case expr_negated:
+	flat_push(flat_work_expr, exp->data.negated.expr, 0,
+		  flat_dest_expr_a, e);
+	break;
+    case expr_ident:
+	a = flat_name(fa, exp->data.ident.name);
+	break;
+    case expr_number:
+	a = (flat_index) exp->data.number.value;
+	break;
+    default:
+	bail_with_error("Unexpected expr_kind_e (%d) in flatten_expr!",
+			exp->expr_kind);
+	break;
+    }
+    fa->exprs.kind[e] = exp->expr_kind;
+    fa->exprs.op[e] = op;
+    fa->exprs.loc[e] = exp->file_loc;
+    fa->exprs.a[e] = a;
+    fa->exprs.b[e] = b;
+    fa->exprs.binding[e] = ID_BINDING_UNRESOLVED;
+    return e;
+}
+
+// Reserve room in fa for the statements in stmts, returning their range,
+// and push work for them
+static flat_range flatten_stmts(flat_ast *fa, const stmts_t *stmts)
+{
+    flat_range ret = { fa->stmts.count, 0 };
+    if (stmts->stmts_kind == empty_stmts_e) {
+	return ret;
+    }
+    for (stmt_t *sp = stmts->stmt_list.start; sp != NULL; sp = sp->next) {
+	ret.count++;
+    }
+    // the statements in the list are consecutive,
+    // so reserve them all before adding their parts
+    ret.first = stmts_add(fa, ret.count);
+    if (ret.count > 0) {
+	flat_push(flat_work_stmt_list, stmts->stmt_list.start, ret.first,
+		  flat_dest_root, 0);
+    }
+    return ret;
+}
+
+// Push work to add the statements in stmts to fa, storing their range
+// into the field dest of the node at dest_at
+static void flatten_stmt_list(flat_ast *fa, const stmts_t *stmts,
+			      flat_dest dest, flat_index dest_at)
+{
+    flat_push(flat_work_stmts, stmts, 0, dest, dest_at);
+}
+
+// Fill in the statement s of fa from sp, pushing work for its parts
+static void flatten_stmt(flat_ast *fa, const stmt_t *sp, flat_index s)
+{
+    flat_index a = FLAT_NONE, b = FLAT_NONE, c = FLAT_NONE;
+    switch (sp->stmt_kind) {
+    case assign_stmt:
+	a = flat_name(fa, sp->data.assign_stmt.name);
+	flat_push(flat_work_expr, sp->data.assign_stmt.expr, 0,
+		  flat_dest_stmt_b, s);
+	break;
+    case call_stmt:
+	a = flat_name(fa, sp->data.call_stmt.name);
+	break;
+    case read_stmt:
+	a = flat_name(fa, sp->data.read_stmt.name);
+	break;
+    case if_stmt:
+	b = stmt_lists_add(fa, 1);
+	if (sp->data.if_stmt.else_stmts != NULL) {
+	    c = stmt_lists_add(fa, 1);
+	    flatten_stmt_list(fa, sp->data.if_stmt.else_stmts,
+			      flat_dest_stmt_list, c);
+	}
+	flatten_stmt_list(fa, sp->data.if_stmt.then_stmts,
+			  flat_dest_stmt_list, b);
+	flat_push(flat_work_condition, &sp->data.if_stmt.condition, 0,
+		  flat_dest_stmt_a, s);
+	break;
+    case while_stmt:
+	b = stmt_lists_add(fa, 1);
+	flatten_stmt_list(fa, sp->data.while_stmt.body,
+			  flat_dest_stmt_list, b);
+	flat_push(flat_work_condition, &sp->data.while_stmt.condition, 0,
+		  flat_dest_stmt_a, s);
+	break;
+    case print_stmt:
+	flat_push(flat_work_expr, &sp->data.print_stmt.expr, 0,
+		  flat_dest_stmt_a, s);
+	break;
+    case block_stmt:
+	flat_push(flat_work_block, sp->data.block_stmt.block, 0,
+		  flat_dest_stmt_a, s);
+	break;
+    default:
+	bail_with_error("Unknown stmt_kind (%d) in flatten_stmts!",
+			sp->stmt_kind);
+	break;
+    }
+    fa->stmts.kind[s] = sp->stmt_kind;
+    fa->stmts.loc[s] = sp->file_loc;
+    fa->stmts.a[s] = a;
+    fa->stmts.b[s] = b;
+    fa->stmts.c[s] = c;
+    fa->stmts.binding[s] = ID_BINDING_UNRESOLVED;
+}
+
+// Add the condition cond to fa, returning its index,
+// and push work for its expressions
+static flat_index flatten_condition(flat_ast *fa, const condition_t *cond)
+{
+    const expr_t *a, *b;
+    uint8_t op = 0;
+    switch (cond->cond_kind) {
+    case ck_db:
+	a = &cond->data.db_cond.dividend;
+	b = &cond->data.db_cond.divisor;
+	break;
+    case ck_rel:
+	op = flat_op_of(cond->data.rel_op_cond.rel_op.code);
+	a = &cond->data.rel_op_cond.expr1;
+	b = &cond->data.rel_op_cond.expr2;
+	break;
+    default:
+	bail_with_error("Unexpected condition_kind_e (%d) in flatten_condition!",
+			cond->cond_kind);
+	return FLAT_NONE;
+    }
+    flat_index c = conditions_add(fa, 1);
+    fa->conditions.kind[c] = cond->cond_kind;
+    fa->conditions.op[c] = op;
+    fa->conditions.loc[c] = cond->file_loc;
+    fa->conditions.a[c] = FLAT_NONE;
+    fa->conditions.b[c] = FLAT_NONE;
+    flat_push(flat_work_expr, b, 0, flat_dest_condition_b, c);
+    flat_push(flat_work_expr, a, 0, flat_dest_condition_a, c);
+    return c;
+}
+
+// Add the const-decls in cds to fa, returning their range
+static flat_range flatten_const_decls(flat_ast *fa, const const_decls_t *cds)
+{
+    flat_range ret = { fa->const_decls.count, 0 };
+    for (const_decl_t *cdp = cds->start; cdp != NULL; cdp = cdp->next) {
+	ret.count++;
+    }
+    ret.first = const_decls_add(fa, ret.count);
+    flat_index d = ret.first;
+    for (const_decl_t *cdp = cds->start; cdp != NULL; cdp = cdp->next, d++) {
+	flat_range defs = { fa->const_defs.count, 0 };
+	for (const_def_t *dp = cdp->const_def_list.start; dp != NULL;
+	     dp = dp->next) {
+	    flat_index i = const_defs_add(fa, 1);
+	    fa->const_defs.loc[i] = dp->ident.file_loc;
+	    fa->const_defs.name[i] = flat_name(fa, dp->ident.name);
+	    fa->const_defs.value[i] = dp->number.value;
+	    defs.count++;
+	}
+	fa->const_decls.loc[d] = cdp->file_loc;
+	fa->const_decls.defs[d] = defs;
+    }
+    return ret;
+}
+
+// Add the var-decls in vds to fa, returning their range
+static flat_range flatten_var_decls(flat_ast *fa, const var_decls_t *vds)
+{
+    flat_range ret = { fa->var_decls.count, 0 };
+    for (var_decl_t *vdp = vds->var_decls; vdp != NULL; vdp = vdp->next) {
+	ret.count++;
+    }
+    ret.first = var_decls_add(fa, ret.count);
+    flat_index d = ret.first;
+    for (var_decl_t *vdp = vds->var_decls; vdp != NULL; vdp = vdp->next, d++) {
+	flat_range ids = { fa->idents.count, 0 };
+	for (ident_t *ip = vdp->ident_list.start; ip != NULL; ip = ip->next) {
+	    flat_index i = idents_add(fa, 1);
+	    fa->idents.loc[i] = ip->file_loc;
+	    fa->idents.name[i] = flat_name(fa, ip->name);
+	    ids.count++;
+	}
+	fa->var_decls.loc[d] = vdp->file_loc;
+	fa->var_decls.idents[d] = ids;
+    }
+    return ret;
+}
+
+// Add the proc-decls in pds to fa, returning their range,
+// and push work for their blocks
+static flat_range flatten_proc_decls(flat_ast *fa, const proc_decls_t *pds)
+{
+    flat_range ret = { fa->proc_decls.count, 0 };
+    for (proc_decl_t *pdp = pds->proc_decls; pdp != NULL; pdp = pdp->next) {
+	ret.count++;
+    }
+    ret.first = proc_decls_add(fa, ret.count);
+    if (ret.count > 0) {
+	flat_push(flat_work_proc_decls, pds->proc_decls, ret.first,
+		  flat_dest_root, 0);
+    }
+    return ret;
+}
+
+// Fill in the proc-decl p of fa from pdp, pushing work for its block
+static void flatten_proc_decl(flat_ast *fa, const proc_decl_t *pdp,
+			      flat_index p)
+{
+    fa->proc_decls.loc[p] = pdp->file_loc;
+    fa->proc_decls.name[p] = flat_name(fa, pdp->name);
+    fa->proc_decls.block[p] = FLAT_NONE;
+    flat_push(flat_work_block, pdp->block, 0, flat_dest_proc_block, p);
+}
+
+// Add the block blk to fa, returning its index,
+// and push work for its procedures and statements
+static flat_index flatten_block(flat_ast *fa, const block_t *blk)
+{
+    flat_index b = blocks_add(fa, 1);
+    flat_range cds = flatten_const_decls(fa, &blk->const_decls);
+    flat_range vds = flatten_var_decls(fa, &blk->var_decls);
+    fa->blocks.loc[b] = blk->file_loc;
+    fa->blocks.const_decls[b] = cds;
+    fa->blocks.var_decls[b] = vds;
+    // the statements are reserved after the procedures are added
+    flatten_stmt_list(fa, &blk->stmts, flat_dest_block_stmts, b);
+    flat_range pds = flatten_proc_decls(fa, &blk->proc_decls);
+    fa->blocks.proc_decls[b] = pds;
+    return b;
+}
+
+// Do the work on the stack, adding its nodes to fa
+static void flatten_run(flat_ast *fa)
+{
+    while (work_size > 0) {
+	flat_work w = work[--work_size];
+	switch (w.kind) {
+	case flat_work_block:
+	    flat_store(fa, w.dest, w.dest_at,
+		       flatten_block(fa, (const block_t *) w.node));
+	    break;
+	case flat_work_proc_decls:
+	{
+	    const proc_decl_t *pdp = (const proc_decl_t *) w.node;
+	    if (pdp->next != NULL) {
+		flat_push(flat_work_proc_decls, pdp->next, w.at + 1,
+			  flat_dest_root, 0);
+	    }
+	    flatten_proc_decl(fa, pdp, w.at);
+	    break;
+	}
+	case flat_work_stmts:
+	    flat_store_range(fa, w.dest, w.dest_at,
+			     flatten_stmts(fa, (const stmts_t *) w.node));
+	    break;
+	case flat_work_stmt_list:
+	{
+	    const stmt_t *sp = (const stmt_t *) w.node;
+	    if (sp->next != NULL) {
+		flat_push(flat_work_stmt_list, sp->next, w.at + 1,
+			  flat_dest_root, 0);
+	    }
+	    flatten_stmt(fa, sp, w.at);
+	    break;
+	}
+	case flat_work_condition:
+	    flat_store(fa, w.dest, w.dest_at,
+		       flatten_condition(fa, (const condition_t *) w.node));
+	    break;
+	case flat_work_expr:
+	    flat_store(fa, w.dest, w.dest_at,
+		       flatten_expr(fa, (const expr_t *) w.node));
+	    break;
+	}
+    }
+}
+
+// Requires: the identifier names in prog are interned
+// Return a freshly allocated flat AST for the program prog
+// (which does not refer to prog's storage, except for the names)
+flat_ast *flat_ast_build(block_t prog)
+{
+    flat_ast *fa = (flat_ast *) calloc(1, sizeof(flat_ast));
+    if (fa == NULL) {
+	bail_with_error("No space for a flat AST!");
+    }
+    flat_push(flat_work_block, &prog, 0, flat_dest_root, 0);
+    flatten_run(fa);
+    free(work);
+    work = NULL;
+    work_size = 0;
+    work_capacity = 0;
+    return fa;
+}
+
+// Free all the storage used by fa
+void flat_ast_destroy(flat_ast *fa)
+{
+    if (fa->mapping != NULL) {
+	// (only the table of names and the bindings were allocated)
+	munmap(fa->mapping, fa->mapping_size);
+	free(fa->names.name);
+	free(fa->stmts.binding);
+	free(fa->exprs.binding);
+	free(fa);
+	return;
+    }
+    free(fa->blocks.loc);
+    free(fa->blocks.const_decls);
+    free(fa->blocks.var_decls);
+    free(fa->blocks.proc_decls);
+    free(fa->blocks.stmts);
+    free(fa->const_decls.loc);
+    free(fa->const_decls.defs);
+    free(fa->const_defs.loc);
+    free(fa->const_defs.name);
+    free(fa->const_defs.value);
+    free(fa->var_decls.loc);
+    free(fa->var_decls.idents);
+    free(fa->idents.loc);
+    free(fa->idents.name);
+    free(fa->proc_decls.loc);
+    free(fa->proc_decls.name);
+    free(fa->proc_decls.block);
+    free(fa->stmts.kind);
+    free(fa->stmts.loc);
+    free(fa->stmts.a);
+    free(fa->stmts.b);
+    free(fa->stmts.c);
+    free(fa->stmts.binding);
+    free(fa->stmt_lists.stmts);
+    free(fa->conditions.kind);
+    free(fa->conditions.op);
+    free(fa->conditions.loc);
+    free(fa->conditions.a);
+    free(fa->conditions.b);
+    free(fa->exprs.kind);
+    free(fa->exprs.op);
+    free(fa->exprs.loc);
+    free(fa->exprs.a);
+    free(fa->exprs.b);
+    free(fa->exprs.binding);
+    free(fa->names.name);
+    free(fa->names.index);
+    free(fa);
+}
+
+// Return the number of bytes used by the node arrays of fa
+size_t flat_ast_bytes(const flat_ast *fa)
+{
+    return (size_t) fa->blocks.capacity
+	    * (sizeof(source_loc) + 4 * sizeof(flat_range))
+	+ (size_t) fa->const_decls.capacity
+	    * (sizeof(source_loc) + sizeof(flat_range))
+	+ (size_t) fa->const_defs.capacity
+	    * (sizeof(source_loc) + sizeof(flat_index) + sizeof(word_type))
+	+ (size_t) fa->var_decls.capacity
+	    * (sizeof(source_loc) + sizeof(flat_range))
+	+ (size_t) fa->idents.capacity
+	    * (sizeof(source_loc) + sizeof(flat_index))
+	+ (size_t) fa->proc_decls.capacity
+	    * (sizeof(source_loc) + 2 * sizeof(flat_index))
+	+ (size_t) fa->stmts.capacity
+	    * (sizeof(uint8_t) + sizeof(source_loc) + 3 * sizeof(flat_index)
+	       + sizeof(id_binding))
+	+ (size_t) fa->stmt_lists.capacity * sizeof(flat_range)
+	+ (size_t) fa->conditions.capacity
+	    * (2 * sizeof(uint8_t) + sizeof(source_loc) + 2 * sizeof(flat_index))
+	+ (size_t) fa->exprs.capacity
+	    * (2 * sizeof(uint8_t) + sizeof(source_loc) + 2 * sizeof(flat_index)
+	       + sizeof(id_binding))
+	+ (size_t) fa->names.capacity * sizeof(const char *)
+	+ (size_t) fa->names.index_capacity * sizeof(uint32_t);
+}
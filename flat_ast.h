@@ -0,0 +1,187 @@
+#ifndef _FLAT_AST_H
+#define _FLAT_AST_H
+#include <stdint.h>
+#include <stddef.h>
+#include "ast.h"
+#include "file_location.h"
+
+// A flat AST is an alternative representation of a program's AST,
+// in which the nodes of each kind live in contiguous arrays
+// (one array per field, so a traversal that looks at one field
+// of many nodes touches little memory).
+// Nodes refer to their children by 32-bit indexes into those arrays,
+// operators are small enums, and the names of identifiers
+// are indexes into a table of (interned) names.
+// The elements of a list (e.g., the statements in a block)
+// are consecutive nodes, referred to by a flat_range.
+
+// index of a node in one of the arrays of a flat AST
+typedef uint32_t flat_index;
+
+// the flat_index used when there is no node (e.g., no else part)
+#define FLAT_NONE UINT32_MAX
+
+// a run of count consecutive nodes starting at first
+typedef struct {
+    flat_index first;
+    uint32_t count;
+} flat_range;
+
+// arithmetic and relational operators
+typedef enum {
+    flat_op_plus, flat_op_minus, flat_op_mult, flat_op_div,
+    flat_op_eq, flat_op_neq, flat_op_lt, flat_op_leq, flat_op_gt, flat_op_geq
+} flat_op;
+
+// blocks; each refers to runs of the declarations in it,
+// and to the run of its statements
+typedef struct {
+    uint32_t count, capacity;
+    source_loc *loc;
+    flat_range *const_decls;
+    flat_range *var_decls;
+    flat_range *proc_decls;
+    flat_range *stmts;
+} flat_blocks;
+
+// const-decls, each with a run of const-defs
+typedef struct {
+    uint32_t count, capacity;
+    source_loc *loc;
+    flat_range *defs;
+} flat_const_decls;
+
+// const-defs
+typedef struct {
+    uint32_t count, capacity;
+    source_loc *loc;
+    flat_index *name;
+    word_type *value;
+} flat_const_defs;
+
+// var-decls, each with a run of declared identifiers
+typedef struct {
+    uint32_t count, capacity;
+    source_loc *loc;
+    flat_range *idents;
+} flat_var_decls;
+
+// identifiers declared in var-decls
+typedef struct {
+    uint32_t count, capacity;
+    source_loc *loc;
+    flat_index *name;
+} flat_idents;
+
+// proc-decls
+typedef struct {
+    uint32_t count, capacity;
+    source_loc *loc;
+    flat_index *name;
+    flat_index *block;
+} flat_proc_decls;
+
+// statements; kind is a stmt_kind_e, and the meaning of a, b and c
+// depends on it:
+//   assign_stmt: a is the name, b the expression
+//   call_stmt, read_stmt: a is the name
+//   if_stmt: a is the condition, b the then part (a stmt list),
+//            c the else part (a stmt list, or FLAT_NONE if there is none)
+//   while_stmt: a is the condition, b the body (a stmt list)
+//   print_stmt: a is the expression
+//   block_stmt: a is the block
+// and binding is the binding of the name of an assign, call or read
+// statement (filled in by scope checking)
+typedef struct {
+    uint32_t count, capacity;
+    uint8_t *kind;
+    source_loc *loc;
+    flat_index *a;
+    flat_index *b;
+    flat_index *c;
+    id_binding *binding;
+} flat_stmts;
+
+// runs of statements used as the bodies of if and while statements
+typedef struct {
+    uint32_t count, capacity;
+    flat_range *stmts;
+} flat_stmt_lists;
+
+// conditions; kind is a condition_kind_e,
+// op is a flat_op (for relational conditions),
+// and a and b are the two expressions
+typedef struct {
+    uint32_t count, capacity;
+    uint8_t *kind;
+    uint8_t *op;
+    source_loc *loc;
+    flat_index *a;
+    flat_index *b;
+} flat_conditions;
+
+// expressions; kind is an expr_kind_e, and the meaning of a and b
+// depends on it:
+//   expr_bin: op is a flat_op, a and b are the operands
+//   expr_negated: a is the negated expression
+//   expr_ident: a is the name
+//   expr_number: a is the value (as a word_type)
+// and binding is the binding of the name of an expr_ident
+// (filled in by scope checking)
+typedef struct {
+    uint32_t count, capacity;
+    uint8_t *kind;
+    uint8_t *op;
+    source_loc *loc;
+    flat_index *a;
+    flat_index *b;
+    id_binding *binding;
+} flat_exprs;
+
+// the names of identifiers (each occurs once)
+typedef struct {
+    uint32_t count, capacity;
+    const char **name;
+    // hash index on the (interned) names: 0 is empty, else 1 + name index
+    uint32_t index_capacity;
+    uint32_t *index;
+} flat_names;
+
+// a whole program
+typedef struct {
+    flat_index root; // the program's block
+    flat_blocks blocks;
+    flat_const_decls const_decls;
+    flat_const_defs const_defs;
+    flat_var_decls var_decls;
+    flat_idents idents;
+    flat_proc_decls proc_decls;
+    flat_stmts stmts;
+    flat_stmt_lists stmt_lists;
+    flat_conditions conditions;
+    flat_exprs exprs;
+    flat_names names;
+    // for a flat AST loaded from a file (see ast_file.h), the file
+    // mapped into memory, which holds its arrays (other than names.name
+    // and the bindings)
+    void *mapping;
+    size_t mapping_size;
+} flat_ast;
+
+// Requires: the identifier names in prog are interned, and
+//           no procedure body in prog is still skipped by the parser
+//           (see parseProcBodies)
+// Return a freshly allocated flat AST for the program prog
+// (which does not refer to prog's storage, except for the names)
+extern flat_ast *flat_ast_build(block_t prog);
+
+// Free all the storage used by fa
+extern void flat_ast_destroy(flat_ast *fa);
+
+// Return the number of bytes used by the node arrays of fa
+extern size_t flat_ast_bytes(const flat_ast *fa);
+
+// Return the spelling of the operator op
+extern const char *flat_op_spelling(flat_op op);
+
+#endif
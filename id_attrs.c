@@ -3,23 +3,22 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include "utilities.h"
+#include "arena.h"
 #include "id_attrs.h"
 
 // Return a freshly allocated id_attrs struct
 // with its field file_loc set to floc, kind set to k, 
-// and its offset_count set to ofst_cnt.
+// and its offset_count set to ofst_cnt (and no decl_id).
 // If there is no space, bail with an error message,
 // so this should never return NULL.
-extern id_attrs *create_id_attrs(file_location floc, id_kind k,
+extern id_attrs *create_id_attrs(source_loc floc, id_kind k,
 				 unsigned int ofst_cnt)
 {
-    id_attrs *ret = (id_attrs *)malloc(sizeof(id_attrs));
-    if (ret == NULL) {
-	bail_with_error("No space to allocate id_attrs!");
-    }
+    id_attrs *ret = (id_attrs *)arena_alloc(sizeof(id_attrs));
     ret->file_loc = floc;
     ret->kind = k;
     ret->offset_count = ofst_cnt;
+    ret->decl_id = NO_DECL_ID;
     return ret;
 }
 
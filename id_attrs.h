@@ -6,22 +6,29 @@
 // kinds of entries in the symbol table
 typedef enum {constant_idk, variable_idk, procedure_idk} id_kind;
 
+// the declaration ID of a declaration not (yet) recorded
+// in the resolution table (see resolution.h)
+#define NO_DECL_ID 0xFFFFFFFFu
+
 // attributes of identifiers in the symbol table
 typedef struct {
     // file_loc is the source file location of the identifier's declaration
-    file_location file_loc;
+    source_loc file_loc;
     id_kind kind;  // kind of identifier
     // offset_count is the number of constant or variable decls before this one
     // in this scope
     unsigned int offset_count;
+    // decl_id is the declaration's dense ID in the resolution table
+    // (or NO_DECL_ID)
+    unsigned int decl_id;
 } id_attrs;
 
 // Return a freshly allocated id_attrs struct
 // with its field file_loc set to floc, kind set to k, 
-// and its offset_count set to ofst_cnt.
+// and its offset_count set to ofst_cnt (and no decl_id).
 // If there is no space, bail with an error message,
 // so this should never return NULL.
-extern id_attrs *create_id_attrs(file_location floc, id_kind k,
+extern id_attrs *create_id_attrs(source_loc floc, id_kind k,
 				 unsigned int ofst_cnt);
 
 // Return a lowercase version of the kind's name as a string
@@ -1,6 +1,7 @@
 /* $Id: id_use.c,v 1.1 2023/10/15 21:29:24 leavens Exp $ */
 #include <stdlib.h>
 #include "id_use.h"
+#include "arena.h"
 #include "utilities.h"
 
 // Requires: attrs != NULL
@@ -11,10 +12,7 @@
 // so this should never return NULL.
 extern id_use *id_use_create(id_attrs *attrs, unsigned int levelsOut)
 {
-    id_use *ret = (id_use *)malloc(sizeof(id_use));
-    if (ret == NULL) {
-	bail_with_error("No space to allocate id_use!");
-    }
+    id_use *ret = (id_use *)arena_alloc(sizeof(id_use));
     ret->attrs = attrs;
     ret->levelsOutward = levelsOut;
     // Shouldn't create a label for procedures here!
@@ -22,6 +20,20 @@ extern id_use *id_use_create(id_attrs *attrs, unsigned int levelsOut)
     return ret;
 }
 
+// Requires: idu.attrs != NULL
+// Return the (resolved) binding described by idu (with no use ID)
+id_binding id_use_binding(id_use idu)
+{
+    id_binding ret;
+    ret.levelsOutward = idu.levelsOutward;
+    ret.offset_count = idu.attrs->offset_count;
+    ret.kind = idu.attrs->kind;
+    ret.decl_id = idu.attrs->decl_id;
+    ret.use_id = NO_USE_ID;
+    ret.resolved = true;
+    return ret;
+}
+
 // We'll use lexical addresses in HW4...
 // Requires: idu != NULL
 // Return (a pointer to) the lexical address for idu.
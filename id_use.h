@@ -1,6 +1,7 @@
 /* $Id: id_use.h,v 1.1 2023/10/15 21:29:24 leavens Exp $ */
 #ifndef _ID_USE_H
 #define _ID_USE_H
+#include <stdbool.h>
 #include "id_attrs.h"
 // we'll use lexical_address in HW4
 // #include "lexical_address.h"
@@ -15,6 +16,32 @@ typedef struct {
     unsigned int levelsOutward;    
 } id_use;
 
+// An id_binding is what the scope checker records in the AST
+// for each use (and declaration) of a name, so later passes
+// need no symbol table lookups: the lexical address of the
+// declaration (levelsOutward and offset_count) and its kind,
+// plus the IDs of the declaration and of the use in the
+// resolution table (see resolution.h).
+typedef struct {
+    unsigned int levelsOutward;
+    unsigned int offset_count;
+    id_kind kind;
+    unsigned int decl_id;
+    unsigned int use_id; // NO_USE_ID for declarations
+    bool resolved; // has scope checking filled in this binding?
+} id_binding;
+
+// the use ID of a binding that is not a recorded use
+#define NO_USE_ID 0xFFFFFFFFu
+
+// The binding of a name that has not been resolved (yet)
+#define ID_BINDING_UNRESOLVED \
+    ((id_binding) { 0, 0, constant_idk, NO_DECL_ID, NO_USE_ID, false })
+
+// Requires: idu.attrs != NULL
+// Return the (resolved) binding described by idu (with no use ID)
+extern id_binding id_use_binding(id_use idu);
+
 // Requires: attrs != NULL
 // Return a (pointer to a fresh) id_use struct containing the attributes
 // given by attrs and the information about the number of lexical levels
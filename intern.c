@@ -0,0 +1,248 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "intern.h"
+#include "arena.h"
+#include "utilities.h"
+
+// Initial number of slots in the table (a power of 2)
+#define INITIAL_INTERN_CAPACITY 256
+
+// An interned string, with its length and hash code
+typedef struct {
+    const char *str;
+    size_t len;
+    unsigned int hash;
+} intern_entry_t;
+
+// An intern table: an open addressing (linear probing) hash table
+// of the interned strings, with str == NULL in empty slots.
+// While it is shared, its entries are not changed (so they are read
+// without locking), and the strings interned that are not in them
+// are in the table added (which lock protects) instead.
+// Invariant: count <= capacity / 2
+struct intern_table_s {
+    intern_entry_t *entries;
+    unsigned int count;
+    unsigned int capacity;
+    bool shared;
+    pthread_mutex_t lock;
+    struct intern_table_s *added;
+};
+
+// the table used by threads that have not chosen another
+static intern_table default_table
+    = { NULL, 0, 0, false, PTHREAD_MUTEX_INITIALIZER, NULL };
+
+// the table this thread interns strings in
+static _Thread_local intern_table *current = &default_table;
+
+// Return the FNV-1a hash of the first len characters of s
+static unsigned int intern_hash(const char *s, size_t len)
+{
+    unsigned int h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+	h ^= (unsigned char) s[i];
+	h *= 16777619u;
+    }
+    return h;
+}
+
+// Make the table t empty, with cap slots
+static void intern_alloc_table(intern_table *t, unsigned int cap)
+{
+    t->entries = (intern_entry_t *) calloc(cap, sizeof(intern_entry_t));
+    if (t->entries == NULL) {
+	bail_with_error("No space for the intern table!");
+    }
+    t->count = 0;
+    t->capacity = cap;
+}
+
+// Requires: t->entries != NULL
+// Return the slot of t holding the spelling given by s and len (with hash h)
+// or the empty slot where it would go
+static intern_entry_t *intern_find_slot(const intern_table *t, const char *s,
+					size_t len, unsigned int h)
+{
+    intern_entry_t *table = t->entries;
+    unsigned int mask = t->capacity - 1;
+    unsigned int slot = h & mask;
+    while (table[slot].str != NULL
+	   && !(table[slot].hash == h && table[slot].len == len
+		&& memcmp(table[slot].str, s, len) == 0)) {
+	slot = (slot + 1) & mask;
+    }
+    return &table[slot];
+}
+
+// Double the capacity of the table t
+static void intern_grow_table(intern_table *t)
+{
+    intern_entry_t *old_table = t->entries;
+    unsigned int old_capacity = t->capacity;
+    unsigned int old_count = t->count;
+    intern_alloc_table(t, 2 * old_capacity);
+    for (unsigned int i = 0; i < old_capacity; i++) {
+	if (old_table[i].str != NULL) {
+	    *intern_find_slot(t, old_table[i].str, old_table[i].len,
+			      old_table[i].hash) = old_table[i];
+	}
+    }
+    t->count = old_count;
+    free(old_table);
+}
+
+// Requires: the spelling of entry is not in t
+// Put entry in t
+static void intern_put(intern_table *t, intern_entry_t entry)
+{
+    if (t->entries == NULL) {
+	intern_alloc_table(t, INITIAL_INTERN_CAPACITY);
+    } else if (2 * (t->count + 1) > t->capacity) {
+	intern_grow_table(t);
+    }
+    *intern_find_slot(t, entry.str, entry.len, entry.hash) = entry;
+    t->count++;
+}
+
+// Requires: s != NULL and s has at least len characters
+// Return the copy of the first len characters of s (whose hash is h)
+// interned in t, or NULL if that spelling is not in t
+static const char *intern_find(const intern_table *t, const char *s,
+			       size_t len, unsigned int h)
+{
+    if (t->entries == NULL) {
+	return NULL;
+    }
+    return intern_find_slot(t, s, len, h)->str;
+}
+
+// Requires: s != NULL and s has at least len characters
+// Return the interned copy in t of the first len characters of s
+// (whose hash is h), making one (in the arena) if that spelling
+// is not in t yet (without locking t)
+static const char *intern_add(intern_table *t, const char *s, size_t len,
+			      unsigned int h)
+{
+    const char *ret = intern_find(t, s, len, h);
+    if (ret == NULL) {
+	intern_entry_t e = { arena_strndup(s, len), len, h };
+	intern_put(t, e);
+	ret = e.str;
+    }
+    return ret;
+}
+
+// Requires: s != NULL and s has at least len characters
+// Return the interned copy of the first len characters of s,
+// making one (in the arena) if that spelling has not been interned yet.
+const char *intern_string(const char *s, size_t len)
+{
+    unsigned int h = intern_hash(s, len);
+    if (!current->shared) {
+	return intern_add(current, s, len, h);
+    }
+    // (the table's entries are not changed while it is shared)
+    const char *ret = intern_find(current, s, len, h);
+    if (ret == NULL) {
+	pthread_mutex_lock(&current->lock);
+	if (current->added == NULL) {
+	    current->added = intern_table_create();
+	}
+	ret = intern_add(current->added, s, len, h);
+	pthread_mutex_unlock(&current->lock);
+    }
+    return ret;
+}
+
+// Requires: no other thread is interning strings in this thread's table
+// Make interning strings in this thread's table safe for several threads
+// at once (if shared is true), or only safe for one thread at a time again.
+// While the table is shared, the strings already in it are found without
+// locking it, and only those not in it yet take a lock, so interning
+// the names a parallel task will use before sharing the table
+// keeps its threads from waiting for each other.
+void intern_set_shared(bool shared)
+{
+    intern_table *added = current->added;
+    current->shared = shared;
+    current->added = NULL;
+    if (added != NULL) {
+	// (the strings added while shared keep their copies,
+	// which may already be in use)
+	for (unsigned int i = 0; i < added->capacity; i++) {
+	    if (added->entries[i].str != NULL) {
+		intern_put(current, added->entries[i]);
+	    }
+	}
+	intern_table_destroy(added);
+    }
+}
+
+// Requires: name != NULL
+// Is name the interned copy of its spelling?
+bool intern_is_interned(const char *name)
+{
+    size_t len = strlen(name);
+    unsigned int h = intern_hash(name, len);
+    const char *found = intern_find(current, name, len, h);
+    if (found == NULL && current->shared) {
+	pthread_mutex_lock(&current->lock);
+	if (current->added != NULL) {
+	    found = intern_find(current->added, name, len, h);
+	}
+	pthread_mutex_unlock(&current->lock);
+    }
+    return found == name;
+}
+
+// Return the number of distinct spellings interned
+unsigned int intern_count()
+{
+    return current->count;
+}
+
+// Forget all the interned strings
+void intern_reset()
+{
+    free(current->entries);
+    current->entries = NULL;
+    current->count = 0;
+    current->capacity = 0;
+}
+
+// Return a new, empty intern table
+intern_table *intern_table_create()
+{
+    intern_table *t = (intern_table *) malloc(sizeof(intern_table));
+    if (t == NULL) {
+	bail_with_error("No space for an intern table!");
+    }
+    t->entries = NULL;
+    t->count = 0;
+    t->capacity = 0;
+    t->shared = false;
+    pthread_mutex_init(&t->lock, NULL);
+    t->added = NULL;
+    return t;
+}
+
+// Release the intern table t
+// (if this thread is using t, it goes back to the default table)
+void intern_table_destroy(intern_table *t)
+{
+    if (current == t) {
+	current = &default_table;
+    }
+    free(t->entries);
+    pthread_mutex_destroy(&t->lock);
+    free(t);
+}
+
+// Make this thread intern strings in the table t
+// (or in the default table, if t is NULL)
+void intern_table_use(intern_table *t)
+{
+    current = (t != NULL) ? t : &default_table;
+}
@@ -0,0 +1,54 @@
+#ifndef _INTERN_H
+#define _INTERN_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// The intern table keeps exactly one copy of each distinct
+// identifier spelling (allocated in the arena),
+// so interned names can be compared by pointer equality
+// instead of with strcmp.
+// Each thread interns strings in the table it is using
+// (the default table, unless it has chosen another with intern_table_use),
+// and the functions below work on that table.
+
+// An intern table (its contents are private to intern.c)
+typedef struct intern_table_s intern_table;
+
+// Requires: s != NULL and s has at least len characters
+// Return the interned copy of the first len characters of s,
+// making one if that spelling has not been interned yet.
+extern const char *intern_string(const char *s, size_t len);
+
+// Requires: name != NULL
+// Is name the interned copy of its spelling?
+extern bool intern_is_interned(const char *name);
+
+// Return the number of distinct spellings interned
+extern unsigned int intern_count();
+
+// Requires: no other thread is interning strings in this thread's table
+// Make interning strings in this thread's table safe for several threads
+// at once (if shared is true), or only safe for one thread at a time again.
+// While the table is shared, the strings already in it are found without
+// locking it, and only those not in it yet take a lock, so interning
+// the names a parallel task will use before sharing the table
+// keeps its threads from waiting for each other.
+extern void intern_set_shared(bool shared);
+
+// Forget all the interned strings
+// (this must be done when the arena they are allocated in is reset)
+extern void intern_reset();
+
+// Return a new, empty intern table
+extern intern_table *intern_table_create();
+
+// Release the intern table t
+// (if this thread is using t, it goes back to the default table)
+extern void intern_table_destroy(intern_table *t);
+
+// Make this thread intern strings in the table t
+// (or in the default table, if t is NULL)
+extern void intern_table_use(intern_table *t);
+
+#endif
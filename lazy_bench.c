@@ -0,0 +1,134 @@
+// Benchmark for lazy parsing (see lexer_set_lazy): reports the time
+// to the first result, parsing a program with many procedures and
+// then looking at the bodies of only a few of them, as a tool that
+// shows one procedure would, parsing eagerly and lazily.
+// It also reports the time to parse every body lazily, which is
+// what a whole compilation costs in lazy mode, and the time to parse
+// the whole program with the bodies parsed in parallel
+// (with the number of threads given as the argument,
+// by default one per processor).
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "lexer.h"
+#include "parser.h"
+#include "file_location.h"
+#include "thread_pool.h"
+#include "arena.h"
+#include "intern.h"
+#include "utilities.h"
+
+// name of the generated program file
+#define BENCH_FILE "lazy_bench.tmp.spl"
+
+// numbers of procedures in the generated programs
+static const unsigned int sizes[] = { 100, 1000, 10000 };
+
+// number of statements in each procedure's body
+#define PROC_STMTS 100
+
+// number of procedures whose bodies are looked at
+#define INSPECTED 3
+
+// Return the current time in nanoseconds
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Write a program with n procedures to BENCH_FILE, each with
+// PROC_STMTS statements (some nested, with comments) in its body
+static void write_program(unsigned int n)
+{
+    FILE *f = fopen(BENCH_FILE, "w");
+    if (f == NULL) {
+	bail_with_error("Cannot create %s", BENCH_FILE);
+    }
+    fprintf(f, "begin\n  var x;\n");
+    for (unsigned int p = 0; p < n; p++) {
+	fprintf(f, "  proc p%u\n  begin\n    var y;\n", p);
+	for (unsigned int i = 0; i < PROC_STMTS; i++) {
+	    const char *semi = (i + 1 < PROC_STMTS) ? ";" : "";
+	    switch (i % 4) {
+	    case 0:
+		fprintf(f, "    y := x + %u * (y - 1)%s\n", i, semi);
+		break;
+	    case 1:
+		fprintf(f, "    if y < %u then x := y else print x end%s"
+			"  %% end of if\n", i, semi);
+		break;
+	    case 2:
+		fprintf(f, "    while x > 0 do begin x := x - 1 end end%s\n",
+			semi);
+		break;
+	    default:
+		fprintf(f, "    print y%s\n", semi);
+		break;
+	    }
+	}
+	fprintf(f, "  end;\n");
+    }
+    fprintf(f, "  x := 0\nend.\n");
+    fclose(f);
+}
+
+// ways of parsing the program
+typedef enum { parse_eager, parse_lazy, parse_parallel } parse_mode;
+
+// Parse BENCH_FILE as mode says, then parse the bodies
+// of its first INSPECTED procedures (or all of them, if all is true),
+// and return the time that took, in nanoseconds
+static double time_parse(parse_mode mode, bool all)
+{
+    double start = now_ns();
+    lexer_init(BENCH_FILE);
+    lexer_set_lazy(mode == parse_lazy);
+    block_t prog;
+    int rc = (mode == parse_parallel) ? tryParseProgramParallel(&prog)
+	                               : tryParseProgram(&prog);
+    if (rc != 0) {
+	bail_with_error("Cannot parse %s!", BENCH_FILE);
+    }
+    unsigned int inspected = 0;
+    for (proc_decl_t *pd = prog.proc_decls.proc_decls;
+	 pd != NULL && (all || inspected < INSPECTED); pd = pd->next) {
+	if (parseProcBody(pd) == NULL) {
+	    bail_with_error("No body for procedure %s!", pd->name);
+	}
+	inspected++;
+    }
+    double elapsed = now_ns() - start;
+    lexer_set_lazy(false);
+    intern_reset();
+    arena_reset();
+    lexer_close();
+    file_location_reset();
+    return elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int threads = thread_pool_processors();
+    if (argc > 1 && atoi(argv[1]) > 0) {
+	threads = (unsigned int) atoi(argv[1]);
+    }
+    parseSetThreads(threads);
+    printf("%-8s %12s %12s %8s %12s %12s\n", "procs", "eager ms",
+	   "lazy ms", "speedup", "lazy all ms", "parallel ms");
+    for (int k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+	unsigned int n = sizes[k];
+	write_program(n);
+	double eager = time_parse(parse_eager, false);
+	double lazy = time_parse(parse_lazy, false);
+	double lazy_all = time_parse(parse_lazy, true);
+	double parallel = time_parse(parse_parallel, true);
+	printf("%-8u %12.2f %12.2f %7.1fx %12.2f %12.2f\n", n, eager / 1e6,
+	       lazy / 1e6, eager / lazy, lazy_all / 1e6, parallel / 1e6);
+    }
+    printf("(in parallel with %u threads)\n", threads);
+    remove(BENCH_FILE);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,97 @@
+// Benchmark for the lexer alone:
+// generates a large SPL source file (500 MB by default,
+// or the number of megabytes given as the argument)
+// and reports the time it takes to read all of its tokens.
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "ast.h"
+#include "lexer.h"
+#include "arena.h"
+#include "intern.h"
+#include "utilities.h"
+
+// name of the generated program file
+#define BENCH_FILE "lex_bench.tmp.spl"
+
+// default size of the generated file, in megabytes
+#define DEFAULT_MB 500
+
+// the ASTs of tokens are discarded, so the storage for them
+// is released after this many tokens, to keep memory use bounded
+#define TOKENS_PER_RESET 1000000
+
+// Return the current time in nanoseconds
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Write a program of about mb megabytes to BENCH_FILE,
+// using a mix of keywords, identifiers, numbers, operators and comments
+// Return the number of bytes written
+static size_t write_program(unsigned int mb)
+{
+    FILE *f = fopen(BENCH_FILE, "w");
+    if (f == NULL) {
+	bail_with_error("Cannot create %s", BENCH_FILE);
+    }
+    size_t goal = (size_t) mb * 1024 * 1024;
+    size_t written = fprintf(f, "var x0, x1, x2, x3, x4, x5, x6, x7;\nbegin\n");
+    unsigned int i = 0;
+    while (written < goal) {
+	unsigned int v = i % 1000;
+	written += fprintf(f,
+			   "  if x%u <= %u then x%u := (x%u + %u) * 3"
+			   " else x%u := x%u / 2; %% comment %u\n"
+			   "  while x%u != 0 do begin read x%u; print -x%u end;\n",
+			   v, i, v, v, i, v, v, i, v, v, v);
+	i++;
+    }
+    written += fprintf(f, "  x0 := 0\nend.\n");
+    fclose(f);
+    return written;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int mb = DEFAULT_MB;
+    if (argc > 1) {
+	mb = (unsigned int) atoi(argv[1]);
+	if (mb == 0) {
+	    bail_with_error("Usage: %s [megabytes]", argv[0]);
+	}
+    }
+    size_t bytes = write_program(mb);
+    unsigned long tokens = 0;
+    unsigned long arena_allocs = 0;
+    AST lval;
+    double start = now_ns();
+    lexer_init(BENCH_FILE);
+    while (lexer_next(&lval) != 0) {
+	tokens++;
+	if (tokens % TOKENS_PER_RESET == 0) {
+	    arena_allocs += arena_allocation_count();
+	    intern_reset();
+	    arena_reset();
+	}
+    }
+    double elapsed = now_ns() - start;
+    arena_allocs += arena_allocation_count();
+    lexer_close();
+    file_location_reset();
+    intern_reset();
+    arena_reset();
+    remove(BENCH_FILE);
+    printf("%-12s %12s %12s %12s %14s\n",
+	   "MB", "tokens", "seconds", "MB/s", "ns/token");
+    printf("%-12.1f %12lu %12.2f %12.1f %14.1f\n",
+	   bytes / (1024.0 * 1024.0), tokens, elapsed / 1e9,
+	   bytes / (1024.0 * 1024.0) / (elapsed / 1e9), elapsed / tokens);
+    printf("arena allocations per token: %.2f\n",
+	   (double) arena_allocs / tokens);
+    return EXIT_SUCCESS;
+}
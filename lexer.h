@@ -1,7 +1,31 @@
 /* $Id: lexer.h,v 1.3 2024/10/06 01:25:18 leavens Exp $ */
 #ifndef _LEXER_H
 #define _LEXER_H
+#include <stdio.h>
 #include <stdbool.h>
+#include "file_location.h"
+#include "parser_types.h"
+
+// A lexer (its contents are private to spl_lexer.l).
+// Each thread reads with the default lexer, unless it has chosen
+// another with lexer_use (as each compilation under way does,
+// see compile_context.h), and the functions below that do not take
+// a lexer work on the lexer the thread is using.
+typedef struct lexer_s lexer;
+
+// Return a new lexer (which is not reading a file)
+extern lexer *lexer_create();
+
+// Release the lexer lx and the text it was reading
+// (if this thread is using lx, it goes back to the default lexer)
+extern void lexer_destroy(lexer *lx);
+
+// Make this thread read with the lexer lx
+// (or the default lexer, if lx is NULL)
+extern void lexer_use(lexer *lx);
+
+// Return the lexer this thread reads with
+extern lexer *lexer_current();
 
 // Requires: fname != NULL
 // Requires: fname is the name of a readable file
@@ -9,8 +33,65 @@
 // from the given file name
 extern void lexer_init(char *fname);
 
-// Return the next token in the input
-extern int yylex();
+// Requires: fname != NULL and text points to len chars
+// Initialize the lexer and start it reading a copy of the len chars
+// at text, as if they were the contents of the file named fname
+extern void lexer_init_text(char *fname, const char *text, size_t len);
+
+// Requires: the lexer has started reading a file, whose text is still open
+// Start the lexer reading its file again, from the start
+extern void lexer_rewind();
+
+// Requires: body was skipped by a lexer in lazy mode (see lexer_set_lazy)
+//           whose text is still open, and errors != NULL
+// Start lx reading the text of body, to be parsed as a block
+// (the first token read is bodystartsym, and the input ends
+// after the body's "end"), reporting errors on errors.
+// The body is scanned in place, in the text of the lexer that skipped it,
+// so several lexers can read the bodies of different procedures at once;
+// what flex writes in that text while scanning is undone
+// when lx is destroyed (or starts reading something else).
+extern void lexer_init_body(lexer *lx, const lazy_block_t *body,
+			    FILE *errors);
+
+// Make the lexer skip the body of each procedure declared
+// in the program's block (if lazy is true), or not.
+// A skipped body is read as one token, lazyblocksym,
+// whose value (a lazy_block_t) says where its text is,
+// so it can be parsed later (see parseProcBody).
+// Finding the "end" of a body only takes noting the words that start
+// and end blocks, ifs and whiles, so skipping is much faster than parsing.
+extern void lexer_set_lazy(bool lazy);
+
+// Make the lexer, in lazy mode, intern (see intern.h) the identifiers
+// in the bodies it skips (if intern is true), or not, so the lexers
+// that parse those bodies later only find their names in the intern table
+// (see intern_set_shared)
+extern void lexer_set_intern_bodies(bool intern);
+
+// Release the text of the file the lexer was reading (if any).
+// Spans of that text (source_span values) are meaningless afterwards.
+extern void lexer_close();
+
+// Return the next token in the input, putting its value in *lvalp
+extern int lexer_next(YYSTYPE *lvalp);
+
+// Return the next token read by lx, putting its value in *lvalp
+// (this is the scanner the parser calls)
+extern int yylex(YYSTYPE *lvalp, lexer *lx);
+
+// Report an error (msg) at the line lx has reached
+// to the user on its error file (stderr by default).
+// The output looks like: the filename, ":", the line number,
+// ": ", and then msg.
+extern void lexer_error(lexer *lx, const char *msg);
+
+// Make the lexer report errors on the file errors
+// (or on stderr, if errors is NULL)
+extern void lexer_set_errors(FILE *errors);
+
+// Return the file the lexer reports errors on
+extern FILE *lexer_errors();
 
 // Return the name of the current file
 extern const char *lexer_filename();
@@ -18,6 +99,13 @@ extern const char *lexer_filename();
 // Return the line number of the next token
 extern unsigned int lexer_line();
 
+// Return the location just after the last token read
+// (which is on the line lexer_line() returns)
+extern source_loc lexer_location();
+
+// Return the location just after the last token lx read
+extern source_loc lexer_location_of(const lexer *lx);
+
 // On standard output:
 // Print a message about the file name of the lexer's input
 // and then print a heading for the lexer's output.
@@ -0,0 +1,192 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include "libspl.h"
+#include "compile.h"
+#include "compile_context.h"
+#include "phase_stats.h"
+#include "arena.h"
+#include "utilities.h"
+
+// Each result keeps the compilation context its program was compiled in
+// (with the arena holding its AST), and freeing the result releases
+// the storage in that context and keeps the context for reuse,
+// so compiling another program does not have to allocate it again.
+
+// the most contexts kept for reuse
+#define SPL_POOLED_CONTEXTS 8
+
+// the contexts kept for reuse
+static compile_context *pool[SPL_POOLED_CONTEXTS];
+static unsigned int pooled = 0;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Set *opts to the default options: the program is named
+// SPL_DEFAULT_NAME, and it is unparsed and checked (with the tree AST)
+void spl_options_init(spl_options *opts)
+{
+    opts->name = NULL;
+    opts->unparse = true;
+    opts->check = true;
+    opts->flat = false;
+}
+
+// Return a context for a compilation (a pooled one if there is one),
+// or NULL if there is no space for one
+static compile_context *context_get()
+{
+    compile_context *ctx = NULL;
+    pthread_mutex_lock(&pool_lock);
+    if (pooled > 0) {
+	ctx = pool[--pooled];
+    }
+    pthread_mutex_unlock(&pool_lock);
+    if (ctx == NULL) {
+	error_trap trap;
+	if (setjmp(trap.env) == 0) {
+	    error_trap_push(&trap);
+	    ctx = compile_context_create();
+	    error_trap_pop(&trap);
+	}
+    }
+    return ctx;
+}
+
+// Put ctx (whose storage has been released) back in the pool,
+// or destroy it if the pool is full
+static void context_put(compile_context *ctx)
+{
+    pthread_mutex_lock(&pool_lock);
+    if (pooled < SPL_POOLED_CONTEXTS) {
+	pool[pooled++] = ctx;
+	ctx = NULL;
+    }
+    pthread_mutex_unlock(&pool_lock);
+    if (ctx != NULL) {
+	compile_context_destroy(ctx);
+    }
+}
+
+// Requires: src points to len chars and result != NULL
+// Compile as spl_compile_buffer does, but with errno as it is
+static int compile_buffer(const char *src, size_t len,
+			  const spl_options *opts, spl_result *result)
+{
+    spl_options defaults;
+    if (opts == NULL) {
+	spl_options_init(&defaults);
+	opts = &defaults;
+    }
+    compile_options copts;
+    copts.flat = opts->flat;
+    copts.lazy = false;
+    copts.parallel_parse = false;
+    copts.phases = 1u << phase_parse;
+    if (opts->unparse) {
+	copts.phases |= 1u << phase_unparse;
+    }
+    if (opts->check) {
+	copts.phases |= 1u << phase_check;
+    }
+    copts.stats = false;
+    copts.stats_json = false;
+    copts.cache = NULL;
+    copts.emit_ast = NULL;
+
+    result->ast = NULL;
+    result->output = result->diagnostics = NULL;
+    result->output_size = result->diagnostics_size = 0;
+    compile_context *ctx = context_get();
+    if (ctx == NULL) {
+	return -1;
+    }
+    FILE *out = open_memstream(&result->output, &result->output_size);
+    FILE *err = open_memstream(&result->diagnostics,
+			       &result->diagnostics_size);
+    if (out == NULL || err == NULL) {
+	if (out != NULL) {
+	    fclose(out);
+	}
+	if (err != NULL) {
+	    fclose(err);
+	}
+	free(result->output);
+	free(result->diagnostics);
+	context_put(ctx);
+	return -1;
+    }
+
+    // compile in ctx, leaving the caller's thread in the context it was in
+    compile_context *caller = compile_context_current();
+    compile_context_enter(ctx);
+    // (the name is copied into the arena, as the AST's locations refer to it)
+    const char *name = (opts->name != NULL) ? opts->name : SPL_DEFAULT_NAME;
+    error_trap trap;
+    char *volatile copy = NULL;
+    if (setjmp(trap.env) == 0) {
+	error_trap_push(&trap);
+	copy = arena_strdup(name);
+	error_trap_pop(&trap);
+    }
+    block_t *ast = NULL;
+    if (copy != NULL) {
+	result->status = compile_text_keeping_ast(copy, src, len, &copts,
+						  out, err, &ast);
+    } else {
+	fprintf(err, "%s\n", trap.message);
+	result->status = EXIT_FAILURE;
+    }
+    compile_context_enter(caller);
+
+    fclose(out);
+    fclose(err);
+    result->ast = ast;
+    result->storage = ctx;
+    return result->status;
+}
+
+// Requires: src points to len chars and result != NULL
+// Compile the program that is the len chars at src, as opts says
+// (or with the default options, if opts is NULL), putting the result
+// in *result, which the caller must free with spl_result_free.
+// The caller's errno is neither used in the diagnostics nor changed.
+// Return result->status, or -1 if there was not enough storage
+// to compile the program (and then result needs no freeing).
+int spl_compile_buffer(const char *src, size_t len,
+		       const spl_options *opts, spl_result *result)
+{
+    int saved_errno = errno;
+    errno = 0;
+    int rc = compile_buffer(src, len, opts, result);
+    errno = saved_errno;
+    return rc;
+}
+
+// Free all the storage used by result (including its AST)
+void spl_result_free(spl_result *result)
+{
+    compile_context *ctx = (compile_context *) result->storage;
+    if (ctx != NULL) {
+	compile_context *caller = compile_context_current();
+	compile_context_enter(ctx);
+	compile_release();
+	compile_context_enter(caller);
+	context_put(ctx);
+    }
+    free(result->output);
+    free(result->diagnostics);
+    result->ast = NULL;
+    result->output = result->diagnostics = NULL;
+    result->output_size = result->diagnostics_size = 0;
+    result->storage = NULL;
+}
+
+// Free the storage this thread keeps for compiling programs
+// (the results it has not freed stay valid)
+void spl_thread_release()
+{
+    compile_thread_release();
+}
@@ -0,0 +1,63 @@
+#ifndef _LIBSPL_H
+#define _LIBSPL_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "ast.h"
+
+// The SPL compiler as a library (libspl.a or libspl.so):
+// it compiles programs held in memory, returning the program's AST,
+// the unparsed program and the diagnostics in a result,
+// and never exits the process (errors in a program are diagnostics).
+// Several threads may compile at once. Each thread keeps some storage
+// for compiling from one program to the next, which it should free
+// with spl_thread_release when it is done compiling (e.g., before it
+// exits).
+
+// What to do with a program
+typedef struct {
+    const char *name; // the program's name in diagnostics (if not NULL)
+    bool unparse;     // produce the unparsed program as the output
+    bool check;       // scope check the program
+    bool flat;        // unparse and check using the flat AST layout
+} spl_options;
+
+// The name of a program that has none (see spl_options)
+#define SPL_DEFAULT_NAME "<buffer>"
+
+// The result of compiling a program
+typedef struct {
+    int status;          // 0 if there were no errors, otherwise
+                         // the compiler's exit code for them
+    const block_t *ast;  // the program's AST (or NULL, if it could not
+                         // be parsed), with its names and locations,
+                         // valid until the result is freed
+    char *output;        // the unparsed program (null terminated)
+    size_t output_size;
+    char *diagnostics;   // the error messages (null terminated)
+    size_t diagnostics_size;
+    void *storage;       // (private: the storage the result uses)
+} spl_result;
+
+// Set *opts to the default options: the program is named
+// SPL_DEFAULT_NAME, and it is unparsed and checked (with the tree AST)
+extern void spl_options_init(spl_options *opts);
+
+// Requires: src points to len chars and result != NULL
+// Compile the program that is the len chars at src, as opts says
+// (or with the default options, if opts is NULL), putting the result
+// in *result, which the caller must free with spl_result_free.
+// The caller's errno is neither used in the diagnostics nor changed.
+// Return result->status, or -1 if there was not enough storage
+// to compile the program (and then result needs no freeing).
+extern int spl_compile_buffer(const char *src, size_t len,
+			      const spl_options *opts, spl_result *result);
+
+// Free all the storage used by result (including its AST)
+extern void spl_result_free(spl_result *result);
+
+// Free the storage this thread keeps for compiling programs
+// (the results it has not freed stay valid)
+extern void spl_thread_release();
+
+#endif
@@ -0,0 +1,130 @@
+// Test of the library (see libspl.h): compiles each file named
+// on the command line with spl_compile_buffer, all in this process,
+// printing the output and then the diagnostics for each, in order,
+// as the compiler would have (so they can be compared with the .out files).
+// The results are all kept until the end, so each program's AST must
+// stay valid while the others are compiled; a program that is parsed
+// without errors must have an AST.
+// Each file is also compiled without unparsing it, with errno set
+// beforehand (as a host application might leave it), which must give
+// the same diagnostics and leave errno as it was.
+// Exits with the status of the first compilation that failed.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+#include "libspl.h"
+
+// Read all of the file named fname, returning its contents (from malloc)
+// and putting its length in *len
+static char *read_file(const char *fname, size_t *len)
+{
+    FILE *f = fopen(fname, "r");
+    if (f == NULL) {
+	perror(fname);
+	exit(EXIT_FAILURE);
+    }
+    size_t capacity = 4096;
+    size_t n = 0;
+    char *buf = (char *) malloc(capacity);
+    while (buf != NULL) {
+	n += fread(buf + n, 1, capacity - n, f);
+	if (n < capacity) {
+	    break;
+	}
+	capacity *= 2;
+	buf = (char *) realloc(buf, capacity);
+    }
+    fclose(f);
+    if (buf == NULL) {
+	fprintf(stderr, "No space to read %s!\n", fname);
+	exit(EXIT_FAILURE);
+    }
+    *len = n;
+    return buf;
+}
+
+// Compile the len chars at src (from the file named fname) without
+// unparsing them, with errno set beforehand, and return true
+// if that gives the diagnostics in expected and leaves errno as it was,
+// otherwise printing what is wrong on stderr
+static bool quiet_compile_ok(const char *fname, const char *src, size_t len,
+			     const spl_result *expected)
+{
+    spl_options opts;
+    spl_options_init(&opts);
+    opts.name = fname;
+    opts.unparse = false;
+    spl_result result;
+    errno = ENOENT;
+    int rc = spl_compile_buffer(src, len, &opts, &result);
+    bool ok = errno == ENOENT;
+    if (!ok) {
+	fprintf(stderr, "%s: errno changed by spl_compile_buffer!\n", fname);
+    }
+    if (rc < 0) {
+	fprintf(stderr, "No space to compile %s!\n", fname);
+	return false;
+    }
+    if (result.diagnostics_size != expected->diagnostics_size
+	|| memcmp(result.diagnostics, expected->diagnostics,
+		  result.diagnostics_size) != 0) {
+	fprintf(stderr, "%s: different diagnostics without unparsing:\n",
+		fname);
+	fwrite(result.diagnostics, 1, result.diagnostics_size, stderr);
+	ok = false;
+    }
+    spl_result_free(&result);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+	fprintf(stderr, "Usage: %s file.spl ...\n", argv[0]);
+	exit(EXIT_FAILURE);
+    }
+    unsigned int count = argc - 1;
+    spl_result *results = (spl_result *) calloc(count, sizeof(spl_result));
+    if (results == NULL) {
+	fprintf(stderr, "No space for %u results!\n", count);
+	exit(EXIT_FAILURE);
+    }
+    spl_options opts;
+    spl_options_init(&opts);
+    int status = 0;
+    for (unsigned int i = 0; i < count; i++) {
+	size_t len;
+	char *src = read_file(argv[i + 1], &len);
+	opts.name = argv[i + 1];
+	int rc = spl_compile_buffer(src, len, &opts, &results[i]);
+	if (rc < 0) {
+	    fprintf(stderr, "No space to compile %s!\n", argv[i + 1]);
+	    exit(EXIT_FAILURE);
+	}
+	if (!quiet_compile_ok(argv[i + 1], src, len, &results[i])) {
+	    status = EXIT_FAILURE;
+	}
+	// (the result must not depend on the source text after this)
+	free(src);
+	fwrite(results[i].output, 1, results[i].output_size, stdout);
+	fflush(stdout);
+	fwrite(results[i].diagnostics, 1, results[i].diagnostics_size, stderr);
+	fflush(stderr);
+	if (status == 0) {
+	    status = rc;
+	}
+    }
+    for (unsigned int i = 0; i < count; i++) {
+	if (results[i].status == 0 && results[i].ast == NULL) {
+	    fprintf(stderr, "%s: no AST for a program without errors!\n",
+		    argv[i + 1]);
+	    status = EXIT_FAILURE;
+	}
+	spl_result_free(&results[i]);
+    }
+    spl_thread_release();
+    free(results);
+    return status;
+}
@@ -0,0 +1,203 @@
+// Stress test for deeply nested programs: generates programs nested
+// 100000 and 1000000 levels deep (or as deep as the argument says)
+// and checks that they can be parsed, scope checked (in both AST layouts),
+// and (when the output is not too big) unparsed,
+// none of which may be limited by the depth of the C call stack.
+// Prints one line per program and exits with a failure code
+// if anything is wrong.
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "lexer.h"
+#include "parser.h"
+#include "flat_ast.h"
+#include "symtab.h"
+#include "scope_check.h"
+#include "unparser.h"
+#include "file_location.h"
+#include "arena.h"
+#include "intern.h"
+#include "utilities.h"
+
+// name of the generated program file
+#define TEST_FILE "nesting_test.tmp.spl"
+
+// the depths tested by default
+#define SHALLOW_DEPTH 100000
+#define DEEP_DEPTH 1000000
+
+// shapes of the generated programs
+typedef enum {
+    shape_expr,  // a print of nested binary and negated expressions
+    shape_ifs,   // nested if and while statements
+    shape_blocks // nested blocks, each declaring a variable
+} shape;
+
+static const char *shape_names[] = { "expr", "ifs", "blocks" };
+
+// Return the current time in nanoseconds
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Write a program of the given shape nested depth levels deep
+static void write_program(shape s, unsigned int depth)
+{
+    FILE *f = fopen(TEST_FILE, "w");
+    if (f == NULL) {
+	bail_with_error("Cannot create %s", TEST_FILE);
+    }
+    fprintf(f, "begin\n  var x;\n");
+    switch (s) {
+    case shape_expr:
+	fprintf(f, "  print ");
+	for (unsigned int i = 0; i < depth; i++) {
+	    fprintf(f, (i % 2 == 0) ? "(x + " : "-(");
+	}
+	fprintf(f, "x");
+	for (unsigned int i = 0; i < depth; i++) {
+	    fprintf(f, ")");
+	}
+	fprintf(f, "\n");
+	break;
+    case shape_ifs:
+	for (unsigned int i = 0; i < depth; i++) {
+	    fprintf(f, (i % 2 == 0) ? "if x < %u then\n" : "while x > %u do\n",
+		    i);
+	}
+	fprintf(f, "x := 0\n");
+	for (unsigned int i = 0; i < depth; i++) {
+	    fprintf(f, "end\n");
+	}
+	break;
+    case shape_blocks:
+	for (unsigned int i = 0; i < depth; i++) {
+	    fprintf(f, "begin var y;\n");
+	}
+	fprintf(f, "x := y\n");
+	for (unsigned int i = 0; i < depth; i++) {
+	    fprintf(f, "end\n");
+	}
+	break;
+    }
+    fprintf(f, "end.\n");
+    fclose(f);
+}
+
+// Return the innermost statement of prog (a program of shape_blocks)
+static stmt_t *innermost_stmt(block_t *prog)
+{
+    stmt_t *sp = prog->stmts.stmt_list.start;
+    while (sp->stmt_kind == block_stmt) {
+	sp = sp->data.block_stmt.block->stmts.stmt_list.start;
+    }
+    return sp;
+}
+
+// Return the index of the first statement in the innermost block of
+// the flat AST fa of a program of shape shape_blocks
+static flat_index flat_innermost_stmt(const flat_ast *fa)
+{
+    flat_index s = fa->blocks.stmts[fa->root].first;
+    while (fa->stmts.kind[s] == block_stmt) {
+	s = fa->blocks.stmts[fa->stmts.a[s]].first;
+    }
+    return s;
+}
+
+// Return true if the bindings x and y of the innermost assignment
+// are what they should be in a program nested depth levels deep,
+// printing an error message if not
+static bool bindings_ok(id_binding x, id_binding y, unsigned int depth)
+{
+    if (!x.resolved || x.levelsOutward != depth
+	|| !y.resolved || y.levelsOutward != 0) {
+	fprintf(stderr, "wrong bindings (levels outward %u and %u)\n",
+		x.levelsOutward, y.levelsOutward);
+	return false;
+    }
+    return true;
+}
+
+// Test the program of shape s nested depth levels deep,
+// returning true if it passed
+static bool test(shape s, unsigned int depth)
+{
+    write_program(s, depth);
+    double start = now_ns();
+    lexer_init(TEST_FILE);
+    block_t prog;
+    if (tryParseProgram(&prog) != 0) {
+	bail_with_error("Cannot parse %s!", TEST_FILE);
+    }
+    symtab_initialize();
+    scope_check_program(&prog);
+
+    bool passed = true;
+    if (s == shape_blocks) {
+	// the innermost use of x is depth levels inside its declaration,
+	// and y is declared in the innermost block
+	stmt_t *sp = innermost_stmt(&prog);
+	passed = bindings_ok(sp->data.assign_stmt.binding,
+			     sp->data.assign_stmt.expr->data.ident.binding,
+			     depth);
+    }
+    if (s == shape_expr) {
+	// (indentation makes the unparsed output of nested statements
+	//  quadratic in the depth, so only expressions are unparsed)
+	FILE *devnull = fopen("/dev/null", "w");
+	if (devnull == NULL) {
+	    bail_with_error("Cannot open /dev/null");
+	}
+	unparseProgram(devnull, prog);
+	fclose(devnull);
+    }
+
+    flat_ast *fa = flat_ast_build(prog);
+    symtab_initialize();
+    scope_check_flat_program(fa);
+    if (s == shape_blocks) {
+	// (and the flat checker fills in the same bindings)
+	flat_index i = flat_innermost_stmt(fa);
+	passed = bindings_ok(fa->stmts.binding[i],
+			     fa->exprs.binding[fa->stmts.b[i]], depth)
+	    && passed;
+    }
+    flat_ast_destroy(fa);
+    double elapsed = now_ns() - start;
+
+    printf("%-8s %10u %12.1f %s\n", shape_names[s], depth, elapsed / 1e6,
+	   passed ? "passed" : "FAILED");
+
+    lexer_close();
+    file_location_reset();
+    intern_reset();
+    arena_reset();
+    return passed;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int depths[] = { SHALLOW_DEPTH, DEEP_DEPTH };
+    unsigned int num_depths = 2;
+    if (argc > 1) {
+	depths[0] = (unsigned int) atoi(argv[1]);
+	num_depths = 1;
+	if (depths[0] == 0) {
+	    bail_with_error("Usage: %s [depth]", argv[0]);
+	}
+    }
+    printf("%-8s %10s %12s\n", "shape", "depth", "ms");
+    bool passed = true;
+    for (unsigned int d = 0; d < num_depths; d++) {
+	for (shape s = shape_expr; s <= shape_blocks; s++) {
+	    passed = test(s, depths[d]) && passed;
+	}
+    }
+    remove(TEST_FILE);
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,166 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "out_buffer.h"
+#include "utilities.h"
+
+// initial number of bytes a buffer has room for
+#define INITIAL_OUT_BUFFER_CAPACITY (64 * 1024)
+
+// spaces copied for indentation (so no loop per space is needed)
+static const char spaces[]
+    = "                                                                "
+      "                                                                ";
+
+// Start collecting output to be written to f
+// (anything already buffered by stdio for f is flushed first)
+void out_buffer_open(out_buffer *ob, FILE *f)
+{
+    fflush(f);
+    ob->data = NULL;
+    ob->size = 0;
+    ob->capacity = 0;
+    ob->file = f;
+}
+
+// Start collecting output in memory
+void out_buffer_init(out_buffer *ob)
+{
+    ob->data = NULL;
+    ob->size = 0;
+    ob->capacity = 0;
+    ob->file = NULL;
+}
+
+// Write the n bytes at p to f, with write(2) if f has a descriptor
+// (and otherwise with fwrite, e.g., for memory streams)
+static void out_buffer_write(FILE *f, const char *p, size_t n)
+{
+    int fd = fileno(f);
+    if (fd < 0) {
+	if (fwrite(p, 1, n, f) != n) {
+	    bail_with_error("Cannot write output!");
+	}
+	return;
+    }
+    while (n > 0) {
+	ssize_t written = write(fd, p, n);
+	if (written < 0) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    bail_with_error("Cannot write output!");
+	}
+	p += written;
+	n -= (size_t) written;
+    }
+}
+
+// Write the output collected in ob to its file (if it has one)
+void out_buffer_flush(out_buffer *ob)
+{
+    if (ob->file != NULL && ob->size > 0) {
+	out_buffer_write(ob->file, ob->data, ob->size);
+	ob->size = 0;
+    }
+}
+
+// Flush ob and free the storage it uses
+void out_buffer_close(out_buffer *ob)
+{
+    out_buffer_flush(ob);
+    free(ob->data);
+    ob->data = NULL;
+    ob->size = 0;
+    ob->capacity = 0;
+}
+
+// Make room in ob for n more bytes, flushing or growing it as needed
+void out_buffer_reserve(out_buffer *ob, size_t n)
+{
+    if (ob->size + n <= ob->capacity) {
+	return;
+    }
+    if (ob->file != NULL && ob->size >= OUT_BUFFER_FLUSH_SIZE) {
+	out_buffer_flush(ob);
+	if (n <= ob->capacity) {
+	    return;
+	}
+    }
+    size_t capacity = (ob->capacity == 0) ? INITIAL_OUT_BUFFER_CAPACITY
+	                                  : 2 * ob->capacity;
+    while (capacity < ob->size + n) {
+	capacity *= 2;
+    }
+    char *bigger = (char *) realloc(ob->data, capacity);
+    if (bigger == NULL) {
+	bail_with_error("No space for %zu bytes of output!", capacity);
+    }
+    ob->data = bigger;
+    ob->capacity = capacity;
+}
+
+// Add the n bytes at p to ob
+void out_buffer_put_bytes(out_buffer *ob, const char *p, size_t n)
+{
+    if (ob->file != NULL && n >= OUT_BUFFER_FLUSH_SIZE) {
+	// (large pieces are written directly, not copied)
+	out_buffer_flush(ob);
+	out_buffer_write(ob->file, p, n);
+	return;
+    }
+    out_buffer_reserve(ob, n);
+    memcpy(ob->data + ob->size, p, n);
+    ob->size += n;
+}
+
+// Add the string s to ob
+void out_buffer_put_string(out_buffer *ob, const char *s)
+{
+    out_buffer_put_bytes(ob, s, strlen(s));
+}
+
+// Add the character c to ob
+void out_buffer_put_char(out_buffer *ob, char c)
+{
+    out_buffer_reserve(ob, 1);
+    ob->data[ob->size++] = c;
+}
+
+// Add the decimal numeral for n to ob (as printf's %d would)
+void out_buffer_put_int(out_buffer *ob, int n)
+{
+    // the digits are produced backwards, from the end of digits
+    char digits[16];
+    char *p = digits + sizeof(digits);
+    // (the magnitude is unsigned, so the most negative int works)
+    unsigned int magnitude = (n < 0) ? 0u - (unsigned int) n : (unsigned int) n;
+    do {
+	*--p = (char) ('0' + magnitude % 10);
+	magnitude /= 10;
+    } while (magnitude != 0);
+    if (n < 0) {
+	*--p = '-';
+    }
+    out_buffer_put_bytes(ob, p, (size_t) (digits + sizeof(digits) - p));
+}
+
+// Add n spaces to ob
+void out_buffer_put_spaces(out_buffer *ob, unsigned int n)
+{
+    while (n > 0) {
+	unsigned int chunk = (n < sizeof(spaces) - 1) ? n : sizeof(spaces) - 1;
+	out_buffer_put_bytes(ob, spaces, chunk);
+	n -= chunk;
+    }
+}
+
+// Add the contents of the buffer src to ob
+void out_buffer_append(out_buffer *ob, const out_buffer *src)
+{
+    if (src->size > 0) {
+	out_buffer_put_bytes(ob, src->data, src->size);
+    }
+}
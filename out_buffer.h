@@ -0,0 +1,57 @@
+#ifndef _OUT_BUFFER_H
+#define _OUT_BUFFER_H
+#include <stdio.h>
+#include <stddef.h>
+
+// An out_buffer collects output in a growable block of memory.
+// A buffer opened on a FILE is written to that file's descriptor
+// with write(2) whenever OUT_BUFFER_FLUSH_SIZE bytes have collected
+// (and when it is flushed or closed), instead of going through stdio;
+// a buffer in memory just grows, and its contents can be appended
+// to another buffer.
+
+// number of bytes collected before a buffer opened on a file is written
+#define OUT_BUFFER_FLUSH_SIZE (1024 * 1024)
+
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+    FILE *file; // NULL for a buffer in memory
+} out_buffer;
+
+// Start collecting output to be written to f
+// (anything already buffered by stdio for f is flushed first)
+extern void out_buffer_open(out_buffer *ob, FILE *f);
+
+// Start collecting output in memory
+extern void out_buffer_init(out_buffer *ob);
+
+// Write the output collected in ob to its file (if it has one)
+extern void out_buffer_flush(out_buffer *ob);
+
+// Flush ob and free the storage it uses
+extern void out_buffer_close(out_buffer *ob);
+
+// Make room in ob for n more bytes, flushing or growing it as needed
+extern void out_buffer_reserve(out_buffer *ob, size_t n);
+
+// Add the n bytes at p to ob
+extern void out_buffer_put_bytes(out_buffer *ob, const char *p, size_t n);
+
+// Add the string s to ob
+extern void out_buffer_put_string(out_buffer *ob, const char *s);
+
+// Add the character c to ob
+extern void out_buffer_put_char(out_buffer *ob, char c);
+
+// Add the decimal numeral for n to ob (as printf's %d would)
+extern void out_buffer_put_int(out_buffer *ob, int n);
+
+// Add n spaces to ob
+extern void out_buffer_put_spaces(out_buffer *ob, unsigned int n);
+
+// Add the contents of the buffer src to ob
+extern void out_buffer_append(out_buffer *ob, const out_buffer *src);
+
+#endif
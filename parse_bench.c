@@ -0,0 +1,67 @@
+// Benchmark for parsing long statement lists:
+// the time per statement should stay flat as the number
+// of statements in a block grows (so parsing is linear).
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "lexer.h"
+#include "parser.h"
+#include "arena.h"
+#include "intern.h"
+#include "utilities.h"
+
+// name of the generated program file
+#define BENCH_FILE "parse_bench.tmp.spl"
+
+// numbers of statements in the generated programs
+static const unsigned int sizes[] = { 1000, 10000, 100000, 1000000 };
+
+// Return the current time in nanoseconds
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Write a program with a block of n assignment statements to BENCH_FILE
+static void write_program(unsigned int n)
+{
+    FILE *f = fopen(BENCH_FILE, "w");
+    if (f == NULL) {
+	bail_with_error("Cannot create %s", BENCH_FILE);
+    }
+    fprintf(f, "begin\n  var x;\n");
+    for (unsigned int i = 0; i < n; i++) {
+	fprintf(f, "  x := %u%s\n", i, (i + 1 < n) ? ";" : "");
+    }
+    fprintf(f, "end.\n");
+    fclose(f);
+}
+
+int main()
+{
+    printf("%-10s %12s %12s\n", "stmts", "parse ms", "ns/stmt");
+    for (int k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+	unsigned int n = sizes[k];
+	write_program(n);
+	double start = now_ns();
+	lexer_init(BENCH_FILE);
+	block_t prog;
+	if (tryParseProgram(&prog) != 0) {
+	    bail_with_error("Cannot parse %s!", BENCH_FILE);
+	}
+	double elapsed = now_ns() - start;
+	if (ast_list_length(prog.stmts.stmt_list.start) != n) {
+	    bail_with_error("Parsed the wrong number of statements!");
+	}
+	printf("%-10u %12.1f %12.1f\n", n, elapsed / 1e6, elapsed / n);
+	intern_reset();
+	arena_reset();
+	lexer_close();
+	file_location_reset();
+    }
+    remove(BENCH_FILE);
+    return EXIT_SUCCESS;
+}
@@ -1,20 +1,246 @@
 /* $Id: parser.c,v 1.20 2023/10/15 02:46:46 leavens Exp $ */
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <stdatomic.h>
 #include "parser.h"
+#include "lexer.h"
+#include "arena.h"
+#include "intern.h"
+#include "compile_context.h"
+#include "thread_pool.h"
 #include "utilities.h"
 
-// Parse a PL/0 program from the given file,
-// putting the AST into progast
-extern int yyparse (char const *file_name);
+// Parse a PL/0 program using the tokens from the lexer lx,
+// putting the AST into *prog (generated by bison from spl.y)
+extern int yyparse (lexer *lx, block_t *prog);
 
 // Parse a PL/0 program using the tokens from the lexer,
-// returning the program's AST
-extern block_t parseProgram(char const *file_name)
+// putting the program's AST in *prog.
+// Return 0 if that worked, and otherwise (after the syntax errors
+// have been reported) the nonzero code yyparse returned.
+extern int tryParseProgram(block_t *prog)
 {
-    int rc = yyparse(file_name);
+    return yyparse(lexer_current(), prog);
+}
+
+// Requires: pd's body was skipped by the lexer, which is still open
+// Parse the body of pd (with a lexer of its own), putting the messages
+// about it (if any, each ending with a newline) in *msgs and their size
+// in *msgs_size (so the caller should free *msgs), and setting pd->block
+// if there were no syntax errors.
+// Return 0, or the nonzero code yyparse returned.
+static int parse_body(proc_decl_t *pd, char **msgs, size_t *msgs_size)
+{
+    FILE *errors = open_memstream(msgs, msgs_size);
+    if (errors == NULL) {
+	bail_with_error("No space to parse the body of procedure %s!",
+			pd->name);
+    }
+    lexer *lx = lexer_create();
+    // (the lexer is destroyed even if the parse stops with an error,
+    // which puts back what it wrote in the text it scans in place)
+    error_trap trap;
+    if (setjmp(trap.env) != 0) {
+	lexer_destroy(lx);
+	fclose(errors);
+	free(*msgs);
+	bail_with_message(trap.message);
+    }
+    error_trap_push(&trap);
+    lexer_init_body(lx, pd->body, errors);
+    block_t *blk = (block_t *) arena_alloc(sizeof(block_t));
+    int rc = yyparse(lx, blk);
+    error_trap_pop(&trap);
+    lexer_destroy(lx);
+    fclose(errors);
+    if (rc == 0) {
+	pd->block = blk;
+    }
+    return rc;
+}
+
+// Requires: pd was parsed by this thread's lexer, which is still open
+// Return the block of the procedure pd, first parsing its body,
+// if the lexer skipped it (in lazy mode, see lexer_set_lazy).
+// A syntax error in the body is reported as the error that stops
+// the compilation (with bail_with_error).
+extern block_t *parseProcBody(proc_decl_t *pd)
+{
+    if (pd->block != NULL || pd->body == NULL) {
+	return pd->block;
+    }
+    // the errors are collected, so a syntax error (after which
+    // bison stops) can be reported as the error that stops the compilation
+    char *msgs;
+    size_t msgs_size;
+    int rc = parse_body(pd, &msgs, &msgs_size);
     if (rc != 0) {
-	exit(rc);
+	// (without the newline that ends the last message)
+	if (msgs_size > 0 && msgs[msgs_size-1] == '\n') {
+	    msgs[msgs_size-1] = '\0';
+	}
+	char *msg = arena_strdup(msgs);
+	free(msgs);
+	// (a syntax error is not an OS error, whatever errno is)
+	bail_with_message(msg);
+    }
+    // (other errors, such as invalid characters, do not stop parsing)
+    fputs(msgs, lexer_errors());
+    free(msgs);
+    return pd->block;
+}
+
+// Requires: the procedures in pds were parsed by this thread's lexer,
+//           which is still open
+// Parse the bodies of the procedures in pds that were skipped,
+// as parseProcBody does
+extern void parseProcBodies(proc_decls_t *pds)
+{
+    for (proc_decl_t *pd = pds->proc_decls; pd != NULL; pd = pd->next) {
+	parseProcBody(pd);
+    }
+}
+
+//--------------------------------------------------------------
+// Parsing procedure bodies in parallel
+//--------------------------------------------------------------
+
+// The program is first parsed with the lexer skipping the body
+// of each procedure declared in its block (as in lazy mode),
+// which only takes finding the "end" of each body
+// (and interning the identifiers in it).
+// Then the bodies are parsed by worker threads, each with a lexer
+// (scanning the body in place) and a (reentrant) parser of its own,
+// and each body's block is put in its proc_decl_t, so the AST is
+// the same as when parsing with one thread. As the names in the bodies
+// were interned already, the workers find them in the intern table
+// without waiting for each other (see intern_set_shared). Nothing is reported while doing that:
+// if the parser or lexer would report anything (which is rare),
+// the program is parsed again with one thread, which reports it,
+// so the diagnostics are also the same as when parsing with one thread.
+
+// the number of threads tryParseProgramParallel uses
+static unsigned int parse_threads = 1;
+
+// Make tryParseProgramParallel use the given number of threads (at least 1)
+extern void parseSetThreads(unsigned int threads)
+{
+    parse_threads = (threads > 0) ? threads : 1;
+}
+
+// The procedures whose bodies are parsed in parallel
+typedef struct {
+    proc_decl_t **pds;
+    compile_context *context; // the compilation's context
+    // would anything have been reported about a body?
+    _Atomic bool reported;
+} body_batch;
+
+// Parse the body of the procedure numbered task in ctx (a body_batch),
+// noting if anything would be reported about it
+static void parse_body_task(void *ctx, unsigned int task, unsigned int worker)
+{
+    body_batch *batch = (body_batch *) ctx;
+    if (atomic_load(&batch->reported)) {
+	// (the program will be parsed again anyway)
+	return;
+    }
+    compile_context_enter(batch->context);
+    error_trap trap;
+    if (setjmp(trap.env) == 0) {
+	error_trap_push(&trap);
+	char *msgs;
+	size_t msgs_size;
+	if (parse_body(batch->pds[task], &msgs, &msgs_size) != 0
+	    || msgs_size > 0) {
+	    atomic_store(&batch->reported, true);
+	}
+	free(msgs);
+	error_trap_pop(&trap);
+    } else {
+	atomic_store(&batch->reported, true);
+    }
+}
+
+// Finish a worker thread's use of the compilation's storage
+static void parse_body_done(void *ctx, unsigned int worker)
+{
+    arena_thread_done();
+    compile_context_enter(NULL);
+}
+
+// Requires: the procedures in pds were parsed by this thread's lexer,
+//           which is still open
+// Parse the bodies of the procedures in pds that were skipped in parallel,
+// reporting nothing, and return true if there was nothing to report
+static bool parse_bodies_parallel(proc_decls_t *pds)
+{
+    unsigned int n = 0;
+    for (proc_decl_t *pd = pds->proc_decls; pd != NULL; pd = pd->next) {
+	if (pd->block == NULL && pd->body != NULL) {
+	    n++;
+	}
+    }
+    if (n == 0) {
+	return true;
+    }
+    body_batch batch;
+    batch.pds = (proc_decl_t **) malloc(n * sizeof(proc_decl_t *));
+    if (batch.pds == NULL) {
+	bail_with_error("No space to parse procedures in parallel!");
+    }
+    n = 0;
+    for (proc_decl_t *pd = pds->proc_decls; pd != NULL; pd = pd->next) {
+	if (pd->block == NULL && pd->body != NULL) {
+	    batch.pds[n++] = pd;
+	}
+    }
+    batch.context = compile_context_current();
+    atomic_init(&batch.reported, false);
+    // (the workers intern the names in the bodies in the same table,
+    // where the lexer put them while skipping the bodies)
+    intern_set_shared(true);
+    thread_pool_run(n, parse_threads, parse_body_task, parse_body_done,
+		    &batch);
+    intern_set_shared(false);
+    free(batch.pds);
+    return !atomic_load(&batch.reported);
+}
+
+// Parse a PL/0 program using the tokens from the lexer,
+// as tryParseProgram does, but parsing the bodies of the procedures
+// declared in the program's block in parallel
+// (with the number of threads set by parseSetThreads),
+// giving the same AST and diagnostics as tryParseProgram.
+extern int tryParseProgramParallel(block_t *prog)
+{
+    if (parse_threads <= 1) {
+	return tryParseProgram(prog);
+    }
+    FILE *errors = lexer_errors();
+    char *msgs;
+    size_t msgs_size;
+    FILE *quiet = open_memstream(&msgs, &msgs_size);
+    if (quiet == NULL) {
+	return tryParseProgram(prog);
+    }
+    lexer_set_errors(quiet);
+    lexer_set_lazy(true);
+    lexer_set_intern_bodies(true);
+    int rc = tryParseProgram(prog);
+    lexer_set_intern_bodies(false);
+    lexer_set_lazy(false);
+    lexer_set_errors(errors);
+    fclose(quiet);
+    bool reported = rc != 0 || msgs_size > 0;
+    free(msgs);
+    if (!reported && parse_bodies_parallel(&prog->proc_decls)) {
+	return 0;
     }
-    return progast;
+    // (the first AST is abandoned in the arena)
+    lexer_rewind();
+    return tryParseProgram(prog);
 }
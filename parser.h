@@ -4,10 +4,33 @@
 #define _PARSER_H
 #include "ast.h"
 
-extern block_t progast;
+// Parse a PL/0 program using the tokens from the lexer,
+// putting the program's AST in *prog.
+// Return 0 if that worked, and otherwise (after the syntax errors
+// have been reported) the nonzero code yyparse returned.
+extern int tryParseProgram(block_t *prog);
+
+// Make tryParseProgramParallel use the given number of threads (at least 1)
+extern void parseSetThreads(unsigned int threads);
 
 // Parse a PL/0 program using the tokens from the lexer,
-// returning the program's AST
-extern block_t parseProgram(char const *file_name);
+// as tryParseProgram does, but parsing the bodies of the procedures
+// declared in the program's block in parallel
+// (with the number of threads set by parseSetThreads),
+// giving the same AST and diagnostics as tryParseProgram.
+extern int tryParseProgramParallel(block_t *prog);
+
+// Requires: pd was parsed by this thread's lexer, which is still open
+// Return the block of the procedure pd, first parsing its body,
+// if the lexer skipped it (in lazy mode, see lexer_set_lazy).
+// A syntax error in the body is reported as the error that stops
+// the compilation (with bail_with_error).
+extern block_t *parseProcBody(proc_decl_t *pd);
+
+// Requires: the procedures in pds were parsed by this thread's lexer,
+//           which is still open
+// Parse the bodies of the procedures in pds that were skipped,
+// as parseProcBody does
+extern void parseProcBodies(proc_decls_t *pds);
 
 #endif
@@ -0,0 +1,172 @@
+#define _POSIX_C_SOURCE 200809L
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "phase_stats.h"
+#include "arena.h"
+
+static const char *phase_names[NUM_PHASES]
+    = { "lex", "parse", "unparse", "check" };
+
+// what is known about a phase
+typedef struct {
+    bool measured;          // whether the phase has finished
+    bool started;           // whether it has started but not finished
+    double wall_start, cpu_start;
+    unsigned long allocations_start;
+    size_t bytes_start;
+    double wall_ms, cpu_ms; // time taken (cpu_ms by the whole process)
+    unsigned long allocations; // arena allocations made
+    size_t bytes;           // bytes allocated from the arena
+    long peak_rss_kb;       // peak resident set size when finished
+} phase_stats;
+
+// (each thread measures the phases of the compilation it is doing)
+static _Thread_local phase_stats stats[NUM_PHASES];
+
+// the numbers of hits and misses in the compile cache
+static _Thread_local unsigned long cache_hits, cache_misses;
+
+// Return the current reading of clock (in milliseconds)
+static double clock_ms(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Return the name of phase p
+const char *phase_name(compiler_phase p)
+{
+    return phase_names[p];
+}
+
+// If the len characters at name are the name of a phase,
+// then put that phase in *p and return true, otherwise return false
+bool phase_lookup(const char *name, size_t len, compiler_phase *p)
+{
+    for (int i = 0; i < NUM_PHASES; i++) {
+	if (strlen(phase_names[i]) == len
+	    && strncmp(phase_names[i], name, len) == 0) {
+	    *p = (compiler_phase) i;
+	    return true;
+	}
+    }
+    return false;
+}
+
+// Forget the statistics of this thread's previous compilation
+// (before starting a new one)
+void phase_stats_reset()
+{
+    memset(stats, 0, sizeof(stats));
+    cache_hits = cache_misses = 0;
+}
+
+// Start measuring phase p
+void phase_stats_start(compiler_phase p)
+{
+    phase_stats *s = &stats[p];
+    s->allocations_start = arena_allocation_count();
+    s->bytes_start = arena_bytes_allocated();
+    s->cpu_start = clock_ms(CLOCK_PROCESS_CPUTIME_ID);
+    s->wall_start = clock_ms(CLOCK_MONOTONIC);
+    s->started = true;
+}
+
+// Finish measuring phase p
+void phase_stats_finish(compiler_phase p)
+{
+    phase_stats *s = &stats[p];
+    s->wall_ms = clock_ms(CLOCK_MONOTONIC) - s->wall_start;
+    s->cpu_ms = clock_ms(CLOCK_PROCESS_CPUTIME_ID) - s->cpu_start;
+    s->allocations = arena_allocation_count() - s->allocations_start;
+    s->bytes = arena_bytes_allocated() - s->bytes_start;
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    s->peak_rss_kb = usage.ru_maxrss; // (in kilobytes on Linux)
+    s->measured = true;
+    s->started = false;
+}
+
+// Finish measuring the phases that were started but not finished
+// (as when an error stops the compilation in the middle of a phase)
+void phase_stats_finish_started()
+{
+    for (int i = 0; i < NUM_PHASES; i++) {
+	if (stats[i].started) {
+	    phase_stats_finish((compiler_phase) i);
+	}
+    }
+}
+
+// Count a lookup in the compile cache (see compile_cache.h),
+// which was a hit if hit is true, and otherwise a miss
+void phase_stats_count_cache(bool hit)
+{
+    if (hit) {
+	cache_hits++;
+    } else {
+	cache_misses++;
+    }
+}
+
+// Print the string str to out as a JSON string
+static void print_json_string(FILE *out, const char *str)
+{
+    fputc('"', out);
+    for (const char *c = str; *c != '\0'; c++) {
+	if (*c == '"' || *c == '\\') {
+	    fprintf(out, "\\%c", *c);
+	} else if ((unsigned char) *c < ' ') {
+	    fprintf(out, "\\u%04x", (unsigned char) *c);
+	} else {
+	    fputc(*c, out);
+	}
+    }
+    fputc('"', out);
+}
+
+// Print the statistics for the phases measured (in the compilation
+// of the named file) to out, as a table, or as JSON if json is true
+void phase_stats_print(FILE *out, bool json, const char *file_name)
+{
+    if (json) {
+	fprintf(out, "{\"file\": ");
+	print_json_string(out, file_name);
+	fprintf(out, ", \"phases\": [");
+    } else {
+	fprintf(out, "%-8s %12s %15s %12s %14s %12s\n", "phase", "wall ms",
+		"process cpu ms", "arena allocs", "arena bytes", "peak RSS KB");
+    }
+    bool first = true;
+    for (int i = 0; i < NUM_PHASES; i++) {
+	const phase_stats *s = &stats[i];
+	if (!s->measured) {
+	    continue;
+	}
+	if (json) {
+	    fprintf(out, "%s\n  {\"phase\": \"%s\", \"wall_ms\": %.3f,"
+		    " \"process_cpu_ms\": %.3f, \"arena_allocations\": %lu,"
+		    " \"arena_bytes\": %zu, \"peak_rss_kb\": %ld}",
+		    first ? "" : ",", phase_names[i], s->wall_ms, s->cpu_ms,
+		    s->allocations, s->bytes, s->peak_rss_kb);
+	} else {
+	    fprintf(out, "%-8s %12.3f %15.3f %12lu %14zu %12ld\n",
+		    phase_names[i], s->wall_ms, s->cpu_ms, s->allocations,
+		    s->bytes, s->peak_rss_kb);
+	}
+	first = false;
+    }
+    bool cached = cache_hits + cache_misses > 0;
+    if (json) {
+	fprintf(out, "\n]");
+	if (cached) {
+	    fprintf(out, ", \"cache\": {\"hits\": %lu, \"misses\": %lu}",
+		    cache_hits, cache_misses);
+	}
+	fprintf(out, "}\n");
+    } else if (cached) {
+	fprintf(out, "cache: %lu hits, %lu misses\n", cache_hits, cache_misses);
+    }
+}
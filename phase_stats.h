@@ -0,0 +1,60 @@
+#ifndef _PHASE_STATS_H
+#define _PHASE_STATS_H
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Statistics on the phases of a compilation:
+// for each phase run, its wall clock time and the CPU time of the
+// process (of all its threads, so including the worker threads
+// of a phase, but also any other compilations running at the time),
+// the number of allocations (and bytes) it made from the arena
+// (not counting the storage malloc'd for, e.g., a flat AST),
+// and the peak resident set size of the process when it finished,
+// and the number of compilations whose results were found
+// in the compile cache (hits) or not (misses), if one was used.
+
+// The compiler's phases, in the order they run
+typedef enum {
+    phase_lex,     // reading all the tokens (in a pass of its own)
+    phase_parse,   // building the AST (lexing tokens as they are needed)
+    phase_unparse, // printing the AST
+    phase_check    // scope checking
+} compiler_phase;
+
+// number of compiler_phase values
+#define NUM_PHASES 4
+
+// Return the name of phase p
+extern const char *phase_name(compiler_phase p);
+
+// If the len characters at name are the name of a phase,
+// then put that phase in *p and return true, otherwise return false
+extern bool phase_lookup(const char *name, size_t len, compiler_phase *p);
+
+// Forget the statistics of this thread's previous compilation
+// (before starting a new one)
+extern void phase_stats_reset();
+
+// Start measuring phase p
+extern void phase_stats_start(compiler_phase p);
+
+// Requires: phase_stats_start(p) was called (since p last finished)
+//           and the arena has not been reset since
+// Finish measuring phase p
+extern void phase_stats_finish(compiler_phase p);
+
+// Requires: the arena has not been reset since the phases were started
+// Finish measuring the phases that were started but not finished
+// (as when an error stops the compilation in the middle of a phase)
+extern void phase_stats_finish_started();
+
+// Count a lookup in the compile cache (see compile_cache.h),
+// which was a hit if hit is true, and otherwise a miss
+extern void phase_stats_count_cache(bool hit);
+
+// Print the statistics for the phases measured (in the compilation
+// of the named file) to out, as a table, or as JSON if json is true
+extern void phase_stats_print(FILE *out, bool json, const char *file_name);
+
+#endif
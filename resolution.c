@@ -0,0 +1,236 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "resolution.h"
+#include "utilities.h"
+
+// Initial number of declarations and uses there is room for
+#define INITIAL_RESOLUTION_CAPACITY 256
+
+struct resolution_table_s {
+    // the declarations, indexed by declaration ID
+    const char **decl_names;
+    id_attrs **decl_attrs;
+    unsigned int decls_count;
+    unsigned int decls_capacity;
+
+    // the uses, indexed by use ID
+    source_loc *use_locs;
+    unsigned int *use_decls;
+    unsigned int uses_count;
+    unsigned int uses_capacity;
+};
+
+// the table used by threads that have not chosen another
+static resolution_table default_table;
+
+// the table this thread records declarations and uses in
+static _Thread_local resolution_table *current = &default_table;
+
+// the range this thread is filling (or NULL)
+static _Thread_local resolution_range *filling = NULL;
+
+// Return the new capacity for an array of capacity elements
+// that must have room for needed elements
+static unsigned int resolution_grow(unsigned int capacity,
+				    unsigned int needed)
+{
+    if (needed >= NO_DECL_ID / 2) {
+	bail_with_error("Too many declarations or uses to resolve!");
+    }
+    if (capacity == 0) {
+	capacity = INITIAL_RESOLUTION_CAPACITY;
+    }
+    while (capacity < needed) {
+	capacity *= 2;
+    }
+    return capacity;
+}
+
+// Make room for needed declarations
+static void resolution_ensure_decls(unsigned int needed)
+{
+    if (needed <= current->decls_capacity) {
+	return;
+    }
+    current->decls_capacity = resolution_grow(current->decls_capacity, needed);
+    current->decl_names = (const char **) realloc(current->decl_names,
+				 current->decls_capacity * sizeof(const char *));
+    current->decl_attrs = (id_attrs **) realloc(current->decl_attrs,
+			       current->decls_capacity * sizeof(id_attrs *));
+    if (current->decl_names == NULL || current->decl_attrs == NULL) {
+	bail_with_error("No space for the resolution table!");
+    }
+}
+
+// Make room for needed uses
+static void resolution_ensure_uses(unsigned int needed)
+{
+    if (needed <= current->uses_capacity) {
+	return;
+    }
+    current->uses_capacity = resolution_grow(current->uses_capacity, needed);
+    current->use_locs = (source_loc *) realloc(current->use_locs,
+			      current->uses_capacity * sizeof(source_loc));
+    current->use_decls = (unsigned int *) realloc(current->use_decls,
+				 current->uses_capacity * sizeof(unsigned int));
+    if (current->use_locs == NULL || current->use_decls == NULL) {
+	bail_with_error("No space for the resolution table!");
+    }
+}
+
+// Forget all declarations and uses (starting a new program)
+void resolution_reset()
+{
+    current->decls_count = 0;
+    current->uses_count = 0;
+}
+
+// Requires: name is interned and attrs != NULL
+// Give the declaration of name (with attributes attrs) the next
+// declaration ID, recording it in attrs->decl_id, and return it
+unsigned int resolution_declare(const char *name, id_attrs *attrs)
+{
+    assert(attrs != NULL);
+    unsigned int id;
+    if (filling != NULL) {
+	assert(filling->next_decl < filling->end_decl);
+	id = filling->next_decl++;
+    } else {
+	resolution_ensure_decls(current->decls_count + 1);
+	id = current->decls_count++;
+    }
+    current->decl_names[id] = name;
+    current->decl_attrs[id] = attrs;
+    attrs->decl_id = id;
+    return id;
+}
+
+// Requires: decl_id < resolution_decl_count()
+// Record a use of the declaration with ID decl_id at location loc,
+// and return the use's ID
+unsigned int resolution_use(source_loc loc, unsigned int decl_id)
+{
+    assert(decl_id < current->decls_count);
+    unsigned int id;
+    if (filling != NULL) {
+	assert(filling->next_use < filling->end_use);
+	id = filling->next_use++;
+    } else {
+	resolution_ensure_uses(current->uses_count + 1);
+	id = current->uses_count++;
+    }
+    current->use_locs[id] = loc;
+    current->use_decls[id] = decl_id;
+    return id;
+}
+
+// Reserve the next decls declaration IDs and the next uses use IDs
+// (as if that many declarations and uses had been recorded),
+// storing them in *r
+void resolution_reserve(unsigned int decls, unsigned int uses,
+			resolution_range *r)
+{
+    resolution_ensure_decls(current->decls_count + decls);
+    resolution_ensure_uses(current->uses_count + uses);
+    r->next_decl = current->decls_count;
+    current->decls_count += decls;
+    r->end_decl = current->decls_count;
+    r->next_use = current->uses_count;
+    current->uses_count += uses;
+    r->end_use = current->uses_count;
+}
+
+// Make this thread record its declarations and uses in the range r
+// (in order), instead of after the others
+// (if r is NULL, this thread records them after the others again)
+void resolution_fill(resolution_range *r)
+{
+    filling = r;
+}
+
+// Return the number of declarations recorded
+unsigned int resolution_decl_count()
+{
+    return current->decls_count;
+}
+
+// Return the number of uses recorded
+unsigned int resolution_use_count()
+{
+    return current->uses_count;
+}
+
+// Requires: decl_id < resolution_decl_count()
+// Return the name declared by the declaration with ID decl_id
+const char *resolution_decl_name(unsigned int decl_id)
+{
+    assert(decl_id < current->decls_count);
+    return current->decl_names[decl_id];
+}
+
+// Requires: decl_id < resolution_decl_count()
+// Return the attributes of the declaration with ID decl_id
+id_attrs *resolution_decl_attrs(unsigned int decl_id)
+{
+    assert(decl_id < current->decls_count);
+    return current->decl_attrs[decl_id];
+}
+
+// Requires: use_id < resolution_use_count()
+// Return the declaration ID that the use with ID use_id resolves to
+unsigned int resolution_use_decl(unsigned int use_id)
+{
+    assert(use_id < current->uses_count);
+    return current->use_decls[use_id];
+}
+
+// Requires: use_id < resolution_use_count()
+// Return the location of the use with ID use_id
+source_loc resolution_use_loc(unsigned int use_id)
+{
+    assert(use_id < current->uses_count);
+    return current->use_locs[use_id];
+}
+
+// Requires: counts has room for resolution_decl_count() elements
+// Set counts[d] to the number of uses of the declaration with ID d,
+// for each declaration ID d
+void resolution_count_uses(unsigned int *counts)
+{
+    memset(counts, 0, current->decls_count * sizeof(unsigned int));
+    for (unsigned int u = 0; u < current->uses_count; u++) {
+	counts[current->use_decls[u]]++;
+    }
+}
+
+// Return a new, empty resolution table
+resolution_table *resolution_table_create()
+{
+    resolution_table *t = (resolution_table *) calloc(1, sizeof(resolution_table));
+    if (t == NULL) {
+	bail_with_error("No space for a resolution table!");
+    }
+    return t;
+}
+
+// Release the table t
+// (if this thread is using t, it goes back to the default table)
+void resolution_table_destroy(resolution_table *t)
+{
+    if (current == t) {
+	current = &default_table;
+    }
+    free(t->decl_names);
+    free(t->decl_attrs);
+    free(t->use_locs);
+    free(t->use_decls);
+    free(t);
+}
+
+// Make this thread record declarations and uses in the table t
+// (or in the default table, if t is NULL)
+void resolution_table_use(resolution_table *t)
+{
+    current = (t != NULL) ? t : &default_table;
+}
@@ -0,0 +1,98 @@
+#ifndef _RESOLUTION_H
+#define _RESOLUTION_H
+
+#include "id_attrs.h"
+#include "file_location.h"
+
+// The resolution table is produced by scope checking a program.
+// Each declaration gets a dense declaration ID (0, 1, 2, ...,
+// in the order the declarations are checked), and each use of a name
+// gets a dense use ID, so later analyses can use flat arrays
+// (and bitsets) indexed by these IDs instead of looking names up.
+// The table maps each declaration ID to the declaration's
+// name and attributes, and each use ID to the use's location
+// and the declaration ID it resolves to.
+
+// A range of declaration IDs and use IDs reserved for a part of
+// the program that is checked by another thread,
+// which fills them in (see resolution_fill), so the IDs are the same
+// as if the whole program were checked by one thread
+typedef struct {
+    unsigned int next_decl, end_decl;
+    unsigned int next_use, end_use;
+} resolution_range;
+
+// Each thread records declarations and uses in the default table,
+// unless it has chosen another with resolution_table_use
+// (as each compilation under way does, see compile_context.h),
+// and the functions below work on the table the thread is using.
+
+// A resolution table (its contents are private to resolution.c)
+typedef struct resolution_table_s resolution_table;
+
+// Return a new, empty resolution table
+extern resolution_table *resolution_table_create();
+
+// Release the table t
+// (if this thread is using t, it goes back to the default table)
+extern void resolution_table_destroy(resolution_table *t);
+
+// Make this thread record declarations and uses in the table t
+// (or in the default table, if t is NULL)
+extern void resolution_table_use(resolution_table *t);
+
+// Forget all declarations and uses (starting a new program)
+extern void resolution_reset();
+
+// Reserve the next decls declaration IDs and the next uses use IDs
+// (as if that many declarations and uses had been recorded),
+// storing them in *r
+extern void resolution_reserve(unsigned int decls, unsigned int uses,
+			       resolution_range *r);
+
+// Requires: no thread calls resolution_reserve,
+//           or records declarations or uses without a range,
+//           while any thread is filling a range
+// Make this thread record its declarations and uses in the range r
+// (in order), instead of after the others
+// (if r is NULL, this thread records them after the others again)
+extern void resolution_fill(resolution_range *r);
+
+// Requires: name is interned and attrs != NULL
+// Give the declaration of name (with attributes attrs) the next
+// declaration ID, recording it in attrs->decl_id, and return it
+extern unsigned int resolution_declare(const char *name, id_attrs *attrs);
+
+// Requires: decl_id < resolution_decl_count()
+// Record a use of the declaration with ID decl_id at location loc,
+// and return the use's ID
+extern unsigned int resolution_use(source_loc loc, unsigned int decl_id);
+
+// Return the number of declarations recorded
+extern unsigned int resolution_decl_count();
+
+// Return the number of uses recorded
+extern unsigned int resolution_use_count();
+
+// Requires: decl_id < resolution_decl_count()
+// Return the name declared by the declaration with ID decl_id
+extern const char *resolution_decl_name(unsigned int decl_id);
+
+// Requires: decl_id < resolution_decl_count()
+// Return the attributes of the declaration with ID decl_id
+extern id_attrs *resolution_decl_attrs(unsigned int decl_id);
+
+// Requires: use_id < resolution_use_count()
+// Return the declaration ID that the use with ID use_id resolves to
+extern unsigned int resolution_use_decl(unsigned int use_id);
+
+// Requires: use_id < resolution_use_count()
+// Return the location of the use with ID use_id
+extern source_loc resolution_use_loc(unsigned int use_id);
+
+// Requires: counts has room for resolution_decl_count() elements
+// Set counts[d] to the number of uses of the declaration with ID d,
+// for each declaration ID d
+extern void resolution_count_uses(unsigned int *counts);
+
+#endif
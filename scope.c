@@ -1,13 +1,65 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <assert.h>
 #include "scope.h"
 #include "utilities.h"
 
+// Initial number of slots in a scope's hash index (a power of 2)
+#define INITIAL_INDEX_CAPACITY 16
+
+// Requires: name is interned (see intern.h)
+// Return the hash code of name used to index scopes
+// (since names are interned, this hashes the pointer,
+//  using Fibonacci hashing to spread its bits)
+unsigned int scope_hash(const char *name)
+{
+    uint64_t h = (uint64_t)(uintptr_t) name * 0x9E3779B97F4A7C15ull;
+    return (unsigned int)(h >> 32);
+}
+
+// Allocate a hash index with capacity slots (all empty) for s
+static void scope_alloc_index(scope_t *s, unsigned int capacity)
+{
+    s->index = (unsigned int *) calloc(capacity, sizeof(unsigned int));
+    if (s->index == NULL) {
+	bail_with_error("No space for scope index!");
+    }
+    s->index_capacity = capacity;
+}
+
+// Return the slot of s's index that holds name's entry,
+// or the empty slot where it would be placed if name is not in s
+static unsigned int scope_find_slot(scope_t *s, const char *name)
+{
+    unsigned int mask = s->index_capacity - 1;
+    unsigned int slot = scope_hash(name) & mask;
+    while (s->index[slot] != 0
+	   && s->entries[s->index[slot] - 1].id != name) {
+	slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+// Double the capacity of s's hash index, rehashing all entries
+// (or give s its first index)
+static void scope_grow_index(scope_t *s)
+{
+    unsigned int *old_index = s->index;
+    scope_alloc_index(s, (s->index_capacity == 0) ? INITIAL_INDEX_CAPACITY
+		                                  : 2 * s->index_capacity);
+    for (unsigned int i = 0; i < s->size; i++) {
+	s->index[scope_find_slot(s, s->entries[i].id)] = i + 1;
+    }
+    free(old_index);
+}
+
 // Allocate a fresh scope symbol table and return (a pointer to) it.
 // Issues an error message (on stderr) if there is no space
 // and exits with a failure error code in that case.
+// (The space for entries is only allocated when the first is added,
+//  so the many empty scopes of deeply nested blocks are cheap.)
 scope_t *scope_create()
 {
     scope_t *new_s
@@ -17,12 +69,35 @@ scope_t *scope_create()
     }
     new_s->size = 0;
     new_s->loc_count = 0;
-    for (int j = 0; j < MAX_SCOPE_SIZE; j++) {
-	new_s->entries[j] = NULL;
-    }
+    new_s->capacity = 0;
+    new_s->entries = NULL;
+    new_s->index_capacity = 0;
+    new_s->index = NULL;
+    new_s->next_free = NULL;
     return new_s;
 }
 
+// Remove all the declarations from s, so that it can be reused
+// as if it was freshly created (keeping the space it has grown to).
+void scope_reset(scope_t *s)
+{
+    if (s->size > 0) {
+	memset(s->index, 0, s->index_capacity * sizeof(unsigned int));
+    }
+    s->size = 0;
+    s->loc_count = 0;
+    s->next_free = NULL;
+}
+
+// Requires: s was returned by scope_create()
+// Deallocate s and all of the space it uses.
+void scope_destroy(scope_t *s)
+{
+    free(s->entries);
+    free(s->index);
+    free(s);
+}
+
 // Return the number of constant and variables declarations
 // that have been added to this scope.
 extern unsigned int scope_loc_count(scope_t *s)
@@ -37,26 +112,48 @@ unsigned int scope_size(scope_t *s)
 }
 
 // Is the current scope full?
+// (Scopes grow as needed, so this is always false.)
 bool scope_full(scope_t *s)
 {
-    return scope_size(s) >= MAX_SCOPE_SIZE;
+    return false;
 }
 
-// Requires: assoc != NULL && !scope_full() && !scope_declared(assoc->id);
+// Double the number of entries that s has room for
+// (or make room for its first INITIAL_SCOPE_CAPACITY entries)
+static void scope_grow_entries(scope_t *s)
+{
+    unsigned int capacity = (s->capacity == 0) ? INITIAL_SCOPE_CAPACITY
+	                                       : 2 * s->capacity;
+    scope_assoc_t *bigger = (scope_assoc_t *)
+	realloc(s->entries, capacity * sizeof(scope_assoc_t));
+    if (bigger == NULL) {
+	bail_with_error("No space to grow scope to %u entries!", capacity);
+    }
+    s->entries = bigger;
+    s->capacity = capacity;
+}
+
+// Requires: assoc != NULL && !scope_declared(assoc->id);
 // Add an association from the given name to the given id attributes
 // in the current scope.
 // If assoc->attrs->kind != procedure_idk, 
 // then this stores the scope_count value into assoc->attrs->offset_count
 // and then increases loc_count by 1.
-static void scope_add(scope_t *s, scope_assoc_t *assoc)
+static void scope_add(scope_t *s, scope_assoc_t assoc)
 {
-    // assert(assoc != NULL);
-    // assert(!scope_full());
-    // assert(!scope_declared(assoc->id));
-    assoc->attrs->offset_count = (s->loc_count)++;
+    // assert(assoc.attrs != NULL);
+    // assert(!scope_declared(assoc.id));
+    assoc.attrs->offset_count = (s->loc_count)++;
+    if (s->size == s->capacity) {
+	scope_grow_entries(s);
+    }
+    if (2 * (s->size + 1) > s->index_capacity) {
+	scope_grow_index(s);
+    }
+    s->index[scope_find_slot(s, assoc.id)] = s->size + 1;
     s->entries[(s->size)++] = assoc;
-    // fprintf(stderr, "assoc->attrs->offset_count is %d\n",
-    //         assoc->attrs->offset_count);
+    // fprintf(stderr, "assoc.attrs->offset_count is %d\n",
+    //         assoc.attrs->offset_count);
 }
 
 // Requires: !scope_declared(name) && attrs != NULL;
@@ -70,12 +167,9 @@ void scope_insert(scope_t *s, const char *name, id_attrs *attrs)
     // assert(!scope_declared(name));
     // assert(attrs != NULL);
     // debug_print("Running scope_insert for name "%s\"\n", name);
-    scope_assoc_t *new_assoc = malloc(sizeof(scope_assoc_t));
-    if (new_assoc == NULL) {
-	bail_with_error("No space for association!");
-    }
-    new_assoc->id = name;
-    new_assoc->attrs = attrs;
+    scope_assoc_t new_assoc;
+    new_assoc.id = name;
+    new_assoc.attrs = attrs;
     scope_add(s, new_assoc);
 }
 
@@ -94,25 +188,16 @@ bool scope_declared(scope_t *s, const char *name)
 // or NULL if there is no association for name.
 id_attrs *scope_lookup(scope_t *s, const char *name)
 {
-    int i;
     // assert(name != NULL);
     // assert(s != NULL);
     // debug_print("Entering scope_lookup for \"%s\"\n", name);
-    for (i = 0; i < s->size; i++) {
-	// assert(s != NULL);
-	// assert(s->entries != NULL);
-	// assert(0 <= i && i < s->size);
-	// assert(s->entries[i] != NULL);
-	// assert(s->entries[i]->id != NULL);
-	// debug_print("Past asserts in scope_lookup loop\n");
-	// debug_print("Length of name is %d\n", strlen(name));
-	if (strcmp(s->entries[i]->id, name) == 0) {
-	    // debug_print("scope_lookup(\"%s\") returning attributes\n",
-	    //		name);
-	    return s->entries[i]->attrs;
-	}
+    if (s->size == 0) {
+	return NULL;
+    }
+    unsigned int entry = s->index[scope_find_slot(s, name)];
+    if (entry == 0) {
+	// debug_print("The scope_lookup call on \"%s\" returns NULL\n", name);
+	return NULL;
     }
-    // assert(i == s->size);
-    // debug_print("The scope_lookup call on \"%s\" returns NULL\n", name);
-    return NULL;
+    return s->entries[entry - 1].attrs;
 }
\ No newline at end of file
@@ -6,29 +6,53 @@
 #include "machine_types.h"
 #include "id_attrs.h"
 
-// Maximum number of declarations
-// that can be stored in a scope
-#define MAX_SCOPE_SIZE 4096
+// The names in scopes must be interned (see intern.h),
+// as they are compared by pointer equality.
+
+// Number of declarations a scope has room for once the first is added
+// (scopes grow geometrically beyond this)
+#define INITIAL_SCOPE_CAPACITY 8
 
 typedef struct {
     const char *id;
     id_attrs *attrs;
 } scope_assoc_t;
 
-// Invariant: 0 <= size < MAX_SCOPE_SIZE;
+// Invariant: 0 <= size <= capacity;
+// Invariant: size <= index_capacity / 2 && index_capacity is a power of 2
 typedef struct scope_s {
     unsigned int size;
     // num. of associations in this scope
     unsigned int loc_count;
-    scope_assoc_t
-                *entries[MAX_SCOPE_SIZE];
+    // entries in declaration (insertion) order,
+    // with room for capacity associations
+    unsigned int capacity;
+    scope_assoc_t *entries;
+    // open addressing (linear probing) hash index over entries,
+    // each slot is 0 if it is empty or 1 + the index of an entry
+    unsigned int index_capacity;
+    unsigned int *index;
+    // link for the symbol table's pool of free scopes
+    struct scope_s *next_free;
 } scope_t;
 
+// Requires: name is interned
+// Return the hash code of name used to index scopes
+extern unsigned int scope_hash(const char *name);
+
 // Allocate a fresh scope symbol table and return (a pointer to) it.
 // Issues an error message (on stderr) if there is no space
 // and exits with a failure error code in that case.
 extern scope_t *scope_create();
 
+// Remove all the declarations from s, so that it can be reused
+// as if it was freshly created (keeping the space it has grown to).
+extern void scope_reset(scope_t *s);
+
+// Requires: s was returned by scope_create()
+// Deallocate s and all of the space it uses.
+extern void scope_destroy(scope_t *s);
+
 // Return the number of constant and variables declarations
 // that have been added to this scope.
 extern address_type scope_loc_count(scope_t *s);
@@ -37,6 +61,7 @@ extern address_type scope_loc_count(scope_t *s);
 extern unsigned int scope_size(scope_t *s);
 
 // Is the current scope full?
+// (Scopes grow as needed, so this is always false.)
 extern bool scope_full(scope_t *s);
 
 // Is the given name associated with some attributes in the current scope?
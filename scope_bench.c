@@ -0,0 +1,72 @@
+// Microbenchmark for scope_lookup:
+// the time per lookup should stay flat as the number of
+// declarations in a scope grows.
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "scope.h"
+#include "id_attrs.h"
+#include "file_location.h"
+#include "intern.h"
+#include "utilities.h"
+
+// number of lookups timed for each scope size
+#define LOOKUPS 1000000
+
+// sizes (numbers of declarations) of the scopes measured
+static const unsigned int sizes[] = { 10, 100, 1000, 10000, 100000 };
+
+// Return the current time in nanoseconds
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Return the interned generated identifier name for i
+static const char *bench_name(unsigned int i)
+{
+    char buf[32];
+    sprintf(buf, "x%u", i);
+    return intern_string(buf, strlen(buf));
+}
+
+int main()
+{
+    printf("%-8s %12s %12s\n", "decls", "hit ns", "miss ns");
+    for (int k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+	unsigned int n = sizes[k];
+	scope_t *s = scope_create();
+	const char **names = (const char **) malloc(n * sizeof(const char *));
+	if (names == NULL) {
+	    bail_with_error("No space for benchmark names!");
+	}
+	for (unsigned int i = 0; i < n; i++) {
+	    names[i] = bench_name(i);
+	    scope_insert(s, names[i],
+			 create_id_attrs(NO_SOURCE_LOC, variable_idk, i));
+	}
+	// look up declared names, then an undeclared one
+	unsigned long found = 0;
+	double start = now_ns();
+	for (unsigned int i = 0; i < LOOKUPS; i++) {
+	    found += scope_lookup(s, names[(i * 7919u) % n]) != NULL;
+	}
+	double hit = (now_ns() - start) / LOOKUPS;
+	const char *missing = bench_name(n + 1);
+	start = now_ns();
+	for (unsigned int i = 0; i < LOOKUPS; i++) {
+	    found += scope_lookup(s, missing) != NULL;
+	}
+	double miss = (now_ns() - start) / LOOKUPS;
+	if (found != LOOKUPS) {
+	    bail_with_error("scope_lookup found %lu of %d names!",
+			    found, LOOKUPS);
+	}
+	printf("%-8u %12.1f %12.1f\n", n, hit, miss);
+    }
+    return EXIT_SUCCESS;
+}
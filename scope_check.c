@@ -1,477 +1,1218 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <setjmp.h>
+#include <stdatomic.h>
 #include "scope_check.h"
 #include "id_attrs.h"
 #include "file_location.h"
 #include "ast.h"
+#include "parser.h"
 #include "utilities.h"
 #include "symtab.h"
+#include "resolution.h"
+#include "thread_pool.h"
+#include "arena.h"
+#include "compile_context.h"
+
+// The checks below traverse the AST in place, through pointers,
+// so no AST structs are copied (or returned) along the way.
+// Each use of a name (and each declaration) is annotated with
+// its resolved id_binding, so later passes need not look names up.
+// Checking a whole program also fills in the resolution table
+// (see resolution.h), giving each declaration and each use a dense ID.
+// Nested constructs are checked with an explicit stack of work
+// (see below) instead of by recursion, so the depth of nesting
+// in programs is only limited by the memory available.
+
+// the number of threads that check the bodies of the procedures
+// declared in the program's block (see scope_check_set_threads)
+static unsigned int check_threads = 1;
+
+// Requires: threads > 0
+// Make scope checking use the given number of threads
+void scope_check_set_threads(unsigned int threads)
+{
+    assert(threads > 0);
+    check_threads = threads;
+}
+
+static bool scope_check_proc_header(proc_decl_t *pd);
+static void scope_check_procDecls_parallel(proc_decls_t *pds);
+
+// Return true if the procedures pds, declared in the current scope,
+// should be checked in parallel: they are the program's own
+// procedures, there is more than one, and more than one thread
+static bool scope_check_in_parallel(proc_decls_t *pds)
+{
+    return check_threads > 1 && symtab_size() == 1
+        && pds->proc_decls != NULL && pds->proc_decls->next != NULL;
+}
+
+//--------------------------------------------------------------
+// The explicit stack of work
+//--------------------------------------------------------------
+
+// Each work item is a node whose checking is pending.
+// Checking a node does the checks for the node itself and pushes
+// its children, the one to be checked first pushed last,
+// so nodes are checked in the same order as a recursive walk would.
+// The same walk can also just count the declarations and uses
+// that checking would record (see check_counts).
+
+// kinds of work items
+typedef enum {
+    work_block,       // node is a block_t to check
+    work_leave_scope, // leave the scope of a block that has been checked
+    work_proc_decls,  // node is a proc_decl_t to check, then those after it
+    work_stmt_list,   // node is a stmt_t to check, then those after it
+    work_condition,   // node is a condition_t to check
+    work_expr,        // node is an expr_t to check
+    // (work on flat ASTs, for scope_check_flat_program)
+    work_flat_block,      // index is a block to check
+    work_flat_proc_decls, // proc-decls index up to (not including) end
+    work_flat_stmts,      // statements index up to (not including) end
+    work_flat_condition,  // index is a condition to check
+    work_flat_expr        // index is an expression to check
+} work_kind;
+
+typedef struct {
+    work_kind kind;
+    void *node;
+    flat_index index, end;
+} work_item;
+
+// Initial number of work items there is room for
+#define INITIAL_WORK_CAPACITY 256
+
+// this thread's stack of work (reused by each walk)
+static _Thread_local work_item *work = NULL;
+static _Thread_local size_t work_size = 0;
+static _Thread_local size_t work_capacity = 0;
+
+// The counts of declarations and uses made by a walk that only counts
+typedef struct {
+    unsigned int decls;
+    unsigned int uses;
+} check_counts;
+
+// Push a work item of the given kind for node
+// (or for the nodes index up to end of a flat AST)
+static void work_push_item(work_kind kind, void *node,
+                           flat_index index, flat_index end)
+{
+    if (work_size == work_capacity)
+    {
+        size_t capacity = (work_capacity == 0) ? INITIAL_WORK_CAPACITY
+                                               : 2 * work_capacity;
+        work_item *bigger
+            = (work_item *) realloc(work, capacity * sizeof(work_item));
+        if (bigger == NULL)
+        {
+            bail_with_error("No space to check a program nested this deeply!");
+        }
+        work = bigger;
+        work_capacity = capacity;
+    }
+    work[work_size].kind = kind;
+    work[work_size].node = node;
+    work[work_size].index = index;
+    work[work_size].end = end;
+    work_size++;
+}
+
+// Push a work item of the given kind for node
+static void work_push(work_kind kind, void *node)
+{
+    work_push_item(kind, node, 0, 0);
+}
+
+// Forget any work left behind (by an error)
+static void work_discard()
+{
+    work_size = 0;
+}
+
+// Free the storage used by this thread's stack of work
+static void work_release()
+{
+    free(work);
+    work = NULL;
+    work_size = 0;
+    work_capacity = 0;
+}
+
+// Free the storage this thread used for scope checking
+// (e.g., before it exits)
+void scope_check_release()
+{
+    work_release();
+}
+
+static void scope_check_run(size_t base, check_counts *counts);
+static void check_block(block_t *block, check_counts *counts);
+static void check_proc_decl(proc_decl_t *pd, check_counts *counts);
+static void check_stmts(stmts_t *stmts);
+static void check_stmt(stmt_t *stmt, check_counts *counts);
+static void check_condition(condition_t *cond);
+static void check_expr(expr_t *exp, check_counts *counts);
+
+// Return the binding of the use of name at floc (checking that it
+// is declared), or if counting, count the use
+static id_binding check_use(source_loc floc, const char *name,
+                            check_counts *counts)
+{
+    if (counts != NULL)
+    {
+        counts->uses++;
+        return ID_BINDING_UNRESOLVED;
+    }
+    return scope_check_ident_use(floc, name);
+}
+
+// Do the work on the stack down to (but not including) the item at base
+static void scope_check_run(size_t base, check_counts *counts)
+{
+    while (work_size > base)
+    {
+        work_item w = work[--work_size];
+        switch (w.kind)
+        {
+            case work_block:
+                check_block((block_t *) w.node, counts);
+                break;
+
+            case work_leave_scope:
+                if (counts == NULL)
+                {
+                    symtab_leave_scope();
+                }
+                break;
+
+            case work_proc_decls:
+            {
+                proc_decl_t *pd = (proc_decl_t *) w.node;
+                if (pd->next != NULL)
+                {
+                    work_push(work_proc_decls, pd->next);
+                }
+                check_proc_decl(pd, counts);
+                break;
+            }
+
+            case work_stmt_list:
+            {
+                stmt_t *sp = (stmt_t *) w.node;
+                if (sp->next != NULL)
+                {
+                    work_push(work_stmt_list, sp->next);
+                }
+                check_stmt(sp, counts);
+                break;
+            }
+
+            case work_condition:
+                check_condition((condition_t *) w.node);
+                break;
+
+            case work_expr:
+                check_expr((expr_t *) w.node, counts);
+                break;
+
+            default:
+                bail_with_error("Unexpected work (%d) in scope_check_run",
+                                w.kind);
+                break;
+        }
+    }
+}
+
+// Check (or count) the block: its declarations now,
+// its procedures and statements by pushing work for them
+static void check_block(block_t *block, check_counts *counts)
+{
+    if (counts != NULL)
+    {
+        for (const_decl_t *cd = block->const_decls.start; cd != NULL; cd = cd->next)
+        {
+            for (const_def_t *def = cd->const_def_list.start; def != NULL;
+                 def = def->next)
+            {
+                if (def->ident.name != NULL && def->ident.file_loc != NO_SOURCE_LOC)
+                {
+                    counts->decls++;
+                }
+            }
+        }
+        for (var_decl_t *vd = block->var_decls.var_decls; vd != NULL; vd = vd->next)
+        {
+            for (ident_t *id = vd->ident_list.start; id != NULL; id = id->next)
+            {
+                if (id->name != NULL && id->file_loc != NO_SOURCE_LOC)
+                {
+                    counts->decls++;
+                }
+            }
+        }
+        check_stmts(&block->stmts);
+        if (block->proc_decls.proc_decls != NULL)
+        {
+            work_push(work_proc_decls, block->proc_decls.proc_decls);
+        }
+        return;
+    }
+
+    if (symtab_empty())
+    {
+        resolution_reset(); // a new program
+    }
+    symtab_enter_scope(); // Enter a new scope for the block
+
+    // Check constant and variable declarations
+    scope_check_constDecls(&block->const_decls);
+    scope_check_varDecls(&block->var_decls);
+
+    // then (in this order) the procedures, the statements,
+    // and leave the scope
+    work_push(work_leave_scope, NULL);
+    check_stmts(&block->stmts);
+    proc_decls_t *pds = &block->proc_decls;
+    if (scope_check_in_parallel(pds))
+    {
+        scope_check_procDecls_parallel(pds);
+    }
+    else if (pds->proc_decls != NULL)
+    {
+        work_push(work_proc_decls, pds->proc_decls);
+    }
+}
+
+// Push work to check the statements
+static void check_stmts(stmts_t *stmts)
+{
+    switch (stmts->stmts_kind) 
+    {
+        case empty_stmts_e:
+            // No statements to check
+            break;
+
+        case stmt_list_e:
+            if (stmts->stmt_list.start != NULL)
+            {
+                work_push(work_stmt_list, stmts->stmt_list.start);
+            }
+            break;
+
+        default:
+            bail_with_error("Invalid AST in scope_check_stmts for stmts.stmts_kind!");
+            break;
+    }
+}
+
+// Check (or count) the statement, pushing work for its parts
+static void check_stmt(stmt_t *stmt, check_counts *counts)
+{
+    switch (stmt->stmt_kind) 
+    {
+        case assign_stmt:
+        {
+            assign_stmt_t *as = &stmt->data.assign_stmt;
+            as->binding = check_use(as->file_loc, as->name, counts);
+            if (as->expr == NULL) 
+            {
+                bail_with_prog_error(as->file_loc, "Expression is NULL in statement");
+                return;
+            }
+            work_push(work_expr, as->expr);
+            break;
+        }
+
+        case call_stmt:
+        {
+            call_stmt_t *cs = &stmt->data.call_stmt;
+            cs->binding = check_use(cs->file_loc, cs->name, counts);
+            break;
+        }
+
+        case if_stmt:
+            if (stmt->data.if_stmt.else_stmts != NULL)
+            {
+                check_stmts(stmt->data.if_stmt.else_stmts);
+            }
+            if (stmt->data.if_stmt.then_stmts != NULL)
+            {
+                check_stmts(stmt->data.if_stmt.then_stmts);
+            }
+            work_push(work_condition, &stmt->data.if_stmt.condition);
+            break;
+
+        case while_stmt:
+            if (stmt->data.while_stmt.body != NULL)
+            {
+                check_stmts(stmt->data.while_stmt.body);
+            }
+            work_push(work_condition, &stmt->data.while_stmt.condition);
+            break;
+
+        case read_stmt:
+        {
+            read_stmt_t *rs = &stmt->data.read_stmt;
+            rs->binding = check_use(rs->file_loc, rs->name, counts);
+            break;
+        }
+
+        case print_stmt:
+            work_push(work_expr, &stmt->data.print_stmt.expr);
+            break;
+
+        case block_stmt:
+            assert(stmt->data.block_stmt.block != NULL);  // since would bail if not declared
+            work_push(work_block, stmt->data.block_stmt.block);
+            break;
+
+        default:
+            bail_with_error("Invalid AST in scope_check_stmt for stmt_kind!");
+            break;
+    }
+}
+
+// Push work to check the condition's expressions
+static void check_condition(condition_t *cond)
+{
+    switch (cond->cond_kind) 
+    {
+        case ck_db:
+            work_push(work_expr, &cond->data.db_cond.divisor);
+            work_push(work_expr, &cond->data.db_cond.dividend);
+            break;
+
+        case ck_rel:
+            work_push(work_expr, &cond->data.rel_op_cond.expr2);
+            work_push(work_expr, &cond->data.rel_op_cond.expr1);
+            break;
+        
+        default:
+            bail_with_error("Call to scope_check_condition with an AST that is not a statement for cond.cond_kind");
+            break;
+    }
+}
+
+// Check (or count) the expression, pushing work for its subexpressions
+static void check_expr(expr_t *exp, check_counts *counts)
+{
+    switch (exp->expr_kind) 
+    {
+        case expr_bin:
+            // (note: no identifiers can occur in the operator)
+            work_push(work_expr, exp->data.binary.expr2);
+            work_push(work_expr, exp->data.binary.expr1);
+            break;
+
+        case expr_ident:
+            exp->data.ident.binding
+                = check_use(exp->data.ident.file_loc, exp->data.ident.name,
+                            counts);
+            break;
+
+        case expr_number:
+            // no identifiers are possible in this case, so just return
+            break;
+
+        case expr_negated:
+            work_push(work_expr, exp->data.negated.expr);
+            break;
+
+        default:
+            bail_with_error("Unexpected expr_kind_e (%d) in scope_check_expr", exp->expr_kind);
+            break;
+    }
+}
+
+// Check (or count) the procedure declaration,
+// pushing work for its body
+static void check_proc_decl(proc_decl_t *pd, check_counts *counts)
+{
+    if (counts != NULL)
+    {
+        if (pd->name != NULL && pd->file_loc != NO_SOURCE_LOC)
+        {
+            counts->decls++;
+        }
+        block_t *block = parseProcBody(pd);
+        if (block != NULL)
+        {
+            work_push(work_block, block);
+        }
+        return;
+    }
+    if (scope_check_proc_header(pd))
+    {
+        work_push(work_block, pd->block);
+    }
+}
+
+// Requires: kind and node make a work item
+// Check node (or, if counts != NULL, count its declarations and uses
+// into *counts) completely
+static void scope_check_walk(work_kind kind, void *node, check_counts *counts)
+{
+    size_t base = work_size;
+    work_push(kind, node);
+    scope_check_run(base, counts);
+}
 
 // Build the symbol table for a program block and check declarations
-// Return: Modified AST with id_use pointers updated
-block_t scope_check_program(block_t block) 
+// (the AST is checked in place)
+void scope_check_program(block_t *block) 
 {
-    symtab_enter_scope(); // Enter a new scope for the program block
-    
-    // Check constant, variable, and procedure declarations
-    scope_check_constDecls(block.const_decls);
-    scope_check_varDecls(block.var_decls);
-    scope_check_procDecls(block.proc_decls);
-    
-    // Check statements within the block
-    block.stmts = scope_check_stmts(block.stmts);
-    
-    symtab_leave_scope(); // Exit the scope after processing
-    return block;
+    if (symtab_empty())
+    {
+        work_discard(); // a new program
+    }
+    scope_check_walk(work_block, block, NULL);
 }
 
 // Process constant declarations
 // Checks for duplicate declarations
-void scope_check_constDecls(const_decls_t cds) 
+void scope_check_constDecls(const_decls_t *cds) 
 {
-    const_decl_t *cdp1 = cds.start;
+    const_decl_t *cdp1 = cds->start;
     
     // Iterate over each constant declaration
     while (cdp1 != NULL) 
     {
-        scope_check_constDecl(*cdp1);
+        scope_check_constDecl(cdp1);
         cdp1 = cdp1->next;
     }
 }
 
 // Process a single constant declaration for duplicates
-void scope_check_constDecl(const_decl_t cd) 
+void scope_check_constDecl(const_decl_t *cd) 
 {
-    scope_check_const_def_list(cd.const_def_list);
+    scope_check_const_def_list(&cd->const_def_list);
 }
 
 // Process a list of constant definitions
-void scope_check_const_def_list(const_def_list_t cdl) 
+void scope_check_const_def_list(const_def_list_t *cdl) 
 {
-    const_def_t *cdp2 = cdl.start;
+    const_def_t *cdp2 = cdl->start;
     
     // Iterate over each constant definition in the list
     while (cdp2 != NULL) 
     {
-        scope_check_const_def(*cdp2);
+        scope_check_const_def(cdp2);
         cdp2 = cdp2->next;
     }
 }
 
 // Process a single constant definition by declaring its identifier
-void scope_check_const_def(const_def_t cd) 
+void scope_check_const_def(const_def_t *cd) 
 {
-    if (cd.ident.name != NULL) 
+    if (cd->ident.name != NULL) 
     {
-        scope_check_declare_ident(cd.ident, constant_idk);
+        scope_check_declare_ident(&cd->ident, constant_idk);
     } 
-    else if (cd.ident.file_loc != NULL) 
+    else if (cd->ident.file_loc != NO_SOURCE_LOC) 
     {
-        bail_with_prog_error(*(cd.ident.file_loc), "Identifier name is NULL");
+        bail_with_prog_error(cd->ident.file_loc, "Identifier name is NULL");
     }
 }
 
 // Process variable declarations in the block
-void scope_check_varDecls(var_decls_t vds) {
-    var_decl_t *vdp = vds.var_decls;
+void scope_check_varDecls(var_decls_t *vds) {
+    var_decl_t *vdp = vds->var_decls;
     
     // Iterate over each variable declaration
     while (vdp != NULL) 
     {
-        scope_check_varDecl(*vdp);
+        scope_check_varDecl(vdp);
         vdp = vdp->next;
     }
 }
 
 // Process a single variable declaration by declaring its identifiers
-void scope_check_varDecl(var_decl_t vd) 
+void scope_check_varDecl(var_decl_t *vd) 
 {
-    scope_check_idents(vd.ident_list, variable_idk);
+    scope_check_idents(&vd->ident_list, variable_idk);
 }
 
 // Declare each identifier in the list as a specific type
-void scope_check_idents(ident_list_t ids, id_kind t) 
+void scope_check_idents(ident_list_t *ids, id_kind t) 
 {
-    ident_t *idp = ids.start;
+    ident_t *idp = ids->start;
     
     // Iterate over identifiers in the list
     while (idp != NULL) 
     {
-        scope_check_declare_ident(*idp, t);
+        scope_check_declare_ident(idp, t);
         idp = idp->next;
     }
 }
 
 // Declare an identifier in the current scope and report duplicates
-void scope_check_declare_ident(ident_t id, id_kind t) 
+void scope_check_declare_ident(ident_t *id, id_kind t) 
 {
-    if (id.name == NULL) 
+    if (id->name == NULL) 
     {
-        if (id.file_loc != NULL) 
+        if (id->file_loc != NO_SOURCE_LOC) 
         {
-            bail_with_prog_error(*(id.file_loc), "Identifier name is NULL");
+            bail_with_prog_error(id->file_loc, "Identifier name is NULL");
         }
         return;
     }
 
     // Check if the identifier is already declared in the current scope
-    if (symtab_declared_in_current_scope(id.name)) 
+    if (symtab_declared_in_current_scope(id->name)) 
     {
-        if (id.file_loc != NULL)
+        if (id->file_loc != NO_SOURCE_LOC)
         {
-            id_use *ident_id = symtab_lookup(id.name);
-            if (ident_id != NULL && ident_id->attrs != NULL) 
+            id_use ident_id;
+            if (symtab_lookup_use(id->name, &ident_id) && ident_id.attrs != NULL) 
             {
-                bail_with_prog_error(*(id.file_loc), "%s \"%s\" is already declared as a %s",
-                                     kind2str(t), id.name, kind2str(ident_id->attrs->kind));
+                bail_with_prog_error(id->file_loc, "%s \"%s\" is already declared as a %s",
+                                     kind2str(t), id->name, kind2str(ident_id.attrs->kind));
             }
         }
         return;
     }
 
     // Declare the identifier with its attributes
-    if (id.file_loc != NULL) 
+    if (id->file_loc != NO_SOURCE_LOC) 
     {
         int ofst_cnt = symtab_scope_loc_count();
-        id_attrs *attrs = create_id_attrs(*(id.file_loc), t, ofst_cnt);
-        if (attrs != NULL) symtab_insert(id.name, attrs);
+        id_attrs *attrs = create_id_attrs(id->file_loc, t, ofst_cnt);
+        if (attrs != NULL)
+        {
+            resolution_declare(id->name, attrs);
+            symtab_insert(id->name, attrs);
+            id_use idu = { attrs, 0 };
+            id->binding = id_use_binding(idu);
+        }
     }
 }
 
 // Process procedure declarations in the block
-void scope_check_procDecls(proc_decls_t pds) 
+void scope_check_procDecls(proc_decls_t *pds) 
 {
-    proc_decl_t *pdp = pds.proc_decls;
-    
-    // Iterate over each procedure declaration
-    while (pdp != NULL) 
+    if (scope_check_in_parallel(pds))
     {
-        scope_check_procDecl(*pdp);
-        pdp = pdp->next;
+        scope_check_procDecls_parallel(pds);
+    }
+    else if (pds->proc_decls != NULL)
+    {
+        scope_check_walk(work_proc_decls, pds->proc_decls, NULL);
     }
 }
 
-// Process a single procedure declaration and check for duplicates
-void scope_check_procDecl(proc_decl_t pd) 
+// Declare the procedure named name, declared at floc,
+// in the current scope, reporting duplicates
+static void scope_check_declare_proc(source_loc floc, const char *name)
 {
-    if (pd.name == NULL) 
+    ident_t id;
+    id.file_loc = floc;
+    id.type_tag = ident_ast;
+    id.next = NULL;
+    id.name = name;
+    id.binding = ID_BINDING_UNRESOLVED;
+    scope_check_declare_ident(&id, procedure_idk);
+}
+
+// Declare the procedure pd in the current scope (reporting duplicates)
+// and return true if its body should be checked
+static bool scope_check_proc_header(proc_decl_t *pd)
+{
+    if (pd->name == NULL) 
     {
-        if (pd.file_loc != NULL) 
+        if (pd->file_loc != NO_SOURCE_LOC) 
         {
-            bail_with_prog_error(*(pd.file_loc), "Procedure name is NULL");
+            bail_with_prog_error(pd->file_loc, "Procedure name is NULL");
         }
-        return;
+        return false;
     }
 
-    if (symtab_declared_in_current_scope(pd.name)) 
+    // declared first, so the body can call it recursively
+    scope_check_declare_proc(pd->file_loc, pd->name);
+    // (a body the parser skipped is parsed now)
+    if (parseProcBody(pd) == NULL)
     {
-        if (pd.block != NULL) 
+        if (pd->file_loc != NO_SOURCE_LOC) 
         {
-            *pd.block = scope_check_program(*pd.block);
-        } 
-        else if (pd.file_loc != NULL) 
-        {
-            bail_with_prog_error(*(pd.file_loc), "Procedure block is NULL for procedure %s", pd.name);
+            bail_with_prog_error(pd->file_loc, "Procedure block is NULL for procedure %s", pd->name);
         }
-    } 
-    else 
-    {
-        int ofst_cnt = symtab_scope_loc_count();
-        id_attrs *attrs = create_id_attrs(*(pd.file_loc), procedure_idk, ofst_cnt);
-        symtab_insert(pd.name, attrs);
+        return false;
     }
+    return true;
 }
 
-// Check all statements within a block
-// Returns the modified AST with id_use pointers
-stmts_t scope_check_stmts(stmts_t stmts) 
+// Process a single procedure declaration: check for duplicates,
+// then check its body
+void scope_check_procDecl(proc_decl_t *pd) 
 {
-    switch (stmts.stmts_kind) 
-    {
-        case empty_stmts_e:
-            // No statements to check
-            break;
+    size_t base = work_size;
+    check_proc_decl(pd, NULL);
+    scope_check_run(base, NULL);
+}
 
-        case stmt_list_e:
-            stmts.stmt_list = scope_check_stmt_list(stmts.stmt_list);
-            break;
+//--------------------------------------------------------------
+// Checking procedure bodies in parallel
+//--------------------------------------------------------------
 
-        default:
-            bail_with_error("Invalid AST in scope_check_stmts for stmts.stmts_kind!");
-            break;
-    }
+// Once the program's procedures are declared, the body of each
+// can be checked by a different thread, whose symbol table is layered
+// over a frozen view of the program's scope (showing the declarations
+// that precede the procedure's body, see symtab_layer_over).
+// Each body fills in a range of the resolution table reserved for it,
+// so the IDs are the same as when checking in one thread.
+// Errors are caught in each thread, and only the first one
+// in source order is reported, after all the threads are finished,
+// so the diagnostics are the same as when checking in one thread.
 
-    return stmts;
-}
+// A procedure whose body is checked by a worker thread
+typedef struct {
+    proc_decl_t *pd;
+    symtab_snapshot snap; // the bindings visible in the body
+    resolution_range ids; // the IDs for the body's declarations and uses
+    char *error; // the message for the error found in the body (or NULL)
+} proc_task;
 
-// Process a list of statements
-stmt_list_t scope_check_stmt_list(stmt_list_t sl) 
+// The procedures being checked in parallel
+typedef struct {
+    proc_task *tasks;
+    const symtab_view *outer; // the program's scope
+    compile_context *context; // the compilation's context
+    // the number of the first task with an error found so far
+    // (or the number of tasks)
+    _Atomic unsigned int first_error;
+} proc_batch;
+
+// Check the body of the procedure of task number task in ctx
+// (a proc_batch), catching any error
+static void scope_check_proc_task(void *ctx, unsigned int task,
+                                  unsigned int worker)
 {
-    stmt_t *sp = sl.start;
+    proc_batch *batch = (proc_batch *) ctx;
+    proc_task *t = &batch->tasks[task];
+    if (task > atomic_load(&batch->first_error))
+    {
+        // an error in an earlier body would be reported instead
+        return;
+    }
+    compile_context_enter(batch->context);
 
-    while (sp != NULL) 
+    error_trap trap;
+    if (setjmp(trap.env) == 0)
     {
-        *sp = scope_check_stmt(*sp);
-        sp = sp->next;
+        error_trap_push(&trap);
+        symtab_layer_over(batch->outer, t->snap);
+        resolution_fill(&t->ids);
+        scope_check_program(t->pd->block);
+        error_trap_pop(&trap);
     }
+    else
+    {
+        t->error = arena_strdup(trap.message);
+        // forget the scopes and work the error left behind
+        symtab_initialize();
+        work_discard();
+        unsigned int first = atomic_load(&batch->first_error);
+        while (task < first
+               && !atomic_compare_exchange_weak(&batch->first_error,
+                                                &first, task))
+        {
+            // (first was updated, try again)
+        }
+    }
+    resolution_fill(NULL);
+    symtab_layer_over(NULL, 0);
+}
 
-    return sl;
+// Finish a worker thread's checking: its symbol table's names
+// are in the compilation's arena, so they are forgotten
+// (its stack of work and its scopes are kept for the next batch)
+static void scope_check_proc_done(void *ctx, unsigned int worker)
+{
+    symtab_initialize();
+    arena_thread_done();
+    compile_context_enter(NULL);
 }
 
-// Check individual statement for undeclared identifiers
-stmt_t scope_check_stmt(stmt_t stmt) 
+// Process the procedure declarations of the program's block,
+// as scope_check_procDecls does, but checking their bodies in parallel
+static void scope_check_procDecls_parallel(proc_decls_t *pds)
 {
-    switch (stmt.stmt_kind) 
+    unsigned int n = 0;
+    for (proc_decl_t *pdp = pds->proc_decls; pdp != NULL; pdp = pdp->next)
     {
-        case assign_stmt:
-            stmt.data.assign_stmt = scope_check_assignStmt(stmt.data.assign_stmt);
-            break;
-
-        case call_stmt:
-            stmt.data.call_stmt = scope_check_callStmt(stmt.data.call_stmt);
-            break;
+        n++;
+    }
+    proc_task *tasks = (proc_task *) malloc(n * sizeof(proc_task));
+    if (tasks == NULL)
+    {
+        bail_with_error("No space to check procedures in parallel!");
+    }
 
-        case if_stmt:
-            stmt.data.if_stmt = scope_check_ifStmt(stmt.data.if_stmt);
-            break;
+    // Declare the procedures in order, noting what each body can see,
+    // and reserving the IDs its declarations and uses will get.
+    // An error here is only reported if no body before it has an error.
+    error_trap trap;
+    volatile unsigned int declared = 0;
+    bool header_error = false;
+    if (setjmp(trap.env) == 0)
+    {
+        error_trap_push(&trap);
+        for (proc_decl_t *pdp = pds->proc_decls; pdp != NULL; pdp = pdp->next)
+        {
+            if (!scope_check_proc_header(pdp))
+            {
+                continue;
+            }
+            proc_task *t = &tasks[declared];
+            t->pd = pdp;
+            t->snap = symtab_take_snapshot();
+            check_counts counts = { 0, 0 };
+            scope_check_walk(work_block, pdp->block, &counts);
+            resolution_reserve(counts.decls, counts.uses, &t->ids);
+            t->error = NULL;
+            declared++;
+        }
+        error_trap_pop(&trap);
+    }
+    else
+    {
+        header_error = true;
+    }
 
-        case while_stmt:
-            stmt.data.while_stmt = scope_check_whileStmt(stmt.data.while_stmt);
-            break;
+    proc_batch batch;
+    batch.tasks = tasks;
+    batch.outer = symtab_freeze();
+    batch.context = compile_context_current();
+    atomic_init(&batch.first_error, declared);
+    thread_pool_run(declared, check_threads, scope_check_proc_task,
+                    scope_check_proc_done, &batch);
+    symtab_view_destroy((symtab_view *) batch.outer);
 
-        case read_stmt:
-            stmt.data.read_stmt = scope_check_readStmt(stmt.data.read_stmt);
-            break;
+    unsigned int first = atomic_load(&batch.first_error);
+    char *error = (first < declared) ? tasks[first].error : NULL;
+    free(tasks);
+    if (error != NULL)
+    {
+        bail_with_message(error);
+    }
+    else if (header_error)
+    {
+        bail_with_message(trap.message);
+    }
+}
 
-        case print_stmt:
-            stmt.data.print_stmt = scope_check_printStmt(stmt.data.print_stmt);
-            break;
+// Each of the following checks its node completely,
+// using the explicit stack of work for the nodes nested in it.
 
-        case block_stmt:
-            stmt.data.block_stmt = scope_check_blockStmt(stmt.data.block_stmt);
-            break;
+// Check all statements within a block
+void scope_check_stmts(stmts_t *stmts) 
+{
+    size_t base = work_size;
+    check_stmts(stmts);
+    scope_check_run(base, NULL);
+}
 
-        default:
-            bail_with_error("Invalid AST in scope_check_stmt for stmt_kind!");
-            break;
+// Process a list of statements
+void scope_check_stmt_list(stmt_list_t *sl) 
+{
+    if (sl->start != NULL)
+    {
+        scope_check_walk(work_stmt_list, sl->start, NULL);
     }
+}
 
-    return stmt;
+// Check individual statement for undeclared identifiers
+void scope_check_stmt(stmt_t *stmt) 
+{
+    size_t base = work_size;
+    check_stmt(stmt, NULL);
+    scope_check_run(base, NULL);
 }
 
 // check the condition to make sure that
 // all idenfifiers used have been declared
 // (if not, then produce an error)
-// Return the modified AST with id_use pointers
-condition_t scope_check_condition(condition_t cond)
+void scope_check_condition(condition_t *cond)
 {
-    switch (cond.cond_kind) 
-    {
-        case ck_db:
-            cond.data.db_cond = scope_check_db_condition(cond.data.db_cond);
-            break;
-
-        case ck_rel:
-            cond.data.rel_op_cond = scope_check_rel_op_condition(cond.data.rel_op_cond);
-            break;
-        
-        default:
-            bail_with_error("Call to scope_check_condition with an AST that is not a statement for cond.cond_kind");
-            break;
-    }
-
-    return cond;
+    scope_check_walk(work_condition, cond, NULL);
 }
 
 // check the statement for
 // undeclared identifiers
-// Return the modified AST with id_use pointers
-assign_stmt_t scope_check_assignStmt(assign_stmt_t stmt)
+void scope_check_assignStmt(assign_stmt_t *stmt)
 {
-    (void) scope_check_ident_declared(*(stmt.file_loc), stmt.name);
-    if (stmt.expr == NULL) 
+    stmt->binding = scope_check_ident_use(stmt->file_loc, stmt->name);
+    if (stmt->expr == NULL) 
     {
-        bail_with_prog_error(*(stmt.file_loc), "Expression is NULL in statement");
-        return stmt;
+        bail_with_prog_error(stmt->file_loc, "Expression is NULL in statement");
+        return;
     }
     // Perform the expression scope check
-    if (stmt.expr != NULL) 
-    {
-        *stmt.expr = scope_check_expr(*(stmt.expr));
-    }
-
-    return stmt;
+    scope_check_expr(stmt->expr);
 }
 
 // check the statement to make sure that
 // all idenfifiers referenced in it have been declared
 // (if not, then produce an error)
-// Return the modified AST with id_use pointers
-call_stmt_t scope_check_callStmt(call_stmt_t stmt)
+void scope_check_callStmt(call_stmt_t *stmt)
 {
-    (void) scope_check_ident_declared(*(stmt.file_loc), stmt.name);
-    return stmt;
+    stmt->binding = scope_check_ident_use(stmt->file_loc, stmt->name);
 }
 
 // check the statement to make sure that
 // all idenfifiers referenced in it have been declared
 // (if not, then produce an error)
-// Return the modified AST with id_use pointers
-if_stmt_t scope_check_ifStmt(if_stmt_t stmt)
+void scope_check_ifStmt(if_stmt_t *stmt)
 {
-    stmt.condition = scope_check_condition(stmt.condition);
+    scope_check_condition(&stmt->condition);
 
-    if(stmt.then_stmts != NULL)
+    if(stmt->then_stmts != NULL)
     {
-        *(stmt.then_stmts) = scope_check_stmts(*(stmt.then_stmts));
+        scope_check_stmts(stmt->then_stmts);
     }
-    if(stmt.else_stmts != NULL)
+    if(stmt->else_stmts != NULL)
     {
-        *(stmt.else_stmts) = scope_check_stmts(*(stmt.else_stmts));
+        scope_check_stmts(stmt->else_stmts);
     }       
-
-    return stmt;
 }
 
 // check the statement to make sure that
 // all idenfifiers referenced in it have been declared
 // (if not, then produce an error)
-// Return the modified AST with id_use pointers
-while_stmt_t scope_check_whileStmt(while_stmt_t stmt)
+void scope_check_whileStmt(while_stmt_t *stmt)
 {
-    stmt.condition = scope_check_condition(stmt.condition);
-    if (stmt.body != NULL) 
+    scope_check_condition(&stmt->condition);
+    if (stmt->body != NULL) 
     {
-        *(stmt.body) = scope_check_stmts(*(stmt.body));
+        scope_check_stmts(stmt->body);
     }
-
-    return stmt;
 }
 
 // check the statement to make sure that
 // all idenfifiers referenced in it have been declared
 // (if not, then produce an error)
-// Return the modified AST with id_use pointers
-read_stmt_t scope_check_readStmt(read_stmt_t stmt)
+void scope_check_readStmt(read_stmt_t *stmt)
 {
-    (void) scope_check_ident_declared(*(stmt.file_loc), stmt.name);
-    return stmt;
+    stmt->binding = scope_check_ident_use(stmt->file_loc, stmt->name);
 }
 
 // check the statement to make sure that
 // all idenfifiers referenced in it have been declared
 // (if not, then produce an error)
-// Return the modified AST with id_use pointers
-print_stmt_t scope_check_printStmt(print_stmt_t stmt)
+void scope_check_printStmt(print_stmt_t *stmt)
 {
-    stmt.expr = scope_check_expr(stmt.expr);
-    return stmt;
+    scope_check_expr(&stmt->expr);
 }
 
 // check the statement to make sure that
 // all idenfifiers referenced in it have been declared
 // (if not, then produce an error)
-// Return the modified AST with id_use pointers
-block_stmt_t scope_check_blockStmt(block_stmt_t stmt)
+void scope_check_blockStmt(block_stmt_t *stmt)
 {
-    assert(stmt.block != NULL);  // since would bail if not declared
-    *(stmt.block) = scope_check_program(*(stmt.block));
-    
-    return stmt;
+    assert(stmt->block != NULL);  // since would bail if not declared
+    scope_check_walk(work_block, stmt->block, NULL);
 }
 
 // check the expresion to make sure that
 // all idenfifiers used have been declared
 // (if not, then produce an error)
-// Return the modified AST with id_use pointers
-expr_t scope_check_expr(expr_t exp)
+void scope_check_expr(expr_t *exp)
+{
+    scope_check_walk(work_expr, exp, NULL);
+}
+
+// check that all identifiers used in exp
+// have been declared
+// (if not, then produce an error)
+void scope_check_binary_op_expr(binary_op_expr_t *exp)
+{
+    scope_check_expr(exp->expr1);
+    // (note: no identifiers can occur in the operator)
+    scope_check_expr(exp->expr2);
+}
+
+void scope_check_negated_expr(negated_expr_t *exp)
+{
+    scope_check_expr(exp->expr);
+}
+
+// check the identifier (id) to make sure that
+// all it has been declared (if not, then produce an error)
+// and record its binding
+void scope_check_ident_expr(ident_t *exp)
+{
+    exp->binding = scope_check_ident_use(exp->file_loc, exp->name);
+}
+
+// check that name has been declared,
+// if so, then return an id_use for it (by value, so nothing is allocated)
+// otherwise, produce an error 
+id_use scope_check_ident_declared(source_loc floc, const char *name)
+{
+    id_use ret;
+    if (!symtab_lookup_use(name, &ret)) 
+    {
+	    bail_with_prog_error(floc, "identifier \"%s\" is not declared!", name);
+    }
+    
+    assert(ret.attrs != NULL);
+    return ret;
+}
+
+// check that name has been declared (producing an error if not),
+// record the use at floc in the resolution table,
+// and return the use's binding
+id_binding scope_check_ident_use(source_loc floc, const char *name)
+{
+    id_binding ret = id_use_binding(scope_check_ident_declared(floc, name));
+    ret.use_id = resolution_use(floc, ret.decl_id);
+    return ret;
+}
+
+// Check relational operator conditions for declaration of identifiers.
+void scope_check_db_condition(db_condition_t *cond)
+{
+    scope_check_expr(&cond->dividend);
+    scope_check_expr(&cond->divisor);
+}
+
+// Check relational operator conditions for declaration of identifiers.
+void scope_check_rel_op_condition(rel_op_condition_t *cond)
+{
+    scope_check_expr(&cond->expr1);
+    scope_check_expr(&cond->expr2);
+}
+
+
+//--------------------------------------------------------------
+// Scope Checking of Flat ASTs
+//--------------------------------------------------------------
+
+// Each of the following checks its part of a flat AST
+// and pushes work for the nodes nested in it, as for trees.
+
+// Declare the identifier named by name (an index into fa's names),
+// declared at loc, with kind t, in the current scope
+static void scope_check_flat_declare(const flat_ast *fa, source_loc loc,
+                                     flat_index name, id_kind t)
+{
+    ident_t id;
+    id.file_loc = loc;
+    id.type_tag = ident_ast;
+    id.next = NULL;
+    id.name = fa->names.name[name];
+    id.binding = ID_BINDING_UNRESOLVED;
+    scope_check_declare_ident(&id, t);
+}
+
+// check that all identifiers used in the expression e of fa
+// have been declared, filling in the binding of each
+static void scope_check_flat_expr(flat_ast *fa, flat_index e)
 {
-    switch (exp.expr_kind) 
+    switch (fa->exprs.kind[e])
     {
         case expr_bin:
-            exp.data.binary = scope_check_binary_op_expr(exp.data.binary);
+            work_push_item(work_flat_expr, NULL, fa->exprs.b[e], 0);
+            work_push_item(work_flat_expr, NULL, fa->exprs.a[e], 0);
             break;
 
-        case expr_ident:
-            exp.data.ident = scope_check_ident_expr(exp.data.ident);
+        case expr_negated:
+            work_push_item(work_flat_expr, NULL, fa->exprs.a[e], 0);
             break;
 
-        case expr_number:
-            // no identifiers are possible in this case, so just return
+        case expr_ident:
+            fa->exprs.binding[e]
+                = scope_check_ident_use(fa->exprs.loc[e],
+                                        fa->names.name[fa->exprs.a[e]]);
             break;
 
-        case expr_negated:
-            exp.data.negated = scope_check_negated_expr(exp.data.negated);
+        case expr_number:
+            // no identifiers are possible in this case
             break;
 
         default:
-            bail_with_error("Unexpected expr_kind_e (%d) in scope_check_expr", exp.expr_kind);
+            bail_with_error("Unexpected expr_kind_e (%d) in scope_check_flat_expr",
+                            fa->exprs.kind[e]);
             break;
     }
-
-    return exp;
 }
 
-// check that all identifiers used in exp
+// check that all identifiers used in the condition c of fa
 // have been declared
-// (if not, then produce an error)
-// Return the modified AST with id_use pointers
-binary_op_expr_t scope_check_binary_op_expr(binary_op_expr_t exp)
+static void scope_check_flat_condition(flat_ast *fa, flat_index c)
 {
-    *(exp.expr1) = scope_check_expr(*(exp.expr1));
-    // (note: no identifiers can occur in the operator)
-    *(exp.expr2) = scope_check_expr(*(exp.expr2));
-
-    return exp;
+    work_push_item(work_flat_expr, NULL, fa->conditions.b[c], 0);
+    work_push_item(work_flat_expr, NULL, fa->conditions.a[c], 0);
 }
 
-negated_expr_t scope_check_negated_expr(negated_expr_t exp)
+// Push work to check the statements in the range r of fa
+static void scope_check_flat_stmts(flat_range r)
 {
-    *(exp.expr) = scope_check_expr(*(exp.expr));
-    return exp;
+    if (r.count > 0)
+    {
+        work_push_item(work_flat_stmts, NULL, r.first, r.first + r.count);
+    }
 }
 
-// check the identifier (id) to make sure that
-// all it has been declared (if not, then produce an error)
-// Return the modified AST with id_use pointers
-ident_t scope_check_ident_expr(ident_t exp)
+// check that all identifiers used in the statement s of fa
+// have been declared, filling in the binding of its name (if any)
+static void scope_check_flat_stmt(flat_ast *fa, flat_index s)
 {
-    (void) scope_check_ident_declared(*(exp.file_loc), exp.name);
-    return exp;
+    flat_stmts *st = &fa->stmts;
+    switch (st->kind[s])
+    {
+        case assign_stmt:
+            st->binding[s] = scope_check_ident_use(st->loc[s],
+                                                   fa->names.name[st->a[s]]);
+            work_push_item(work_flat_expr, NULL, st->b[s], 0);
+            break;
+
+        case call_stmt:
+        case read_stmt:
+            st->binding[s] = scope_check_ident_use(st->loc[s],
+                                                   fa->names.name[st->a[s]]);
+            break;
+
+        case if_stmt:
+            if (st->c[s] != FLAT_NONE)
+            {
+                scope_check_flat_stmts(fa->stmt_lists.stmts[st->c[s]]);
+            }
+            scope_check_flat_stmts(fa->stmt_lists.stmts[st->b[s]]);
+            work_push_item(work_flat_condition, NULL, st->a[s], 0);
+            break;
+
+        case while_stmt:
+            scope_check_flat_stmts(fa->stmt_lists.stmts[st->b[s]]);
+            work_push_item(work_flat_condition, NULL, st->a[s], 0);
+            break;
+
+        case print_stmt:
+            work_push_item(work_flat_expr, NULL, st->a[s], 0);
+            break;
+
+        case block_stmt:
+            work_push_item(work_flat_block, NULL, st->a[s], 0);
+            break;
+
+        default:
+            bail_with_error("Invalid AST in scope_check_flat_stmts for stmt_kind!");
+            break;
+    }
 }
 
-// check that name has been declared,
-// if so, then return an id_use for it
-// otherwise, produce an error 
-id_use *scope_check_ident_declared(file_location floc, const char *name)
+// Build the symbol table for the block b of fa and check its declarations
+// (as scope_check_program does), pushing work for the rest of it
+static void scope_check_flat_block(flat_ast *fa, flat_index b)
 {
-    id_use *ret = symtab_lookup(name);
-    if (ret == NULL) 
+    if (symtab_empty())
     {
-	    bail_with_prog_error(floc, "identifier \"%s\" is not declared!", name);
+        resolution_reset(); // a new program
+    }
+    symtab_enter_scope();
+
+    flat_range cds = fa->blocks.const_decls[b];
+    for (flat_index cd = cds.first; cd < cds.first + cds.count; cd++)
+    {
+        flat_range defs = fa->const_decls.defs[cd];
+        for (flat_index d = defs.first; d < defs.first + defs.count; d++)
+        {
+            scope_check_flat_declare(fa, fa->const_defs.loc[d],
+                                     fa->const_defs.name[d], constant_idk);
+        }
+    }
+
+    flat_range vds = fa->blocks.var_decls[b];
+    for (flat_index vd = vds.first; vd < vds.first + vds.count; vd++)
+    {
+        flat_range ids = fa->var_decls.idents[vd];
+        for (flat_index i = ids.first; i < ids.first + ids.count; i++)
+        {
+            scope_check_flat_declare(fa, fa->idents.loc[i],
+                                     fa->idents.name[i], variable_idk);
+        }
+    }
+
+    // then (in this order) the procedures, the statements,
+    // and leave the scope
+    work_push(work_leave_scope, NULL);
+    scope_check_flat_stmts(fa->blocks.stmts[b]);
+    flat_range pds = fa->blocks.proc_decls[b];
+    if (pds.count > 0)
+    {
+        work_push_item(work_flat_proc_decls, NULL, pds.first,
+                       pds.first + pds.count);
     }
-    
-    assert(id_use_create(ret->attrs, ret->levelsOutward) != NULL);
-    return ret;
 }
 
-// Check relational operator conditions for declaration of identifiers.
-// Returns the modified AST with id_use pointers.
-db_condition_t scope_check_db_condition(db_condition_t cond)
+// Do the work on the flat AST fa on the stack
+// down to (but not including) the item at base
+static void scope_check_flat_run(flat_ast *fa, size_t base)
 {
-    cond.dividend = scope_check_expr(cond.dividend);
-    cond.divisor = scope_check_expr(cond.divisor);
+    while (work_size > base)
+    {
+        work_item w = work[--work_size];
+        switch (w.kind)
+        {
+            case work_leave_scope:
+                symtab_leave_scope();
+                break;
+
+            case work_flat_block:
+                scope_check_flat_block(fa, w.index);
+                break;
+
+            case work_flat_proc_decls:
+                if (w.index + 1 < w.end)
+                {
+                    work_push_item(work_flat_proc_decls, NULL, w.index + 1,
+                                   w.end);
+                }
+                // (as in scope_check_procDecl)
+                scope_check_declare_proc(fa->proc_decls.loc[w.index],
+                                         fa->names.name[fa->proc_decls.name[w.index]]);
+                work_push_item(work_flat_block, NULL,
+                               fa->proc_decls.block[w.index], 0);
+                break;
+
+            case work_flat_stmts:
+                if (w.index + 1 < w.end)
+                {
+                    work_push_item(work_flat_stmts, NULL, w.index + 1, w.end);
+                }
+                scope_check_flat_stmt(fa, w.index);
+                break;
 
-    return cond;
+            case work_flat_condition:
+                scope_check_flat_condition(fa, w.index);
+                break;
+
+            case work_flat_expr:
+                scope_check_flat_expr(fa, w.index);
+                break;
+
+            default:
+                bail_with_error("Unexpected work (%d) in scope_check_flat_run",
+                                w.kind);
+                break;
+        }
+    }
 }
 
-// Check relational operator conditions for declaration of identifiers.
-// Returns the modified AST with id_use pointers.
-rel_op_condition_t scope_check_rel_op_condition(rel_op_condition_t cond)
+// Build the symbol table for the program in the flat AST fa
+// and check for duplicate declarations or undeclared identifier usage,
+// producing the same diagnostics as scope_check_program,
+// and fill in the bindings of the names used in fa.
+void scope_check_flat_program(flat_ast *fa)
 {
-    cond.expr1 = scope_check_expr(cond.expr1);
-    cond.expr2 = scope_check_expr(cond.expr2);
-
-    return cond;
-}
\ No newline at end of file
+    if (symtab_empty())
+    {
+        work_discard(); // a new program
+    }
+    size_t base = work_size;
+    scope_check_flat_block(fa, fa->root);
+    scope_check_flat_run(fa, base);
+}
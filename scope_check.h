@@ -2,6 +2,7 @@
 #define _SCOPE_CHECK_H
 
 #include "ast.h"
+#include "flat_ast.h"
 #include "id_use.h"
 
 //--------------------------------------------------------------
@@ -11,8 +12,23 @@
 /**
  * Build the symbol table for the program AST (block)
  * and check for duplicate declarations or undeclared identifier usage.
+ * The AST is checked in place (through the pointer), so nothing is copied.
  */
-extern block_t scope_check_program(block_t block);
+extern void scope_check_program(block_t *block);
+
+/**
+ * Make scope checking use the given number of threads (at least 1):
+ * with more than one, the bodies of the procedures declared
+ * in the program's block are checked in parallel,
+ * giving the same results and diagnostics as with one.
+ */
+extern void scope_check_set_threads(unsigned int threads);
+
+/**
+ * Free the storage this thread used for scope checking
+ * (e.g., before it exits)
+ */
+extern void scope_check_release();
 
 //--------------------------------------------------------------
 // Constant Declarations Scope Checking
@@ -21,10 +37,10 @@ extern block_t scope_check_program(block_t block);
 /**
  * Build the symbol table and check constant declarations.
  */
-extern void scope_check_constDecls(const_decls_t cds);
-extern void scope_check_constDecl(const_decl_t cd);
-extern void scope_check_const_def_list(const_def_list_t cdl);
-extern void scope_check_const_def(const_def_t cd);
+extern void scope_check_constDecls(const_decls_t *cds);
+extern void scope_check_constDecl(const_decl_t *cd);
+extern void scope_check_const_def_list(const_def_list_t *cdl);
+extern void scope_check_const_def(const_def_t *cd);
 
 //--------------------------------------------------------------
 // Variable Declarations Scope Checking
@@ -33,8 +49,8 @@ extern void scope_check_const_def(const_def_t cd);
 /**
  * Build the symbol table and check variable declarations.
  */
-extern void scope_check_varDecls(var_decls_t vds);
-extern void scope_check_varDecl(var_decl_t vd);
+extern void scope_check_varDecls(var_decls_t *vds);
+extern void scope_check_varDecl(var_decl_t *vd);
 
 //--------------------------------------------------------------
 // Procedure Declarations Scope Checking
@@ -43,8 +59,8 @@ extern void scope_check_varDecl(var_decl_t vd);
 /**
  * Build the symbol table and check procedure declarations.
  */
-extern void scope_check_procDecls(proc_decls_t pds);
-extern void scope_check_procDecl(proc_decl_t pd);
+extern void scope_check_procDecls(proc_decls_t *pds);
+extern void scope_check_procDecl(proc_decl_t *pd);
 
 //--------------------------------------------------------------
 // Identifier Declarations Scope Checking
@@ -55,8 +71,8 @@ extern void scope_check_procDecl(proc_decl_t pd);
  * - Check identifiers for duplicate declarations.
  * - Declare a single identifier with a specified kind.
  */
-extern void scope_check_idents(ident_list_t ids, id_kind t);
-extern void scope_check_declare_ident(ident_t id, id_kind t);
+extern void scope_check_idents(ident_list_t *ids, id_kind t);
+extern void scope_check_declare_ident(ident_t *id, id_kind t);
 
 //--------------------------------------------------------------
 // Statements Scope Checking
@@ -64,18 +80,18 @@ extern void scope_check_declare_ident(ident_t id, id_kind t);
 
 /**
  * Check all statements to ensure identifiers referenced have been declared.
- * Returns the modified AST with id_use pointers where applicable.
+ * The AST is checked in place.
  */
-extern stmts_t scope_check_stmts(stmts_t stmts);
-extern stmt_list_t scope_check_stmt_list(stmt_list_t sl);
-extern stmt_t scope_check_stmt(stmt_t stmt);
-extern assign_stmt_t scope_check_assignStmt(assign_stmt_t stmt);
-extern call_stmt_t scope_check_callStmt(call_stmt_t stmt);
-extern if_stmt_t scope_check_ifStmt(if_stmt_t stmt);
-extern while_stmt_t scope_check_whileStmt(while_stmt_t stmt);
-extern read_stmt_t scope_check_readStmt(read_stmt_t stmt);
-extern print_stmt_t scope_check_printStmt(print_stmt_t stmt);
-extern block_stmt_t scope_check_blockStmt(block_stmt_t stmt);
+extern void scope_check_stmts(stmts_t *stmts);
+extern void scope_check_stmt_list(stmt_list_t *sl);
+extern void scope_check_stmt(stmt_t *stmt);
+extern void scope_check_assignStmt(assign_stmt_t *stmt);
+extern void scope_check_callStmt(call_stmt_t *stmt);
+extern void scope_check_ifStmt(if_stmt_t *stmt);
+extern void scope_check_whileStmt(while_stmt_t *stmt);
+extern void scope_check_readStmt(read_stmt_t *stmt);
+extern void scope_check_printStmt(print_stmt_t *stmt);
+extern void scope_check_blockStmt(block_stmt_t *stmt);
 
 //--------------------------------------------------------------
 // Expressions Scope Checking
@@ -83,11 +99,11 @@ extern block_stmt_t scope_check_blockStmt(block_stmt_t stmt);
 
 /**
  * Check all expressions to ensure identifiers referenced have been declared.
- * Returns the modified AST with id_use pointers where applicable.
+ * The AST is checked in place.
  */
-extern expr_t scope_check_expr(expr_t exp);
-extern binary_op_expr_t scope_check_binary_op_expr(binary_op_expr_t exp);
-extern negated_expr_t scope_check_negated_expr(negated_expr_t exp);
+extern void scope_check_expr(expr_t *exp);
+extern void scope_check_binary_op_expr(binary_op_expr_t *exp);
+extern void scope_check_negated_expr(negated_expr_t *exp);
 
 //--------------------------------------------------------------
 // Identifier Usage Verification
@@ -95,11 +111,16 @@ extern negated_expr_t scope_check_negated_expr(negated_expr_t exp);
 
 /**
  * Verify that identifiers used in expressions or statements have been declared.
- * - Returns the modified AST with id_use pointers for identifiers.
  * - Produces an error for undeclared identifiers.
  */
-extern ident_t scope_check_ident_expr(ident_t exp);
-extern id_use *scope_check_ident_declared(file_location floc, const char *name);
+extern void scope_check_ident_expr(ident_t *exp);
+extern id_use scope_check_ident_declared(source_loc floc, const char *name);
+
+/**
+ * Verify that name has been declared, record the use (at floc)
+ * in the resolution table, and return the use's binding.
+ */
+extern id_binding scope_check_ident_use(source_loc floc, const char *name);
 
 //--------------------------------------------------------------
 // Conditions Scope Checking
@@ -107,10 +128,21 @@ extern id_use *scope_check_ident_declared(file_location floc, const char *name);
 
 /**
  * Check condition expressions to ensure identifiers referenced have been declared.
- * Returns the modified AST with id_use pointers.
  */
-extern condition_t scope_check_condition(condition_t cond);
-extern db_condition_t scope_check_db_condition(db_condition_t cond);
-extern rel_op_condition_t scope_check_rel_op_condition(rel_op_condition_t cond);
+extern void scope_check_condition(condition_t *cond);
+extern void scope_check_db_condition(db_condition_t *cond);
+extern void scope_check_rel_op_condition(rel_op_condition_t *cond);
+
+//--------------------------------------------------------------
+// Scope Checking of Flat ASTs
+//--------------------------------------------------------------
+
+/**
+ * Build the symbol table for the program in the flat AST fa
+ * and check for duplicate declarations or undeclared identifier usage,
+ * producing the same diagnostics as scope_check_program,
+ * and fill in the bindings of the names used in fa.
+ */
+extern void scope_check_flat_program(flat_ast *fa);
 
 #endif /* _SCOPE_CHECK_H */
@@ -0,0 +1,653 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "serve.h"
+#include "compile_context.h"
+#include "thread_pool.h"
+#include "utilities.h"
+
+// Write the n bytes at p on the connection fd,
+// returning false if the connection failed
+static bool send_all(int fd, const char *p, size_t n)
+{
+    while (n > 0) {
+	// (MSG_NOSIGNAL, so a closed connection is an error, not a SIGPIPE)
+	ssize_t sent = send(fd, p, n, MSG_NOSIGNAL);
+	if (sent < 0) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    return false;
+	}
+	p += sent;
+	n -= (size_t) sent;
+    }
+    return true;
+}
+
+// Read n bytes from the connection fd into p,
+// returning false if the connection failed or closed first
+static bool receive_all(int fd, char *p, size_t n)
+{
+    while (n > 0) {
+	ssize_t got = read(fd, p, n);
+	if (got < 0) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    return false;
+	} else if (got == 0) {
+	    return false;
+	}
+	p += got;
+	n -= (size_t) got;
+    }
+    return true;
+}
+
+// A connection, and the bytes read from it (in chunks, so not a read
+// per byte of a line) that have not been used yet
+typedef struct {
+    int fd;
+    size_t start, end; // the unused bytes are data[start..end)
+    char data[SERVE_MAX_LINE];
+} connection;
+
+// Requires: size <= SERVE_MAX_LINE
+// Read a line (of fewer than size chars, including the newline)
+// from the connection c into line, replacing the newline with a null char
+// (the bytes read after the line are kept in c for the next read).
+// Return false if the connection failed or closed first,
+// or if the line is too long.
+static bool receive_line(connection *c, char *line, size_t size)
+{
+    size_t scanned = 0; // (the unused bytes known to have no newline)
+    for (;;) {
+	const char *first = c->data + c->start;
+	const char *nl = (const char *)
+	    memchr(first + scanned, '\n', c->end - c->start - scanned);
+	if (nl != NULL) {
+	    size_t len = (size_t) (nl - first);
+	    if (len + 1 >= size) {
+		return false;
+	    }
+	    memcpy(line, first, len);
+	    line[len] = '\0';
+	    c->start += len + 1;
+	    return true;
+	}
+	scanned = c->end - c->start;
+	if (scanned + 1 >= size) {
+	    return false;
+	}
+	// (there is room for more, as the line is shorter than the buffer)
+	if (c->end == sizeof(c->data)) {
+	    memmove(c->data, first, scanned);
+	    c->start = 0;
+	    c->end = scanned;
+	}
+	ssize_t got = read(c->fd, c->data + c->end, sizeof(c->data) - c->end);
+	if (got < 0) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    return false;
+	} else if (got == 0) {
+	    return false;
+	}
+	c->end += (size_t) got;
+    }
+}
+
+// Read n bytes from the connection c into p (starting with the unused
+// bytes already read from it), returning false if the connection failed
+// or closed first
+static bool receive_bytes(connection *c, char *p, size_t n)
+{
+    size_t buffered = c->end - c->start;
+    if (buffered > n) {
+	buffered = n;
+    }
+    memcpy(p, c->data + c->start, buffered);
+    c->start += buffered;
+    // (the rest is read straight into p)
+    return receive_all(c->fd, p + buffered, n - buffered);
+}
+
+//--------------------------------------------------------------
+// The server
+//--------------------------------------------------------------
+
+// A server and what its threads share.
+// One thread (the dispatcher) waits for new connections and for
+// requests on the connections that are idle, and queues each connection
+// with a request for a worker thread, which serves that one request
+// and then hands the connection back to the dispatcher
+// (by writing its address on the pipe handback),
+// so idle clients do not tie up the workers.
+// (A connection whose next request has already been read
+// is queued again at once, as waiting for input on it would not see it.)
+typedef struct {
+    int listener; // the listening socket
+    const compile_options *opts;
+    _Atomic bool stopping; // has a client asked for a shutdown?
+    int handback[2]; // the pipe the workers hand connections back on
+    pthread_mutex_t lock; // protects the queue
+    pthread_cond_t queued; // signaled when a connection is queued
+    connection **queue; // the connections with requests (circular buffer)
+    size_t queue_first, queue_count, queue_capacity;
+} server;
+
+// Return a new connection for the socket fd (with nothing read from it),
+// or NULL (closing fd) if there is no space for it
+static connection *connection_open(int fd)
+{
+    connection *c = (connection *) malloc(sizeof(connection));
+    if (c == NULL) {
+	close(fd);
+	return NULL;
+    }
+    c->fd = fd;
+    c->start = c->end = 0;
+    return c;
+}
+
+// Close the connection c and free it
+static void connection_close(connection *c)
+{
+    close(c->fd);
+    free(c);
+}
+
+// Send the response for a compilation with the given status,
+// output and errors on the connection fd,
+// returning false if the connection failed
+static bool send_response(int fd, int status, const char *output,
+			  size_t output_size, const char *errors,
+			  size_t errors_size)
+{
+    char header[64];
+    int len = snprintf(header, sizeof(header), "%d %zu %zu\n",
+		       status, output_size, errors_size);
+    return send_all(fd, header, (size_t) len)
+	&& send_all(fd, output, output_size)
+	&& send_all(fd, errors, errors_size);
+}
+
+// Send a response with the error message msg (and EXIT_FAILURE
+// as the status) on the connection fd
+static void send_error(int fd, const char *msg)
+{
+    send_response(fd, EXIT_FAILURE, "", 0, msg, strlen(msg));
+}
+
+// Compile the file named name (or, if text is not NULL,
+// the len chars at text) as the server's options say,
+// and send the response on the connection fd,
+// returning false if the connection failed
+static bool serve_compile(server *srv, int fd, char *name,
+			  const char *text, size_t len)
+{
+    char *output = NULL;
+    size_t output_size = 0;
+    char *errors = NULL;
+    size_t errors_size = 0;
+    FILE *out = open_memstream(&output, &output_size);
+    FILE *err = open_memstream(&errors, &errors_size);
+    bool ok;
+    if (out == NULL || err == NULL) {
+	const char *msg = "No space for the output!\n";
+	ok = send_response(fd, EXIT_FAILURE, "", 0, msg, strlen(msg));
+    } else {
+	int status = (text != NULL)
+	    ? compile_text(name, text, len, srv->opts, out, err)
+	    : compile_file(name, srv->opts, out, err);
+	fclose(out);
+	fclose(err);
+	out = err = NULL;
+	ok = send_response(fd, status, output, output_size,
+			   errors, errors_size);
+    }
+    if (out != NULL) {
+	fclose(out);
+    }
+    if (err != NULL) {
+	fclose(err);
+    }
+    free(output);
+    free(errors);
+    return ok;
+}
+
+// Stop the server srv: the dispatcher is woken up (by a NULL
+// connection on the handback pipe) and stops the workers
+static void serve_stop(server *srv)
+{
+    atomic_store(&srv->stopping, true);
+    connection *none = NULL;
+    if (write(srv->handback[1], &none, sizeof(none)) < 0) {
+	// (the pipe cannot be full, as the dispatcher empties it)
+    }
+}
+
+// Serve the next request made on the connection c.
+// Return true if the connection should be kept for more requests,
+// and false if it was closed (or failed), the request was malformed
+// (an error is sent for it), or it was a shutdown.
+static bool serve_request(server *srv, connection *c)
+{
+    int fd = c->fd;
+    char line[SERVE_MAX_LINE];
+    if (!receive_line(c, line, sizeof(line))) {
+	return false;
+    }
+    if (strncmp(line, "file ", 5) == 0) {
+	return serve_compile(srv, fd, line + 5, NULL, 0);
+    } else if (strncmp(line, "source ", 7) == 0) {
+	char *name;
+	errno = 0;
+	unsigned long long len = strtoull(line + 7, &name, 10);
+	if (errno != 0 || *name != ' ') {
+	    send_error(fd, "Malformed source request!\n");
+	    return false;
+	}
+	name++;
+	// (the text that follows is not read, so the connection is closed)
+	if (len > SERVE_MAX_SOURCE) {
+	    char msg[128];
+	    snprintf(msg, sizeof(msg),
+		     "Program of %llu bytes is longer than the limit of"
+		     " %lu bytes!\n", len, (unsigned long) SERVE_MAX_SOURCE);
+	    send_error(fd, msg);
+	    return false;
+	}
+	char *text = (char *) malloc(len + 1);
+	if (text == NULL) {
+	    send_error(fd, "No space for the program!\n");
+	    return false;
+	}
+	bool ok = receive_bytes(c, text, (size_t) len)
+	    && serve_compile(srv, fd, name, text, (size_t) len);
+	free(text);
+	return ok;
+    } else if (strcmp(line, "shutdown") == 0) {
+	serve_stop(srv);
+	send_response(fd, 0, "", 0, "", 0);
+	return false;
+    } else {
+	send_error(fd, "Unknown request!\n");
+	return false;
+    }
+}
+
+// Add the connection c to the queue of srv for a worker to serve
+static void queue_connection(server *srv, connection *c)
+{
+    pthread_mutex_lock(&srv->lock);
+    if (srv->queue_count == srv->queue_capacity) {
+	size_t capacity = 2 * srv->queue_capacity;
+	connection **queue
+	    = (connection **) malloc(capacity * sizeof(connection *));
+	if (queue == NULL) {
+	    pthread_mutex_unlock(&srv->lock);
+	    connection_close(c); // (there is no space to serve it)
+	    return;
+	}
+	for (size_t i = 0; i < srv->queue_count; i++) {
+	    queue[i] = srv->queue[(srv->queue_first + i) % srv->queue_capacity];
+	}
+	free(srv->queue);
+	srv->queue = queue;
+	srv->queue_first = 0;
+	srv->queue_capacity = capacity;
+    }
+    srv->queue[(srv->queue_first + srv->queue_count++) % srv->queue_capacity]
+	= c;
+    pthread_cond_signal(&srv->queued);
+    pthread_mutex_unlock(&srv->lock);
+}
+
+// Return the next connection queued in srv,
+// waiting for one if need be, or NULL if the server is stopping
+static connection *next_connection(server *srv)
+{
+    pthread_mutex_lock(&srv->lock);
+    while (srv->queue_count == 0 && !atomic_load(&srv->stopping)) {
+	pthread_cond_wait(&srv->queued, &srv->lock);
+    }
+    connection *c = NULL;
+    if (!atomic_load(&srv->stopping)) {
+	c = srv->queue[srv->queue_first];
+	srv->queue_first = (srv->queue_first + 1) % srv->queue_capacity;
+	srv->queue_count--;
+    }
+    pthread_mutex_unlock(&srv->lock);
+    return c;
+}
+
+// The idle connections the dispatcher waits on,
+// after the listener and the handback pipe
+// (conns[i] is the connection waited on with fds[i],
+// or NULL for the listener and the pipe)
+typedef struct {
+    struct pollfd *fds;
+    connection **conns;
+    nfds_t count;
+    nfds_t capacity;
+} poll_set;
+
+// Add the socket or pipe fd (whose connection is c, or NULL if
+// it is not a connection) to the poll set ps, waiting for input on it
+// (or close it, if there is no space to)
+static void poll_set_add(poll_set *ps, int fd, connection *c)
+{
+    if (ps->count == ps->capacity) {
+	struct pollfd *fds = (struct pollfd *)
+	    realloc(ps->fds, 2 * ps->capacity * sizeof(struct pollfd));
+	if (fds != NULL) {
+	    ps->fds = fds;
+	}
+	connection **conns = (connection **)
+	    realloc(ps->conns, 2 * ps->capacity * sizeof(connection *));
+	if (conns != NULL) {
+	    ps->conns = conns;
+	}
+	if (fds == NULL || conns == NULL) {
+	    if (c != NULL) {
+		connection_close(c);
+	    }
+	    return;
+	}
+	ps->capacity *= 2;
+    }
+    ps->conns[ps->count] = c;
+    ps->fds[ps->count].fd = fd;
+    ps->fds[ps->count].events = POLLIN;
+    ps->fds[ps->count].revents = 0;
+    ps->count++;
+}
+
+// Accept connections to srv and queue the requests made on them
+// for the workers, until the server is stopping,
+// then wake up the workers (to stop) and close the idle connections
+static void serve_dispatch(server *srv)
+{
+    poll_set ps;
+    ps.capacity = 16;
+    ps.count = 0;
+    ps.fds = (struct pollfd *) malloc(ps.capacity * sizeof(struct pollfd));
+    ps.conns = (connection **) malloc(ps.capacity * sizeof(connection *));
+    if (ps.fds == NULL || ps.conns == NULL) {
+	bail_with_error("No space to wait for connections!");
+    }
+    poll_set_add(&ps, srv->listener, NULL);
+    poll_set_add(&ps, srv->handback[0], NULL);
+    while (!atomic_load(&srv->stopping)) {
+	if (poll(ps.fds, ps.count, -1) < 0) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    bail_with_error("Cannot wait for connections");
+	}
+	// queue the connections with requests (or closed by the client)
+	for (nfds_t i = 2; i < ps.count; ) {
+	    if (ps.fds[i].revents != 0) {
+		queue_connection(srv, ps.conns[i]);
+		ps.count--;
+		ps.fds[i] = ps.fds[ps.count];
+		ps.conns[i] = ps.conns[ps.count];
+	    } else {
+		i++;
+	    }
+	}
+	if (ps.fds[0].revents & POLLIN) {
+	    int fd = accept(srv->listener, NULL, NULL);
+	    if (fd >= 0) {
+		// (a client that stalls in a request is disconnected)
+		struct timeval timeout = { SERVE_TIMEOUT_SECONDS, 0 };
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+			   sizeof(timeout));
+		connection *c = connection_open(fd);
+		if (c != NULL) {
+		    poll_set_add(&ps, fd, c);
+		}
+	    }
+	}
+	if (ps.fds[1].revents & POLLIN) {
+	    connection *conns[64];
+	    ssize_t got = read(srv->handback[0], conns, sizeof(conns));
+	    for (ssize_t i = 0; i < got / (ssize_t) sizeof(connection *);
+		 i++) {
+		connection *c = conns[i];
+		if (c == NULL) {
+		    continue;
+		} else if (c->start < c->end) {
+		    queue_connection(srv, c);
+		} else {
+		    poll_set_add(&ps, c->fd, c);
+		}
+	    }
+	}
+    }
+    pthread_mutex_lock(&srv->lock);
+    pthread_cond_broadcast(&srv->queued);
+    pthread_mutex_unlock(&srv->lock);
+    for (nfds_t i = 2; i < ps.count; i++) {
+	connection_close(ps.conns[i]);
+    }
+    free(ps.fds);
+    free(ps.conns);
+}
+
+// Serve the requests queued in srv, one at a time,
+// until the server is stopping, working in a compilation context
+// of this thread's own
+static void serve_work(server *srv)
+{
+    compile_context *cc = compile_context_create();
+    compile_context_enter(cc);
+    connection *c;
+    while ((c = next_connection(srv)) != NULL) {
+	if (!serve_request(srv, c)) {
+	    connection_close(c);
+	} else if (write(srv->handback[1], &c, sizeof(c)) < 0) {
+	    connection_close(c);
+	}
+    }
+    compile_thread_release();
+    compile_context_destroy(cc);
+}
+
+// Run task number task of ctx (a server): the dispatcher (task 0)
+// or a worker (the other tasks)
+static void serve_task(void *ctx, unsigned int task, unsigned int worker)
+{
+    server *srv = (server *) ctx;
+    if (task == 0) {
+	serve_dispatch(srv);
+    } else {
+	serve_work(srv);
+    }
+}
+
+// Requires: threads > 0
+// Serve compile requests on the Unix domain socket at socket_path
+// (replacing any file there), compiling as opts says,
+// with threads requests served at once, until a client asks for
+// a shutdown. Return the process's exit code.
+int serve_run(const char *socket_path, const compile_options *opts,
+	      unsigned int threads)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+	bail_with_error("Socket path %s is too long!", socket_path);
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    server srv;
+    srv.opts = opts;
+    atomic_init(&srv.stopping, false);
+    srv.queue_capacity = 16;
+    srv.queue_first = srv.queue_count = 0;
+    srv.queue
+	= (connection **) malloc(srv.queue_capacity * sizeof(connection *));
+    if (srv.queue == NULL || pipe(srv.handback) != 0) {
+	bail_with_error("No space for a server!");
+    }
+    pthread_mutex_init(&srv.lock, NULL);
+    pthread_cond_init(&srv.queued, NULL);
+    srv.listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (srv.listener < 0) {
+	bail_with_error("Cannot create a socket");
+    }
+    unlink(socket_path);
+    // (not blocking, in case a client gives up before it is accepted)
+    if (bind(srv.listener, (struct sockaddr *) &addr, sizeof(addr)) != 0
+	|| listen(srv.listener, SOMAXCONN) != 0
+	|| fcntl(srv.listener, F_SETFL, O_NONBLOCK) != 0) {
+	bail_with_error("Cannot listen on %s", socket_path);
+    }
+
+    // the dispatcher, and threads workers
+    thread_pool_run(threads + 1, threads + 1, serve_task, NULL, &srv);
+
+    // close the connections that were queued or handed back
+    for (size_t i = 0; i < srv.queue_count; i++) {
+	connection_close(srv.queue[(srv.queue_first + i) % srv.queue_capacity]);
+    }
+    close(srv.handback[1]);
+    connection *c;
+    while (read(srv.handback[0], &c, sizeof(c)) == sizeof(c)) {
+	if (c != NULL) {
+	    connection_close(c);
+	}
+    }
+    close(srv.handback[0]);
+    pthread_cond_destroy(&srv.queued);
+    pthread_mutex_destroy(&srv.lock);
+    free(srv.queue);
+    close(srv.listener);
+    unlink(socket_path);
+    return EXIT_SUCCESS;
+}
+
+//--------------------------------------------------------------
+// Clients
+//--------------------------------------------------------------
+
+// Return a connection to the server listening at socket_path,
+// or -1 (with errno set) if there is none
+int serve_connect(const char *socket_path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+	errno = ENAMETOOLONG;
+	return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+	return -1;
+    }
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+	int saved = errno;
+	close(fd);
+	errno = saved;
+	return -1;
+    }
+    return fd;
+}
+
+// Read the response to a request from the connection fd into *r,
+// returning false if the connection failed
+static bool receive_response(int fd, serve_result *r)
+{
+    // (the server sends nothing after the response until the next
+    // request, so the bytes read with its header are all part of it)
+    connection c;
+    c.fd = fd;
+    c.start = c.end = 0;
+    char header[64];
+    r->output = r->errors = NULL;
+    if (!receive_line(&c, header, sizeof(header))
+	|| sscanf(header, "%d %zu %zu", &r->status, &r->output_size,
+		  &r->errors_size) != 3) {
+	return false;
+    }
+    r->output = (char *) malloc(r->output_size + 1);
+    r->errors = (char *) malloc(r->errors_size + 1);
+    if (r->output == NULL || r->errors == NULL
+	|| !receive_bytes(&c, r->output, r->output_size)
+	|| !receive_bytes(&c, r->errors, r->errors_size)) {
+	serve_result_free(r);
+	return false;
+    }
+    r->output[r->output_size] = '\0';
+    r->errors[r->errors_size] = '\0';
+    return true;
+}
+
+// Requires: fd is a connection to a server
+// Ask the server to compile the file at path, putting the response in *r.
+// Return true if that worked, and false if the connection failed.
+bool serve_compile_file(int fd, const char *path, serve_result *r)
+{
+    char line[SERVE_MAX_LINE];
+    int len = snprintf(line, sizeof(line), "file %s\n", path);
+    if (len < 0 || (size_t) len >= sizeof(line)) {
+	errno = ENAMETOOLONG;
+	return false;
+    }
+    return send_all(fd, line, (size_t) len) && receive_response(fd, r);
+}
+
+// Requires: fd is a connection to a server and name contains no newline
+// Ask the server to compile the len chars at text (named name),
+// putting the response in *r.
+// Return true if that worked, and false if the connection failed.
+bool serve_compile_source(int fd, const char *name,
+			  const char *text, size_t len, serve_result *r)
+{
+    char line[SERVE_MAX_LINE];
+    int n = snprintf(line, sizeof(line), "source %zu %s\n", len, name);
+    if (n < 0 || (size_t) n >= sizeof(line)) {
+	errno = ENAMETOOLONG;
+	return false;
+    }
+    return send_all(fd, line, (size_t) n) && send_all(fd, text, len)
+	&& receive_response(fd, r);
+}
+
+// Requires: fd is a connection to a server
+// Ask the server to shut down, returning false if the connection failed
+bool serve_shutdown(int fd)
+{
+    serve_result r;
+    if (!send_all(fd, "shutdown\n", 9) || !receive_response(fd, &r)) {
+	return false;
+    }
+    serve_result_free(&r);
+    return true;
+}
+
+// Free the storage used by the response r
+void serve_result_free(serve_result *r)
+{
+    free(r->output);
+    free(r->errors);
+    r->output = r->errors = NULL;
+}
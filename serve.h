@@ -0,0 +1,85 @@
+#ifndef _SERVE_H
+#define _SERVE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "compile.h"
+
+// The compile server (compiler --serve path) listens on a Unix domain
+// socket and compiles the programs its clients send it, so they do not
+// pay for starting a process (and warming up its storage) each time.
+// Each of its threads keeps a compilation context (see compile_context.h)
+// and its symbol table's pooled scopes from one request to the next,
+// and errors in a program are sent back to the client, never exiting.
+// One thread waits for requests on all the connections, and hands each
+// request to a worker thread when it arrives, so clients that keep
+// a connection open without making requests do not hold up the workers.
+//
+// A client may make any number of requests on a connection.
+// Each request is a line, which is one of
+//   "file <path>\n"             compile the file at path
+//                               (relative to the server's directory),
+//   "source <length> <name>\n"  compile the length bytes that follow
+//                               the line, named name in diagnostics,
+//   "shutdown\n"                stop the server (once the requests
+//                               under way are finished).
+// The response to each is a line "<status> <output length> <errors length>\n"
+// followed by the output and then the errors (the bytes the compiler
+// would have written on stdout and on stderr), where the status is
+// the compiler's exit code.
+// A request that is malformed, or a program longer than SERVE_MAX_SOURCE,
+// gets a response with a status of 1 and an error message (but no
+// output), and the server then closes the connection. So does a client
+// that stops sending for SERVE_TIMEOUT_SECONDS in the middle of a request.
+
+// The longest request line a server reads (including the newline)
+#define SERVE_MAX_LINE 4096
+
+// The longest program a server compiles from a source request (in bytes)
+#define SERVE_MAX_SOURCE (64 * 1024 * 1024)
+
+// How long a server waits for the rest of a request (in seconds)
+#define SERVE_TIMEOUT_SECONDS 30
+
+// Requires: threads > 0
+// Serve compile requests on the Unix domain socket at socket_path
+// (replacing any file there), compiling as opts says,
+// with threads requests served at once, until a client asks for
+// a shutdown. Return the process's exit code.
+extern int serve_run(const char *socket_path, const compile_options *opts,
+		     unsigned int threads);
+
+// The response to a compile request
+typedef struct {
+    int status;
+    char *output; // the output (null terminated), from malloc
+    size_t output_size;
+    char *errors; // the errors (null terminated), from malloc
+    size_t errors_size;
+} serve_result;
+
+// Return a connection to the server listening at socket_path,
+// or -1 (with errno set) if there is none
+extern int serve_connect(const char *socket_path);
+
+// Requires: fd is a connection to a server
+// Ask the server to compile the file at path, putting the response in *r.
+// Return true if that worked, and false if the connection failed.
+extern bool serve_compile_file(int fd, const char *path, serve_result *r);
+
+// Requires: fd is a connection to a server and name contains no newline
+// Ask the server to compile the len chars at text (named name),
+// putting the response in *r.
+// Return true if that worked, and false if the connection failed.
+extern bool serve_compile_source(int fd, const char *name,
+				 const char *text, size_t len,
+				 serve_result *r);
+
+// Requires: fd is a connection to a server
+// Ask the server to shut down, returning false if the connection failed
+extern bool serve_shutdown(int fd);
+
+// Free the storage used by the response r
+extern void serve_result_free(serve_result *r);
+
+#endif
@@ -0,0 +1,212 @@
+// Benchmark for the compile server: reports the latency of compiling
+// a small program by running the compiler in a process of its own
+// (as a build tool would), and by asking a compile server
+// (./compiler --serve) over a connection made for each request,
+// both with a file request and with a source request (see serve.h).
+// The argument is the number of compilations of each kind
+// (by default DEFAULT_RUNS). The compiler must have been built.
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "serve.h"
+#include "utilities.h"
+
+// name of the generated program file
+#define BENCH_FILE "serve_bench.tmp.spl"
+
+// the socket the server listens on
+#define BENCH_SOCKET "serve_bench.tmp.sock"
+
+// the compiler that is run
+#define COMPILER "./compiler"
+
+// number of compilations of each kind, by default
+#define DEFAULT_RUNS 200
+
+// number of procedures in the program, and statements in each
+#define PROCS 10
+#define PROC_STMTS 10
+
+// how long to wait for the server to start (in milliseconds)
+#define START_WAIT_MS 5000
+
+// Return the current time in nanoseconds
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Write a small program, with PROCS procedures
+// that each have PROC_STMTS statements, to BENCH_FILE,
+// returning its text (from malloc) and putting its length in *len
+static char *write_program(size_t *len)
+{
+    char *text = NULL;
+    FILE *f = open_memstream(&text, len);
+    if (f == NULL) {
+	bail_with_error("No space for the program!");
+    }
+    fprintf(f, "begin\n  const n = 10;\n  var x, y;\n");
+    for (int p = 0; p < PROCS; p++) {
+	fprintf(f, "  proc p%d\n  begin\n    var z;\n", p);
+	for (int s = 0; s < PROC_STMTS; s++) {
+	    fprintf(f, "    z := ((x + %d) * y) - n;\n", s);
+	}
+	fprintf(f, "    if z > 0 then x := z else y := z end\n  end;\n");
+    }
+    for (int p = 0; p < PROCS; p++) {
+	fprintf(f, "  call p%d;\n", p);
+    }
+    fprintf(f, "  print x\nend.\n");
+    fclose(f);
+    FILE *out = fopen(BENCH_FILE, "w");
+    if (out == NULL || fwrite(text, 1, *len, out) != *len) {
+	bail_with_error("Cannot write %s", BENCH_FILE);
+    }
+    fclose(out);
+    return text;
+}
+
+// Run the program in argv (in a new process, with its output
+// thrown away), returning its process ID
+static pid_t spawn(char *const argv[])
+{
+    pid_t pid = fork();
+    if (pid < 0) {
+	bail_with_error("Cannot fork");
+    } else if (pid == 0) {
+	int null = open("/dev/null", O_WRONLY);
+	dup2(null, STDOUT_FILENO);
+	dup2(null, STDERR_FILENO);
+	execv(argv[0], argv);
+	_exit(127);
+    }
+    return pid;
+}
+
+// Wait for the process pid to finish, returning its exit code
+static int finish(pid_t pid)
+{
+    int status;
+    if (waitpid(pid, &status, 0) != pid) {
+	bail_with_error("Cannot wait for process %d", (int) pid);
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Compare two doubles (for qsort)
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+// Print a line of the report for the compilations (of the given kind)
+// that took the runs times (in nanoseconds) in ns, sorting ns
+static void report(const char *kind, double *ns, unsigned int runs)
+{
+    double total = 0;
+    for (unsigned int i = 0; i < runs; i++) {
+	total += ns[i];
+    }
+    qsort(ns, runs, sizeof(double), compare_doubles);
+    printf("%-14s %8u %12.3f %12.3f %12.3f\n", kind, runs,
+	   total / runs / 1e6, ns[runs / 2] / 1e6, ns[(runs * 99) / 100] / 1e6);
+}
+
+// Ask the server to compile the program (with a file request,
+// or a source request for the len chars at text, if text is not NULL),
+// on a connection made for the request, and check that it worked
+static void request(const char *text, size_t len)
+{
+    int fd = serve_connect(BENCH_SOCKET);
+    if (fd < 0) {
+	bail_with_error("Cannot connect to the server");
+    }
+    serve_result r;
+    bool ok = (text != NULL)
+	? serve_compile_source(fd, BENCH_FILE, text, len, &r)
+	: serve_compile_file(fd, BENCH_FILE, &r);
+    if (!ok || r.status != 0) {
+	bail_with_error("The server did not compile %s", BENCH_FILE);
+    }
+    serve_result_free(&r);
+    close(fd);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int runs = DEFAULT_RUNS;
+    if (argc > 1) {
+	runs = (unsigned int) atoi(argv[1]);
+	if (runs == 0) {
+	    bail_with_error("Usage: %s [runs]", argv[0]);
+	}
+    }
+    size_t len;
+    char *text = write_program(&len);
+    double *ns = (double *) malloc(runs * sizeof(double));
+    if (ns == NULL) {
+	bail_with_error("No space for %u times!", runs);
+    }
+
+    printf("%-14s %8s %12s %12s %12s\n",
+	   "compiling by", "runs", "mean ms", "median ms", "p99 ms");
+
+    char *compile_argv[] = { COMPILER, BENCH_FILE, NULL };
+    for (unsigned int i = 0; i < runs; i++) {
+	double start = now_ns();
+	if (finish(spawn(compile_argv)) != 0) {
+	    bail_with_error("%s did not compile %s", COMPILER, BENCH_FILE);
+	}
+	ns[i] = now_ns() - start;
+    }
+    report("process", ns, runs);
+
+    char *serve_argv[] = { COMPILER, "--serve", BENCH_SOCKET, NULL };
+    pid_t server = spawn(serve_argv);
+    int fd = -1;
+    for (int waited = 0; fd < 0 && waited < START_WAIT_MS; waited++) {
+	struct timespec ms = { 0, 1000000 };
+	nanosleep(&ms, NULL);
+	fd = serve_connect(BENCH_SOCKET);
+    }
+    if (fd < 0) {
+	bail_with_error("The server did not start");
+    }
+    close(fd);
+    // (the first request warms up the server)
+    request(NULL, 0);
+
+    for (unsigned int i = 0; i < runs; i++) {
+	double start = now_ns();
+	request(NULL, 0);
+	ns[i] = now_ns() - start;
+    }
+    report("server, file", ns, runs);
+
+    for (unsigned int i = 0; i < runs; i++) {
+	double start = now_ns();
+	request(text, len);
+	ns[i] = now_ns() - start;
+    }
+    report("server, source", ns, runs);
+
+    fd = serve_connect(BENCH_SOCKET);
+    if (fd < 0 || !serve_shutdown(fd)) {
+	bail_with_error("Cannot shut down the server");
+    }
+    close(fd);
+    finish(server);
+    free(ns);
+    free(text);
+    remove(BENCH_FILE);
+    return EXIT_SUCCESS;
+}
@@ -2,6 +2,10 @@
 
 %code top {
 #include <stdio.h>
+
+ /* Let the parser's stacks grow (on the heap) as deep as programs nest,
+    instead of bison's default limit of 10000 entries */
+#define YYMAXDEPTH 100000000
 }
 
 %code requires {
@@ -12,18 +16,23 @@
 #include "parser_types.h"
 #include "lexer.h"
 
-    /* Report an error to the user on stderr */
-extern void yyerror(const char *filename, const char *msg);
-
 }    /* end of %code requires */
 
 %verbose
 %define parse.lac full
-%define parse.error detailed
+ /* the messages are bison's detailed ones, but do not mention
+    the tokens used by lazy parsing (see yyreport_syntax_error) */
+%define parse.error custom
+
+ /* The parser is pure (reentrant): its state is local to yyparse,
+    so several threads can parse at once, each with its own lexer. */
+%define api.pure full
 
- /* the following passes file_name to yyerror,
-    and declares it as an formal parameter of yyparse. */
-%parse-param { char const *file_name }
+ /* the following passes the lexer to yylex and yyerror,
+    and the place for the program's AST to yyerror,
+    and declares them as formal parameters of yyparse. */
+%param { lexer *lx }
+%parse-param { block_t *prog }
 
 %token <ident> identsym
 %token <number> numbersym 
@@ -63,6 +72,14 @@ extern void yyerror(const char *filename, const char *msg);
 %token <token> gtsym      ">"
 %token <token> geqsym     ">="
 
+ /* In lazy mode, the lexer skips the body of each procedure
+    declared in the program's block, returning lazyblocksym for it
+    (see lexer_set_lazy), and it starts with bodystartsym when it is
+    reading the body of a procedure, to be parsed as a block
+    (see parseProcBody). */
+%token <lazy_block> lazyblocksym
+%token bodystartsym
+
 %type <block> program
 
 %type <block> block
@@ -102,25 +119,23 @@ extern void yyerror(const char *filename, const char *msg);
 %type <expr> factor
 %type <token> sign
 
-%start program
+%start input
 
 %code {
- /* extern declarations provided by the lexer */
-extern int yylex(void);
-
- /* The AST for the program, set by the semantic action 
-    for the nonterminal program. */
-block_t progast; 
-
- /* Set the program's ast to be t */
-extern void setProgAST(block_t t);
+ /* Report a syntax error to the user (through the lexer) */
+static void yyerror(lexer *lx, block_t *prog, const char *msg);
 }
 
 %%
  /* Write your grammar rules below and before the next %% */
 
+input:
+    program
+    | bodystartsym block { *prog = $2; }
+    ;
+
 program:
-    block "." { setProgAST($1); }
+    block "." { *prog = $1; }
     ;
 
 block:
@@ -138,8 +153,7 @@ constDecls:
 empty: 
     %empty
     {
-        file_location *floc = file_location_make(lexer_filename(), lexer_line());
-        $$ = ast_empty(floc); 
+        $$ = ast_empty(lexer_location_of(lx)); 
     }
     ;
 
@@ -167,7 +181,7 @@ varDecl:
 
 identList:
     identsym { $$ = ast_ident_list_singleton($1); }
-    | identList "," identsym {ast_ident_list($1, $3); }
+    | identList "," identsym { $$ = ast_ident_list($1, $3); }
     ;
 
 procDecls:
@@ -177,6 +191,7 @@ procDecls:
 
 procDecl:
     "proc" identsym block ";" { $$ = ast_proc_decl($2, $3); }
+    | "proc" identsym lazyblocksym ";" { $$ = ast_proc_decl_lazy($2, $3); }
     ;
 
 stmts:
@@ -276,9 +291,56 @@ sign:
 
 %%
 
-// Set the program's ast to be ast
-void setProgAST(block_t ast) { progast = ast; }
-
-
+// Report the syntax error msg to the user, at the line lx has reached
+static void yyerror(lexer *lx, block_t *prog, const char *msg)
+{
+    lexer_error(lx, msg);
+}
 
+// Is the token of kind sym one the user never writes
+// (but only the lexer, in lazy mode)?
+static bool lazy_token(yysymbol_kind_t sym)
+{
+    return sym == YYSYMBOL_lazyblocksym || sym == YYSYMBOL_bodystartsym;
+}
 
+// the most tokens listed as expected in a syntax error message
+#define MAX_EXPECTED_TOKENS 4
+
+// Report the syntax error described by ctx to the user (through lx),
+// as bison's detailed messages do: listing the unexpected token,
+// and the expected ones (if there are not too many of them),
+// but not those only used by lazy parsing.
+// Return 0, or bison's code if there is no space to do that.
+static int yyreport_syntax_error(const yypcontext_t *ctx, lexer *lx,
+				 block_t *prog)
+{
+    yysymbol_kind_t unexpected = yypcontext_token(ctx);
+    if (unexpected == YYSYMBOL_YYEMPTY) {
+	lexer_error(lx, "syntax error");
+	return 0;
+    }
+    yysymbol_kind_t expected[YYNTOKENS];
+    int count = yypcontext_expected_tokens(ctx, expected, YYNTOKENS);
+    if (count < 0) {
+	return count;
+    }
+    int shown = 0;
+    for (int i = 0; i < count; i++) {
+	if (!lazy_token(expected[i])) {
+	    expected[shown++] = expected[i];
+	}
+    }
+    char msg[512];
+    int len = snprintf(msg, sizeof(msg), "syntax error, unexpected %s",
+		       yysymbol_name(unexpected));
+    if (shown <= MAX_EXPECTED_TOKENS) {
+	for (int i = 0; i < shown && len < (int) sizeof(msg); i++) {
+	    len += snprintf(msg + len, sizeof(msg) - len, "%s%s",
+			    (i == 0) ? ", expecting " : " or ",
+			    yysymbol_name(expected[i]));
+	}
+    }
+    lexer_error(lx, msg);
+    return 0;
+}
@@ -0,0 +1,116 @@
+// A client for the compile server (compiler --serve socket, see serve.h):
+// it asks the server to compile each file named on the command line
+// (or the program on standard input, for "-"), printing the output
+// and errors for each, in order, as the compiler would have,
+// and exits with the status of the first compilation that failed.
+// The client reads each file and sends its text, named as on the
+// command line, so the diagnostics are the same as the compiler's
+// wherever the server is running.
+// With --shutdown, it asks the server to shut down instead.
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "serve.h"
+
+/* Print a usage message on stderr
+   and exit with failure. */
+static void usage(const char *cmdname)
+{
+    fprintf(stderr,
+	    "Usage: %s socket file.spl ...\n"
+	    "   or: %s socket --shutdown\n"
+	    "(where a file named - means the program on standard input)\n",
+	    cmdname, cmdname);
+    exit(EXIT_FAILURE);
+}
+
+// Print an error message (about the socket at socket_path) on stderr
+// and exit with failure
+static void connection_failed(const char *socket_path)
+{
+    fprintf(stderr, "Cannot talk to the compile server on %s: %s\n",
+	    socket_path, strerror(errno));
+    exit(EXIT_FAILURE);
+}
+
+// Read all of the file f, returning its contents (from malloc)
+// and putting its length in *len
+static char *read_all(FILE *f, size_t *len)
+{
+    size_t capacity = 4096;
+    size_t n = 0;
+    char *buf = (char *) malloc(capacity);
+    while (buf != NULL) {
+	n += fread(buf + n, 1, capacity - n, f);
+	if (n < capacity) {
+	    break;
+	}
+	capacity *= 2;
+	buf = (char *) realloc(buf, capacity);
+    }
+    if (buf == NULL) {
+	fprintf(stderr, "No space to read a program!\n");
+	exit(EXIT_FAILURE);
+    }
+    *len = n;
+    return buf;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *cmdname = argv[0];
+    if (argc < 3) {
+	usage(cmdname);
+    }
+    const char *socket_path = argv[1];
+    int fd = serve_connect(socket_path);
+    if (fd < 0) {
+	connection_failed(socket_path);
+    }
+    if (strcmp(argv[2], "--shutdown") == 0) {
+	if (argc != 3 || !serve_shutdown(fd)) {
+	    connection_failed(socket_path);
+	}
+	close(fd);
+	return EXIT_SUCCESS;
+    }
+
+    int status = EXIT_SUCCESS;
+    for (int i = 2; i < argc; i++) {
+	bool is_stdin = strcmp(argv[i], "-") == 0;
+	FILE *f = is_stdin ? stdin : fopen(argv[i], "r");
+	if (f == NULL) {
+	    // as the compiler would report it
+	    fprintf(stderr, "Cannot open %s: %s\n", argv[i], strerror(errno));
+	    if (status == EXIT_SUCCESS) {
+		status = EXIT_FAILURE;
+	    }
+	    continue;
+	}
+	size_t len;
+	char *text = read_all(f, &len);
+	if (!is_stdin) {
+	    fclose(f);
+	}
+	serve_result r;
+	bool ok = serve_compile_source(fd, is_stdin ? "stdin" : argv[i],
+				       text, len, &r);
+	free(text);
+	if (!ok) {
+	    connection_failed(socket_path);
+	}
+	fwrite(r.output, 1, r.output_size, stdout);
+	fflush(stdout);
+	fwrite(r.errors, 1, r.errors_size, stderr);
+	fflush(stderr);
+	if (status == EXIT_SUCCESS) {
+	    status = r.status;
+	}
+	serve_result_free(&r);
+    }
+    close(fd);
+    return status;
+}
@@ -1,30 +1,339 @@
 #include <stddef.h>
+#include <stdlib.h>
 #include "symtab.h"
 #include "scope.h"
+#include "arena.h"
 #include "utilities.h"
 
 // The symbol table is a stack of scope (see the scope module).
 
+// To find the innermost declaration of a name without probing
+// every scope, the symbol table also keeps a shadow chain for each name:
+// the stack of its bindings in the scopes on the stack, innermost first.
+
+// Each thread has a symbol table of its own.
+// A thread's table can also be layered over a frozen view of
+// another thread's table (see symtab_freeze and symtab_layer_over),
+// whose scopes then act as the outer scopes of the thread's own,
+// so that, e.g., the bodies of sibling procedures can be checked
+// by different threads against the same enclosing scopes.
+
+// A binding of a name in one of the scopes on the stack
+typedef struct {
+    id_attrs *attrs;
+    // index in symtab of the scope the binding is in
+    int level;
+    struct symbol_s *sym;
+    // index in bindings of the binding this one shadows (or -1)
+    int shadowed;
+} binding_t;
+
+// A name that has been bound, with the index in bindings
+// of its innermost binding (or -1 if it is not bound now)
+// (symbols are allocated in the arena)
+typedef struct symbol_s {
+    const char *name;
+    int top;
+} symbol_t;
+
+// Initial number of slots in the table of symbols (a power of 2)
+#define INITIAL_SYMBOLS_CAPACITY 64
+
+// all the bindings in the scopes on the stack, in the order they were made
+// (so the bindings of the innermost scope are at the end)
+static _Thread_local binding_t *bindings = NULL;
+static _Thread_local unsigned int bindings_size = 0;
+static _Thread_local unsigned int bindings_capacity = 0;
+
+// open addressing (linear probing) hash table of the symbols,
+// with each slot NULL if it is empty
+// Invariant: symbols_count <= symbols_capacity / 2
+static _Thread_local symbol_t **symbols = NULL;
+static _Thread_local unsigned int symbols_count = 0;
+static _Thread_local unsigned int symbols_capacity = 0;
+
+// Initial number of scopes the stack has room for
+// (it grows geometrically beyond this, so nesting is not limited)
+#define INITIAL_NESTING_CAPACITY 64
+
 // index of the top of the stack of scopes
-static int symtab_top_idx = -1;
+static _Thread_local int symtab_top_idx = -1;
+
+// the symbol table itself, with room for symtab_capacity scopes
+static _Thread_local scope_t **symtab = NULL;
+static _Thread_local unsigned int symtab_capacity = 0;
+
+// the pool of scopes that have been left,
+// which are reused by symtab_enter_scope() (linked through next_free)
+static _Thread_local scope_t *free_scopes = NULL;
+
+// A frozen view of a thread's symbol table
+struct symtab_view_s {
+    const binding_t *bindings;
+    symbol_t *const *symbols;
+    unsigned int symbols_capacity;
+    int top_idx;
+};
+
+// the view this thread's table is layered over (or NULL),
+// the number of its bindings that are visible,
+// and the number of scopes in it
+static _Thread_local const symtab_view *outer = NULL;
+static _Thread_local symtab_snapshot outer_visible = 0;
+static _Thread_local unsigned int outer_levels = 0;
+
+// Return s to the pool of free scopes
+static void symtab_release_scope(scope_t *s)
+{
+    scope_reset(s);
+    s->next_free = free_scopes;
+    free_scopes = s;
+}
+
+// Return an empty scope, reusing one from the pool if possible
+static scope_t *symtab_acquire_scope()
+{
+    if (free_scopes == NULL) {
+	return scope_create();
+    }
+    scope_t *ret = free_scopes;
+    free_scopes = ret->next_free;
+    ret->next_free = NULL;
+    return ret;
+}
+
+// Return the slot in table (a table of symbols of the given capacity)
+// that holds the symbol for name,
+// or the (empty) slot where it would go if there is none
+static symbol_t *const *symtab_slot_in(symbol_t *const *table,
+				       unsigned int capacity,
+				       const char *name)
+{
+    unsigned int mask = capacity - 1;
+    unsigned int slot = scope_hash(name) & mask;
+    while (table[slot] != NULL && table[slot]->name != name) {
+	slot = (slot + 1) & mask;
+    }
+    return &table[slot];
+}
+
+// Return the slot in symbols that holds the symbol for name,
+// or the (empty) slot where it would go if there is none
+static symbol_t **symtab_symbol_slot(const char *name)
+{
+    return (symbol_t **) symtab_slot_in(symbols, symbols_capacity, name);
+}
+
+// Make the table of symbols empty, with the given capacity
+static void symtab_alloc_symbols(unsigned int capacity)
+{
+    symbols = (symbol_t **) calloc(capacity, sizeof(symbol_t *));
+    if (symbols == NULL) {
+	bail_with_error("No space for the symbol table's symbols!");
+    }
+    symbols_count = 0;
+    symbols_capacity = capacity;
+}
+
+// Double the capacity of the table of symbols
+static void symtab_grow_symbols()
+{
+    symbol_t **old_symbols = symbols;
+    unsigned int old_capacity = symbols_capacity;
+    unsigned int count = symbols_count;
+    symtab_alloc_symbols(2 * old_capacity);
+    for (unsigned int i = 0; i < old_capacity; i++) {
+	if (old_symbols[i] != NULL) {
+	    *symtab_symbol_slot(old_symbols[i]->name) = old_symbols[i];
+	}
+    }
+    symbols_count = count;
+    free(old_symbols);
+}
+
+// Return the symbol for name, creating it if necessary
+static symbol_t *symtab_symbol(const char *name)
+{
+    symbol_t **slot = symtab_symbol_slot(name);
+    if (*slot != NULL) {
+	return *slot;
+    }
+    if (2 * (symbols_count + 1) > symbols_capacity) {
+	symtab_grow_symbols();
+	slot = symtab_symbol_slot(name);
+    }
+    symbol_t *sym = (symbol_t *) arena_alloc(sizeof(symbol_t));
+    sym->name = name;
+    sym->top = -1;
+    *slot = sym;
+    symbols_count++;
+    return sym;
+}
+
+// Return (a pointer to) the innermost binding of name,
+// or NULL if name is not declared in any scope on the stack
+static binding_t *symtab_innermost_binding(const char *name)
+{
+    symbol_t *sym = *symtab_symbol_slot(name);
+    if (sym == NULL || sym->top < 0) {
+	return NULL;
+    }
+    return &bindings[sym->top];
+}
+
+// Return (a pointer to) the innermost binding of name in the outer view
+// that is visible, or NULL if there is none
+static const binding_t *symtab_outer_binding(const char *name)
+{
+    if (outer == NULL) {
+	return NULL;
+    }
+    symbol_t *sym = *symtab_slot_in(outer->symbols, outer->symbols_capacity,
+				    name);
+    if (sym == NULL) {
+	return NULL;
+    }
+    // the bindings made after the snapshot are skipped
+    int i = sym->top;
+    while (i >= 0 && (symtab_snapshot) i >= outer_visible) {
+	i = outer->bindings[i].shadowed;
+    }
+    return (i < 0) ? NULL : &outer->bindings[i];
+}
+
+// Bind sym to attrs in the current scope, shadowing its outer bindings
+static void symtab_push_binding(symbol_t *sym, id_attrs *attrs)
+{
+    if (bindings_size == bindings_capacity) {
+	unsigned int capacity
+	    = (bindings_capacity == 0) ? INITIAL_SYMBOLS_CAPACITY
+	                               : 2 * bindings_capacity;
+	binding_t *bigger
+	    = (binding_t *) realloc(bindings, capacity * sizeof(binding_t));
+	if (bigger == NULL) {
+	    bail_with_error("No space for the symbol table's bindings!");
+	}
+	bindings = bigger;
+	bindings_capacity = capacity;
+    }
+    binding_t *b = &bindings[bindings_size];
+    b->attrs = attrs;
+    b->level = symtab_top_idx;
+    b->sym = sym;
+    b->shadowed = sym->top;
+    sym->top = bindings_size++;
+}
 
-// the symbol table itself
-static scope_t *symtab[MAX_NESTING];
+// Remove the bindings of the current scope,
+// uncovering the bindings they shadow
+static void symtab_pop_bindings()
+{
+    while (bindings_size > 0
+	   && bindings[bindings_size - 1].level == symtab_top_idx) {
+	binding_t *b = &bindings[--bindings_size];
+	b->sym->top = b->shadowed;
+    }
+}
 
 // initialize the symbol table
 void symtab_initialize()
 {
-    // initialize the internal state
+    // initialize the internal state,
+    // recycling any scopes left from a previous use
+    for (int i = 0; i <= symtab_top_idx; i++) {
+	symtab_release_scope(symtab[i]);
+    }
+    symtab_top_idx = -1;
+    bindings_size = 0;
+    free(symbols);
+    symtab_alloc_symbols(INITIAL_SYMBOLS_CAPACITY);
+    outer = NULL;
+    outer_visible = 0;
+    outer_levels = 0;
+}
+
+// Free all the storage used by this thread's symbol table
+// (which must be initialized again before it is used)
+void symtab_release()
+{
+    for (int i = 0; i <= symtab_top_idx; i++) {
+	scope_destroy(symtab[i]);
+    }
+    free(symtab);
+    symtab = NULL;
+    symtab_capacity = 0;
     symtab_top_idx = -1;
-    for (int i = 0; i < MAX_NESTING; i++) {
-	symtab[i] = NULL;
+    while (free_scopes != NULL) {
+	scope_t *next = free_scopes->next_free;
+	scope_destroy(free_scopes);
+	free_scopes = next;
+    }
+    free(bindings);
+    bindings = NULL;
+    bindings_size = 0;
+    bindings_capacity = 0;
+    free(symbols);
+    symbols = NULL;
+    symbols_count = 0;
+    symbols_capacity = 0;
+    outer = NULL;
+    outer_visible = 0;
+    outer_levels = 0;
+}
+
+// Requires: this thread's table is not layered over a view
+// Return a frozen view of this thread's symbol table,
+// which other threads may layer their tables over.
+// The view is only valid until this thread next changes its table.
+symtab_view *symtab_freeze()
+{
+    assert(outer == NULL);
+    symtab_view *ret = (symtab_view *) malloc(sizeof(symtab_view));
+    if (ret == NULL) {
+	bail_with_error("No space for a view of the symbol table!");
+    }
+    ret->bindings = bindings;
+    ret->symbols = symbols;
+    ret->symbols_capacity = symbols_capacity;
+    ret->top_idx = symtab_top_idx;
+    return ret;
+}
+
+// Free the storage used by the view v
+void symtab_view_destroy(symtab_view *v)
+{
+    free(v);
+}
+
+// Return a snapshot of this thread's symbol table,
+// which identifies the bindings made in it so far
+symtab_snapshot symtab_take_snapshot()
+{
+    return bindings_size;
+}
+
+// Requires: this thread's table has no scopes of its own,
+//           and v is a view of another thread's table (or NULL)
+//           in which snap was taken
+// Make the scopes of v the outer scopes of this thread's table,
+// with only the bindings made before snap was taken visible in them
+// (if v is NULL, this thread's table is no longer layered over a view)
+void symtab_layer_over(const symtab_view *v, symtab_snapshot snap)
+{
+    assert(symtab_top_idx < 0);
+    if (symbols == NULL) {
+	symtab_initialize();
     }
+    outer = v;
+    outer_visible = (v == NULL) ? 0 : snap;
+    outer_levels = (v == NULL) ? 0 : v->top_idx + 1;
 }
 
-// Return the number of scopes currently in the symbol table.
+// Return the number of scopes currently in the symbol table
+// (including those of the view it is layered over, if any).
 unsigned int symtab_size()
 {
-    return symtab_top_idx + 1;
+    return outer_levels + symtab_top_idx + 1;
 }
 
 // Does this symbol table have any scopes in it?
@@ -57,29 +366,30 @@ bool symtab_scope_full()
 unsigned int symtab_current_nesting_level()
 {
     // assert(symtab_top_idx >= 0);
-    return symtab_top_idx;
+    return outer_levels + symtab_top_idx;
 }
 
 // Is the symbol table itself full
-// (i.e., is symtab_current_nesting_level() equal to MAX_NESTING-1)?
+// (i.e., can this thread enter no more scopes)?
+// (The stack of scopes grows as needed, so this is always false.)
 bool symtab_full()
 {
-    return symtab_current_nesting_level() == MAX_NESTING - 1;
+    return false;
 }
 
 // Is the given name associated with some attributes?
 // (this looks back through all scopes).
 bool symtab_declared(const char *name)
 {
-    return symtab_lookup(name) != NULL;
+    return symtab_innermost_binding(name) != NULL
+	|| symtab_outer_binding(name) != NULL;
 }
 
 // Is the given name associated with some attributes in the current scope?
 // (this only looks in the current scope).
 bool symtab_declared_in_current_scope(const char *name)
 {
-    id_attrs *attrs = scope_lookup(symtab[symtab_top_idx], name);
-    return attrs != NULL;
+    return symtab_find(name) != NULL;
 }
 
 
@@ -88,14 +398,15 @@ bool symtab_declared_in_current_scope(const char *name)
 // into the current scope's symbol table at the offset scope_next_offset().
 static void add_ident(scope_t *s, const char *name, id_attrs *attrs)
 {
-    id_attrs *old_attrs = scope_lookup(s, name);
-    if (old_attrs != NULL) 
+    symbol_t *sym = symtab_symbol(name);
+    if (sym->top >= 0 && bindings[sym->top].level == symtab_top_idx) 
     {
         bail_with_prog_error(attrs->file_loc, "symtab_insert called with an already declared variable\"%s\"!", name);
     } 
     else 
     {
 	    scope_insert(s, name, attrs);
+	    symtab_push_binding(sym, attrs);
     }
 }
 
@@ -107,12 +418,29 @@ void symtab_insert(const char *name, id_attrs *attrs)
     add_ident(symtab[symtab_top_idx], name, attrs);
 }
 
+// Double the number of scopes the stack has room for
+static void symtab_grow()
+{
+    unsigned int capacity = (symtab_capacity == 0) ? INITIAL_NESTING_CAPACITY
+	                                           : 2 * symtab_capacity;
+    scope_t **bigger
+	= (scope_t **) realloc(symtab, capacity * sizeof(scope_t *));
+    if (bigger == NULL) {
+	bail_with_error("No space to nest %u scopes!", capacity);
+    }
+    symtab = bigger;
+    symtab_capacity = capacity;
+}
+
 // Requires: !symtab_full()
 // Start a new scope (for a procedure)
 void symtab_enter_scope()
 {
+    if ((unsigned int) (symtab_top_idx + 1) == symtab_capacity) {
+	symtab_grow();
+    }
     symtab_top_idx++;
-    symtab[symtab_top_idx] = scope_create();
+    symtab[symtab_top_idx] = symtab_acquire_scope();
 }
 
 // Requires: !symtab_empty()
@@ -122,32 +450,59 @@ void symtab_leave_scope()
     {
 	    bail_with_error("Cannot leave scope, no scope on symtab's stack!");
     }
+    symtab_pop_bindings();
+    symtab_release_scope(symtab[symtab_top_idx]);
     symtab_top_idx--;
 }
 
+// Requires: idu != NULL
+// If name is declared, store its attributes and the number of
+// levels outward of its declaration into *idu and return true,
+// otherwise return false.
+// (this looks back through all scopes, using name's shadow chain).
+bool symtab_lookup_use(const char *name, id_use *idu)
+{
+    binding_t *b = symtab_innermost_binding(name);
+    if (b == NULL) 
+    {
+        const binding_t *ob = symtab_outer_binding(name);
+        if (ob == NULL)
+        {
+            return false;
+        }
+        // all of this thread's scopes are inside the view's
+        idu->attrs = ob->attrs;
+        idu->levelsOutward = symtab_top_idx + 1 + (outer->top_idx - ob->level);
+        return true;
+    }
+    idu->attrs = b->attrs;
+    idu->levelsOutward = symtab_top_idx - b->level;
+    return true;
+}
+
 // Return (a pointer to) the attributes of the given name 
 // or NULL if there is no association for name in the symbol table.
 // (this looks back through all scopes).
 id_use *symtab_lookup(const char *name)
 {
-    unsigned int levelsOut = 0;
-    for (int level = symtab_top_idx; 0 <= level; level--) 
+    id_use idu;
+    if (!symtab_lookup_use(name, &idu)) 
     {
-	    id_attrs *attrs = scope_lookup(symtab[level], name);
-
-        if (attrs != NULL) 
-        {
-            return id_use_create(attrs, levelsOut);
-        }
-        levelsOut++;
+        return NULL;
     }
-    return NULL;
+    return id_use_create(idu.attrs, idu.levelsOutward);
 }
 
+// Return (a pointer to) the attributes of the given name
+// in the current scope, or NULL if it is not declared there.
 id_attrs *symtab_find(const char *name)
 {
-    id_attrs *attrs = scope_lookup(symtab[symtab_top_idx], name);
-    return attrs;
+    binding_t *b = symtab_innermost_binding(name);
+    if (b == NULL || b->level != symtab_top_idx) 
+    {
+        return NULL;
+    }
+    return b->attrs;
 }
 
 // We'll use lexical addresses in HW4...
@@ -4,13 +4,49 @@
 #include "scope.h"
 #include "id_use.h"
 
-// Maximum nesting of potential scopes
-#define MAX_NESTING 100
+// Names given to the symbol table must be interned (see intern.h),
+// as they are compared by pointer equality.
+// Each thread has its own symbol table, which this interface works on.
 
 // initialize the symbol table
 extern void symtab_initialize();
 
-// Return the number of scopes currently in the symbol table.
+// Free all the storage used by this thread's symbol table
+// (which must be initialized again before it is used)
+extern void symtab_release();
+
+// A frozen (read-only) view of a thread's symbol table,
+// which the tables of other threads can be layered over
+typedef struct symtab_view_s symtab_view;
+
+// A snapshot identifies the bindings made in a symbol table
+// up to the time it was taken
+typedef unsigned int symtab_snapshot;
+
+// Requires: this thread's table is not layered over a view
+// Return a frozen view of this thread's symbol table,
+// which other threads may layer their tables over.
+// The view is only valid until this thread next changes its table.
+extern symtab_view *symtab_freeze();
+
+// Free the storage used by the view v
+extern void symtab_view_destroy(symtab_view *v);
+
+// Return a snapshot of this thread's symbol table,
+// which identifies the bindings made in it so far
+extern symtab_snapshot symtab_take_snapshot();
+
+// Requires: this thread's table has no scopes of its own,
+//           and v is a view of another thread's table (or NULL)
+//           in which snap was taken
+// Make the scopes of v the outer scopes of this thread's table,
+// with only the bindings made before snap was taken visible in them,
+// so names not declared in this thread's scopes are looked up in v
+// (if v is NULL, this thread's table is no longer layered over a view)
+extern void symtab_layer_over(const symtab_view *v, symtab_snapshot snap);
+
+// Return the number of scopes currently in the symbol table
+// (including those of the view it is layered over, if any).
 extern unsigned int symtab_size();
 
 // Does this symbol table have any scopes in it?
@@ -33,6 +69,7 @@ extern bool symtab_scope_full();
 extern unsigned int symtab_current_nesting_level();
 
 // Is the symbol table itself full?
+// (the stack of scopes grows as needed, so it never is)
 extern bool symtab_full();
 
 // Is name declared?
@@ -56,9 +93,17 @@ extern void symtab_enter_scope();
 // Requires: !symtab_empty()
 extern void symtab_leave_scope();
 
+// Requires: idu != NULL
+// If name is declared, store the id_use for it
+// (its attributes and levels outward) into *idu and return true,
+// otherwise return false (without changing *idu).
+// This does not allocate any storage.
+extern bool symtab_lookup_use(const char *name, id_use *idu);
+
 // If name is declared, return
 // an id_use pointer for it, otherwise
 // return NULL if name isn't declared
+// (this allocates a fresh id_use, see symtab_lookup_use)
 extern id_use *symtab_lookup(const char *name);
 
 extern id_attrs *symtab_find(const char *name);
@@ -0,0 +1,277 @@
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "thread_pool.h"
+#include "utilities.h"
+
+// Each worker's share of the tasks not yet started is a range of task
+// numbers [front, back), packed into one word (front in the high half),
+// so the owner (taking from the front) and thieves (taking from the back)
+// can both update it with a single compare and swap.
+// The shares are padded to separate cache lines.
+typedef struct {
+    _Alignas(64) _Atomic uint64_t range;
+} worker_share;
+
+// A thread's pool of worker threads, and the batch they are running.
+// The workers wait on work_ready for a new batch (a new generation)
+// and the owner waits on work_done for them to finish it;
+// the fields from generation on are protected by lock.
+typedef struct pool_s {
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+    pthread_t *ids; // the threads started (of which there are started)
+    unsigned int started;
+    unsigned int capacity; // the room in ids and shares
+    worker_share *shares;
+    // the batch being run, by the workers numbered below workers
+    unsigned int workers;
+    thread_pool_task_fn task;
+    thread_pool_done_fn done;
+    void *ctx;
+    unsigned long generation; // the number of batches started
+    unsigned int running; // the number of workers not done with the batch
+    bool stopping; // true when the workers should call done and exit
+} pool_t;
+
+// What a worker thread is started with (which it frees)
+typedef struct {
+    pool_t *pool;
+    unsigned int worker;
+} worker_arg;
+
+// this thread's pool of workers (or NULL, if it has none)
+static _Thread_local pool_t *pool = NULL;
+
+// Return the range [front, back) packed into a word
+static uint64_t pack_range(uint32_t front, uint32_t back)
+{
+    return ((uint64_t) front << 32) | back;
+}
+
+// Take a task from the front (if from_front) or the back of share,
+// storing its number in *task and returning true,
+// or return false if share is empty
+static bool take_task(worker_share *share, bool from_front,
+		      unsigned int *task)
+{
+    uint64_t r = atomic_load(&share->range);
+    for (;;) {
+	uint32_t front = (uint32_t) (r >> 32);
+	uint32_t back = (uint32_t) r;
+	if (front >= back) {
+	    return false;
+	}
+	uint64_t taken = from_front ? pack_range(front + 1, back)
+	                            : pack_range(front, back - 1);
+	// (on failure, r is updated to the current range)
+	if (atomic_compare_exchange_weak(&share->range, &r, taken)) {
+	    *task = from_front ? front : back - 1;
+	    return true;
+	}
+    }
+}
+
+// Run tasks from the worker's own share, then steal from the others,
+// until no tasks of the batch are left
+static void run_batch(pool_t *pool, unsigned int worker)
+{
+    unsigned int task;
+    for (;;) {
+	if (take_task(&pool->shares[worker], true, &task)) {
+	    pool->task(pool->ctx, task, worker);
+	    continue;
+	}
+	bool stole = false;
+	for (unsigned int i = 1; i < pool->workers && !stole; i++) {
+	    unsigned int victim = (worker + i) % pool->workers;
+	    stole = take_task(&pool->shares[victim], false, &task);
+	}
+	if (!stole) {
+	    // tasks are never added, so all shares stay empty
+	    break;
+	}
+	pool->task(pool->ctx, task, worker);
+    }
+}
+
+// Wait for each batch the worker takes part in and run it,
+// until the pool is stopped
+static void *worker_main(void *varg)
+{
+    pool_t *pool = ((worker_arg *) varg)->pool;
+    unsigned int worker = ((worker_arg *) varg)->worker;
+    free(varg);
+    pthread_mutex_lock(&pool->lock);
+    // (a worker is started for the batch about to be run)
+    unsigned long seen = pool->generation - 1;
+    for (;;) {
+	while (!pool->stopping && pool->generation == seen) {
+	    pthread_cond_wait(&pool->work_ready, &pool->lock);
+	}
+	if (pool->stopping) {
+	    break;
+	}
+	seen = pool->generation;
+	if (worker >= pool->workers) {
+	    continue; // (this batch needs fewer workers)
+	}
+	pthread_mutex_unlock(&pool->lock);
+	run_batch(pool, worker);
+	if (pool->done != NULL) {
+	    pool->done(pool->ctx, worker);
+	}
+	pthread_mutex_lock(&pool->lock);
+	if (--pool->running == 0) {
+	    pthread_cond_signal(&pool->work_done);
+	}
+    }
+    pthread_mutex_unlock(&pool->lock);
+    if (pool->done != NULL) {
+	pool->done(pool->ctx, worker);
+    }
+    return NULL;
+}
+
+// Return the number of processors available (at least 1)
+unsigned int thread_pool_processors()
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n < 1) ? 1 : (unsigned int) n;
+}
+
+// Return this thread's pool, creating it if need be
+static pool_t *pool_get()
+{
+    if (pool == NULL) {
+	pool = (pool_t *) calloc(1, sizeof(pool_t));
+	if (pool == NULL) {
+	    bail_with_error("No space for a thread pool!");
+	}
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work_ready, NULL);
+	pthread_cond_init(&pool->work_done, NULL);
+    }
+    return pool;
+}
+
+// Requires: p->lock is held by this thread
+// Make room in the pool p for n workers
+// (if there is no room, release p->lock and bail,
+// so the pool can still be used if the error is trapped)
+static void pool_grow(pool_t *p, unsigned int n)
+{
+    if (n <= p->capacity) {
+	return;
+    }
+    pthread_t *ids = (pthread_t *) realloc(p->ids, n * sizeof(pthread_t));
+    if (ids != NULL) {
+	p->ids = ids;
+    }
+    // (no batch is running, so the shares are not in use)
+    worker_share *shares = (worker_share *)
+	aligned_alloc(_Alignof(worker_share), n * sizeof(worker_share));
+    if (ids == NULL || shares == NULL) {
+	pthread_mutex_unlock(&p->lock);
+	bail_with_error("No space for a thread pool!");
+    }
+    free(p->shares);
+    p->shares = shares;
+    p->capacity = n;
+}
+
+// Requires: threads > 0
+// Run task(ctx, i, w) for each i in [0, tasks)
+// on min(threads, tasks) of this thread's worker threads
+// (numbered w = 0, 1, ..., and started if need be),
+// then call done(ctx, w) on each of them (unless done is NULL),
+// and return when all of that is finished.
+void thread_pool_run(unsigned int tasks, unsigned int threads,
+		     thread_pool_task_fn task, thread_pool_done_fn done,
+		     void *ctx)
+{
+    assert(threads > 0);
+    if (tasks == 0) {
+	return;
+    }
+    pool_t *p = pool_get();
+    unsigned int workers = (threads < tasks) ? threads : tasks;
+    pthread_mutex_lock(&p->lock);
+    // (grown first, so the workers see no new batch if that bails)
+    pool_grow(p, workers);
+    p->generation++;
+    if (p->started < workers) {
+	// if some threads cannot be started, the others steal their shares
+	int rc = 0;
+	while (p->started < workers) {
+	    worker_arg *arg = (worker_arg *) malloc(sizeof(worker_arg));
+	    if (arg == NULL) {
+		break;
+	    }
+	    arg->pool = p;
+	    arg->worker = p->started;
+	    rc = pthread_create(&p->ids[p->started], NULL, worker_main, arg);
+	    if (rc != 0) {
+		free(arg);
+		break;
+	    }
+	    p->started++;
+	}
+	if (p->started == 0) {
+	    // (there are no workers to see the new generation)
+	    pthread_mutex_unlock(&p->lock);
+	    // (pthread_create returns its error instead of setting errno,
+	    // and if it was not called, malloc set errno)
+	    if (rc != 0) {
+		errno = rc;
+	    }
+	    bail_with_error("Cannot create a thread for the thread pool!");
+	}
+    }
+    p->workers = (p->started < workers) ? p->started : workers;
+    for (unsigned int w = 0; w < p->workers; w++) {
+	uint32_t front = (uint32_t) ((uint64_t) tasks * w / p->workers);
+	uint32_t back = (uint32_t) ((uint64_t) tasks * (w + 1) / p->workers);
+	atomic_init(&p->shares[w].range, pack_range(front, back));
+    }
+    p->task = task;
+    p->done = done;
+    p->ctx = ctx;
+    p->running = p->workers;
+    pthread_cond_broadcast(&p->work_ready);
+    while (p->running > 0) {
+	pthread_cond_wait(&p->work_done, &p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+// Stop this thread's worker threads (if any), after calling
+// release(ctx, w) on each of them (unless release is NULL),
+// and return when they have all exited
+void thread_pool_release(thread_pool_done_fn release, void *ctx)
+{
+    if (pool == NULL) {
+	return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pool->done = release;
+    pool->ctx = ctx;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+    for (unsigned int w = 0; w < pool->started; w++) {
+	pthread_join(pool->ids[w], NULL);
+    }
+    pthread_cond_destroy(&pool->work_done);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->shares);
+    free(pool->ids);
+    free(pool);
+    pool = NULL;
+}
@@ -0,0 +1,46 @@
+#ifndef _THREAD_POOL_H
+#define _THREAD_POOL_H
+
+// The thread pool runs a batch of numbered tasks on several threads.
+// Each thread that runs batches has a pool of its own worker threads,
+// started as they are first needed and then kept, waiting for the
+// next batch, until that thread releases them (thread_pool_release),
+// so the workers' thread-local storage (e.g., their symbol tables)
+// is reused from one batch to the next.
+// Each worker starts with a contiguous share of the tasks,
+// which it runs in order; when it runs out, it steals tasks
+// from the ends of the other threads' shares (work stealing),
+// so the threads stay busy even when the tasks take very different times.
+
+// A function that runs task number task for the worker thread
+// numbered worker, given the ctx passed to thread_pool_run
+typedef void (*thread_pool_task_fn)(void *ctx, unsigned int task,
+				    unsigned int worker);
+
+// A function called by each worker thread (numbered worker)
+// when it has no more tasks to run, given the ctx passed to thread_pool_run
+typedef void (*thread_pool_done_fn)(void *ctx, unsigned int worker);
+
+// Return the number of processors available (at least 1)
+extern unsigned int thread_pool_processors();
+
+// Requires: threads > 0
+// Run task(ctx, i, w) for each i in [0, tasks)
+// on min(threads, tasks) of this thread's worker threads
+// (numbered w = 0, 1, ..., and started if need be),
+// then call done(ctx, w) on each of them (unless done is NULL),
+// and return when all of that is finished.
+// The tasks may run in any order, and concurrently with each other,
+// but never on the calling thread.
+extern void thread_pool_run(unsigned int tasks, unsigned int threads,
+			    thread_pool_task_fn task, thread_pool_done_fn done,
+			    void *ctx);
+
+// Stop this thread's worker threads (if any), after calling
+// release(ctx, w) on each of them (unless release is NULL),
+// e.g., to free their thread-local storage,
+// and return when they have all exited
+// (a later thread_pool_run starts new ones)
+extern void thread_pool_release(thread_pool_done_fn release, void *ctx);
+
+#endif
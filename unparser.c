@@ -1,33 +1,338 @@
 /* $Id: unparser.c,v 1.22 2024/10/07 21:38:11 leavens Exp $ */
 #include <stdio.h>
+#include <stdlib.h>
 #include <assert.h>
 #include "unparser.h"
+#include "parser.h"
+#include "out_buffer.h"
+#include "thread_pool.h"
 #include "utilities.h"
 
 // Amount of spaces to indent per nesting level
 #define SPACES_PER_LEVEL 2
 
-// Print SPACES_PER_LEVEL * level spaces to out
-static void indent(FILE *out, int level)
+// The unparser writes its output through an out_buffer (see out_buffer.h),
+// rather than with a stdio call for each piece,
+// so each public function below collects its output in a buffer
+// and writes it to its FILE when done.
+
+// Print SPACES_PER_LEVEL * level spaces to ob
+static void indent(out_buffer *ob, int level)
 {
-    int num = SPACES_PER_LEVEL * level;
-    for (int i = 0; i < num; i++) {
-	fprintf(out, " ");
-    }
+    out_buffer_put_spaces(ob, SPACES_PER_LEVEL * level);
 }
 
-// Print (to out) a semicolon, but only if addSemiToEnd is true,
+// Print (to ob) a semicolon, but only if addSemiToEnd is true,
 // and then print a newline.
-static void newlineAndOptionalSemi(FILE *out, bool addSemiToEnd)
+static void newlineAndOptionalSemi(out_buffer *ob, bool addSemiToEnd)
+{
+    out_buffer_put_string(ob, (addSemiToEnd ? ";\n" : "\n"));
+}
+
+// Nested constructs are unparsed with an explicit stack of work
+// instead of by recursion, so the depth of nesting in programs
+// is only limited by the memory available.
+// Unparsing a node prints what comes before its first child
+// and pushes work for the rest (its children and the text between
+// and after them), the part to be printed first pushed last.
+// The same stack is used for trees and for flat ASTs.
+
+// kinds of work items
+typedef enum {
+    work_block,          // node is a block_t, unparsed at level
+    work_proc_decls,     // node is a proc_decl_t, then those after it
+    work_stmt_list,      // node is a stmt_t, then those after it
+    work_condition,      // node is a condition_t
+    work_expr,           // node is an expr_t
+    work_flat_block,     // index is a block of a flat AST
+    work_flat_proc_decls,// proc-decls index up to (not including) end
+    work_flat_stmts,     // statements index up to (not including) end
+    work_flat_condition, // index is a condition of a flat AST
+    work_flat_expr,      // index is an expression of a flat AST
+    work_text,           // print text
+    work_spaced_text,    // print text with a space on each side
+    work_indented_text,  // print text indented by level
+    work_end,            // print "end" indented by level, then end the line
+    work_end_line        // end the line
+} work_kind;
+
+// a pending piece of unparsing; semi tells whether the construct
+// should end with a semicolon
+typedef struct {
+    work_kind kind;
+    bool semi;
+    int level;
+    const void *node;
+    const char *text;
+    flat_index index, end;
+} work_item;
+
+// Initial number of work items there is room for
+#define INITIAL_WORK_CAPACITY 256
+
+// this thread's stack of work (reused by each unparse)
+static _Thread_local work_item *work = NULL;
+static _Thread_local size_t work_size = 0;
+static _Thread_local size_t work_capacity = 0;
+
+// Push a work item and return it (with all other fields zero),
+// for the caller to fill in
+static work_item *work_push(work_kind kind)
+{
+    if (work_size == work_capacity) {
+	size_t capacity = (work_capacity == 0) ? INITIAL_WORK_CAPACITY
+	                                       : 2 * work_capacity;
+	work_item *bigger
+	    = (work_item *) realloc(work, capacity * sizeof(work_item));
+	if (bigger == NULL) {
+	    bail_with_error("No space to unparse a program nested this deeply!");
+	}
+	work = bigger;
+	work_capacity = capacity;
+    }
+    work_item *w = &work[work_size++];
+    w->kind = kind;
+    w->semi = false;
+    w->level = 0;
+    w->node = NULL;
+    w->text = NULL;
+    w->index = 0;
+    w->end = 0;
+    return w;
+}
+
+// Free this thread's stack of work
+static void work_release()
+{
+    free(work);
+    work = NULL;
+    work_size = 0;
+    work_capacity = 0;
+}
+
+// Free the storage this thread used for unparsing (e.g., before it exits)
+void unparseRelease()
+{
+    work_release();
+}
+
+// Push work to unparse node (of the given kind) at the given level,
+// adding a semicolon to its end if semi is true
+static void push_node(work_kind kind, const void *node, int level, bool semi)
+{
+    work_item *w = work_push(kind);
+    w->node = node;
+    w->level = level;
+    w->semi = semi;
+}
+
+// Push work to unparse the nodes index up to (not including) end
+// of a flat AST (of the given kind) at the given level,
+// adding a semicolon to the end if semi is true
+static void push_flat(work_kind kind, flat_index index, flat_index end,
+		      int level, bool semi)
+{
+    work_item *w = work_push(kind);
+    w->index = index;
+    w->end = end;
+    w->level = level;
+    w->semi = semi;
+}
+
+// Push work to print text (of the given kind) at the given level
+static void push_text(work_kind kind, const char *text, int level)
+{
+    work_item *w = work_push(kind);
+    w->text = text;
+    w->level = level;
+}
+
+// Push work to print "end" indented by level,
+// then a semicolon if semi is true, and a newline
+static void push_end(work_kind kind, int level, bool semi)
+{
+    work_item *w = work_push(kind);
+    w->level = level;
+    w->semi = semi;
+}
+
+static void unparse_block(out_buffer *ob, const block_t *blk, int level,
+			  bool addSemiToEnd);
+static void unparse_proc_decl(out_buffer *ob, const proc_decl_t *pd, int level);
+static void unparse_stmt(out_buffer *ob, const stmt_t *stmt, int level,
+			 bool addSemiToEnd);
+static void unparse_condition(out_buffer *ob, const condition_t *cond);
+static void unparse_expr(out_buffer *ob, const expr_t *exp);
+static void unparse_flat_block(out_buffer *ob, const flat_ast *fa, flat_index b,
+			       int level, bool addSemiToEnd);
+static void unparse_flat_stmt(out_buffer *ob, const flat_ast *fa, flat_index s,
+			      int level, bool addSemiToEnd);
+static void unparse_flat_condition(out_buffer *ob, const flat_ast *fa,
+				   flat_index c);
+static void unparse_flat_expr(out_buffer *ob, const flat_ast *fa, flat_index e);
+static void unparse_flat_proc_decl(out_buffer *ob, const flat_ast *fa,
+				   flat_index p, int level);
+static void unparse_program_parallel(out_buffer *ob, const block_t *prog,
+				     const flat_ast *fa);
+
+// Do the work on the stack down to (but not including) the item at base,
+// printing to ob (fa is the flat AST the flat work refers to, if any)
+static void unparse_run(out_buffer *ob, const flat_ast *fa, size_t base)
+{
+    while (work_size > base) {
+	work_item w = work[--work_size];
+	switch (w.kind) {
+	case work_block:
+	    unparse_block(ob, (const block_t *) w.node, w.level, w.semi);
+	    break;
+	case work_proc_decls:
+	{
+	    const proc_decl_t *pd = (const proc_decl_t *) w.node;
+	    if (pd->next != NULL) {
+		push_node(work_proc_decls, pd->next, w.level, false);
+	    }
+	    unparse_proc_decl(ob, pd, w.level);
+	    break;
+	}
+	case work_stmt_list:
+	{
+	    const stmt_t *s = (const stmt_t *) w.node;
+	    if (s->next != NULL) {
+		push_node(work_stmt_list, s->next, w.level, w.semi);
+	    }
+	    unparse_stmt(ob, s, w.level, w.semi || (s->next != NULL));
+	    break;
+	}
+	case work_condition:
+	    unparse_condition(ob, (const condition_t *) w.node);
+	    break;
+	case work_expr:
+	    unparse_expr(ob, (const expr_t *) w.node);
+	    break;
+	case work_flat_block:
+	    unparse_flat_block(ob, fa, w.index, w.level, w.semi);
+	    break;
+	case work_flat_proc_decls:
+	    if (w.index + 1 < w.end) {
+		push_flat(work_flat_proc_decls, w.index + 1, w.end, w.level,
+			  false);
+	    }
+	    unparse_flat_proc_decl(ob, fa, w.index, w.level);
+	    break;
+	case work_flat_stmts:
+	    if (w.index + 1 < w.end) {
+		push_flat(work_flat_stmts, w.index + 1, w.end, w.level, false);
+	    }
+	    unparse_flat_stmt(ob, fa, w.index, w.level, w.index + 1 < w.end);
+	    break;
+	case work_flat_condition:
+	    unparse_flat_condition(ob, fa, w.index);
+	    break;
+	case work_flat_expr:
+	    unparse_flat_expr(ob, fa, w.index);
+	    break;
+	case work_text:
+	    out_buffer_put_string(ob, w.text);
+	    break;
+	case work_spaced_text:
+	    out_buffer_put_char(ob, ' ');
+	    out_buffer_put_string(ob, w.text);
+	    out_buffer_put_char(ob, ' ');
+	    break;
+	case work_indented_text:
+	    indent(ob, w.level);
+	    out_buffer_put_string(ob, w.text);
+	    break;
+	case work_end:
+	    indent(ob, w.level);
+	    out_buffer_put_string(ob, "end");
+	    newlineAndOptionalSemi(ob, w.semi);
+	    break;
+	case work_end_line:
+	    newlineAndOptionalSemi(ob, w.semi);
+	    break;
+	}
+    }
+}
+
+// Push work to unparse the statements in stmts at the given level
+static void push_stmts(const stmts_t *stmts, int level)
+{
+    if (stmts->stmts_kind != empty_stmts_e && stmts->stmt_list.start != NULL) {
+	push_node(work_stmt_list, stmts->stmt_list.start, level, false);
+    }
+}
+
+// the number of threads unparseProgram and unparseFlatProgram use
+static unsigned int unparse_threads = 1;
+
+// Make unparsing programs use the given number of threads (at least 1)
+void unparseSetThreads(unsigned int threads)
 {
-    fprintf(out, "%s\n", (addSemiToEnd ? ";" : ""));
+    unparse_threads = (threads > 0) ? threads : 1;
+}
+
+// Start unparsing to out: open ob on out,
+// and return the base of the work for this unparse
+static size_t unparse_start(out_buffer *ob, FILE *out)
+{
+    out_buffer_open(ob, out);
+    return work_size;
+}
+
+// Finish unparsing a tree: do the work down to base,
+// and write the output collected in ob
+static void unparse_finish(out_buffer *ob, size_t base)
+{
+    unparse_run(ob, NULL, base);
+    out_buffer_close(ob);
 }
 
 // Unparse the given program AST and then print a period and an newline
 void unparseProgram(FILE *out, block_t prog)
 {
-    unparseBlock(out, prog, 0, false);
-    fprintf(out, ".\n");
+    // the bodies the parser skipped (if any) are parsed first, so
+    // a syntax error in one is reported before anything is written
+    parseProcBodies(&prog.proc_decls);
+    out_buffer ob;
+    size_t base = unparse_start(&ob, out);
+    if (unparse_threads > 1) {
+	unparse_program_parallel(&ob, &prog, NULL);
+    } else {
+	unparse_block(&ob, &prog, 0, false);
+	unparse_run(&ob, NULL, base);
+    }
+    out_buffer_put_string(&ob, ".\n");
+    out_buffer_close(&ob);
+}
+
+static void unparse_const_decls(out_buffer *ob, const const_decls_t *cds,
+				int level);
+static void unparse_var_decls(out_buffer *ob, const var_decls_t *vds,
+			      int level);
+
+// Unparse the beginning and the declarations (other than procedures)
+// of the given block, indented by the given level, to ob
+static void unparse_block_start(out_buffer *ob, const block_t *blk, int level)
+{
+    indent(ob, level);
+    out_buffer_put_string(ob, "begin\n");
+    unparse_const_decls(ob, &blk->const_decls, level+1);
+    unparse_var_decls(ob, &blk->var_decls, level+1);
+}
+
+// Unparse the start of the given block, indented by the given level,
+// to ob, and push work for the rest of it
+static void unparse_block(out_buffer *ob, const block_t *blk, int level,
+			  bool addSemiToEnd)
+{
+    unparse_block_start(ob, blk, level);
+    push_end(work_end, level, addSemiToEnd);
+    push_stmts(&blk->stmts, level+1);
+    assert(blk->proc_decls.type_tag == proc_decls_ast);
+    if (blk->proc_decls.proc_decls != NULL) {
+	push_node(work_proc_decls, blk->proc_decls.proc_decls, level+1, false);
+    }
 }
 
 // Unparse the given block, indented by the given level, to out
@@ -35,112 +340,195 @@ void unparseProgram(FILE *out, block_t prog)
 extern void unparseBlock(FILE *out, block_t blk, int level,
 			 bool addSemiToEnd)
 {
-    indent(out, level);
-    fprintf(out, "begin\n");
-    unparseConstDecls(out, blk.const_decls, level+1);
-    unparseVarDecls(out, blk.var_decls, level+1);
-    unparseProcDecls(out, blk.proc_decls, level+1);
-    unparseStmts(out, blk.stmts, level+1);
-    indent(out, level);
-    fprintf(out, "end");
-    newlineAndOptionalSemi(out, addSemiToEnd);
+    parseProcBodies(&blk.proc_decls);
+    out_buffer ob;
+    size_t base = unparse_start(&ob, out);
+    unparse_block(&ob, &blk, level, addSemiToEnd);
+    unparse_finish(&ob, base);
 }
 
-// Unparse the list of const-decls given by the AST cds to out
+static void unparse_const_decl(out_buffer *ob, const const_decl_t *cd,
+			       int level);
+static void unparse_const_def_list(out_buffer *ob,
+				   const const_def_list_t *cdl, int level);
+static void unparse_const_def(out_buffer *ob, const const_def_t *cdf,
+			      int level);
+
+// Unparse the list of const-decls given by the AST cds to ob
 // with the given nesting level
-// (note that if cds == NULL, then nothing is printed)
-void unparseConstDecls(FILE *out, const_decls_t cds, int level)
+static void unparse_const_decls(out_buffer *ob, const const_decls_t *cds,
+				int level)
 {
     // debug_print("unparseConstDecls entry ...\n");
-    assert(cds.type_tag == const_decls_ast);
-    const_decl_t *cd_listp = cds.start;
+    assert(cds->type_tag == const_decls_ast);
+    const const_decl_t *cd_listp = cds->start;
     while (cd_listp != NULL) {
-	unparseConstDecl(out, *cd_listp, level);
+	unparse_const_decl(ob, cd_listp, level);
 	cd_listp = cd_listp->next;
     }
 }
 
+// Unparse the list of const-decls given by the AST cds to out
+// with the given nesting level
+// (note that if cds == NULL, then nothing is printed)
+void unparseConstDecls(FILE *out, const_decls_t cds, int level)
+{
+    out_buffer ob;
+    out_buffer_open(&ob, out);
+    unparse_const_decls(&ob, &cds, level);
+    out_buffer_close(&ob);
+}
+
+// Unparse a single const-decl given by the AST cd to ob,
+// indented for the given nesting level
+static void unparse_const_decl(out_buffer *ob, const const_decl_t *cd,
+			       int level)
+{
+    // debug_print("unparseConstDecl entry ...\n");
+    indent(ob, level);
+    out_buffer_put_string(ob, "const ");
+    unparse_const_def_list(ob, &cd->const_def_list, level);
+}
+
 // Unparse a single const-def given by the AST cd to out,
 // indented for the given nesting level
 void unparseConstDecl(FILE *out, const_decl_t cd, int level)
 {
-    // debug_print("unparseConstDecl entry ...\n");
-    indent(out, level);
-    fprintf(out, "const ");
-    unparseConstDefList(out, cd.const_def_list, level);
+    out_buffer ob;
+    out_buffer_open(&ob, out);
+    unparse_const_decl(&ob, &cd, level);
+    out_buffer_close(&ob);
 }
 
-// Unparse the list of const-defs given by the AST cdl to out
+// Unparse the list of const-defs given by the AST cdl to ob
 // with the given nesting level, followed by a semicolon and a newline.
-void unparseConstDefList(FILE *out, const_def_list_t cdl, int level)
+static void unparse_const_def_list(out_buffer *ob,
+				   const const_def_list_t *cdl, int level)
 {
     // debug_print("unparseConstDefList entry ...\n");
-    assert(cdl.type_tag == const_def_list_ast);
+    assert(cdl->type_tag == const_def_list_ast);
     bool printed_already = false;
-    const_def_t *cdp = cdl.start;
+    const const_def_t *cdp = cdl->start;
     while (cdp != NULL) {
 	if (printed_already) {
-	    fprintf(out, ", ");
+	    out_buffer_put_string(ob, ", ");
 	}
-	unparseConstDef(out, *cdp, level);
+	unparse_const_def(ob, cdp, level);
 	printed_already = true;
 	cdp = cdp->next;
     }
-    fprintf(out, ";\n");
+    out_buffer_put_string(ob, ";\n");
+}
+
+// Unparse the list of const-defs given by the AST cdl to out
+// with the given nesting level, followed by a semicolon and a newline.
+void unparseConstDefList(FILE *out, const_def_list_t cdl, int level)
+{
+    out_buffer ob;
+    out_buffer_open(&ob, out);
+    unparse_const_def_list(&ob, &cdl, level);
+    out_buffer_close(&ob);
+}
+
+// Unparse the const-def given by the AST cdf to ob
+static void unparse_const_def(out_buffer *ob, const const_def_t *cdf,
+			      int level)
+{
+    out_buffer_put_string(ob, cdf->ident.name);
+    out_buffer_put_string(ob, " = ");
+    out_buffer_put_int(ob, cdf->number.value);
 }
 
 // Unparse the const-def given by the AST cdf to out
 // with the given nesting level
 extern void unparseConstDef(FILE *out, const_def_t cdf, int level)
 {
-    fprintf(out, "%s = %d", cdf.ident.name, cdf.number.value);
+    out_buffer ob;
+    out_buffer_open(&ob, out);
+    unparse_const_def(&ob, &cdf, level);
+    out_buffer_close(&ob);
 }
 
-// Unparse the list of vart-decls given by the AST vds to out
+static void unparse_var_decl(out_buffer *ob, const var_decl_t *vd,
+			     int level);
+static void unparse_ident_list(out_buffer *ob,
+			       const ident_list_t *ident_list);
+
+// Unparse the list of var-decls given by the AST vds to ob
 // with the given nesting level
-// (note that if vds.var_decls == NULL, then nothing is printed)
-void unparseVarDecls(FILE *out, var_decls_t vds, int level)
+static void unparse_var_decls(out_buffer *ob, const var_decls_t *vds,
+			      int level)
 {
     // debug_print("Entering unparseVarDecls ...\n");
-    assert(vds.type_tag == var_decls_ast);
-    var_decl_t *vdp = vds.var_decls;
+    assert(vds->type_tag == var_decls_ast);
+    const var_decl_t *vdp = vds->var_decls;
     while (vdp != NULL) {
-	unparseVarDecl(out, *vdp, level);
+	unparse_var_decl(ob, vdp, level);
 	vdp = vdp->next;
     }
 }
 
+// Unparse the list of vart-decls given by the AST vds to out
+// with the given nesting level
+// (note that if vds.var_decls == NULL, then nothing is printed)
+void unparseVarDecls(FILE *out, var_decls_t vds, int level)
+{
+    out_buffer ob;
+    out_buffer_open(&ob, out);
+    unparse_var_decls(&ob, &vds, level);
+    out_buffer_close(&ob);
+}
+
+// Unparse a single var-decl given by the AST vd to ob,
+// indented for the given nesting level
+static void unparse_var_decl(out_buffer *ob, const var_decl_t *vd,
+			     int level)
+{
+    // debug_print("Entering unparseVarDecl ...\n");
+    indent(ob, level);
+    out_buffer_put_string(ob, "var");
+    unparse_ident_list(ob, &vd->ident_list);
+    out_buffer_put_string(ob, ";\n");
+}
+
 // Unparse a single var-decl given by the AST vd to out,
 // indented for the given nesting level
 void unparseVarDecl(FILE *out, var_decl_t vd, int level)
 {
-    // debug_print("Entering unparseVarDecl ...\n");
-    indent(out, level);
-    fprintf(out, "var");
-    unparseIdentList(out, vd.ident_list);
-    fprintf(out, ";\n");
+    out_buffer ob;
+    out_buffer_open(&ob, out);
+    unparse_var_decl(&ob, &vd, level);
+    out_buffer_close(&ob);
 }
 
-// Unparse the identifiers in idents to out, with a space before each,
+// Unparse the identifiers in idents to ob, with a space before each,
 // and a comma as a separator
-void unparseIdentList(FILE *out, ident_list_t ident_list)
+static void unparse_ident_list(out_buffer *ob,
+			       const ident_list_t *ident_list)
 {
     // debug_print("Entering unparseIdentList ...\n");
-    ident_t *ip = ident_list.start;
+    const ident_t *ip = ident_list->start;
     bool already_printed =false;
     while (ip != NULL) {
 	// debug_print("in unparseIdents ip is %x\n", ip);
 	// debug_print("in unparseIdents ip->name is %s\n", ip->name);
-	if (already_printed) {
-	    fprintf(out, ", %s", ip->name);
-	} else {
-	    fprintf(out, " %s", ip->name);
-	}
+	out_buffer_put_string(ob, already_printed ? ", " : " ");
+	out_buffer_put_string(ob, ip->name);
 	already_printed = true;
 	ip = ip->next;
     }
 }
 
+// Unparse the identifiers in idents to out, with a space before each,
+// and a comma as a separator
+void unparseIdentList(FILE *out, ident_list_t ident_list)
+{
+    out_buffer ob;
+    out_buffer_open(&ob, out);
+    unparse_ident_list(&ob, &ident_list);
+    out_buffer_close(&ob);
+}
+
 // Unparse the list of proc-decls given by the AST pds to out
 // with the given nesting level
 // (note that if pds.proc_decls is NULL, then nothing is printed)
@@ -148,21 +536,38 @@ void unparseProcDecls(FILE *out, proc_decls_t pds, int level)
 {
     // debug_print("unparseProcDecls entry ...\n");
     assert(pds.type_tag == proc_decls_ast);
-    proc_decl_t *pdp = pds.proc_decls;
-    while (pdp != NULL) {
-	unparseProcDecl(out, *pdp, level);
-	pdp = pdp ->next;
+    parseProcBodies(&pds);
+    if (pds.proc_decls != NULL) {
+	out_buffer ob;
+	size_t base = unparse_start(&ob, out);
+	push_node(work_proc_decls, pds.proc_decls, level, false);
+	unparse_finish(&ob, base);
     }
 }
 
+// Unparse the heading of the proc-decl pd to ob
+// with the given nesting level, and push work for its block
+static void unparse_proc_decl(out_buffer *ob, const proc_decl_t *pd, int level)
+{
+    indent(ob, level);
+    out_buffer_put_string(ob, "proc ");
+    out_buffer_put_string(ob, pd->name);
+    out_buffer_put_char(ob, '\n');
+    // (its body has been parsed, if the parser skipped it)
+    assert(pd->block != NULL);
+    push_node(work_block, pd->block, level, true);
+}
+
 // Unparse the given proc-decl given by the AST pd to out
 // with the given nesting level followed by a semicolon
 void unparseProcDecl(FILE *out, proc_decl_t pd, int level)
 {
     // debug_print("unparseProcDecl entry ...\n");
-    indent(out, level);
-    fprintf(out, "proc %s\n", pd.name);
-    unparseBlock(out, *(pd.block), level, true);
+    parseProcBody(&pd);
+    out_buffer ob;
+    size_t base = unparse_start(&ob, out);
+    unparse_proc_decl(&ob, &pd, level);
+    unparse_finish(&ob, base);
 }
 
 
@@ -173,10 +578,10 @@ void unparseStmts(FILE *out, stmts_t stmts, int level)
 {
     // indent(out, level);
     // fprintf(out, "%% stmts at level %d\n", level);
-    if (stmts.stmts_kind != empty_stmts_e) {
-	stmt_list_t sl = stmts.stmt_list;
-	unparseStmtList(out, sl, level, false);
-    }
+    out_buffer ob;
+    size_t base = unparse_start(&ob, out);
+    push_stmts(&stmts, level);
+    unparse_finish(&ob, base);
 }
 
 // Unparse the stmts given by stmt to out
@@ -187,63 +592,113 @@ void unparseStmtList(FILE *out, stmt_list_t stmt_list, int level,
 {
     // indent(out, level);
     // fprintf(out, "%% stmtList at level %d\n", level);    
-    stmt_t *s = stmt_list.start;
-    while (s != NULL) {
-	unparseStmt(out, *s, level, addSemiToEnd || (s->next != NULL));
-	s = s->next;
+    if (stmt_list.start != NULL) {
+	out_buffer ob;
+	size_t base = unparse_start(&ob, out);
+	push_node(work_stmt_list, stmt_list.start, level, addSemiToEnd);
+	unparse_finish(&ob, base);
     }
 }
+static void unparse_assign_stmt(out_buffer *ob, const assign_stmt_t *stmt,
+				int level, bool addSemiToEnd);
+static void unparse_if_stmt(out_buffer *ob, const if_stmt_t *stmt, int level,
+			    bool addSemiToEnd);
+static void unparse_while_stmt(out_buffer *ob, const while_stmt_t *stmt,
+			       int level, bool addSemiToEnd);
+static void unparse_print_stmt(out_buffer *ob, const print_stmt_t *stmt,
+			       int level, bool addSemiToEnd);
+static void unparse_name_stmt(out_buffer *ob, const char *keyword,
+			      const char *name, int level, bool addSemiToEnd);
 
-// Unparse the statement given by the AST stmt to out,
-// indented for the given level,
-// adding a semicolon to the end if addSemiToENd is true.
-void unparseStmt(FILE *out, stmt_t stmt, int level, bool addSemiToEnd)
+// Unparse the start of the statement stmt to out,
+// indented for the given level, and push work for the rest of it
+// (which ends with a semicolon if addSemiToEnd is true)
+static void unparse_stmt(out_buffer *ob, const stmt_t *stmt, int level,
+			 bool addSemiToEnd)
 {
     // debug_print("In unparseStmt stmt.type_tag is %d\n", stmt.type_tag);
-    assert(stmt.type_tag == stmt_ast);
-    switch (stmt.stmt_kind) {
+    assert(stmt->type_tag == stmt_ast);
+    switch (stmt->stmt_kind) {
     case assign_stmt:
-	assert(stmt.data.assign_stmt.type_tag == assign_stmt_ast);
-	unparseAssignStmt(out, stmt.data.assign_stmt, level, addSemiToEnd);
+	assert(stmt->data.assign_stmt.type_tag == assign_stmt_ast);
+	unparse_assign_stmt(ob, &stmt->data.assign_stmt, level, addSemiToEnd);
 	break;
     case call_stmt:
-	unparseCallStmt(out, stmt.data.call_stmt, level, addSemiToEnd);
+	unparse_name_stmt(ob, "call ", stmt->data.call_stmt.name, level,
+			  addSemiToEnd);
 	break;
     case if_stmt:
-	unparseIfStmt(out, stmt.data.if_stmt, level, addSemiToEnd);
+	unparse_if_stmt(ob, &stmt->data.if_stmt, level, addSemiToEnd);
 	break;
     case while_stmt:
-	unparseWhileStmt(out, stmt.data.while_stmt, level, addSemiToEnd);
+	unparse_while_stmt(ob, &stmt->data.while_stmt, level, addSemiToEnd);
 	break;
     case read_stmt:
-	unparseReadStmt(out, stmt.data.read_stmt, level, addSemiToEnd);
+	unparse_name_stmt(ob, "read ", stmt->data.read_stmt.name, level,
+			  addSemiToEnd);
 	break;
     case print_stmt:
-	unparsePrintStmt(out, stmt.data.print_stmt, level, addSemiToEnd);
+	unparse_print_stmt(ob, &stmt->data.print_stmt, level, addSemiToEnd);
 	break;
     case block_stmt:
-	unparseBlockStmt(out, stmt.data.block_stmt, level, addSemiToEnd);
+	unparse_block(ob, stmt->data.block_stmt.block, level, addSemiToEnd);
 	break;
     default:
 	bail_with_error("Unknown stmt_kind (%d) in unparseStmt!",
-			stmt.stmt_kind);
+			stmt->stmt_kind);
 	break;
     }
 }
 
+// Unparse the statement given by the AST stmt to out,
+// indented for the given level,
+// adding a semicolon to the end if addSemiToENd is true.
+void unparseStmt(FILE *out, stmt_t stmt, int level, bool addSemiToEnd)
+{
+    out_buffer ob;
+    size_t base = unparse_start(&ob, out);
+    unparse_stmt(&ob, &stmt, level, addSemiToEnd);
+    unparse_finish(&ob, base);
+}
+
+// Unparse the start of the assignment statement stmt to out
+// with indentation level given by level, and push work for the rest of it
+static void unparse_assign_stmt(out_buffer *ob, const assign_stmt_t *stmt,
+				int level, bool addSemiToEnd)
+{
+    indent(ob, level);
+    out_buffer_put_string(ob, stmt->name);
+    out_buffer_put_string(ob, " := ");
+    if (stmt->expr == NULL) {
+	bail_with_error("Found null expression in assignment statment!");
+    }
+    push_end(work_end_line, level, addSemiToEnd);
+    push_node(work_expr, stmt->expr, level, false);
+}
+
 // Unparse the assignment statment given by stmt to out
 // with indentation level given by level,
 // and add a semicolon at the end if addSemiToEnd is true.
 void unparseAssignStmt(FILE *out, assign_stmt_t stmt, int level,
 			      bool addSemiToEnd)
 {
-    indent(out, level);
-    fprintf(out, "%s := ", stmt.name);
-    if (stmt.expr == NULL) {
-	bail_with_error("Found null expression in assignment statment!");
-    }
-    unparseExpr(out, *(stmt.expr));
-    newlineAndOptionalSemi(out, addSemiToEnd);
+    out_buffer ob;
+    size_t base = unparse_start(&ob, out);
+    unparse_assign_stmt(&ob, &stmt, level, addSemiToEnd);
+    unparse_finish(&ob, base);
+}
+
+// Unparse the statement that is the keyword followed by name
+// (a call or read statement) to ob,
+// with indentation level given by level,
+// and add a semicolon at the end if addSemiToEnd is true.
+static void unparse_name_stmt(out_buffer *ob, const char *keyword,
+			      const char *name, int level, bool addSemiToEnd)
+{
+    indent(ob, level);
+    out_buffer_put_string(ob, keyword);
+    out_buffer_put_string(ob, name);
+    newlineAndOptionalSemi(ob, addSemiToEnd);
 }
 
 // Unparse the call statment given by stmt to out
@@ -252,9 +707,10 @@ void unparseAssignStmt(FILE *out, assign_stmt_t stmt, int level,
 void unparseCallStmt(FILE *out, call_stmt_t stmt, int level,
 			    bool addSemiToEnd)
 {
-    indent(out, level);
-    fprintf(out, "call %s", stmt.name);
-    newlineAndOptionalSemi(out, addSemiToEnd);
+    out_buffer ob;
+    out_buffer_open(&ob, out);
+    unparse_name_stmt(&ob, "call ", stmt.name, level, addSemiToEnd);
+    out_buffer_close(&ob);
 }
 
 // Unparse the sequential statment given by stmt to out
@@ -266,26 +722,47 @@ void unparseBlockStmt(FILE *out, block_stmt_t stmt, int level,
     unparseBlock(out, *(stmt.block), level, addSemiToEnd);
 }
 
+// Unparse the start of the if-statement stmt to out
+// with indentation level given by level, and push work for the rest of it
+static void unparse_if_stmt(out_buffer *ob, const if_stmt_t *stmt, int level,
+			    bool addSemiToEnd)
+{
+    indent(ob, level);
+    out_buffer_put_string(ob, "if ");
+    push_end(work_end, level, addSemiToEnd);
+    if (stmt->else_stmts != NULL) {
+	push_stmts(stmt->else_stmts, level+1);
+	push_text(work_indented_text, "else\n", level);
+    }
+    push_stmts(stmt->then_stmts, level+1);
+    push_text(work_indented_text, "then\n", level);
+    push_text(work_text, "\n", level);
+    push_node(work_condition, &stmt->condition, level, false);
+}
+
 // Unparse the if-statment given by stmt to out
 // with indentation level given by level (and each body indented one more),
 // and add a semicolon at the end if addSemiToEnd is true.
 void unparseIfStmt(FILE *out, if_stmt_t stmt, int level, bool addSemiToEnd)
 {
-    indent(out, level);
-    fprintf(out, "if ");
-    unparseCondition(out, stmt.condition);
-    fprintf(out, "\n");
-    indent(out, level);
-    fprintf(out, "then\n");
-    unparseStmts(out, *(stmt.then_stmts), level+1);
-    if (stmt.else_stmts != NULL) {
-	indent(out, level);
-	fprintf(out, "else\n");
-	unparseStmts(out, *(stmt.else_stmts), level+1);
-    }
-    indent(out, level);
-    fprintf(out, "end");
-    newlineAndOptionalSemi(out, addSemiToEnd);
+    out_buffer ob;
+    size_t base = unparse_start(&ob, out);
+    unparse_if_stmt(&ob, &stmt, level, addSemiToEnd);
+    unparse_finish(&ob, base);
+}
+
+// Unparse the start of the while-statement stmt to out
+// with indentation level given by level, and push work for the rest of it
+static void unparse_while_stmt(out_buffer *ob, const while_stmt_t *stmt,
+			       int level, bool addSemiToEnd)
+{
+    indent(ob, level);
+    out_buffer_put_string(ob, "while ");
+    push_end(work_end, level, addSemiToEnd);
+    push_stmts(stmt->body, level+1);
+    push_text(work_indented_text, "do\n", level);
+    push_text(work_text, "\n", level);
+    push_node(work_condition, &stmt->condition, level, false);
 }
 
 // Unparse the while-statment given by stmt to out
@@ -294,25 +771,31 @@ void unparseIfStmt(FILE *out, if_stmt_t stmt, int level, bool addSemiToEnd)
 void unparseWhileStmt(FILE *out, while_stmt_t stmt, int level,
 		      bool addSemiToEnd)
 {
-    indent(out, level);
-    fprintf(out, "while ");
-    unparseCondition(out, stmt.condition);
-    fprintf(out, "\n");
-    indent(out, level);
-    fprintf(out, "do\n");
-    unparseStmts(out, *(stmt.body), level+1);
-    indent(out, level);
-    fprintf(out, "end");
-    newlineAndOptionalSemi(out, addSemiToEnd);
+    out_buffer ob;
+    size_t base = unparse_start(&ob, out);
+    unparse_while_stmt(&ob, &stmt, level, addSemiToEnd);
+    unparse_finish(&ob, base);
 }
 
 // Unparse the read statment given by stmt to out
 // and add a semicolon at the end if addSemiToEnd is true.
 void unparseReadStmt(FILE *out, read_stmt_t stmt, int level, bool addSemiToEnd)
 {
-    indent(out, level);
-    fprintf(out, "read %s", stmt.name);
-    newlineAndOptionalSemi(out, addSemiToEnd);
+    out_buffer ob;
+    out_buffer_open(&ob, out);
+    unparse_name_stmt(&ob, "read ", stmt.name, level, addSemiToEnd);
+    out_buffer_close(&ob);
+}
+
+// Unparse the start of the print statement stmt to out
+// with indentation level given by level, and push work for the rest of it
+static void unparse_print_stmt(out_buffer *ob, const print_stmt_t *stmt,
+			       int level, bool addSemiToEnd)
+{
+    indent(ob, level);
+    out_buffer_put_string(ob, "print ");
+    push_end(work_end_line, level, addSemiToEnd);
+    push_node(work_expr, &stmt->expr, level, false);
 }
 
 // Unparse the write statment given by stmt to out
@@ -320,46 +803,76 @@ void unparseReadStmt(FILE *out, read_stmt_t stmt, int level, bool addSemiToEnd)
 void unparsePrintStmt(FILE *out, print_stmt_t stmt, int level,
 		      bool addSemiToEnd)
 {
-    indent(out, level);
-    fprintf(out, "print ");
-    unparseExpr(out, stmt.expr);
-    newlineAndOptionalSemi(out, addSemiToEnd);
+    out_buffer ob;
+    size_t base = unparse_start(&ob, out);
+    unparse_print_stmt(&ob, &stmt, level, addSemiToEnd);
+    unparse_finish(&ob, base);
 }
 
-// Unparse the condition given by cond to out
-void unparseCondition(FILE *out, condition_t cond)
+static void unparse_db_cond(out_buffer *ob, const db_condition_t *dbcond);
+static void unparse_rel_op_cond(out_buffer *ob, const rel_op_condition_t *cond);
+
+// Unparse the start of the condition cond to out,
+// and push work for the rest of it
+static void unparse_condition(out_buffer *ob, const condition_t *cond)
 {
-    switch (cond.cond_kind) {
+    switch (cond->cond_kind) {
     case ck_db:
-	unparseDbCond(out, cond.data.db_cond);
+	unparse_db_cond(ob, &cond->data.db_cond);
 	break;
     case ck_rel:
-	unparseRelOpCond(out, cond.data.rel_op_cond);
+	unparse_rel_op_cond(ob, &cond->data.rel_op_cond);
 	break;
     default:
 	bail_with_error("Unexpected condition_kind_e (%d) in unparseCondition!",
-			cond.cond_kind);
+			cond->cond_kind);
 	break;
     }
 }
 
+// Unparse the condition given by cond to out
+void unparseCondition(FILE *out, condition_t cond)
+{
+    out_buffer ob;
+    size_t base = unparse_start(&ob, out);
+    unparse_condition(&ob, &cond);
+    unparse_finish(&ob, base);
+}
+
+// Unparse the start of the divisibility condition dbcond to out,
+// and push work for the rest of it
+static void unparse_db_cond(out_buffer *ob, const db_condition_t *dbcond)
+{
+    out_buffer_put_string(ob, "divisible ");
+    push_node(work_expr, &dbcond->divisor, 0, false);
+    push_text(work_text, " by ", 0);
+    push_node(work_expr, &dbcond->dividend, 0, false);
+}
+
 // Unparse the odd condition given by cond to out
 void unparseDbCond(FILE *out, db_condition_t dbcond)
 {
-    fprintf(out, "divisible ");
-    unparseExpr(out, dbcond.dividend);
-    fprintf(out, " by ");
-    unparseExpr(out, dbcond.divisor);
+    out_buffer ob;
+    size_t base = unparse_start(&ob, out);
+    unparse_db_cond(&ob, &dbcond);
+    unparse_finish(&ob, base);
+}
+
+// Push work to unparse the binary relation condition cond
+static void unparse_rel_op_cond(out_buffer *ob, const rel_op_condition_t *cond)
+{
+    push_node(work_expr, &cond->expr2, 0, false);
+    push_text(work_spaced_text, cond->rel_op.text, 0);
+    push_node(work_expr, &cond->expr1, 0, false);
 }
 
 // Unparse the binary relation condition given by cond to out
 void unparseRelOpCond(FILE *out, rel_op_condition_t cond)
 {
-    unparseExpr(out, cond.expr1);
-    fprintf(out, " ");
-    unparseToken(out, cond.rel_op);
-    fprintf(out, " ");
-    unparseExpr(out, cond.expr2);
+    out_buffer ob;
+    size_t base = unparse_start(&ob, out);
+    unparse_rel_op_cond(&ob, &cond);
+    unparse_finish(&ob, base);
 }
 
 // Unparse the given token, t, to out
@@ -368,50 +881,81 @@ void unparseToken(FILE *out, token_t t)
     fprintf(out, "%s", t.text);
 }
 
-// Unparse the expression given by the AST exp to out
-// adding parentheses to indicate the nesting relationships
-void unparseExpr(FILE *out, expr_t exp)
+static void unparse_bin_op_expr(out_buffer *ob, const binary_op_expr_t *exp);
+static void unparse_negated_expr(out_buffer *ob, const negated_expr_t *exp);
+
+// Unparse the start of the expression exp to out,
+// and push work for the rest of it
+static void unparse_expr(out_buffer *ob, const expr_t *exp)
 {
-    switch (exp.expr_kind) {
+    switch (exp->expr_kind) {
     case expr_bin:
-	unparseBinOpExpr(out, exp.data.binary);
+	unparse_bin_op_expr(ob, &exp->data.binary);
 	break;
     case expr_negated:
-	unparseNegatedExpr(out, exp.data.negated);
+	unparse_negated_expr(ob, &exp->data.negated);
 	break;
     case expr_ident:
-	unparseIdent(out, exp.data.ident);
+	out_buffer_put_string(ob, exp->data.ident.name);
 	break;
     case expr_number:
-	unparseNumber(out, exp.data.number);
+	out_buffer_put_int(ob, exp->data.number.value);
 	break;
     default:
 	bail_with_error("Unexpected expr_kind_e (%d) in unparseExpr!",
-			exp.expr_kind);
+			exp->expr_kind);
 	break;
     }
 }
 
+// Unparse the expression given by the AST exp to out
+// adding parentheses to indicate the nesting relationships
+void unparseExpr(FILE *out, expr_t exp)
+{
+    out_buffer ob;
+    size_t base = unparse_start(&ob, out);
+    unparse_expr(&ob, &exp);
+    unparse_finish(&ob, base);
+}
+
+// Unparse the start of the binary expression exp to out,
+// and push work for the rest of it
+static void unparse_bin_op_expr(out_buffer *ob, const binary_op_expr_t *exp)
+{
+    out_buffer_put_string(ob, "(");
+    push_text(work_text, ")", 0);
+    push_node(work_expr, exp->expr2, 0, false);
+    push_text(work_spaced_text, exp->arith_op.text, 0);
+    push_node(work_expr, exp->expr1, 0, false);
+}
+
 // Unparse the expression given by the AST exp to out
 // adding parentheses (whether needed or not)
 void unparseBinOpExpr(FILE *out, binary_op_expr_t exp)
 {
-    fprintf(out, "(");
-    unparseExpr(out, *(exp.expr1));
-    fprintf(out, " ");
-    unparseToken(out, exp.arith_op);
-    fprintf(out, " ");
-    unparseExpr(out, *(exp.expr2));
-    fprintf(out, ")");
+    out_buffer ob;
+    size_t base = unparse_start(&ob, out);
+    unparse_bin_op_expr(&ob, &exp);
+    unparse_finish(&ob, base);
+}
+
+// Unparse the start of the negated expression exp to out,
+// and push work for the rest of it
+static void unparse_negated_expr(out_buffer *ob, const negated_expr_t *exp)
+{
+    out_buffer_put_string(ob, "-(");
+    push_text(work_text, ")", 0);
+    push_node(work_expr, exp->expr, 0, false);
 }
 
 // Unparse the expression given by the AST exp to out
 // adding parentheses (whether needed or not)
 void unparseNegatedExpr(FILE *out, negated_expr_t exp)
 {
-    fprintf(out, "-(");
-    unparseExpr(out, *(exp.expr));
-    fprintf(out, ")");
+    out_buffer ob;
+    size_t base = unparse_start(&ob, out);
+    unparse_negated_expr(&ob, &exp);
+    unparse_finish(&ob, base);
 }
 
 // Unparse the given identifier reference (i.e., identifier use), id, to out
@@ -425,3 +969,381 @@ void unparseNumber(FILE *out, number_t num)
 {
     fprintf(out, "%d", num.value);
 }
+
+// Unparse the start of the expression e of fa to out
+// (adding parentheses as unparseExpr does), and push work for the rest
+static void unparse_flat_expr(out_buffer *ob, const flat_ast *fa, flat_index e)
+{
+    switch (fa->exprs.kind[e]) {
+    case expr_bin:
+	out_buffer_put_string(ob, "(");
+	push_text(work_text, ")", 0);
+	push_flat(work_flat_expr, fa->exprs.b[e], 0, 0, false);
+	push_text(work_spaced_text, flat_op_spelling(fa->exprs.op[e]), 0);
+	push_flat(work_flat_expr, fa->exprs.a[e], 0, 0, false);
+	break;
+    case expr_negated:
+	out_buffer_put_string(ob, "-(");
+	push_text(work_text, ")", 0);
+	push_flat(work_flat_expr, fa->exprs.a[e], 0, 0, false);
+	break;
+    case expr_ident:
+	out_buffer_put_string(ob, fa->names.name[fa->exprs.a[e]]);
+	break;
+    case expr_number:
+	out_buffer_put_int(ob, (word_type) fa->exprs.a[e]);
+	break;
+    default:
+	bail_with_error("Unexpected expr_kind_e (%d) in unparseFlatExpr!",
+			fa->exprs.kind[e]);
+	break;
+    }
+}
+
+// Unparse the start of the condition c of fa to out,
+// and push work for the rest of it
+static void unparse_flat_condition(out_buffer *ob, const flat_ast *fa,
+				   flat_index c)
+{
+    push_flat(work_flat_expr, fa->conditions.b[c], 0, 0, false);
+    if (fa->conditions.kind[c] == ck_db) {
+	out_buffer_put_string(ob, "divisible ");
+	push_text(work_text, " by ", 0);
+    } else {
+	push_text(work_spaced_text,
+		  flat_op_spelling(fa->conditions.op[c]), 0);
+    }
+    push_flat(work_flat_expr, fa->conditions.a[c], 0, 0, false);
+}
+
+// Push work to unparse the statements in the range r of fa
+// with indentation level given by level
+static void push_flat_stmts(flat_range r, int level)
+{
+    if (r.count > 0) {
+	push_flat(work_flat_stmts, r.first, r.first + r.count, level, false);
+    }
+}
+
+// Unparse the start of the statement s of fa to out
+// with indentation level given by level, and push work for the rest of it
+// (which ends with a semicolon if addSemiToEnd is true)
+static void unparse_flat_stmt(out_buffer *ob, const flat_ast *fa, flat_index s,
+			      int level, bool addSemiToEnd)
+{
+    const flat_stmts *st = &fa->stmts;
+    switch (st->kind[s]) {
+    case assign_stmt:
+	indent(ob, level);
+	out_buffer_put_string(ob, fa->names.name[st->a[s]]);
+	out_buffer_put_string(ob, " := ");
+	push_end(work_end_line, level, addSemiToEnd);
+	push_flat(work_flat_expr, st->b[s], 0, 0, false);
+	break;
+    case call_stmt:
+	unparse_name_stmt(ob, "call ", fa->names.name[st->a[s]], level,
+			  addSemiToEnd);
+	break;
+    case if_stmt:
+	indent(ob, level);
+	out_buffer_put_string(ob, "if ");
+	push_end(work_end, level, addSemiToEnd);
+	if (st->c[s] != FLAT_NONE) {
+	    push_flat_stmts(fa->stmt_lists.stmts[st->c[s]], level+1);
+	    push_text(work_indented_text, "else\n", level);
+	}
+	push_flat_stmts(fa->stmt_lists.stmts[st->b[s]], level+1);
+	push_text(work_indented_text, "then\n", level);
+	push_text(work_text, "\n", level);
+	push_flat(work_flat_condition, st->a[s], 0, 0, false);
+	break;
+    case while_stmt:
+	indent(ob, level);
+	out_buffer_put_string(ob, "while ");
+	push_end(work_end, level, addSemiToEnd);
+	push_flat_stmts(fa->stmt_lists.stmts[st->b[s]], level+1);
+	push_text(work_indented_text, "do\n", level);
+	push_text(work_text, "\n", level);
+	push_flat(work_flat_condition, st->a[s], 0, 0, false);
+	break;
+    case read_stmt:
+	unparse_name_stmt(ob, "read ", fa->names.name[st->a[s]], level,
+			  addSemiToEnd);
+	break;
+    case print_stmt:
+	indent(ob, level);
+	out_buffer_put_string(ob, "print ");
+	push_end(work_end_line, level, addSemiToEnd);
+	push_flat(work_flat_expr, st->a[s], 0, 0, false);
+	break;
+    case block_stmt:
+	unparse_flat_block(ob, fa, st->a[s], level, addSemiToEnd);
+	break;
+    default:
+	bail_with_error("Unknown stmt_kind (%d) in unparseFlatStmts!",
+			st->kind[s]);
+	break;
+    }
+}
+
+// Unparse the beginning and the declarations (other than procedures)
+// of the block b of fa, indented by the given level, to ob
+static void unparse_flat_block_start(out_buffer *ob, const flat_ast *fa,
+				     flat_index b, int level)
+{
+    indent(ob, level);
+    out_buffer_put_string(ob, "begin\n");
+    flat_range cds = fa->blocks.const_decls[b];
+    for (flat_index cd = cds.first; cd < cds.first + cds.count; cd++) {
+	indent(ob, level+1);
+	out_buffer_put_string(ob, "const ");
+	flat_range defs = fa->const_decls.defs[cd];
+	for (flat_index d = defs.first; d < defs.first + defs.count; d++) {
+	    if (d != defs.first) {
+		out_buffer_put_string(ob, ", ");
+	    }
+	    out_buffer_put_string(ob, fa->names.name[fa->const_defs.name[d]]);
+	    out_buffer_put_string(ob, " = ");
+	    out_buffer_put_int(ob, fa->const_defs.value[d]);
+	}
+	out_buffer_put_string(ob, ";\n");
+    }
+    flat_range vds = fa->blocks.var_decls[b];
+    for (flat_index vd = vds.first; vd < vds.first + vds.count; vd++) {
+	indent(ob, level+1);
+	out_buffer_put_string(ob, "var");
+	flat_range ids = fa->var_decls.idents[vd];
+	for (flat_index i = ids.first; i < ids.first + ids.count; i++) {
+	    out_buffer_put_string(ob, (i == ids.first) ? " " : ", ");
+	    out_buffer_put_string(ob, fa->names.name[fa->idents.name[i]]);
+	}
+	out_buffer_put_string(ob, ";\n");
+    }
+}
+
+// Unparse the start of the block b of fa, indented by the given level,
+// to ob, and push work for the rest of it
+// (which ends with a semicolon if addSemiToEnd is true)
+static void unparse_flat_block(out_buffer *ob, const flat_ast *fa, flat_index b,
+			       int level, bool addSemiToEnd)
+{
+    unparse_flat_block_start(ob, fa, b, level);
+    push_end(work_end, level, addSemiToEnd);
+    push_flat_stmts(fa->blocks.stmts[b], level+1);
+    flat_range pds = fa->blocks.proc_decls[b];
+    if (pds.count > 0) {
+	push_flat(work_flat_proc_decls, pds.first, pds.first + pds.count,
+		  level+1, false);
+    }
+}
+
+// Unparse the heading of the proc-decl p of fa to ob
+// with the given nesting level, and push work for its block
+static void unparse_flat_proc_decl(out_buffer *ob, const flat_ast *fa,
+				   flat_index p, int level)
+{
+    indent(ob, level);
+    out_buffer_put_string(ob, "proc ");
+    out_buffer_put_string(ob, fa->names.name[fa->proc_decls.name[p]]);
+    out_buffer_put_char(ob, '\n');
+    push_flat(work_flat_block, fa->proc_decls.block[p], 0, level, true);
+}
+
+// Unparse the program in the flat AST fa to out
+// (in the same format as unparseProgram)
+void unparseFlatProgram(FILE *out, const flat_ast *fa)
+{
+    out_buffer ob;
+    size_t base = unparse_start(&ob, out);
+    if (unparse_threads > 1) {
+	unparse_program_parallel(&ob, NULL, fa);
+    } else {
+	unparse_flat_block(&ob, fa, fa->root, 0, false);
+	unparse_run(&ob, fa, base);
+    }
+    out_buffer_put_string(&ob, ".\n");
+    out_buffer_close(&ob);
+}
+
+//--------------------------------------------------------------
+// Unparsing programs in parallel
+//--------------------------------------------------------------
+
+// With more than one thread, the program's block is split into pieces:
+// each procedure declared in it, and each run of UNPARSE_CHUNK_STMTS
+// statements in its statement list. The text of a piece only depends on
+// its own subtree and its nesting level, so each is unparsed by a worker
+// thread into a buffer in memory, and the buffers are written in order.
+// The pieces are unparsed in batches (of UNPARSE_BATCH_PIECES per thread),
+// so only the output of one batch is held in memory at a time.
+
+// number of the program's statements in one piece
+#define UNPARSE_CHUNK_STMTS 1024
+
+// number of pieces per thread in a batch
+#define UNPARSE_BATCH_PIECES 16
+
+// A piece of the program unparsed by a worker thread
+typedef struct {
+    work_kind kind; // work_proc_decls, work_stmt_list, or their flat kinds
+    const void *node; // the proc_decl_t, or the first stmt_t
+    unsigned int count; // the number of stmt_ts
+    flat_index index, end; // the proc-decl, or the statements [index, end)
+    out_buffer text; // the piece's output
+} unparse_piece;
+
+// The pieces of a program being unparsed in parallel
+typedef struct {
+    unparse_piece *pieces;
+    const flat_ast *fa; // the flat AST (if any) the pieces are in
+    flat_index stmts_end; // the end of the flat program's statements
+} unparse_batch;
+
+// Unparse the piece numbered task of ctx (an unparse_batch)
+// into the piece's own buffer
+static void unparse_piece_task(void *ctx, unsigned int task,
+			       unsigned int worker)
+{
+    unparse_batch *batch = (unparse_batch *) ctx;
+    const flat_ast *fa = batch->fa;
+    unparse_piece *p = &batch->pieces[task];
+    out_buffer *ob = &p->text;
+    out_buffer_init(ob);
+    size_t base = work_size;
+    switch (p->kind) {
+    case work_proc_decls:
+	unparse_proc_decl(ob, (const proc_decl_t *) p->node, 1);
+	unparse_run(ob, NULL, base);
+	break;
+    case work_stmt_list:
+    {
+	const stmt_t *s = (const stmt_t *) p->node;
+	for (unsigned int i = 0; i < p->count; i++) {
+	    unparse_stmt(ob, s, 1, s->next != NULL);
+	    unparse_run(ob, NULL, base);
+	    s = s->next;
+	}
+	break;
+    }
+    case work_flat_proc_decls:
+	unparse_flat_proc_decl(ob, fa, p->index, 1);
+	unparse_run(ob, fa, base);
+	break;
+    case work_flat_stmts:
+	for (flat_index s = p->index; s < p->end; s++) {
+	    unparse_flat_stmt(ob, fa, s, 1, s + 1 < batch->stmts_end);
+	    unparse_run(ob, fa, base);
+	}
+	break;
+    default:
+	bail_with_error("Unexpected work kind (%d) in a parallel unparse!",
+			p->kind);
+	break;
+    }
+}
+
+// Add a piece of the given kind to the pieces (of which there are *n),
+// returning it (with its other fields zero) for the caller to fill in
+static unparse_piece *add_piece(unparse_piece *pieces, unsigned int *n,
+				work_kind kind)
+{
+    unparse_piece *p = &pieces[(*n)++];
+    p->kind = kind;
+    p->node = NULL;
+    p->count = 0;
+    p->index = 0;
+    p->end = 0;
+    return p;
+}
+
+// Unparse the program prog (or, if prog is NULL, the program in fa)
+// to ob, as unparse_block and unparse_run would, but unparsing
+// the pieces of the program's block in parallel
+// (not including the period at the end)
+static void unparse_program_parallel(out_buffer *ob, const block_t *prog,
+				     const flat_ast *fa)
+{
+    unparse_batch batch;
+    batch.fa = fa;
+    batch.stmts_end = 0;
+
+    // count the pieces, so there is room for all of them
+    unsigned int procs = 0;
+    unsigned int stmts = 0;
+    if (prog != NULL) {
+	for (const proc_decl_t *pd = prog->proc_decls.proc_decls; pd != NULL;
+	     pd = pd->next) {
+	    procs++;
+	}
+	if (prog->stmts.stmts_kind != empty_stmts_e) {
+	    for (const stmt_t *s = prog->stmts.stmt_list.start; s != NULL;
+		 s = s->next) {
+		stmts++;
+	    }
+	}
+    } else {
+	procs = fa->blocks.proc_decls[fa->root].count;
+	stmts = fa->blocks.stmts[fa->root].count;
+    }
+    unsigned int chunks
+	= (stmts + UNPARSE_CHUNK_STMTS - 1) / UNPARSE_CHUNK_STMTS;
+    // (with room for at least one, so malloc's result is never NULL)
+    batch.pieces = (unparse_piece *)
+	malloc((procs + chunks + 1) * sizeof(unparse_piece));
+    if (batch.pieces == NULL) {
+	bail_with_error("No space to unparse the program in parallel!");
+    }
+
+    // the procedures come first, then the statements (as in unparse_block)
+    unsigned int n = 0;
+    if (prog != NULL) {
+	unparse_block_start(ob, prog, 0);
+	for (const proc_decl_t *pd = prog->proc_decls.proc_decls; pd != NULL;
+	     pd = pd->next) {
+	    add_piece(batch.pieces, &n, work_proc_decls)->node = pd;
+	}
+	const stmt_t *s = (stmts > 0) ? prog->stmts.stmt_list.start : NULL;
+	while (s != NULL) {
+	    unparse_piece *p = add_piece(batch.pieces, &n, work_stmt_list);
+	    p->node = s;
+	    while (s != NULL && p->count < UNPARSE_CHUNK_STMTS) {
+		p->count++;
+		s = s->next;
+	    }
+	}
+    } else {
+	unparse_flat_block_start(ob, fa, fa->root, 0);
+	flat_range pds = fa->blocks.proc_decls[fa->root];
+	for (flat_index pd = pds.first; pd < pds.first + pds.count; pd++) {
+	    add_piece(batch.pieces, &n, work_flat_proc_decls)->index = pd;
+	}
+	flat_range r = fa->blocks.stmts[fa->root];
+	batch.stmts_end = r.first + r.count;
+	for (flat_index s = r.first; s < batch.stmts_end;
+	     s += UNPARSE_CHUNK_STMTS) {
+	    unparse_piece *p = add_piece(batch.pieces, &n, work_flat_stmts);
+	    p->index = s;
+	    p->end = (batch.stmts_end - s < UNPARSE_CHUNK_STMTS)
+		? batch.stmts_end : s + UNPARSE_CHUNK_STMTS;
+	}
+    }
+
+    // unparse the pieces a batch at a time, writing each batch in order
+    unparse_piece *all = batch.pieces;
+    unsigned int per_batch = UNPARSE_BATCH_PIECES * unparse_threads;
+    for (unsigned int first = 0; first < n; first += per_batch) {
+	unsigned int count = (n - first < per_batch) ? n - first : per_batch;
+	batch.pieces = all + first;
+	thread_pool_run(count, unparse_threads, unparse_piece_task, NULL,
+			&batch);
+	for (unsigned int i = 0; i < count; i++) {
+	    out_buffer_append(ob, &batch.pieces[i].text);
+	    out_buffer_close(&batch.pieces[i].text);
+	}
+    }
+    free(all);
+
+    indent(ob, 0);
+    out_buffer_put_string(ob, "end");
+    newlineAndOptionalSemi(ob, false);
+}
@@ -3,10 +3,20 @@
 #define _UNPARSER_H
 #include <stdio.h>
 #include "ast.h"
+#include "flat_ast.h"
 
 // Unparse the given program AST and then print a period and an newline
 extern void unparseProgram(FILE *out, block_t prog);
 
+// Make unparseProgram and unparseFlatProgram use the given number
+// of threads (at least 1): with more than one, the procedures declared
+// in the program's block, and runs of the statements in it,
+// are unparsed in parallel, giving the same output as with one.
+extern void unparseSetThreads(unsigned int threads);
+
+// Free the storage this thread used for unparsing (e.g., before it exits)
+extern void unparseRelease();
+
 // Unparse the given block, indented by the given level, to out
 // adding a semicolon to the end if addSemiToEnd is true.
 extern void unparseBlock(FILE *out, block_t blk, int indentLevel,
@@ -135,4 +145,8 @@ extern void unparseIdent(FILE *out, ident_t id);
 // Unparse the given number to out in decimal format
 extern void unparseNumber(FILE *out, number_t num);
 
+// Unparse the program in the flat AST fa to out
+// (in the same format as unparseProgram)
+extern void unparseFlatProgram(FILE *out, const flat_ast *fa);
+
 #endif
@@ -7,6 +7,9 @@
 #include <assert.h>
 #include "utilities.h"
 
+// the innermost error trap pushed by this thread (or NULL)
+static _Thread_local error_trap *current_trap = NULL;
+
 // to turn off debugging support (assertions and debug_print)
 // define the symbol NDEBUG (by writing uncommenting the following)
 // #define NDEBUG
@@ -41,69 +44,91 @@ static void vdebug_print(const char *fmt, va_list args)
 }
 #endif
 
-static void vbail_with_error(const char* fmt, va_list args);
+static void vbail_with_error(const char *prefix, bool os_error,
+			     const char* fmt, va_list args);
 
 // Format a string error message and print it followed by a newline on stderr
 // using perror (for an OS error, if the errno is not 0)
 // then exit with a failure code, so a call to this does not return.
 void bail_with_error(const char *fmt, ...)
 {
-    fflush(stdout); // flush so output comes after what has happened already
     va_list(args);
     va_start(args, fmt);
-    vbail_with_error(fmt, args);
+    vbail_with_error("", true, fmt, args);
 }
 
-// The variadic version of bail_with_error
-static void vbail_with_error(const char* fmt, va_list args)
+// The variadic version of bail_with_error,
+// which puts prefix before the message, and (if os_error is true)
+// the OS error after it, if errno is not 0
+static void vbail_with_error(const char *prefix, bool os_error,
+			     const char* fmt, va_list args)
 {
     extern int errno;
-    char buff[2048];
-    vsprintf(buff, fmt, args);
-    if (errno != 0) {
-	perror(buff);
-    } else {
-	fprintf(stderr, "%s\n", buff);
+    char buff[ERROR_MESSAGE_SIZE];
+    int len = snprintf(buff, sizeof(buff), "%s", prefix);
+    len += vsnprintf(buff + len, sizeof(buff) - len, fmt, args);
+    if (os_error && errno != 0 && (size_t) len < sizeof(buff)) {
+	// as perror would print it
+	snprintf(buff + len, sizeof(buff) - len, ": %s", strerror(errno));
     }
-    fflush(stderr);
-    exit(EXIT_FAILURE);
+    bail_with_message(buff);
 }
 
 // Print an error message on stderr
-// starting with the file name and line number from the floc argument
+// starting with the file name and line number of the floc argument
 // (prints: filename, a colon, " line ", the line number, and a space)
-// and then the message.
+// and then the message (which is about the program, so no OS error
+// is added to it, whatever errno is).
 // Then exit with a failure code, so this function does not return.
-void bail_with_prog_error(file_location floc, const char *fmt, ...)
+void bail_with_prog_error(source_loc floc, const char *fmt, ...)
 {
-    fflush(stdout); // flush so output comes after what has happened already
-    // print file, line, column information
-    fprintf(stderr, "%s: line %d ", floc.filename, floc.line);
+    // file, line, column information
+    char prefix[ERROR_MESSAGE_SIZE];
+    file_location fl = file_location_of(floc);
+    snprintf(prefix, sizeof(prefix), "%s: line %d ", fl.filename, fl.line);
 
     va_list(args);
     va_start(args, fmt);
-    vbail_with_error(fmt, args);
+    vbail_with_error(prefix, false, fmt, args);
 }
 
-#define BUF_SIZE 1024
-
-// Call yyerror to print an error message on stderr
-// starting with the filename, ":", the lexer's current line number, ": ",
-// and then the formatted message (as in sprintf)
-extern void formatted_yyerror(const char *filename, const char *fmt, ...)
+// Requires: setjmp(trap->env) has been called by a function
+//           that is still active
+// Make trap catch the errors reported by this thread
+// (until it catches one or is popped)
+void error_trap_push(error_trap *trap)
 {
-    fflush(stdout); // flush so output comes after what has happened already
+    trap->outer = current_trap;
+    current_trap = trap;
+}
 
-    char buf[BUF_SIZE];
-    va_list(args);
-    va_start(args, fmt);
-    vsnprintf(buf, BUF_SIZE, fmt, args);
-    yyerror(filename, buf);
-    va_end(args);
+// Requires: trap is the most recently pushed trap (of this thread)
+//           that is still pushed
+// Stop trap catching errors
+void error_trap_pop(error_trap *trap)
+{
+    assert(current_trap == trap);
+    current_trap = trap->outer;
 }
 
+// Report the (already formatted) message as an error:
+// if there is a trap (see error_trap) catch it there,
+// otherwise print it on stderr and exit with a failure code,
+// so a call to this does not return.
+void bail_with_message(const char *message)
+{
+    error_trap *trap = current_trap;
+    if (trap != NULL) {
+	snprintf(trap->message, sizeof(trap->message), "%s", message);
+	current_trap = trap->outer;
+	longjmp(trap->env, 1);
+    }
+    fflush(stdout); // flush so output comes after what has happened already
+    fprintf(stderr, "%s\n", message);
+    fflush(stderr);
+    exit(EXIT_FAILURE);
+}
 
-    
 // print a newline on out and flush out
 void newline(FILE *out)
 {
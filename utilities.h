@@ -4,13 +4,9 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <assert.h>
+#include <setjmp.h>
 #include "file_location.h"
 
-// Report a syntax error on the current line on stderr.
-// The output looks like: the filename, ":", the lexer's current line number,
-// ": ", and then msg.
-extern void yyerror(const char *filename, const char *msg);
-
 #define MAX(x,y) (((x)>(y))?(x):(y))
 
 // If NDEBUG is defined, do nothing, otherwise (when debugging)
@@ -24,16 +20,46 @@ void debug_print(const char *fmt, ...);
 extern void bail_with_error(const char *fmt, ...);
 
 // Print an error message on stderr
-// starting with the file name and line number from the floc argument
+// starting with the file name and line number of the floc argument
 // (prints: filename, a colon, " line ", the line number, and a space)
-// and then the message.
+// and then the message (which is about the program, so no OS error
+// is added to it, whatever errno is).
 // Then exit with a failure code, so this function does not return.
-extern void bail_with_prog_error(file_location floc, const char *fmt, ...);
+extern void bail_with_prog_error(source_loc floc, const char *fmt, ...);
+
+// Size of the messages stored in error traps
+#define ERROR_MESSAGE_SIZE 2048
+
+// An error trap catches the errors reported by bail_with_error,
+// bail_with_prog_error and bail_with_message in the thread that pushed it:
+// instead of printing the message and exiting, they store the message
+// in the trap, pop the trap, and longjmp to its env
+// (so the setjmp that filled in env returns 1).
+// Traps nest, and the most recently pushed one catches.
+// (This lets a thread working for another report its errors
+// to that other thread, which can then report them in order.)
+typedef struct error_trap_s {
+    jmp_buf env;
+    char message[ERROR_MESSAGE_SIZE];
+    struct error_trap_s *outer; // the trap pushed before this one
+} error_trap;
+
+// Requires: setjmp(trap->env) has been called by a function
+//           that is still active
+// Make trap catch the errors reported by this thread
+// (until it catches one or is popped)
+extern void error_trap_push(error_trap *trap);
+
+// Requires: trap is the most recently pushed trap (of this thread)
+//           that is still pushed
+// Stop trap catching errors
+extern void error_trap_pop(error_trap *trap);
 
-// Call yyerror to print an error message on stderr
-// starting with the filename, ":", the lexer's current line number, ": ",
-// and then the formatted message (as in sprintf)
-extern void formatted_yyerror(const char *filename, const char *fmt, ...);
+// Report the (already formatted) message as an error:
+// if there is a trap (see error_trap) catch it there,
+// otherwise print it on stderr and exit with a failure code,
+// so a call to this does not return.
+extern void bail_with_message(const char *message);
 
 // print a newline on out and flush out
 extern void newline(FILE *out);